@@ -0,0 +1,436 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <sched.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+// Cross-engine benchmark driver (run_benches.sh builds the engines and calls it).
+//
+// Every engine is a run command, plus optionally a compile command, run through
+// /bin/sh in a scratch directory with {src} (the bench, absolute), {exe} (an
+// executable path for the engine to build) and {name} (the bench name)
+// substituted. The driver pins itself, and so every child, to one CPU. Per
+// bench and engine it compiles once (timed), discards the warmup runs, then
+// times the measured runs and reports their median, the peak RSS and ops/sec.
+// Every run's stdout is checked against <golden>/<name>.out.
+//
+// Ops are the work in a bench, the same for every engine: the steps
+// `--work <cmd>` reports on stderr ("Steps executed: N", as bf_interp with
+// --timeout prints them), measured once per bench.
+//
+// --json writes one result per line, and --baseline reads such a file back:
+// a run slower than its baseline by more than --threshold percent (and by
+// more than BENCH_NOISE_MS) is a regression, and the exit status is 1.
+
+#define BENCH_MAX_ENGINES 16
+#define BENCH_NOISE_MS 2.0       // Smaller differences are never regressions
+#define BENCH_DEFAULT_TIMEOUT 600  // Seconds per compile or run
+
+typedef struct {
+    const char *name;
+    const char *compile;  // NULL: nothing to build ahead of the run
+    const char *run;
+} Engine;
+
+typedef struct {
+    const char *engine;
+    char bench[NAME_MAX];
+    const char *status;  // "ok", "compile-failed", "failed", "wrong-output", "timeout"
+    double compile_ms;
+    double run_ms;      // Median of the measured runs
+    double run_min_ms;
+    long peak_rss_kb;
+    uint64_t ops;       // 0: unknown
+    double baseline_ms; // 0: not in the baseline
+    int regressed;
+} Result;
+
+typedef struct {
+    int status;  // As from waitpid, -1 if the command could not be started
+    double ms;
+    long rss_kb;
+} Child;
+
+static const char *scratch_dir;
+static int run_timeout = BENCH_DEFAULT_TIMEOUT;
+
+static double now_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e3 + now.tv_nsec / 1e6;
+}
+
+// Substitute {src}, {exe} and {name} in a command template
+static void expand(char *out, size_t size, const char *template, const char *src, const char *exe, const char *name) {
+    size_t used = 0;
+    for (const char *p = template; *p && used + 1 < size; ++p) {
+        const char *value = NULL;
+        size_t skip = 0;
+        if (strncmp(p, "{src}", 5) == 0) {
+            value = src, skip = 5;
+        } else if (strncmp(p, "{exe}", 5) == 0) {
+            value = exe, skip = 5;
+        } else if (strncmp(p, "{name}", 6) == 0) {
+            value = name, skip = 6;
+        }
+        if (value) {
+            used += snprintf(out + used, size - used, "%s", value);
+            used = used < size ? used : size - 1;
+            p += skip - 1;
+        } else {
+            out[used++] = *p;
+        }
+    }
+    out[used] = '\0';
+}
+
+// Run `command` through the shell in the scratch directory, stdin from
+// /dev/null unless the command redirects it, stdout and stderr to the given
+// files (NULL: /dev/null)
+static Child run_command(const char *command, const char *stdout_path, const char *stderr_path) {
+    Child child = {-1, 0, 0};
+    double start = now_ms();
+    pid_t pid = fork();
+    if (pid == 0) {
+        int null_fd = open("/dev/null", O_RDWR);
+        int out_fd = stdout_path ? open(stdout_path, O_WRONLY | O_CREAT | O_TRUNC, 0644) : null_fd;
+        int err_fd = stderr_path ? open(stderr_path, O_WRONLY | O_CREAT | O_TRUNC, 0644) : null_fd;
+        if (null_fd == -1 || out_fd == -1 || err_fd == -1 || chdir(scratch_dir) != 0) {
+            _exit(127);
+        }
+        dup2(null_fd, STDIN_FILENO);
+        dup2(out_fd, STDOUT_FILENO);
+        dup2(err_fd, STDERR_FILENO);
+        alarm(run_timeout);  // Survives the exec: a hung engine is killed by SIGALRM
+        execl("/bin/sh", "sh", "-c", command, (char *)NULL);
+        _exit(127);
+    }
+    if (pid < 0) {
+        perror("Failed to start a benchmark run");
+        return child;
+    }
+    struct rusage usage;
+    if (wait4(pid, &child.status, 0, &usage) != pid) {
+        perror("Failed to wait for a benchmark run");
+        child.status = -1;
+        return child;
+    }
+    child.ms = now_ms() - start;
+    child.rss_kb = usage.ru_maxrss;
+    return child;
+}
+
+static int child_ok(const Child *child) {
+    return child->status != -1 && WIFEXITED(child->status) && WEXITSTATUS(child->status) == 0;
+}
+
+static int child_timed_out(const Child *child) {
+    return child->status != -1 && WIFSIGNALED(child->status) && WTERMSIG(child->status) == SIGALRM;
+}
+
+// 1 when both files have the same contents
+static int same_file(const char *a, const char *b) {
+    FILE *fa = fopen(a, "rb"), *fb = fopen(b, "rb");
+    int same = fa && fb;
+    while (same) {
+        int ca = getc(fa), cb = getc(fb);
+        same = ca == cb;
+        if (ca == EOF || cb == EOF) {
+            break;
+        }
+    }
+    if (fa) {
+        fclose(fa);
+    }
+    if (fb) {
+        fclose(fb);
+    }
+    return same;
+}
+
+// Steps the --work command reports for a bench, 0 if it doesn't
+static uint64_t measure_work(const char *work, const char *src, const char *name) {
+    char command[PATH_MAX * 4], err_path[PATH_MAX], line[256];
+    expand(command, sizeof(command), work, src, "", name);
+    snprintf(err_path, sizeof(err_path), "%s/work.err", scratch_dir);
+    Child child = run_command(command, NULL, err_path);
+    uint64_t steps = 0;
+    FILE *err = fopen(err_path, "r");
+    while (child_ok(&child) && err && fgets(line, sizeof(line), err)) {
+        unsigned long long value;
+        if (sscanf(line, "Steps executed: %llu", &value) == 1) {
+            steps = value;
+        }
+    }
+    if (err) {
+        fclose(err);
+    }
+    return steps;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void bench_engine(const Engine *engine, const char *src, const char *golden_dir, int runs, int warmups,
+                         Result *result) {
+    char exe[PATH_MAX], command[PATH_MAX * 4], out_path[PATH_MAX], golden[PATH_MAX];
+    snprintf(exe, sizeof(exe), "%s/%s_%s", scratch_dir, engine->name, result->bench);
+    snprintf(out_path, sizeof(out_path), "%s/run.out", scratch_dir);
+    snprintf(golden, sizeof(golden), "%s/%s.out", golden_dir, result->bench);
+    result->engine = engine->name;
+    result->status = "ok";
+
+    if (engine->compile) {
+        expand(command, sizeof(command), engine->compile, src, exe, result->bench);
+        Child child = run_command(command, NULL, NULL);
+        result->compile_ms = child.ms;
+        if (!child_ok(&child)) {
+            result->status = child_timed_out(&child) ? "timeout" : "compile-failed";
+            return;
+        }
+    }
+
+    expand(command, sizeof(command), engine->run, src, exe, result->bench);
+    double *times = calloc(runs, sizeof(double));
+    if (!times) {
+        perror("Failed to allocate run times");
+        exit(1);
+    }
+    for (int k = 0; k < warmups + runs; ++k) {
+        Child child = run_command(command, out_path, NULL);
+        if (!child_ok(&child)) {
+            result->status = child_timed_out(&child) ? "timeout" : "failed";
+            break;
+        }
+        if (access(golden, R_OK) == 0 && !same_file(out_path, golden)) {
+            result->status = "wrong-output";
+            break;
+        }
+        if (k >= warmups) {
+            times[k - warmups] = child.ms;
+            result->peak_rss_kb = child.rss_kb > result->peak_rss_kb ? child.rss_kb : result->peak_rss_kb;
+        }
+    }
+    if (strcmp(result->status, "ok") == 0) {
+        qsort(times, runs, sizeof(double), compare_doubles);
+        result->run_ms = runs % 2 ? times[runs / 2] : (times[runs / 2 - 1] + times[runs / 2]) / 2;
+        result->run_min_ms = times[0];
+    }
+    free(times);
+}
+
+// Fill in baseline_ms from a file written by --json
+static void load_baseline(const char *path, Result *results, size_t count) {
+    FILE *in = fopen(path, "r");
+    if (!in) {
+        perror("Failed to open baseline");
+        exit(1);
+    }
+    char line[1024];
+    while (fgets(line, sizeof(line), in)) {
+        char engine[64], bench[NAME_MAX];
+        double run_ms;
+        const char *e = strstr(line, "\"engine\": \""), *b = strstr(line, "\"bench\": \"");
+        const char *r = strstr(line, "\"run_ms\": ");
+        if (!e || !b || !r || sscanf(e, "\"engine\": \"%63[^\"]\"", engine) != 1 ||
+            sscanf(b, "\"bench\": \"%255[^\"]\"", bench) != 1 || sscanf(r, "\"run_ms\": %lf", &run_ms) != 1) {
+            continue;
+        }
+        for (size_t k = 0; k < count; ++k) {
+            if (strcmp(results[k].engine, engine) == 0 && strcmp(results[k].bench, bench) == 0) {
+                results[k].baseline_ms = run_ms;
+            }
+        }
+    }
+    fclose(in);
+}
+
+static void print_table(const Result *results, size_t count) {
+    printf("%-12s %-14s %11s %11s %11s %12s %10s  %s\n", "engine", "bench", "compile ms", "run ms", "min ms",
+           "peak RSS KB", "Mops/s", "status");
+    for (size_t k = 0; k < count; ++k) {
+        const Result *r = &results[k];
+        char mops[32] = "-", status[64];
+        if (r->ops && r->run_ms > 0) {
+            snprintf(mops, sizeof(mops), "%.1f", r->ops / r->run_ms / 1e3);
+        }
+        if (r->baseline_ms > 0 && strcmp(r->status, "ok") == 0) {
+            snprintf(status, sizeof(status), "ok %+.1f%%%s", (r->run_ms / r->baseline_ms - 1) * 100,
+                     r->regressed ? " REGRESSED" : "");
+        } else {
+            snprintf(status, sizeof(status), "%s", r->status);
+        }
+        printf("%-12s %-14s %11.1f %11.1f %11.1f %12ld %10s  %s\n", r->engine, r->bench, r->compile_ms, r->run_ms,
+               r->run_min_ms, r->peak_rss_kb, mops, status);
+    }
+}
+
+static int write_json(const char *path, const Result *results, size_t count, int cpu, int runs, int warmups) {
+    FILE *out = fopen(path, "w");
+    if (!out) {
+        perror("Failed to open JSON output");
+        return -1;
+    }
+    fprintf(out, "{\"cpu\": %d, \"runs\": %d, \"warmups\": %d, \"results\": [\n", cpu, runs, warmups);
+    for (size_t k = 0; k < count; ++k) {
+        const Result *r = &results[k];
+        fprintf(out,
+                "  {\"engine\": \"%s\", \"bench\": \"%s\", \"status\": \"%s\", \"compile_ms\": %.3f, "
+                "\"run_ms\": %.3f, \"run_min_ms\": %.3f, \"peak_rss_kb\": %ld, \"ops\": %llu, "
+                "\"ops_per_sec\": %.0f}%s\n",
+                r->engine, r->bench, r->status, r->compile_ms, r->run_ms, r->run_min_ms, r->peak_rss_kb,
+                (unsigned long long)r->ops, r->ops && r->run_ms > 0 ? r->ops / (r->run_ms / 1e3) : 0.0,
+                k + 1 < count ? "," : "");
+    }
+    fprintf(out, "]}\n");
+    if (fclose(out) != 0) {
+        perror("Failed to write JSON output");
+        return -1;
+    }
+    return 0;
+}
+
+// Pin to `cpu`, or with -1 to the last CPU we may run on; returns the CPU
+static int pin_cpu(int cpu) {
+    cpu_set_t set;
+    if (cpu < 0) {
+        if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+            return -1;
+        }
+        for (int k = 0; k < CPU_SETSIZE; ++k) {
+            cpu = CPU_ISSET(k, &set) ? k : cpu;
+        }
+    }
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+        perror("Failed to pin to a CPU");
+        exit(1);
+    }
+    return cpu;
+}
+
+static void usage(const char *program) {
+    fprintf(stderr,
+            "Usage: %s --engine <name> <run cmd> [--compile <cmd>] ... [-n <runs>] [-w <warmups>] [--cpu <n>]\n"
+            "          [--golden <dir>] [--work <cmd>] [--json <file>] [--baseline <file>] [--threshold <pct>]\n"
+            "          [--timeout <s>] <bench.b>...\n",
+            program);
+}
+
+int main(int argc, char *argv[]) {
+    Engine engines[BENCH_MAX_ENGINES];
+    size_t engine_count = 0;
+    const char *golden_dir = ".", *work = NULL, *json_path = NULL, *baseline_path = NULL;
+    int runs = 5, warmups = 1, cpu = -1;
+    double threshold = 10;
+    char **benches = calloc(argc, sizeof(char *));
+    size_t bench_count = 0;
+
+    for (int j = 1; j < argc; j++) {
+        if (strcmp(argv[j], "--engine") == 0 && j + 2 < argc && engine_count < BENCH_MAX_ENGINES) {
+            engines[engine_count].name = argv[++j];
+            engines[engine_count].run = argv[++j];
+            engines[engine_count++].compile = NULL;
+        } else if (strcmp(argv[j], "--compile") == 0 && j + 1 < argc && engine_count > 0) {
+            engines[engine_count - 1].compile = argv[++j];  // For the engine named last
+        } else if (strcmp(argv[j], "-n") == 0 && j + 1 < argc) {
+            runs = atoi(argv[++j]);
+        } else if (strcmp(argv[j], "-w") == 0 && j + 1 < argc) {
+            warmups = atoi(argv[++j]);
+        } else if (strcmp(argv[j], "--cpu") == 0 && j + 1 < argc) {
+            cpu = atoi(argv[++j]);
+        } else if (strcmp(argv[j], "--golden") == 0 && j + 1 < argc) {
+            golden_dir = argv[++j];
+        } else if (strcmp(argv[j], "--work") == 0 && j + 1 < argc) {
+            work = argv[++j];
+        } else if (strcmp(argv[j], "--json") == 0 && j + 1 < argc) {
+            json_path = argv[++j];
+        } else if (strcmp(argv[j], "--baseline") == 0 && j + 1 < argc) {
+            baseline_path = argv[++j];
+        } else if (strcmp(argv[j], "--threshold") == 0 && j + 1 < argc) {
+            threshold = strtod(argv[++j], NULL);
+        } else if (strcmp(argv[j], "--timeout") == 0 && j + 1 < argc) {
+            run_timeout = atoi(argv[++j]);
+        } else if (argv[j][0] == '-') {
+            usage(argv[0]);
+            return 1;
+        } else {
+            benches[bench_count++] = argv[j];
+        }
+    }
+    if (engine_count == 0 || bench_count == 0 || runs < 1 || warmups < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    char scratch[] = "/tmp/bf_bench.XXXXXX";
+    if (!mkdtemp(scratch)) {
+        perror("Failed to create scratch directory");
+        return 1;
+    }
+    scratch_dir = scratch;
+    cpu = pin_cpu(cpu);
+
+    Result *results = calloc(engine_count * bench_count, sizeof(Result));
+    if (!results) {
+        perror("Failed to allocate results");
+        return 1;
+    }
+    size_t count = 0;
+    for (size_t b = 0; b < bench_count; ++b) {
+        char src[PATH_MAX], name[NAME_MAX];
+        if (!realpath(benches[b], src)) {
+            perror(benches[b]);
+            return 1;
+        }
+        const char *base = strrchr(src, '/') ? strrchr(src, '/') + 1 : src;
+        snprintf(name, sizeof(name), "%.*s", (int)(strcspn(base, ".")), base);
+        uint64_t ops = work ? measure_work(work, src, name) : 0;
+        for (size_t e = 0; e < engine_count; ++e) {
+            Result *result = &results[count++];
+            snprintf(result->bench, sizeof(result->bench), "%s", name);
+            result->ops = ops;
+            bench_engine(&engines[e], src, golden_dir, runs, warmups, result);
+            fprintf(stderr, "%s %s: %s\n", result->engine, name, result->status);
+        }
+    }
+
+    int failed = 0;
+    if (baseline_path) {
+        load_baseline(baseline_path, results, count);
+    }
+    for (size_t k = 0; k < count; ++k) {
+        Result *r = &results[k];
+        failed |= strcmp(r->status, "ok") != 0;
+        if (r->baseline_ms > 0 && strcmp(r->status, "ok") == 0) {
+            r->regressed = r->run_ms > r->baseline_ms * (1 + threshold / 100) &&
+                           r->run_ms - r->baseline_ms > BENCH_NOISE_MS;
+            failed |= r->regressed;
+        }
+    }
+    printf("Pinned to CPU %d, median of %d runs after %d warmups\n", cpu, runs, warmups);
+    print_table(results, count);
+    if (json_path && write_json(json_path, results, count, cpu, runs, warmups) != 0) {
+        failed = 1;
+    }
+
+    char cleanup[PATH_MAX + 16];
+    snprintf(cleanup, sizeof(cleanup), "rm -rf '%s'", scratch_dir);
+    if (system(cleanup) != 0) {
+        fprintf(stderr, "Error: Could not remove %s\n", scratch_dir);
+    }
+    free(results);
+    free(benches);
+    return failed;
+}
@@ -0,0 +1,288 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+// Synthetic benchmark generator: writes a Brainfuck program with the given
+// shape to <prefix>.b and its expected output to <prefix>.out, for
+// run_benches.sh/scaling.sh (which sweep one parameter to get scaling curves).
+//
+// The program is a sequence of blocks, each working on a few cells at its own
+// place on the tape and leaving them zero again:
+//
+//   - counting loops nested --depth deep, each level running --trips times
+//     (trips^depth iterations per block)
+//   - multiply loops, [->++>+++<<], which the engines turn into one op
+//   - scans, [>] over a run of --trips set cells
+//   - non-affine loops: an outer loop whose body copies the counter with two
+//     inner loops, trips * (trips + 1) / 2 iterations
+//
+// --mul, --scan and --nonaffine set the share of each kind (the rest are
+// counting loops). Blocks are added until the source reaches --size
+// commands; consecutive blocks start 97 cells apart, wrapping within the
+// first --tape cells, so the pointer sweeps the whole footprint and the moves
+// between blocks grow with it. With probability --io a block prints
+// its result cell. The program starts with ,[-] so compile-time evaluation
+// (which stops at the first input) can't run it ahead of time.
+
+#define GEN_TAPE_SIZE 30000
+
+typedef struct {
+    size_t size;
+    int depth;
+    int trips;
+    size_t tape;
+    double io;
+    double mul;
+    double scan;
+    double nonaffine;
+    unsigned long seed;
+} GenOptions;
+
+typedef struct {
+    char *text;
+    size_t length;
+    size_t capacity;
+    long pointer;  // Where the generated code leaves the pointer
+} Source;
+
+static uint64_t rng_state;
+
+static double random_unit(void) {
+    rng_state = rng_state * 6364136223846793005ULL + 1442695040888963407ULL;  // 64-bit LCG
+    return (rng_state >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static void emit(Source *src, const char *text) {
+    size_t n = strlen(text);
+    if (src->length + n + 1 > src->capacity) {
+        while (src->length + n + 1 > src->capacity) {
+            src->capacity = src->capacity ? src->capacity * 2 : 4096;
+        }
+        src->text = realloc(src->text, src->capacity);
+        if (!src->text) {
+            perror("Failed to grow program");
+            exit(1);
+        }
+    }
+    memcpy(src->text + src->length, text, n + 1);
+    src->length += n;
+}
+
+static void emit_repeat(Source *src, char c, long count) {
+    char run[65];
+    memset(run, c, 64);
+    for (; count > 0; count -= 64) {
+        run[count < 64 ? count : 64] = '\0';
+        emit(src, run);
+        run[count < 64 ? count : 64] = c;
+    }
+}
+
+static void move_to(Source *src, long cell) {
+    emit_repeat(src, cell > src->pointer ? '>' : '<', labs(cell - src->pointer));
+    src->pointer = cell;
+}
+
+// Print the cell at `cell` when the block is chosen to, then clear it
+static void finish_result(Source *src, long cell, const GenOptions *options) {
+    move_to(src, cell);
+    if (random_unit() < options->io) {
+        emit(src, ".");
+    }
+    emit(src, "[-]");
+}
+
+// Counting loops: cell base + k counts level k, base + depth accumulates
+static void block_counting(Source *src, long base, const GenOptions *options) {
+    for (int level = 0; level < options->depth; ++level) {
+        move_to(src, base + level);
+        emit_repeat(src, '+', options->trips);
+        emit(src, "[");  // Inner counters are refilled on every iteration of the outer one
+    }
+    move_to(src, base + options->depth);
+    emit(src, "+");
+    for (int level = options->depth - 1; level >= 0; --level) {
+        move_to(src, base + level);
+        emit(src, "-]");
+    }
+    finish_result(src, base + options->depth, options);
+}
+
+static void block_multiply(Source *src, long base, const GenOptions *options) {
+    move_to(src, base);
+    emit_repeat(src, '+', options->trips);
+    int first = 1 + (int)(random_unit() * 5), second = 1 + (int)(random_unit() * 5);
+    emit(src, "[->");
+    emit_repeat(src, '+', first);
+    emit(src, ">");
+    emit_repeat(src, '+', second);
+    emit(src, "<<]");
+    finish_result(src, base + 1, options);
+    finish_result(src, base + 2, options);
+}
+
+// base .. base + trips - 1 are set, the scan stops on base + trips
+static void block_scan(Source *src, long base, const GenOptions *options) {
+    long length = options->trips > 0 ? options->trips : 1;
+    for (long k = 0; k < length; ++k) {
+        move_to(src, base + k);
+        emit(src, "+");
+    }
+    move_to(src, base);
+    emit(src, "[>]");
+    src->pointer = base + length;
+    emit(src, "+");
+    finish_result(src, base + length, options);
+    for (long k = length - 1; k >= 0; --k) {
+        move_to(src, base + k);
+        emit(src, "-");
+    }
+}
+
+// base counts down from trips; each round adds it to base + 1 through base + 2
+static void block_nonaffine(Source *src, long base, const GenOptions *options) {
+    move_to(src, base);
+    emit_repeat(src, '+', options->trips);
+    emit(src, "[[->+>+<<]>>[-<<+>>]<<-]");
+    finish_result(src, base + 1, options);
+}
+
+static int block_width(const GenOptions *options) {
+    int width = options->depth + 1;
+    width = width > 3 ? width : 3;
+    return options->trips + 1 > width ? options->trips + 1 : width;
+}
+
+// Reference run for the expected output; `,` reads zero (the program clears it anyway)
+static void run_reference(const Source *src, FILE *out) {
+    size_t *jumps = malloc(src->length * sizeof(size_t));
+    size_t *stack = malloc(src->length * sizeof(size_t));
+    unsigned char *tape = calloc(GEN_TAPE_SIZE, 1);
+    if (!jumps || !stack || !tape) {
+        perror("Failed to allocate reference run");
+        exit(1);
+    }
+    size_t depth = 0;
+    for (size_t i = 0; i < src->length; ++i) {
+        if (src->text[i] == '[') {
+            stack[depth++] = i;
+        } else if (src->text[i] == ']') {
+            size_t open = stack[--depth];
+            jumps[open] = i;
+            jumps[i] = open;
+        }
+    }
+    unsigned char *ptr = tape;
+    for (size_t i = 0; i < src->length; ++i) {
+        switch (src->text[i]) {
+        case '>': ptr++; break;
+        case '<': ptr--; break;
+        case '+': (*ptr)++; break;
+        case '-': (*ptr)--; break;
+        case '.': putc(*ptr, out); break;
+        case ',': *ptr = 0; break;
+        case '[':
+            if (!*ptr) {
+                i = jumps[i];
+            }
+            break;
+        case ']':
+            if (*ptr) {
+                i = jumps[i];
+            }
+            break;
+        }
+    }
+    free(jumps);
+    free(stack);
+    free(tape);
+}
+
+static void usage(const char *program) {
+    fprintf(stderr,
+            "Usage: %s -o <prefix> [--size <commands>] [--depth <n>] [--trips <n>] [--tape <cells>] [--io <0..1>]\n"
+            "          [--mul <0..1>] [--scan <0..1>] [--nonaffine <0..1>] [--seed <n>]\n",
+            program);
+}
+
+int main(int argc, char *argv[]) {
+    GenOptions options = {10000, 2, 10, 1000, 0.1, 0.2, 0.1, 0.1, 1};
+    const char *prefix = NULL;
+    for (int j = 1; j < argc; j++) {
+        if (strcmp(argv[j], "-o") == 0 && j + 1 < argc) {
+            prefix = argv[++j];
+        } else if (strcmp(argv[j], "--size") == 0 && j + 1 < argc) {
+            options.size = strtoull(argv[++j], NULL, 10);
+        } else if (strcmp(argv[j], "--depth") == 0 && j + 1 < argc) {
+            options.depth = atoi(argv[++j]);
+        } else if (strcmp(argv[j], "--trips") == 0 && j + 1 < argc) {
+            options.trips = atoi(argv[++j]);
+        } else if (strcmp(argv[j], "--tape") == 0 && j + 1 < argc) {
+            options.tape = strtoull(argv[++j], NULL, 10);
+        } else if (strcmp(argv[j], "--io") == 0 && j + 1 < argc) {
+            options.io = strtod(argv[++j], NULL);
+        } else if (strcmp(argv[j], "--mul") == 0 && j + 1 < argc) {
+            options.mul = strtod(argv[++j], NULL);
+        } else if (strcmp(argv[j], "--scan") == 0 && j + 1 < argc) {
+            options.scan = strtod(argv[++j], NULL);
+        } else if (strcmp(argv[j], "--nonaffine") == 0 && j + 1 < argc) {
+            options.nonaffine = strtod(argv[++j], NULL);
+        } else if (strcmp(argv[j], "--seed") == 0 && j + 1 < argc) {
+            options.seed = strtoul(argv[++j], NULL, 10);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (!prefix || options.depth < 1 || options.trips < 1 || options.trips > 255 || options.tape < 1 ||
+        options.mul + options.scan + options.nonaffine > 1) {
+        usage(argv[0]);
+        fprintf(stderr, "Error: Needs -o, --depth >= 1, --trips in 1..255 and --mul + --scan + --nonaffine <= 1\n");
+        return 1;
+    }
+    if (options.tape + block_width(&options) > GEN_TAPE_SIZE) {
+        fprintf(stderr, "Error: --tape plus a block's %d cells must fit the %d-cell tape\n", block_width(&options),
+                GEN_TAPE_SIZE);
+        return 1;
+    }
+    rng_state = options.seed;
+
+    Source src = {0};
+    emit(&src, ",[-]");
+    for (size_t block = 0; src.length < options.size; ++block) {
+        long base = (long)((block * 97) % options.tape);
+        double kind = random_unit();
+        if (kind < options.mul) {
+            block_multiply(&src, base, &options);
+        } else if (kind < options.mul + options.scan) {
+            block_scan(&src, base, &options);
+        } else if (kind < options.mul + options.scan + options.nonaffine) {
+            block_nonaffine(&src, base, &options);
+        } else {
+            block_counting(&src, base, &options);
+        }
+    }
+    emit(&src, "\n");
+
+    char path[4096];
+    snprintf(path, sizeof(path), "%s.b", prefix);
+    FILE *program = fopen(path, "w");
+    if (!program || fwrite(src.text, 1, src.length, program) != src.length || fclose(program) != 0) {
+        perror("Failed to write program");
+        return 1;
+    }
+    snprintf(path, sizeof(path), "%s.out", prefix);
+    FILE *expected = fopen(path, "wb");
+    if (!expected) {
+        perror("Failed to write expected output");
+        return 1;
+    }
+    run_reference(&src, expected);
+    if (fclose(expected) != 0) {
+        perror("Failed to write expected output");
+        return 1;
+    }
+    free(src.text);
+    return 0;
+}
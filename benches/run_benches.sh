@@ -0,0 +1,60 @@
+#!/bin/bash
+
+# Build every engine and benchmark it on benches/*.b with bf_bench.
+#
+#   ./benches/run_benches.sh [-n runs] [-w warmups] [--cpu n] [--json file]
+#                            [--baseline file] [--threshold pct] [bench.b ...]
+#
+# Outputs are checked against benches/golden/. bf_llvm needs LLVM 16 for its
+# CMake build; set BF_LLVM to an existing bf_llvm_project/build/bf_compiler to
+# use that instead. Engines that fail to build are left out. GOLDEN_DIR
+# overrides where the expected outputs are (scaling.sh points it at its own).
+
+REPO=$(cd "$(dirname "$0")/.." && pwd)
+BUILD=${BUILD_DIR:-$REPO/benches/build}
+mkdir -p "$BUILD" || exit 1
+
+gcc -O2 "$REPO/benches/bf_bench.c" -o "$BUILD/bf_bench" || exit 1
+
+ENGINES=()
+if gcc -O3 -pthread "$REPO/bf_interp.c" -o "$BUILD/bf_interp"; then
+    ENGINES+=(--engine bf_interp "'$BUILD/bf_interp' < {src}")
+fi
+if gcc -O3 -pthread "$REPO/bf_compiler/bf_compiler.c" -o "$BUILD/bf_compiler"; then
+    ENGINES+=(--engine bf_compiler "{exe}" --compile "'$BUILD/bf_compiler' {src} -o {exe}.s && as -o {exe}.o {exe}.s && ld -o {exe} {exe}.o -lc --dynamic-linker /lib64/ld-linux-x86-64.so.2")
+fi
+if gcc -O3 -pthread "$REPO/bf_JIT/bf_JIT.c" -o "$BUILD/bf_JIT"; then
+    ENGINES+=(--engine bf_JIT "'$BUILD/bf_JIT' {src}")
+fi
+if [ -z "$BF_LLVM" ]; then
+    if cmake -S "$REPO/bf_llvm_project" -B "$BUILD/llvm" > /dev/null && cmake --build "$BUILD/llvm" > /dev/null; then
+        BF_LLVM=$BUILD/llvm/bf_compiler
+    else
+        echo "Warning: bf_llvm did not build, benchmarking without it" >&2
+    fi
+fi
+if [ -n "$BF_LLVM" ]; then
+    ENGINES+=(--engine bf_llvm "{exe}" --compile "'$BF_LLVM' {src} -o {exe}")
+fi
+
+# Without bench files on the command line, run them all
+BENCHES=()
+for arg in "$@"; do
+    case "$arg" in
+        *.b) BENCHES+=("$arg") ;;
+    esac
+done
+if [ ${#BENCHES[@]} -eq 0 ]; then
+    BENCHES=("$REPO"/benches/*.b)
+fi
+ARGS=()
+for arg in "$@"; do
+    case "$arg" in
+        *.b) ;;
+        *) ARGS+=("$arg") ;;
+    esac
+done
+
+# Ops per bench: the steps bf_interp executes (reported with a step/time limit set)
+exec "$BUILD/bf_bench" "${ENGINES[@]}" --golden "${GOLDEN_DIR:-$REPO/benches/golden}" \
+    --work "'$BUILD/bf_interp' --timeout 1000000 < {src}" "${ARGS[@]}" "${BENCHES[@]}"
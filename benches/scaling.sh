@@ -0,0 +1,99 @@
+#!/bin/bash
+
+# Scaling curves: generate a series of programs with bf_gen, sweeping one of
+# its parameters, benchmark them on every engine with run_benches.sh and
+# check that time grows linearly with the work.
+#
+#   ./benches/scaling.sh [--param size] [--values "1000 10000 100000 1000000"]
+#                        [--gen "more bf_gen options"] [--max-exponent 1.3]
+#                        [run_benches.sh options]
+#
+# Compile time is measured against the source size, run time against the
+# source size plus the ops executed (an interpreter parses as part of its
+# run). Between consecutive points the growth exponent is
+# log(time ratio) / log(size ratio): about 1 when linear, 2 when quadratic.
+# Steps where the work doesn't at least double are skipped. A step above --max-exponent, where the larger point takes at least 20 ms
+# (smaller ones are mostly noise), is reported and the exit status is 1.
+
+REPO=$(cd "$(dirname "$0")/.." && pwd)
+BUILD=${BUILD_DIR:-$REPO/benches/build}
+PARAM=size
+VALUES="1000 10000 100000 1000000"
+GEN_ARGS="--trips 2 --depth 1"
+MAX_EXPONENT=1.3
+ARGS=()
+while [ $# -gt 0 ]; do
+    case "$1" in
+        --param) PARAM=$2; shift 2 ;;
+        --values) VALUES=$2; shift 2 ;;
+        --gen) GEN_ARGS=$2; shift 2 ;;
+        --max-exponent) MAX_EXPONENT=$2; shift 2 ;;
+        *) ARGS+=("$1"); shift ;;
+    esac
+done
+
+SERIES=$BUILD/scaling/$PARAM
+mkdir -p "$SERIES" || exit 1
+rm -f "$SERIES"/*.b "$SERIES"/*.out
+gcc -O2 "$REPO/benches/bf_gen.c" -o "$BUILD/bf_gen" || exit 1
+
+BENCHES=()
+for value in $VALUES; do
+    # shellcheck disable=SC2086
+    "$BUILD/bf_gen" -o "$SERIES/${PARAM}_$value" $GEN_ARGS "--$PARAM" "$value" || exit 1
+    BENCHES+=("$SERIES/${PARAM}_$value.b")
+done
+
+GOLDEN_DIR=$SERIES "$REPO/benches/run_benches.sh" "${ARGS[@]}" --json "$SERIES/results.json" "${BENCHES[@]}"
+STATUS=$?
+
+# One line per result in the JSON: engine, bench, compile_ms, run_ms, ops
+echo
+echo "Growth exponents for --$PARAM (time vs work, 1 is linear):"
+for value in $VALUES; do
+    echo "${PARAM}_$value $(wc -c < "$SERIES/${PARAM}_$value.b")"
+done > "$SERIES/sizes"
+awk -v max="$MAX_EXPONENT" -v order="$VALUES" -v param="$PARAM" '
+    function field(line, key,    rest) {
+        rest = substr(line, index(line, "\"" key "\": ") + length(key) + 4)
+        sub(/^"/, "", rest)
+        sub(/[",}].*/, "", rest)
+        return rest
+    }
+    function check(engine, phase, t0, t1, w0, w1, from, to,    exponent) {
+        t0 += 0; t1 += 0; w0 += 0; w1 += 0
+        if (t0 <= 0 || t1 <= 0 || w1 < 2 * w0) {  # No compile step, or too little growth to tell
+            return
+        }
+        exponent = log(t1 / t0) / log(w1 / w0)
+        flag = exponent > max && t1 >= 20 ? "  SUPERLINEAR" : ""
+        printf "  %-12s %-8s %s -> %s: %.2f%s\n", engine, phase, from, to, exponent, flag
+        if (flag != "") {
+            failed = 1
+        }
+    }
+    FILENAME ~ /sizes$/ { bytes[$1] = $2; next }
+    /"engine"/ {
+        engine = field($0, "engine"); bench = field($0, "bench")
+        if (!(engine in seen)) {
+            seen[engine] = 1; engines[++n] = engine
+        }
+        compile_ms[engine, bench] = field($0, "compile_ms")
+        run_ms[engine, bench] = field($0, "run_ms")
+        ops[bench] = field($0, "ops")
+    }
+    END {
+        count = split(order, values, " ")
+        for (e = 1; e <= n; ++e) {
+            for (k = 2; k <= count; ++k) {
+                from = param "_" values[k - 1]; to = param "_" values[k]
+                check(engines[e], "compile", compile_ms[engines[e], from], compile_ms[engines[e], to],
+                      bytes[from], bytes[to], values[k - 1], values[k])
+                check(engines[e], "run", run_ms[engines[e], from], run_ms[engines[e], to],
+                      bytes[from] + ops[from], bytes[to] + ops[to], values[k - 1], values[k])
+            }
+        }
+        exit failed
+    }
+' "$SERIES/sizes" "$SERIES/results.json" || STATUS=1
+exit $STATUS
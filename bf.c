@@ -0,0 +1,416 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "bf_common/bf_common.h"
+#include "bf_common/bf_bytecode.h"
+#include "bf_common/bf_dataflow.h"
+#include "bf_common/bf_preeval.h"
+#include "bf_common/bf_source.h"
+
+// Front end that picks an engine per program: `bf run prog.b`.
+//
+// The program is decoded once, as bf_interp would, and then probed: its
+// input-free prefix is evaluated (bf_preeval.h) for as long as the cheapest
+// compiling engine needs just to start, the ski-rental rule. A program that finishes, or reaches its
+// first `,`, within that budget is cheap and runs interpreted, from the
+// probe's snapshot. One that doesn't is heavy: the caches of the compiling
+// engines are asked (`--cache-check`), the probe gets the budget of the
+// cheapest real compile, and if it still runs out each engine's total is
+// estimated from the cost model below and the smallest wins. The ops still to
+// come are extrapolated from how far through the top level the probe got.
+//
+// Programs that read input are estimated from their input: the ops per byte
+// of the loop around the first `,` times the bytes left on stdin when it is a
+// file (BF_RUN_UNKNOWN_INPUT for pipes). On a terminal the interpreter wins,
+// as it starts first.
+//
+// Engines are found through $BF_INTERP, $BF_JIT and $BF_LLVM, next to bf, or
+// on the PATH; missing ones are not considered.
+
+#define TAPE_SIZE 30000
+#define BF_RUN_PROBE_STEP_NS 9.0       // bf_preeval_step checks bounds, so it is slower than bf_interp
+#define BF_RUN_HEAVY_FACTOR 16         // A program that outran the probe runs at least this much longer
+#define BF_RUN_NESTED_TRIPS 16         // Assumed trip count of a loop the probe never reached
+#define BF_RUN_UNKNOWN_INPUT (64 << 10)  // Bytes assumed on a pipe
+#define BF_RUN_MAX_PROBE_STEPS 2000000000UL
+
+enum { ENGINE_INTERP, ENGINE_JIT, ENGINE_LLVM, ENGINE_COUNT };
+
+// Cost model in nanoseconds, fitted to long.b, hanoi.b and mandel.b on
+// x86-64 (to within 2x or so). Steps are ops of the decoded program, as
+// bf_interp counts them; the JIT expands clears, multiply loops and scans
+// back into loops, so it also pays for each of their iterations.
+typedef struct {
+    const char *name;
+    const char *binary;
+    const char *env;
+    double startup_ns;
+    double compile_ns;         // Per decoded op, on a cache miss
+    double step_ns;
+    double iteration_ns;       // Per iteration a clear, multiply or scan op stands for
+    int cached;                // Has a compile cache
+} BfEngineModel;
+
+static const BfEngineModel engine_models[ENGINE_COUNT] = {
+    {"interp", "bf_interp", "BF_INTERP", 1e6, 25, 3.5, 0, 0},
+    {"jit", "bf_JIT", "BF_JIT", 30e6, 20000, 2.0, 7.0, 1},
+    {"llvm", "bf_llvm", "BF_LLVM", 40e6, 500000, 1.0, 0, 1},
+};
+
+typedef struct {
+    char path[PATH_MAX];
+    int available;
+    int cache_hit;     // -1: not asked
+    double fixed_ns;   // Startup plus compile
+    double total_ns;
+} BfEngine;
+
+typedef struct {
+    const char *program_path;
+    int forced;        // ENGINE_*, -1: choose
+    int verbose;
+    int explain;       // Print the analysis and the choice, don't run
+    size_t max_probe_steps;
+} BfRunOptions;
+
+// Whether snprintf's result `length` fit in `size` bytes
+static int fits(int length, size_t size) {
+    return length >= 0 && (size_t)length < size;
+}
+
+static int find_engine(const BfEngineModel *model, char *path, size_t size) {
+    const char *from_env = getenv(model->env);
+    if (from_env && *from_env) {
+        return fits(snprintf(path, size, "%s", from_env), size) && access(path, X_OK) == 0;
+    }
+    char self[PATH_MAX];
+    ssize_t length = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (length > 0) {
+        self[length] = '\0';
+        char *slash = strrchr(self, '/');
+        if (slash) {
+            *slash = '\0';
+            if (fits(snprintf(path, size, "%s/%s", self, model->binary), size) && access(path, X_OK) == 0) {
+                return 1;
+            }
+        }
+    }
+    const char *dirs = getenv("PATH");
+    while (dirs && *dirs) {
+        size_t n = strcspn(dirs, ":");
+        if (n > 0 && fits(snprintf(path, size, "%.*s/%s", (int)n, dirs, model->binary), size) &&
+            access(path, X_OK) == 0) {
+            return 1;
+        }
+        dirs += n + (dirs[n] == ':');
+    }
+    return 0;
+}
+
+// Engine command line for the program, NULL-terminated
+static void engine_argv(int engine, const BfEngine *engines, const char *program_path, const char *bytecode_path,
+                        int cache_check, const char **argv) {
+    int n = 0;
+    argv[n++] = engines[engine].path;
+    if (engine == ENGINE_INTERP) {
+        argv[n++] = "--bytecode";
+        argv[n++] = bytecode_path;
+    } else {
+        argv[n++] = program_path;
+        if (engine == ENGINE_LLVM) {
+            argv[n++] = "--jit";
+        }
+        argv[n++] = cache_check ? "--cache-check" : "--cache";
+    }
+    argv[n] = NULL;
+}
+
+// Ask a compiling engine whether its cache holds this program
+static int cache_has(int engine, const BfEngine *engines, const char *program_path) {
+    const char *argv[8];
+    engine_argv(engine, engines, program_path, NULL, 1, argv);
+    pid_t pid = fork();
+    if (pid == -1) {
+        return 0;
+    }
+    if (pid == 0) {
+        int null = open("/dev/null", O_RDWR);
+        dup2(null, STDIN_FILENO);
+        dup2(null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        execv(argv[0], (char *const *)argv);
+        _exit(127);
+    }
+    int status;
+    return waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// Ops one pass over [begin, end) runs, counting loops the probe never
+// reached as BF_RUN_NESTED_TRIPS iterations
+static double static_ops(const BfProgram *program, size_t begin, size_t end) {
+    double ops = 0, scale = 1;
+    for (size_t pc = begin; pc < end; ++pc) {
+        ops += scale;
+        if (program->insns[pc].op == BF_OP_JZ) {
+            scale *= BF_RUN_NESTED_TRIPS;
+        } else if (program->insns[pc].op == BF_OP_JNZ && scale > 1) {
+            scale /= BF_RUN_NESTED_TRIPS;
+        }
+    }
+    return ops;
+}
+
+// Loop around the op at `pc`: index of its BF_OP_JZ plus one, 0 at the top level
+static size_t enclosing_loop(const BfProgram *program, size_t pc) {
+    size_t depth = 0;
+    for (size_t k = pc; k-- > 0;) {
+        if (program->insns[k].op == BF_OP_JNZ) {
+            depth++;
+        } else if (program->insns[k].op == BF_OP_JZ && depth-- == 0) {
+            return k + 1;
+        }
+    }
+    return 0;
+}
+
+// Ops left after the probe stopped at a `,` at `pc`: the first loop that
+// reads runs once per input byte
+static double input_driven_ops(const BfProgram *program, size_t pc, double input_bytes) {
+    for (size_t k = pc; k < program->insn_count; ++k) {
+        size_t open = program->insns[k].op == BF_OP_IN ? enclosing_loop(program, k) : 0;
+        if (open == 0) {
+            continue;
+        }
+        size_t close = program->insns[open - 1].arg - 1;  // The matching BF_OP_JNZ
+        return static_ops(program, pc, open - 1) + input_bytes * (static_ops(program, open, close) + 2) +
+               static_ops(program, close + 1, program->insn_count);
+    }
+    return static_ops(program, pc, program->insn_count);  // Reads a fixed number of bytes
+}
+
+// Bytes left on stdin; -1 on a terminal
+static double input_bytes_left(void) {
+    if (isatty(STDIN_FILENO)) {
+        return -1;
+    }
+    struct stat st;
+    off_t offset = lseek(STDIN_FILENO, 0, SEEK_CUR);
+    if (fstat(STDIN_FILENO, &st) == 0 && S_ISREG(st.st_mode) && offset != -1) {
+        return st.st_size > offset ? (double)(st.st_size - offset) : 0;
+    }
+    return BF_RUN_UNKNOWN_INPUT;
+}
+
+// Ops left after the probe ran out: it has done `resume_pc` of the top level's
+// ops in `steps`, and the rest is assumed to take as long per op. Later loops
+// tend to be the heavier ones, hence the floor.
+static double extrapolated_ops(const BfProgram *program, const BfPreevalStats *stats) {
+    size_t done = program->snapshot.resume_pc > 0 ? program->snapshot.resume_pc : 1;
+    double ops = (double)stats->steps * (program->insn_count - done) / done;
+    return ops > (double)stats->steps * BF_RUN_HEAVY_FACTOR ? ops : (double)stats->steps * BF_RUN_HEAVY_FACTOR;
+}
+
+static double folded_steps(const BfPreevalStats *stats) {
+    return (double)(stats->op_counts[BF_OP_CLEAR] + stats->op_counts[BF_OP_MUL] + stats->op_counts[BF_OP_SCAN]);
+}
+
+static void usage(const char *program) {
+    fprintf(stderr, "Usage: %s run [--engine interp|jit|llvm] [-v] [--explain] [--probe-steps <n>] <program.b>\n",
+            program);
+}
+
+static int parse_run_arguments(int argc, char *argv[], BfRunOptions *options) {
+    for (int j = 2; j < argc; j++) {
+        if (strcmp(argv[j], "--engine") == 0 && j + 1 < argc) {
+            const char *name = argv[++j];  // Skip the analysis and use this engine
+            options->forced = -2;
+            for (int e = 0; e < ENGINE_COUNT; ++e) {
+                if (strcmp(name, engine_models[e].name) == 0) {
+                    options->forced = e;
+                }
+            }
+            if (options->forced == -2) {
+                fprintf(stderr, "Error: Unknown engine '%s'\n", name);
+                return -1;
+            }
+        } else if (strcmp(argv[j], "-v") == 0) {
+            options->verbose = 1;  // Log the choice and why on stderr
+        } else if (strcmp(argv[j], "--explain") == 0) {
+            options->explain = 1;  // Print the estimates instead of running
+        } else if (strcmp(argv[j], "--probe-steps") == 0 && j + 1 < argc) {
+            options->max_probe_steps = strtoul(argv[++j], NULL, 10);  // Cap on the probe
+        } else if (argv[j][0] != '-' && !options->program_path) {
+            options->program_path = argv[j];
+        } else {
+            return -1;
+        }
+    }
+    return options->program_path ? 0 : -1;
+}
+
+int main(int argc, char *argv[]) {
+    BfRunOptions options = {NULL, -1, 0, 0, BF_RUN_MAX_PROBE_STEPS};
+    if (argc < 2 || strcmp(argv[1], "run") != 0 || parse_run_arguments(argc, argv, &options) != 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    size_t source_size;
+    char *source = read_bf_file(options.program_path, &source_size);
+    BfProgram program;
+    if (bf_bytecode_compile(source, source_size, &program) != 0) {
+        free(source);
+        return 1;
+    }
+    free(source);
+    bf_dataflow_optimize(&program, NULL);
+
+    BfEngine engines[ENGINE_COUNT];
+    for (int e = 0; e < ENGINE_COUNT; ++e) {
+        engines[e].available = find_engine(&engine_models[e], engines[e].path, sizeof(engines[e].path));
+        engines[e].cache_hit = -1;
+        engines[e].fixed_ns = engine_models[e].startup_ns;
+        engines[e].total_ns = 0;
+    }
+    if (!engines[ENGINE_INTERP].available) {
+        fprintf(stderr, "Error: bf_interp not found (set BF_INTERP)\n");
+        return 1;
+    }
+    if (options.forced >= 0 && !engines[options.forced].available) {
+        fprintf(stderr, "Error: %s not found (set %s)\n", engine_models[options.forced].binary,
+                engine_models[options.forced].env);
+        return 1;
+    }
+
+    // Probe for what the cheapest compiling engine costs before it runs an op:
+    // first as if its cache hit, then, if that isn't enough, after asking
+    BfPreevalStats stats;
+    memset(&stats, 0, sizeof(stats));
+    stats.stop_op = -1;
+    char reason[256] = "";
+    double remaining_steps = 0;
+    size_t probed = 0;
+    int chosen = options.forced;
+    for (int round = 0; chosen < 0 && round < 2; ++round) {
+        double budget_ns = 0;
+        for (int e = 0; e < ENGINE_COUNT; ++e) {
+            if (e == ENGINE_INTERP || !engines[e].available) {
+                continue;
+            }
+            if (round == 1 && engine_models[e].cached) {
+                engines[e].cache_hit = cache_has(e, engines, options.program_path);
+            }
+            engines[e].fixed_ns = engine_models[e].startup_ns;
+            if (round == 1 && engines[e].cache_hit != 1) {
+                engines[e].fixed_ns += engine_models[e].compile_ns * program.insn_count;
+            }
+            if (budget_ns == 0 || engines[e].fixed_ns < budget_ns) {
+                budget_ns = engines[e].fixed_ns;
+            }
+        }
+        if (budget_ns == 0) {
+            chosen = ENGINE_INTERP;  // Nothing to compare with
+            snprintf(reason, sizeof(reason), "no compiling engine found");
+            break;
+        }
+        size_t budget = (size_t)(budget_ns / BF_RUN_PROBE_STEP_NS);
+        if (budget > options.max_probe_steps) {
+            budget = options.max_probe_steps;
+        }
+        if (round == 1 && budget <= probed) {
+            remaining_steps = extrapolated_ops(&program, &stats);  // A cache hit: probing again won't tell more
+            break;
+        }
+        bf_preeval_run(&program, TAPE_SIZE, budget, &stats);
+        probed = budget;
+        if (stats.stop_op == BF_OP_END) {
+            chosen = ENGINE_INTERP;
+            snprintf(reason, sizeof(reason), "finished within the probe, %zu ops", stats.steps);
+        } else if (stats.stop_op == BF_OP_IN && input_bytes_left() < 0) {
+            chosen = ENGINE_INTERP;
+            snprintf(reason, sizeof(reason), "reads from a terminal");
+        } else if (stats.stop_op == BF_OP_IN) {
+            remaining_steps = input_driven_ops(&program, stats.stop_pc, input_bytes_left());
+            break;
+        } else if (stats.steps < budget || round == 1 || budget == options.max_probe_steps) {
+            remaining_steps = extrapolated_ops(&program, &stats);  // Out of budget, or at the tape's edge
+            break;
+        }
+    }
+
+    if (chosen < 0) {
+        // The steps to come have as many folded loop iterations per op as the probe saw
+        double iterations_per_step = stats.steps ? (double)stats.folded_iterations / stats.steps : 0;
+        double total_steps = stats.steps + remaining_steps;
+        for (int e = 0; e < ENGINE_COUNT; ++e) {
+            const BfEngineModel *model = &engine_models[e];
+            if (!engines[e].available) {
+                continue;
+            }
+            if (model->cached && engines[e].cache_hit == -1) {
+                engines[e].cache_hit = cache_has(e, engines, options.program_path);
+                engines[e].fixed_ns =
+                    model->startup_ns + (engines[e].cache_hit ? 0 : model->compile_ns * program.insn_count);
+            }
+            // The interpreter resumes from the probe's snapshot; the others evaluate again
+            double steps = e == ENGINE_INTERP ? remaining_steps : total_steps;
+            engines[e].total_ns =
+                engines[e].fixed_ns + steps * (model->step_ns + iterations_per_step * model->iteration_ns);
+            if (chosen < 0 || engines[e].total_ns < engines[chosen].total_ns) {
+                chosen = e;
+            }
+        }
+        snprintf(reason, sizeof(reason), "%s, about %.3g ops left; estimated %.0f ms",
+                 stats.stop_op == BF_OP_IN ? "reads input" : "outran the probe", remaining_steps,
+                 engines[chosen].total_ns / 1e6);
+    }
+
+    if (options.verbose || options.explain) {
+        fprintf(stderr, "bf run: %s (%s)\n", engine_models[chosen].name,
+                options.forced >= 0 ? "chosen with --engine" : reason);
+    }
+    if (options.explain) {
+        fprintf(stderr, "  commands %zu, ops %zu, probe %zu ops (%.0f%% folded), stopped at %s\n", source_size,
+                program.insn_count, stats.steps, stats.steps ? 100.0 * folded_steps(&stats) / stats.steps : 0.0,
+                stats.stop_op == BF_OP_END ? "the end" : stats.stop_op == BF_OP_IN ? "input" : "the budget");
+        for (int e = 0; e < ENGINE_COUNT; ++e) {
+            if (!engines[e].available) {
+                fprintf(stderr, "  %-6s not found\n", engine_models[e].name);
+            } else if (engines[e].total_ns > 0) {
+                fprintf(stderr, "  %-6s %10.1f ms%s\n", engine_models[e].name, engines[e].total_ns / 1e6,
+                        engines[e].cache_hit == 1 ? " (cached)" : "");
+            }
+        }
+        bf_bytecode_free(&program);
+        return 0;
+    }
+
+    // The interpreter gets the decoded program, snapshot included, through a
+    // memfd it inherits; stdin is left to the program either way
+    char bytecode_path[64] = "";
+    if (chosen == ENGINE_INTERP) {
+        int fd = memfd_create("bf-run", 0);
+        if (fd == -1) {
+            perror("Failed to create bytecode file");
+            return 1;
+        }
+        snprintf(bytecode_path, sizeof(bytecode_path), "/proc/self/fd/%d", fd);
+        if (bf_bytecode_write(bytecode_path, &program) != 0) {
+            return 1;
+        }
+    }
+    bf_bytecode_free(&program);
+    const char *engine_args[8];
+    engine_argv(chosen, engines, options.program_path, bytecode_path, 0, engine_args);
+    fflush(stderr);
+    execv(engine_args[0], (char *const *)engine_args);
+    perror("Failed to start engine");
+    return 1;
+}
@@ -0,0 +1,442 @@
+#ifndef BF_BYTECODE_H
+#define BF_BYTECODE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "bf_profile.h"  // bf_is_command
+
+// Decoded op stream for Brainfuck and its on-disk form, the `.bfc` file
+// written by `bf_interp --emit-bytecode <file>` and run with `--bytecode <file>`.
+//
+// Runs of +-, <>, and . are folded into one op; clear loops, multiply loops
+// and pointer scans become single ops; every jump already holds its target.
+// A `.bfc` file is the header followed by the ops and the multiply terms,
+// laid out exactly as in memory, so loading it is an mmap plus a bounds check.
+// The snapshot left by compile-time evaluation (bf_preeval.h) comes last:
+//
+//   BfBytecodeHeader | BfInsn[insn_count] | BfMulTerm[term_count] | tape | output
+
+#define BF_BYTECODE_MAGIC "BFC\x1a"
+#define BF_BYTECODE_VERSION 3
+#define BF_BYTECODE_BYTE_ORDER 0x01020304u  // Read back differently on a foreign-endian host
+#define BF_BYTECODE_MAX_TERMS 64            // Larger multiply loops stay ordinary loops
+
+enum {
+    BF_OP_END,    // Stop
+    BF_OP_ADD,    // *ptr += arg
+    BF_OP_MOVE,   // ptr += arg
+    BF_OP_OUT,    // Write *ptr, arg times
+    BF_OP_IN,     // *ptr = getchar()
+    BF_OP_JZ,     // If *ptr == 0, continue at arg (just past the matching BF_OP_JNZ)
+    BF_OP_JNZ,    // If *ptr != 0, continue at arg (just past the matching BF_OP_JZ)
+    BF_OP_CLEAR,  // *ptr = 0
+    BF_OP_MUL,    // ptr[term.offset] += *ptr * term.factor for `count` terms from arg, then *ptr = 0
+    BF_OP_SCAN,   // while (*ptr) ptr += arg
+    BF_OP_SET,    // *ptr = arg (from constant folding, see bf_dataflow.h)
+};
+
+typedef struct {
+    uint16_t op;     // BF_OP_*
+    uint16_t count;  // Number of terms for BF_OP_MUL
+    int32_t arg;
+} BfInsn;
+
+typedef struct {
+    int32_t offset;  // Cell relative to the loop counter
+    int32_t factor;  // Added once per unit of the counter's value
+} BfMulTerm;
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t insn_size;  // sizeof(BfInsn) of the producer, guards against layout changes
+    uint64_t insn_count;
+    uint64_t term_count;
+    uint64_t resume_pc;    // Snapshot, all zero when the program starts from scratch
+    uint64_t pointer;
+    uint64_t tape_size;
+    uint64_t output_size;
+} BfBytecodeHeader;
+
+// Source characters an op was compiled from, first and last inclusive
+typedef struct {
+    size_t begin, end;
+} BfSpan;
+
+// Program state after its input-free prefix ran at compile time (bf_preeval.h):
+// write `output`, load the tape, then continue at `resume_pc`
+typedef struct {
+    size_t resume_pc;
+    size_t pointer;             // Tape index of the pointer at resume_pc
+    const unsigned char *tape;  // Cells [0, tape_size); the rest are zero
+    size_t tape_size;
+    const char *output;
+    size_t output_size;
+    void *owned;  // Heap block behind tape and output, unless they are in the mapping
+} BfSnapshot;
+
+typedef struct {
+    const BfInsn *insns;
+    size_t insn_count;
+    const BfMulTerm *terms;
+    size_t term_count;
+
+    // Backing storage: either heap arrays from bf_bytecode_compile or a mapped file
+    BfInsn *owned_insns;
+    BfSpan *spans;  // Per op, compiled programs only (not stored in .bfc files)
+    size_t insn_capacity;
+    BfMulTerm *owned_terms;
+    size_t term_capacity;
+    void *mapping;
+    size_t mapping_size;
+
+    BfSnapshot snapshot;
+} BfProgram;
+
+static inline BfInsn *bf_bytecode_emit(BfProgram *program, uint16_t op, int32_t arg) {
+    if (program->insn_count == program->insn_capacity) {
+        program->insn_capacity = program->insn_capacity ? program->insn_capacity * 2 : 256;
+        program->owned_insns = (BfInsn *)realloc(program->owned_insns, program->insn_capacity * sizeof(BfInsn));
+        program->spans = (BfSpan *)realloc(program->spans, program->insn_capacity * sizeof(BfSpan));
+        if (!program->owned_insns || !program->spans) {
+            perror("Failed to grow bytecode");
+            exit(1);
+        }
+    }
+    BfInsn *insn = &program->owned_insns[program->insn_count++];
+    insn->op = op;
+    insn->count = 0;
+    insn->arg = arg;
+    return insn;
+}
+
+// Record the source characters of the op emitted last
+static inline void bf_bytecode_span(BfProgram *program, size_t begin, size_t end) {
+    program->spans[program->insn_count - 1].begin = begin;
+    program->spans[program->insn_count - 1].end = end;
+}
+
+static inline void bf_bytecode_add_term(BfProgram *program, int32_t offset, int32_t factor) {
+    if (program->term_count == program->term_capacity) {
+        program->term_capacity = program->term_capacity ? program->term_capacity * 2 : 64;
+        program->owned_terms = (BfMulTerm *)realloc(program->owned_terms, program->term_capacity * sizeof(BfMulTerm));
+        if (!program->owned_terms) {
+            perror("Failed to grow bytecode");
+            exit(1);
+        }
+    }
+    program->owned_terms[program->term_count].offset = offset;
+    program->owned_terms[program->term_count].factor = factor;
+    program->term_count++;
+}
+
+// Replace the loop whose BF_OP_JZ is at `open` (its body runs to the end of the
+// stream) by one op when the body is only ADD/MOVE ops. Returns 1 if rewritten.
+static inline int bf_bytecode_fold_loop(BfProgram *program, size_t open) {
+    const BfInsn *body = program->owned_insns + open + 1;
+    size_t body_count = program->insn_count - open - 1;
+
+    if (body_count == 1 && body[0].op == BF_OP_MOVE) {
+        int32_t stride = body[0].arg;
+        program->insn_count = open;
+        bf_bytecode_emit(program, BF_OP_SCAN, stride);
+        return 1;
+    }
+
+    BfMulTerm terms[BF_BYTECODE_MAX_TERMS];
+    size_t term_count = 0;
+    int64_t position = 0;
+    int32_t counter_delta = 0;
+    for (size_t k = 0; k < body_count; ++k) {
+        if (body[k].op == BF_OP_MOVE) {
+            position += body[k].arg;
+        } else if (body[k].op != BF_OP_ADD) {
+            return 0;  // I/O or a nested loop
+        } else if (position == 0) {
+            counter_delta += body[k].arg;
+        } else {
+            size_t t = 0;
+            while (t < term_count && terms[t].offset != position) {
+                t++;
+            }
+            if (t == term_count) {
+                if (term_count == BF_BYTECODE_MAX_TERMS || position < INT32_MIN || position > INT32_MAX) {
+                    return 0;
+                }
+                terms[term_count].offset = (int32_t)position;
+                terms[term_count++].factor = 0;
+            }
+            terms[t].factor += body[k].arg;
+        }
+    }
+    counter_delta = (int8_t)counter_delta;  // Cell arithmetic is mod 256
+    if (position != 0 || (counter_delta != 1 && counter_delta != -1)) {
+        return 0;
+    }
+
+    // With a +1 counter the loop runs (256 - value) times, i.e. -value mod 256
+    program->insn_count = open;
+    if (term_count == 0) {
+        bf_bytecode_emit(program, BF_OP_CLEAR, 0);
+        return 1;
+    }
+    BfInsn *mul = bf_bytecode_emit(program, BF_OP_MUL, (int32_t)program->term_count);
+    mul->count = (uint16_t)term_count;
+    for (size_t t = 0; t < term_count; ++t) {
+        bf_bytecode_add_term(program, terms[t].offset, counter_delta == -1 ? terms[t].factor : -terms[t].factor);
+    }
+    return 1;
+}
+
+// Compile Brainfuck source (non-command characters are skipped); returns 0 on success
+static inline int bf_bytecode_compile(const char *source, size_t size, BfProgram *program) {
+    memset(program, 0, sizeof(*program));
+    size_t *open_stack = NULL;
+    size_t open_count = 0, open_capacity = 0;
+
+    for (size_t i = 0; i < size; ++i) {
+        char c = source[i];
+        size_t begin = i;
+        if (c == '+' || c == '-') {
+            int32_t delta = 0;
+            for (; i < size; ++i) {
+                if (source[i] == '+') {
+                    delta++;
+                } else if (source[i] == '-') {
+                    delta--;
+                } else if (bf_is_command(source[i])) {
+                    break;
+                }
+            }
+            i--;
+            if ((int8_t)delta) {
+                bf_bytecode_emit(program, BF_OP_ADD, (int8_t)delta);
+                bf_bytecode_span(program, begin, i);
+            }
+        } else if (c == '>' || c == '<') {
+            int64_t delta = 0;
+            for (; i < size; ++i) {
+                if (source[i] == '>') {
+                    delta++;
+                } else if (source[i] == '<') {
+                    delta--;
+                } else if (bf_is_command(source[i])) {
+                    break;
+                }
+            }
+            i--;
+            if (delta) {
+                bf_bytecode_emit(program, BF_OP_MOVE, (int32_t)delta);
+                bf_bytecode_span(program, begin, i);
+            }
+        } else if (c == '.') {
+            int32_t count = 0;
+            for (; i < size && (source[i] == '.' || !bf_is_command(source[i])); ++i) {
+                count += source[i] == '.';
+            }
+            i--;
+            bf_bytecode_emit(program, BF_OP_OUT, count);
+            bf_bytecode_span(program, begin, i);
+        } else if (c == ',') {
+            bf_bytecode_emit(program, BF_OP_IN, 0);
+            bf_bytecode_span(program, i, i);
+        } else if (c == '[') {
+            if (open_count == open_capacity) {
+                open_capacity = open_capacity ? open_capacity * 2 : 64;
+                open_stack = (size_t *)realloc(open_stack, open_capacity * sizeof(size_t));
+                if (!open_stack) {
+                    perror("Failed to grow bracket stack");
+                    exit(1);
+                }
+            }
+            open_stack[open_count++] = program->insn_count;
+            bf_bytecode_emit(program, BF_OP_JZ, 0);
+            bf_bytecode_span(program, i, i);
+        } else if (c == ']') {
+            if (open_count == 0) {
+                fprintf(stderr, "Error: Unmatched ']' at position %zu\n", i);
+                free(open_stack);
+                return -1;
+            }
+            size_t open = open_stack[--open_count];
+            size_t open_begin = program->spans[open].begin;
+            if (bf_bytecode_fold_loop(program, open)) {
+                bf_bytecode_span(program, open_begin, i);  // The whole loop became one op
+            } else {
+                bf_bytecode_emit(program, BF_OP_JNZ, (int32_t)(open + 1));
+                bf_bytecode_span(program, i, i);
+                program->owned_insns[open].arg = (int32_t)program->insn_count;
+            }
+        }
+    }
+    free(open_stack);
+    if (open_count != 0) {
+        fprintf(stderr, "Error: Unmatched '[' in the program\n");
+        return -1;
+    }
+    if (program->insn_count >= INT32_MAX) {
+        fprintf(stderr, "Error: Program too large for bytecode\n");
+        return -1;
+    }
+    bf_bytecode_emit(program, BF_OP_END, 0);
+    bf_bytecode_span(program, size, size);
+
+    program->insns = program->owned_insns;
+    program->terms = program->owned_terms;
+    return 0;
+}
+
+// Ops one iteration of each loop runs, stored at its BF_OP_JNZ: the ops
+// between the brackets, minus nested loop bodies, which charge themselves
+static inline uint32_t *bf_bytecode_loop_costs(const BfProgram *program) {
+    uint32_t *costs = (uint32_t *)calloc(program->insn_count, sizeof(uint32_t));
+    size_t *open_costs = (size_t *)malloc(program->insn_count * sizeof(size_t));
+    size_t depth = 0;
+    if (!costs || !open_costs) {
+        perror("Failed to allocate loop costs");
+        exit(1);
+    }
+    for (size_t pc = 0; pc < program->insn_count; ++pc) {
+        if (depth > 0) {
+            open_costs[depth - 1]++;
+        }
+        if (program->insns[pc].op == BF_OP_JZ) {
+            open_costs[depth++] = 0;
+        } else if (program->insns[pc].op == BF_OP_JNZ && depth > 0) {
+            size_t cost = open_costs[--depth];
+            costs[pc] = cost > UINT32_MAX ? UINT32_MAX : (uint32_t)cost;
+        }
+    }
+    free(open_costs);
+    return costs;
+}
+
+// Write a compiled program as a `.bfc` file; returns 0 on success
+static inline int bf_bytecode_write(const char *path, const BfProgram *program) {
+    FILE *out = fopen(path, "wb");
+    if (!out) {
+        perror("Failed to open bytecode output");
+        return -1;
+    }
+    BfBytecodeHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BF_BYTECODE_MAGIC, 4);
+    header.version = BF_BYTECODE_VERSION;
+    header.byte_order = BF_BYTECODE_BYTE_ORDER;
+    header.insn_size = sizeof(BfInsn);
+    header.insn_count = program->insn_count;
+    header.term_count = program->term_count;
+    header.resume_pc = program->snapshot.resume_pc;
+    header.pointer = program->snapshot.pointer;
+    header.tape_size = program->snapshot.tape_size;
+    header.output_size = program->snapshot.output_size;
+
+    const BfSnapshot *snapshot = &program->snapshot;
+    int ok = fwrite(&header, sizeof(header), 1, out) == 1 &&
+             fwrite(program->insns, sizeof(BfInsn), program->insn_count, out) == program->insn_count &&
+             fwrite(program->terms, sizeof(BfMulTerm), program->term_count, out) == program->term_count &&
+             fwrite(snapshot->tape, 1, snapshot->tape_size, out) == snapshot->tape_size &&
+             fwrite(snapshot->output, 1, snapshot->output_size, out) == snapshot->output_size;
+    if (fclose(out) != 0 || !ok) {
+        perror("Failed to write bytecode");
+        return -1;
+    }
+    return 0;
+}
+
+// Map a `.bfc` file and point the program at it in place. Only the header and
+// the jump/term indices are checked, so a damaged file can't escape the arrays.
+static inline int bf_bytecode_map(const char *path, BfProgram *program) {
+    memset(program, 0, sizeof(*program));
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        perror("Failed to open bytecode");
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(BfBytecodeHeader)) {
+        fprintf(stderr, "Error: %s is not a brainfog bytecode file\n", path);
+        close(fd);
+        return -1;
+    }
+    void *mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        perror("Failed to map bytecode");
+        return -1;
+    }
+    program->mapping = mapping;
+    program->mapping_size = st.st_size;
+
+    const BfBytecodeHeader *header = (const BfBytecodeHeader *)mapping;
+    if (memcmp(header->magic, BF_BYTECODE_MAGIC, 4) != 0 || header->byte_order != BF_BYTECODE_BYTE_ORDER) {
+        fprintf(stderr, "Error: %s is not a brainfog bytecode file\n", path);
+        goto invalid;
+    }
+    if (header->version != BF_BYTECODE_VERSION || header->insn_size != sizeof(BfInsn)) {
+        fprintf(stderr, "Error: %s was written by an incompatible bf_interp (version %u), re-run --emit-bytecode\n",
+                path, header->version);
+        goto invalid;
+    }
+    if (header->insn_count == 0 || header->insn_count >= INT32_MAX || header->term_count >= INT32_MAX ||
+        header->resume_pc >= header->insn_count || header->tape_size > (size_t)st.st_size ||
+        header->output_size > (size_t)st.st_size ||
+        sizeof(BfBytecodeHeader) + header->insn_count * sizeof(BfInsn) + header->term_count * sizeof(BfMulTerm) +
+                header->tape_size + header->output_size !=
+            (size_t)st.st_size) {
+        fprintf(stderr, "Error: %s is truncated or damaged\n", path);
+        goto invalid;
+    }
+
+    program->insns = (const BfInsn *)(header + 1);
+    program->insn_count = header->insn_count;
+    program->terms = (const BfMulTerm *)(program->insns + program->insn_count);
+    program->term_count = header->term_count;
+    program->snapshot.resume_pc = header->resume_pc;
+    program->snapshot.pointer = header->pointer;
+    program->snapshot.tape = (const unsigned char *)(program->terms + program->term_count);
+    program->snapshot.tape_size = header->tape_size;
+    program->snapshot.output = (const char *)(program->snapshot.tape + header->tape_size);
+    program->snapshot.output_size = header->output_size;
+    for (size_t k = 0; k < program->insn_count; ++k) {
+        const BfInsn *insn = &program->insns[k];
+        int bad_jump = (insn->op == BF_OP_JZ || insn->op == BF_OP_JNZ) &&
+                       (insn->arg < 0 || (size_t)insn->arg >= program->insn_count);
+        int bad_mul = insn->op == BF_OP_MUL &&
+                      (insn->arg < 0 || (size_t)insn->arg + insn->count > program->term_count);
+        if (insn->op > BF_OP_SET || bad_jump || bad_mul) {
+            fprintf(stderr, "Error: %s is truncated or damaged\n", path);
+            goto invalid;
+        }
+    }
+    if (program->insns[program->insn_count - 1].op != BF_OP_END) {
+        fprintf(stderr, "Error: %s is truncated or damaged\n", path);
+        goto invalid;
+    }
+    return 0;
+
+invalid:
+    munmap(mapping, st.st_size);
+    memset(program, 0, sizeof(*program));
+    return -1;
+}
+
+static inline void bf_bytecode_free(BfProgram *program) {
+    if (program->mapping) {
+        munmap(program->mapping, program->mapping_size);
+    }
+    free(program->owned_insns);
+    free(program->spans);
+    free(program->owned_terms);
+    free(program->snapshot.owned);
+    memset(program, 0, sizeof(*program));
+}
+
+#endif // BF_BYTECODE_H
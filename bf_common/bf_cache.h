@@ -0,0 +1,357 @@
+#ifndef BF_CACHE_H
+#define BF_CACHE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+// Content-addressed compile cache shared by bf_compiler, bf_JIT and bf_llvm
+// (enabled with `--cache`, reported with `--cache-stats`).
+//
+// The key hashes the normalized source (Brainfuck commands only, so comments
+// and formatting don't matter), the backend, every output-affecting flag
+// (including profile contents) and the tool version. Entries live in
+// $BRAINFOG_CACHE_DIR, or ~/.cache/brainfog, as `<key>.<ext>`:
+//
+//   - a hit refreshes the entry's mtime, which is its LRU position
+//   - after a store, oldest entries are evicted until the cache fits in
+//     $BRAINFOG_CACHE_MAX_MB (default 512) megabytes
+//   - hit/miss/eviction counters live in `stats`, updated under flock
+
+#define BF_CACHE_DEFAULT_MAX_MB 512
+#define BF_CACHE_STATS_FILE "stats"
+#define BF_CACHE_NAME_MAX 64  // Room left after the directory for "/<key>.<ext>.tmp.<pid>"
+
+// Tool version: a rebuilt tool never reuses entries produced by an older build
+#define BF_CACHE_TOOL_VERSION "brainfog-cache-1 " __DATE__ " " __TIME__
+
+typedef struct {
+    char dir[PATH_MAX];
+    uint64_t hash[2];  // Two FNV-1a lanes with different seeds, 128 bits of key
+    char key[33];
+} BfCache;
+
+typedef struct {
+    long hits;
+    long misses;
+    long evictions;
+} BfCacheStats;
+
+static inline int bf_cache_mkdirs(const char *path) {
+    char partial[PATH_MAX];
+    snprintf(partial, sizeof(partial), "%s", path);
+    for (char *p = partial + 1; *p; ++p) {
+        if (*p == '/') {
+            *p = '\0';
+            if (mkdir(partial, 0755) != 0 && errno != EEXIST) {
+                return -1;
+            }
+            *p = '/';
+        }
+    }
+    return (mkdir(partial, 0755) != 0 && errno != EEXIST) ? -1 : 0;
+}
+
+// Start a new key (bf_cache_open does); also for in-memory caches keyed the same way
+static inline void bf_cache_key_start(BfCache *cache) {
+    cache->hash[0] = 0xcbf29ce484222325ULL;  // FNV-1a offset basis
+    cache->hash[1] = 0x84222325cbf29ce4ULL;
+}
+
+// Resolve and create the cache directory; returns 0 on success
+static inline int bf_cache_open(BfCache *cache) {
+    memset(cache, 0, sizeof(*cache));
+    const char *dir = getenv("BRAINFOG_CACHE_DIR");
+    int length;
+    if (dir && *dir) {
+        length = snprintf(cache->dir, sizeof(cache->dir), "%s", dir);
+    } else if (getenv("XDG_CACHE_HOME") && *getenv("XDG_CACHE_HOME")) {
+        length = snprintf(cache->dir, sizeof(cache->dir), "%s/brainfog", getenv("XDG_CACHE_HOME"));
+    } else if (getenv("HOME")) {
+        length = snprintf(cache->dir, sizeof(cache->dir), "%s/.cache/brainfog", getenv("HOME"));
+    } else {
+        fprintf(stderr, "Error: No cache directory (set BRAINFOG_CACHE_DIR or HOME)\n");
+        return -1;
+    }
+    if (length < 0 || (size_t)length >= sizeof(cache->dir) - BF_CACHE_NAME_MAX) {
+        fprintf(stderr, "Error: Cache directory path is too long\n");
+        return -1;
+    }
+    if (bf_cache_mkdirs(cache->dir) != 0) {
+        perror("Failed to create cache directory");
+        return -1;
+    }
+    bf_cache_key_start(cache);
+    return 0;
+}
+
+static inline void bf_cache_add(BfCache *cache, const void *data, size_t size) {
+    const unsigned char *bytes = (const unsigned char *)data;
+    for (size_t i = 0; i < size; ++i) {
+        cache->hash[0] = (cache->hash[0] ^ bytes[i]) * 0x100000001b3ULL;
+        cache->hash[1] = (cache->hash[1] ^ bytes[i]) * 0x100000001b3ULL;
+        cache->hash[1] ^= cache->hash[1] >> 29;  // Decorrelate the second lane
+    }
+}
+
+// Strings are length-prefixed so ("ab", "c") and ("a", "bc") differ
+static inline void bf_cache_add_string(BfCache *cache, const char *text) {
+    size_t length = text ? strlen(text) : 0;
+    bf_cache_add(cache, &length, sizeof(length));
+    bf_cache_add(cache, text, length);
+}
+
+// Only the eight commands count, whatever else the file contains
+static inline void bf_cache_add_commands(BfCache *cache, const char *source, size_t size) {
+    size_t commands = 0;
+    for (size_t i = 0; i < size; ++i) {
+        char c = source[i];
+        if (c == '>' || c == '<' || c == '+' || c == '-' || c == '.' || c == ',' || c == '[' || c == ']') {
+            bf_cache_add(cache, &c, 1);
+            commands++;
+        }
+    }
+    bf_cache_add(cache, &commands, sizeof(commands));
+}
+
+// Hash a file's contents (e.g. a profile); returns 0 on success
+static inline int bf_cache_add_file(BfCache *cache, const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        perror("Failed to open file for cache key");
+        return -1;
+    }
+    char buffer[65536];
+    size_t got;
+    while ((got = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        bf_cache_add(cache, buffer, got);
+    }
+    fclose(file);
+    return 0;
+}
+
+// Finish the key after everything output-affecting has been added
+static inline const char *bf_cache_key(BfCache *cache) {
+    bf_cache_add_string(cache, BF_CACHE_TOOL_VERSION);
+    snprintf(cache->key, sizeof(cache->key), "%016llx%016llx",
+             (unsigned long long)cache->hash[0], (unsigned long long)cache->hash[1]);
+    return cache->key;
+}
+
+// Path of the file `name` in the cache directory; returns -1 if it doesn't fit `size`
+static inline int bf_cache_path(const BfCache *cache, const char *name, char *path, size_t size) {
+    int length = snprintf(path, size, "%s/%s", cache->dir, name);
+    return length >= 0 && (size_t)length < size ? 0 : -1;
+}
+
+static inline int bf_cache_entry_path(const BfCache *cache, const char *ext, char *path, size_t size) {
+    int length = snprintf(path, size, "%s/%s.%s", cache->dir, cache->key, ext);
+    return length >= 0 && (size_t)length < size ? 0 : -1;
+}
+
+// Read-modify-write the counters under an exclusive lock
+static inline void bf_cache_count(const BfCache *cache, long hits, long misses, long evictions) {
+    char path[PATH_MAX];
+    if (bf_cache_path(cache, BF_CACHE_STATS_FILE, path, sizeof(path)) != 0) {
+        return;
+    }
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd == -1) {
+        return;  // Counters are best effort
+    }
+    flock(fd, LOCK_EX);
+    BfCacheStats stats = {0, 0, 0};
+    char text[256];
+    ssize_t got = pread(fd, text, sizeof(text) - 1, 0);
+    if (got > 0) {
+        text[got] = '\0';
+        sscanf(text, "hits %ld\nmisses %ld\nevictions %ld", &stats.hits, &stats.misses, &stats.evictions);
+    }
+    stats.hits += hits;
+    stats.misses += misses;
+    stats.evictions += evictions;
+    int length = snprintf(text, sizeof(text), "hits %ld\nmisses %ld\nevictions %ld\n",
+                          stats.hits, stats.misses, stats.evictions);
+    if (ftruncate(fd, 0) == 0 && pwrite(fd, text, length, 0) != length) {
+        fprintf(stderr, "Warning: Failed to update cache stats\n");
+    }
+    flock(fd, LOCK_UN);
+    close(fd);
+}
+
+// Look up the entry for the current key; on a hit `path` names the cached
+// file and its LRU position is refreshed. Returns 1 on hit, 0 on miss.
+static inline int bf_cache_lookup(const BfCache *cache, const char *ext, char *path, size_t size) {
+    if (bf_cache_entry_path(cache, ext, path, size) != 0 || access(path, R_OK) != 0) {
+        bf_cache_count(cache, 0, 1, 0);
+        return 0;
+    }
+    utimes(path, NULL);  // Most recently used
+    bf_cache_count(cache, 1, 0, 0);
+    return 1;
+}
+
+// Whether the entry for the current key exists, without counting a hit or a
+// miss or refreshing it (`--cache-check`, asked by bf run before choosing)
+static inline int bf_cache_contains(const BfCache *cache, const char *ext) {
+    char path[PATH_MAX];
+    return bf_cache_entry_path(cache, ext, path, sizeof(path)) == 0 && access(path, R_OK) == 0;
+}
+
+// Copy src to dest through a temporary file and rename, so readers never see partial files
+static inline int bf_cache_copy_file(const char *src, const char *dest, mode_t mode) {
+    char temp[PATH_MAX];
+    int length = snprintf(temp, sizeof(temp), "%s.tmp.%ld", dest, (long)getpid());
+    if (length < 0 || (size_t)length >= sizeof(temp)) {
+        fprintf(stderr, "Error: %s: path is too long\n", dest);
+        return -1;
+    }
+    FILE *in = fopen(src, "rb");
+    if (!in) {
+        perror("Failed to open file for copy");
+        return -1;
+    }
+    FILE *out = fopen(temp, "wb");
+    if (!out) {
+        perror("Failed to create file for copy");
+        fclose(in);
+        return -1;
+    }
+    char buffer[65536];
+    size_t got;
+    int ok = 1;
+    while ((got = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+        if (fwrite(buffer, 1, got, out) != got) {
+            ok = 0;
+            break;
+        }
+    }
+    fclose(in);
+    if (fclose(out) != 0 || !ok || chmod(temp, mode) != 0 || rename(temp, dest) != 0) {
+        perror("Failed to copy file");
+        unlink(temp);
+        return -1;
+    }
+    return 0;
+}
+
+typedef struct {
+    char name[NAME_MAX + 1];
+    off_t size;
+    time_t mtime;
+} BfCacheEntry;
+
+static inline int bf_cache_entry_older(const void *a, const void *b) {
+    time_t ta = ((const BfCacheEntry *)a)->mtime, tb = ((const BfCacheEntry *)b)->mtime;
+    return (ta > tb) - (ta < tb);
+}
+
+// List cache entries (everything but the stats file); caller frees *entries
+static inline size_t bf_cache_list(const BfCache *cache, BfCacheEntry **entries, off_t *total) {
+    size_t count = 0, capacity = 0;
+    *entries = NULL;
+    *total = 0;
+    DIR *dir = opendir(cache->dir);
+    if (!dir) {
+        return 0;
+    }
+    struct dirent *item;
+    while ((item = readdir(dir)) != NULL) {
+        if (item->d_name[0] == '.' || strcmp(item->d_name, BF_CACHE_STATS_FILE) == 0 || strstr(item->d_name, ".tmp.")) {
+            continue;
+        }
+        char path[PATH_MAX];
+        struct stat st;
+        if (bf_cache_path(cache, item->d_name, path, sizeof(path)) != 0 || stat(path, &st) != 0 ||
+            !S_ISREG(st.st_mode)) {
+            continue;
+        }
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            *entries = (BfCacheEntry *)realloc(*entries, capacity * sizeof(BfCacheEntry));
+            if (!*entries) {
+                perror("Failed to list cache");
+                exit(1);
+            }
+        }
+        snprintf((*entries)[count].name, sizeof((*entries)[count].name), "%s", item->d_name);
+        (*entries)[count].size = st.st_size;
+        (*entries)[count].mtime = st.st_mtime;
+        *total += st.st_size;
+        count++;
+    }
+    closedir(dir);
+    return count;
+}
+
+// Evict least recently used entries until the cache fits its size bound
+static inline void bf_cache_evict(const BfCache *cache) {
+    const char *max_mb = getenv("BRAINFOG_CACHE_MAX_MB");
+    off_t limit = (off_t)(max_mb && *max_mb ? atol(max_mb) : BF_CACHE_DEFAULT_MAX_MB) << 20;
+
+    BfCacheEntry *entries;
+    off_t total;
+    size_t count = bf_cache_list(cache, &entries, &total);
+    if (total > limit) {
+        qsort(entries, count, sizeof(BfCacheEntry), bf_cache_entry_older);
+        long evicted = 0;
+        for (size_t i = 0; i < count && total > limit; ++i) {
+            char path[PATH_MAX];
+            if (bf_cache_path(cache, entries[i].name, path, sizeof(path)) == 0 && unlink(path) == 0) {
+                total -= entries[i].size;
+                evicted++;
+            }
+        }
+        bf_cache_count(cache, 0, 0, evicted);
+    }
+    free(entries);
+}
+
+// Store a freshly built output under the current key, then enforce the size bound
+static inline int bf_cache_store(const BfCache *cache, const char *ext, const char *built_path) {
+    char path[PATH_MAX];
+    struct stat st;
+    if (bf_cache_entry_path(cache, ext, path, sizeof(path)) != 0 || stat(built_path, &st) != 0 ||
+        bf_cache_copy_file(built_path, path, st.st_mode & 0777) != 0) {
+        return -1;
+    }
+    bf_cache_evict(cache);
+    return 0;
+}
+
+// `--cache-stats` report
+static inline void bf_cache_print_stats(FILE *out, const BfCache *cache) {
+    char path[PATH_MAX];
+    BfCacheStats stats = {0, 0, 0};
+    FILE *file = bf_cache_path(cache, BF_CACHE_STATS_FILE, path, sizeof(path)) == 0 ? fopen(path, "r") : NULL;
+    if (file) {
+        if (fscanf(file, "hits %ld\nmisses %ld\nevictions %ld", &stats.hits, &stats.misses, &stats.evictions) < 0) {
+            stats.hits = stats.misses = stats.evictions = 0;
+        }
+        fclose(file);
+    }
+
+    BfCacheEntry *entries;
+    off_t total;
+    size_t count = bf_cache_list(cache, &entries, &total);
+    free(entries);
+
+    long lookups = stats.hits + stats.misses;
+    fprintf(out, "Cache directory: %s\n", cache->dir);
+    fprintf(out, "Entries:         %zu (%.1f MB)\n", count, total / 1048576.0);
+    fprintf(out, "Hits:            %ld\n", stats.hits);
+    fprintf(out, "Misses:          %ld\n", stats.misses);
+    fprintf(out, "Hit rate:        %.1f%%\n", lookups ? 100.0 * stats.hits / lookups : 0.0);
+    fprintf(out, "Evictions:       %ld\n", stats.evictions);
+}
+
+#endif // BF_CACHE_H
@@ -0,0 +1,351 @@
+#ifndef BF_CHECKPOINT_H
+#define BF_CHECKPOINT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "bf_bytecode.h"
+#include "bf_limits.h"  // bf_limits_now_ns
+
+// Checkpoints of long-running programs for bf_interp (--checkpoint <file>,
+// --resume <file>). A checkpoint is taken at a loop back edge, where the
+// whole state is the op index, the pointer and the tape, plus how far the
+// program got through its input and output. The interpreter forks and the
+// child writes the file from its copy-on-write view of the tape while the
+// parent runs on, so the program only pauses for the fork. The file is
+// written beside its target and renamed over it: a crash mid-write leaves
+// the previous checkpoint intact.
+//
+// The tape is stored in pages: all-zero pages (never touched, or cleared
+// again) are left out, the others are PackBits run-length coded. The file
+// carries a hash of the program's ops, so it only resumes the program that
+// wrote it:
+//
+//   BfCheckpointHeader | (BfCheckpointPage | packed cells)[page_count]
+//
+// SIGTERM and SIGINT (a host drain) write a last checkpoint in the
+// foreground at the next back edge and stop with 128 + the signal; a second
+// signal stops at once.
+
+#define BF_CHECKPOINT_MAGIC "BFK\x1a"
+#define BF_CHECKPOINT_VERSION 1
+#define BF_CHECKPOINT_PAGE 4096
+#define BF_CHECKPOINT_DEFAULT_INTERVAL 60.0  // Seconds, --checkpoint-interval
+
+typedef struct {
+    uint64_t pc;             // Op to continue at, the top of a loop body
+    uint64_t pointer;        // Tape index of the pointer
+    uint64_t input_offset;   // Bytes read from stdin so far
+    uint64_t output_offset;  // Bytes written to stdout so far
+    uint64_t steps;          // Charged so far under --max-steps
+} BfCheckpointState;
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t byte_order;  // BF_BYTECODE_BYTE_ORDER
+    uint32_t page_size;
+    uint64_t program_hash;
+    BfCheckpointState state;
+    uint64_t tape_size;
+    uint64_t page_count;  // Pages stored, the rest of the tape is zero
+} BfCheckpointHeader;
+
+typedef struct {
+    uint64_t index;        // Page number on the tape
+    uint64_t packed_size;  // Bytes that follow
+} BfCheckpointPage;
+
+typedef struct {
+    const char *path;    // --checkpoint, NULL: none are taken
+    double interval;     // --checkpoint-interval
+    const char *resume;  // --resume
+} BfCheckpointOptions;
+
+// Run-time side of --checkpoint
+typedef struct {
+    const char *path;
+    uint64_t program_hash;
+    int64_t interval;         // ns
+    int64_t due;              // CLOCK_MONOTONIC ns of the next checkpoint
+    pid_t writer;             // Child still writing the last checkpoint, 0: none
+    BfCheckpointState state;  // Where the run starts, from --resume
+} BfCheckpoint;
+
+static volatile sig_atomic_t bf_checkpoint_signal;
+
+static inline void bf_checkpoint_on_signal(int sig) {
+    if (bf_checkpoint_signal) {
+        signal(sig, SIG_DFL);  // Asked twice, e.g. while blocked on input: stop now
+        raise(sig);
+    }
+    bf_checkpoint_signal = sig;
+}
+
+// FNV-1a over the ops and multiply terms
+static inline uint64_t bf_checkpoint_hash(const BfProgram *program) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    const unsigned char *bytes = (const unsigned char *)program->insns;
+    for (size_t i = 0; i < program->insn_count * sizeof(BfInsn); ++i) {
+        hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+    }
+    bytes = (const unsigned char *)program->terms;
+    for (size_t i = 0; i < program->term_count * sizeof(BfMulTerm); ++i) {
+        hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// PackBits: a control byte n < 128 is followed by n + 1 literal bytes, n > 128
+// by one byte repeated 257 - n times. `out` needs size + size / 128 + 1 bytes.
+static inline size_t bf_checkpoint_pack(const unsigned char *in, size_t size, unsigned char *out) {
+    size_t packed = 0;
+    for (size_t i = 0; i < size;) {
+        size_t run = 1;
+        while (i + run < size && run < 128 && in[i + run] == in[i]) {
+            run++;
+        }
+        if (run >= 3) {
+            out[packed++] = (unsigned char)(257 - run);
+            out[packed++] = in[i];
+            i += run;
+            continue;
+        }
+        size_t start = i, count = 0;
+        while (i < size && count < 128 && !(i + 2 < size && in[i] == in[i + 1] && in[i] == in[i + 2])) {
+            i++;
+            count++;
+        }
+        out[packed++] = (unsigned char)(count - 1);
+        memcpy(out + packed, in + start, count);
+        packed += count;
+    }
+    return packed;
+}
+
+// Returns 0 when `in` unpacks to exactly `out_size` bytes
+static inline int bf_checkpoint_unpack(const unsigned char *in, size_t size, unsigned char *out, size_t out_size) {
+    size_t filled = 0;
+    for (size_t i = 0; i < size;) {
+        unsigned char control = in[i++];
+        if (control < 128) {
+            size_t count = (size_t)control + 1;
+            if (i + count > size || filled + count > out_size) {
+                return -1;
+            }
+            memcpy(out + filled, in + i, count);
+            i += count;
+            filled += count;
+        } else if (control > 128) {
+            size_t count = 257 - (size_t)control;
+            if (i == size || filled + count > out_size) {
+                return -1;
+            }
+            memset(out + filled, in[i++], count);
+            filled += count;
+        }
+    }
+    return filled == out_size ? 0 : -1;
+}
+
+static inline int bf_checkpoint_page_used(const unsigned char *cells, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        if (cells[i]) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Write a checkpoint file; returns 0 on success
+static inline int bf_checkpoint_write(const char *path, uint64_t program_hash, const BfCheckpointState *state,
+                                      const unsigned char *tape, size_t tape_size) {
+    char temp[PATH_MAX];
+    snprintf(temp, sizeof(temp), "%s.tmp", path);
+    FILE *out = fopen(temp, "wb");
+    if (!out) {
+        perror("Failed to open checkpoint");
+        return -1;
+    }
+    BfCheckpointHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BF_CHECKPOINT_MAGIC, 4);
+    header.version = BF_CHECKPOINT_VERSION;
+    header.byte_order = BF_BYTECODE_BYTE_ORDER;
+    header.page_size = BF_CHECKPOINT_PAGE;
+    header.program_hash = program_hash;
+    header.state = *state;
+    header.tape_size = tape_size;
+    for (size_t at = 0; at < tape_size; at += BF_CHECKPOINT_PAGE) {
+        size_t size = tape_size - at < BF_CHECKPOINT_PAGE ? tape_size - at : BF_CHECKPOINT_PAGE;
+        header.page_count += bf_checkpoint_page_used(tape + at, size);
+    }
+
+    unsigned char packed[BF_CHECKPOINT_PAGE + BF_CHECKPOINT_PAGE / 128 + 1];
+    int ok = fwrite(&header, sizeof(header), 1, out) == 1;
+    for (size_t at = 0; ok && at < tape_size; at += BF_CHECKPOINT_PAGE) {
+        size_t size = tape_size - at < BF_CHECKPOINT_PAGE ? tape_size - at : BF_CHECKPOINT_PAGE;
+        if (!bf_checkpoint_page_used(tape + at, size)) {
+            continue;
+        }
+        BfCheckpointPage page = {at / BF_CHECKPOINT_PAGE, bf_checkpoint_pack(tape + at, size, packed)};
+        ok = fwrite(&page, sizeof(page), 1, out) == 1 && fwrite(packed, 1, page.packed_size, out) == page.packed_size;
+    }
+    ok = ok && fflush(out) == 0 && fsync(fileno(out)) == 0;
+    if (fclose(out) != 0 || !ok || rename(temp, path) != 0) {
+        perror("Failed to write checkpoint");
+        unlink(temp);
+        return -1;
+    }
+    return 0;
+}
+
+// Load a checkpoint of `program` as its snapshot (in place of any from
+// compile-time evaluation) on a tape of `tape_size` cells, and the I/O
+// offsets and steps into `state`; returns 0 on success
+static inline int bf_checkpoint_load(const char *path, BfProgram *program, size_t tape_size, BfCheckpointState *state) {
+    FILE *in = fopen(path, "rb");
+    if (!in) {
+        perror("Failed to open checkpoint");
+        return -1;
+    }
+    BfCheckpointHeader header;
+    unsigned char *tape = NULL;
+    if (fread(&header, sizeof(header), 1, in) != 1 || memcmp(header.magic, BF_CHECKPOINT_MAGIC, 4) != 0 ||
+        header.byte_order != BF_BYTECODE_BYTE_ORDER) {
+        fprintf(stderr, "Error: %s is not a brainfog checkpoint\n", path);
+        goto invalid;
+    }
+    if (header.version != BF_CHECKPOINT_VERSION || header.page_size != BF_CHECKPOINT_PAGE) {
+        fprintf(stderr, "Error: %s was written by an incompatible bf_interp (version %u)\n", path, header.version);
+        goto invalid;
+    }
+    if (header.program_hash != bf_checkpoint_hash(program)) {
+        fprintf(stderr, "Error: %s was written by a different program\n", path);
+        goto invalid;
+    }
+    if (header.tape_size != tape_size || header.state.pc >= program->insn_count ||
+        header.state.pointer >= tape_size) {
+        fprintf(stderr, "Error: %s is truncated or damaged\n", path);
+        goto invalid;
+    }
+
+    tape = (unsigned char *)calloc(tape_size, 1);
+    if (!tape) {
+        perror("Failed to allocate checkpoint tape");
+        goto invalid;
+    }
+    for (uint64_t k = 0; k < header.page_count; ++k) {
+        unsigned char packed[BF_CHECKPOINT_PAGE + BF_CHECKPOINT_PAGE / 128 + 1];
+        BfCheckpointPage page;
+        if (fread(&page, sizeof(page), 1, in) != 1 || page.index * BF_CHECKPOINT_PAGE >= tape_size ||
+            page.packed_size > sizeof(packed) || fread(packed, 1, page.packed_size, in) != page.packed_size) {
+            fprintf(stderr, "Error: %s is truncated or damaged\n", path);
+            goto invalid;
+        }
+        size_t at = page.index * BF_CHECKPOINT_PAGE;
+        size_t size = tape_size - at < BF_CHECKPOINT_PAGE ? tape_size - at : BF_CHECKPOINT_PAGE;
+        if (bf_checkpoint_unpack(packed, page.packed_size, tape + at, size) != 0) {
+            fprintf(stderr, "Error: %s is truncated or damaged\n", path);
+            goto invalid;
+        }
+    }
+    fclose(in);
+
+    BfSnapshot *snapshot = &program->snapshot;
+    free(snapshot->owned);
+    memset(snapshot, 0, sizeof(*snapshot));
+    snapshot->resume_pc = header.state.pc;
+    snapshot->pointer = header.state.pointer;
+    snapshot->tape = tape;
+    snapshot->tape_size = tape_size;
+    snapshot->owned = tape;
+    *state = header.state;
+    return 0;
+
+invalid:
+    free(tape);
+    fclose(in);
+    return -1;
+}
+
+// Put stdin and stdout where the checkpointed run left them: skip the input
+// it consumed, and cut off output a regular file got after the checkpoint
+static inline void bf_checkpoint_seek_io(const BfCheckpointState *state) {
+    if (lseek(STDIN_FILENO, (off_t)state->input_offset, SEEK_CUR) == -1) {
+        for (uint64_t k = 0; k < state->input_offset && getchar() != EOF; ++k) {
+        }
+    }
+    struct stat st;
+    if (fstat(STDOUT_FILENO, &st) == 0 && S_ISREG(st.st_mode) && (uint64_t)st.st_size >= state->output_offset) {
+        if (ftruncate(STDOUT_FILENO, (off_t)state->output_offset) != 0 ||
+            lseek(STDOUT_FILENO, (off_t)state->output_offset, SEEK_SET) == -1) {
+            perror("Failed to rewind output");
+        }
+    }
+}
+
+static inline void bf_checkpoint_start(BfCheckpoint *checkpoint, const char *path, const BfProgram *program,
+                                       double interval) {
+    checkpoint->path = path;
+    checkpoint->program_hash = bf_checkpoint_hash(program);
+    checkpoint->interval = (int64_t)(interval * 1e9);
+    checkpoint->due = bf_limits_now_ns() + checkpoint->interval;
+    checkpoint->writer = 0;
+    signal(SIGTERM, bf_checkpoint_on_signal);
+    signal(SIGINT, bf_checkpoint_on_signal);
+}
+
+// Reap the background writer once it is done (`block`: wait for it);
+// returns 1 while it is still writing
+static inline int bf_checkpoint_busy(BfCheckpoint *checkpoint, int block) {
+    if (checkpoint->writer > 0) {
+        if (waitpid(checkpoint->writer, NULL, block ? 0 : WNOHANG) == 0) {
+            return 1;
+        }
+        checkpoint->writer = 0;
+    }
+    return 0;
+}
+
+// Checked at back edges now and then (the interpreter's fuel slices)
+static inline int bf_checkpoint_due(const BfCheckpoint *checkpoint) {
+    return bf_checkpoint_signal || bf_limits_now_ns() >= checkpoint->due;
+}
+
+// Checkpoint `state` and the tape; stdout must be flushed up to
+// state->output_offset. Returns 0 to run on, or after a signal the exit status.
+static inline int bf_checkpoint_take(BfCheckpoint *checkpoint, const BfCheckpointState *state,
+                                     const unsigned char *tape, size_t tape_size) {
+    int sig = bf_checkpoint_signal;
+    if (sig) {
+        bf_checkpoint_busy(checkpoint, 1);  // It would rename its file over this one
+        if (bf_checkpoint_write(checkpoint->path, checkpoint->program_hash, state, tape, tape_size) == 0) {
+            fprintf(stderr, "Checkpoint written to %s\n", checkpoint->path);
+        }
+        return 128 + sig;
+    }
+    checkpoint->due = bf_limits_now_ns() + checkpoint->interval;
+    if (bf_checkpoint_busy(checkpoint, 0)) {
+        return 0;  // The last one is still being written: skip this one
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        _exit(bf_checkpoint_write(checkpoint->path, checkpoint->program_hash, state, tape, tape_size) == 0 ? 0 : 1);
+    }
+    if (pid < 0) {
+        bf_checkpoint_write(checkpoint->path, checkpoint->program_hash, state, tape, tape_size);
+    } else {
+        checkpoint->writer = pid;
+    }
+    return 0;
+}
+
+#endif // BF_CHECKPOINT_H
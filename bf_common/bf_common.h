@@ -0,0 +1,411 @@
+#ifndef BF_COMMON_H
+#define BF_COMMON_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "bf_source.h"
+
+// Shared front-end pieces for the native compilers (bf_compiler, bf_JIT).
+// Everything here is sized from the source, so there are no fixed limits on
+// program length, nesting depth, loop count or offsets touched by a loop.
+
+// Grow a heap array so it can hold at least `needed` elements (doubling)
+static inline void *grow_array(void *array, size_t *capacity, size_t needed, size_t elem_size) {
+    if (needed <= *capacity) {
+        return array;
+    }
+    size_t new_capacity = *capacity ? *capacity : 16;
+    while (new_capacity < needed) {
+        new_capacity *= 2;
+    }
+    void *grown = realloc(array, new_capacity * elem_size);
+    if (!grown) {
+        perror("Failed to grow array");
+        exit(1);
+    }
+    *capacity = new_capacity;
+    return grown;
+}
+
+// Growable stack of ints used for bracket matching and loop labels
+typedef struct {
+    int *items;
+    size_t count;
+    size_t capacity;
+} IntStack;
+
+static inline void int_stack_push(IntStack *stack, int value) {
+    stack->items = (int *)grow_array(stack->items, &stack->capacity, stack->count + 1, sizeof(int));
+    stack->items[stack->count++] = value;
+}
+
+static inline int int_stack_pop(IntStack *stack) {
+    return stack->items[--stack->count];
+}
+
+static inline void int_stack_free(IntStack *stack) {
+    free(stack->items);
+    stack->items = NULL;
+    stack->count = stack->capacity = 0;
+}
+
+// Function to read the Brainfuck source code from file, filtering out invalid characters
+// (the file is mapped and filtered straight into the returned buffer, see bf_source.h)
+static inline char *read_bf_file(const char *filename, size_t *size) {
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        perror("Failed to open Brainfuck file");
+        exit(1);
+    }
+
+    char *source = bf_read_source_fd(fd, size);
+    close(fd);
+    if (!source) {
+        exit(1);
+    }
+    return source;
+}
+
+// Bracket matching, split across threads for very large sources:
+//
+//   1. each thread walks its chunk with a private stack, filling in the jumps
+//      that close inside the chunk; what is left is a run of unmatched ']'
+//      followed by a run of unmatched '[' (a later ']' would have matched it)
+//   2. one pass over the chunk summaries, in order, pairs every chunk's ']'
+//      run with the '[' runs still open to its left, as a few index ranges
+//   3. each thread writes the cross-chunk pairs for its own ']' run
+//
+// Step 2 sees the brackets in source order, so the first unmatched ']' and the
+// innermost unmatched '[' are reported exactly as a serial walk would.
+
+#define BF_BRACKETS_PER_THREAD (1u << 22)  // Sources below 4M chars per thread stay serial
+#define BF_BRACKETS_MAX_THREADS 64
+
+typedef struct {
+    size_t close_from;  // First of this chunk's unmatched ']' in the range
+    size_t count;
+    size_t open_chunk;  // Chunk whose unmatched '[' they close
+    size_t open_top;    // Its '[' paired with close_from; later ']' take earlier '['
+} BracketLink;
+
+typedef struct BracketChunk {
+    const char *source;
+    int *jump_map;
+    const struct BracketChunk *all;  // Every chunk, for the '[' runs links point into
+    size_t begin, end;
+    IntStack opens;   // Unmatched '[' positions, outermost first
+    IntStack closes;  // Unmatched ']' positions, in order
+    BracketLink links[2 * BF_BRACKETS_MAX_THREADS];
+    size_t link_count;
+} BracketChunk;
+
+static inline void *match_chunk_brackets(void *arg) {
+    BracketChunk *chunk = (BracketChunk *)arg;
+    int *jump_map = chunk->jump_map;
+    memset(jump_map + chunk->begin, -1, (chunk->end - chunk->begin) * sizeof(int));
+    for (size_t i = chunk->begin; i < chunk->end; ++i) {
+        char c = chunk->source[i];
+        if (c == '[') {
+            int_stack_push(&chunk->opens, (int)i);
+        } else if (c == ']') {
+            if (chunk->opens.count == 0) {
+                int_stack_push(&chunk->closes, (int)i);
+            } else {
+                int open = int_stack_pop(&chunk->opens);
+                jump_map[open] = (int)i;  // Map the opening '[' to the closing ']'
+                jump_map[i] = open;       // Map the closing ']' to the opening '['
+            }
+        }
+    }
+    return NULL;
+}
+
+static inline void *link_chunk_brackets(void *arg) {
+    BracketChunk *chunk = (BracketChunk *)arg;
+    for (size_t l = 0; l < chunk->link_count; ++l) {
+        const BracketLink *link = &chunk->links[l];
+        const IntStack *opens = &chunk->all[link->open_chunk].opens;
+        for (size_t k = 0; k < link->count; ++k) {
+            int close = chunk->closes.items[link->close_from + k];
+            int open = opens->items[link->open_top - k];
+            chunk->jump_map[open] = close;
+            chunk->jump_map[close] = open;
+        }
+    }
+    return NULL;
+}
+
+static inline void run_bracket_threads(BracketChunk *chunks, size_t count, void *(*work)(void *)) {
+    pthread_t threads[BF_BRACKETS_MAX_THREADS];
+    size_t started = 0;
+    for (size_t t = 1; t < count; ++t) {
+        if (pthread_create(&threads[t], NULL, work, &chunks[t]) != 0) {
+            break;
+        }
+        started = t;
+    }
+    for (size_t t = started + 1; t < count; ++t) {
+        work(&chunks[t]);  // Couldn't get a thread, do it here
+    }
+    work(&chunks[0]);
+    for (size_t t = 1; t <= started; ++t) {
+        pthread_join(threads[t], NULL);
+    }
+}
+
+// Threads worth using for a source of bf_size characters
+static inline size_t bracket_thread_count(size_t bf_size) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t threads = bf_size / BF_BRACKETS_PER_THREAD;
+    if (cpus > 0 && threads > (size_t)cpus) {
+        threads = (size_t)cpus;
+    }
+    if (threads > BF_BRACKETS_MAX_THREADS) {
+        threads = BF_BRACKETS_MAX_THREADS;
+    }
+    return threads ? threads : 1;
+}
+
+// Fill jump_map[0..bf_size) with matching bracket positions (-1 elsewhere)
+// using `threads` chunks; returns 0, or -1 after reporting a nesting error
+static inline int match_brackets(const char *bf_source, size_t bf_size, int *jump_map, size_t threads) {
+    if (threads < 1) {
+        threads = 1;
+    }
+    if (threads > BF_BRACKETS_MAX_THREADS) {
+        threads = BF_BRACKETS_MAX_THREADS;
+    }
+    BracketChunk *chunks = (BracketChunk *)calloc(threads, sizeof(BracketChunk));
+    if (!chunks) {
+        perror("Failed to allocate bracket chunks");
+        return -1;
+    }
+    for (size_t t = 0; t < threads; ++t) {
+        chunks[t].source = bf_source;
+        chunks[t].jump_map = jump_map;
+        chunks[t].all = chunks;
+        chunks[t].begin = bf_size / threads * t;
+        chunks[t].end = t + 1 == threads ? bf_size : bf_size / threads * (t + 1);
+    }
+    run_bracket_threads(chunks, threads, match_chunk_brackets);
+
+    // Pending '[' runs from earlier chunks, innermost run last
+    size_t pending[BF_BRACKETS_MAX_THREADS];
+    size_t pending_left[BF_BRACKETS_MAX_THREADS];
+    size_t pending_count = 0;
+    int status = 0;
+    for (size_t t = 0; t < threads && status == 0; ++t) {
+        BracketChunk *chunk = &chunks[t];
+        size_t used = 0;
+        while (used < chunk->closes.count && pending_count > 0) {
+            size_t s = pending[pending_count - 1];
+            size_t take = chunk->closes.count - used;
+            if (take > pending_left[pending_count - 1]) {
+                take = pending_left[pending_count - 1];
+            }
+            BracketLink *link = &chunk->links[chunk->link_count++];
+            link->close_from = used;
+            link->count = take;
+            link->open_chunk = s;
+            link->open_top = pending_left[pending_count - 1] - 1;
+            pending_left[pending_count - 1] -= take;
+            if (pending_left[pending_count - 1] == 0) {
+                pending_count--;
+            }
+            used += take;
+        }
+        if (used < chunk->closes.count) {
+            fprintf(stderr, "Error: Unmatched ']' at position %d\n", chunk->closes.items[used]);
+            status = -1;
+        } else if (chunk->opens.count > 0) {
+            pending[pending_count] = t;
+            pending_left[pending_count++] = chunk->opens.count;
+        }
+    }
+    if (status == 0 && pending_count > 0) {
+        const BracketChunk *innermost = &chunks[pending[pending_count - 1]];
+        fprintf(stderr, "Error: Unmatched '[' at position %d\n",
+                innermost->opens.items[pending_left[pending_count - 1] - 1]);
+        status = -1;
+    }
+    if (status == 0) {
+        run_bracket_threads(chunks, threads, link_chunk_brackets);
+    }
+
+    for (size_t t = 0; t < threads; ++t) {
+        int_stack_free(&chunks[t].opens);
+        int_stack_free(&chunks[t].closes);
+    }
+    free(chunks);
+    return status;
+}
+
+// Function to create and populate the jump map for matching '[' and ']' brackets
+static inline int *create_jump_map(const char *bf_source, size_t bf_size) {
+    int *jump_map = (int *)malloc((bf_size ? bf_size : 1) * sizeof(int));
+    if (!jump_map) {
+        perror("Failed to allocate memory for jump map");
+        return NULL;
+    }
+    if (match_brackets(bf_source, bf_size, jump_map, bracket_thread_count(bf_size)) != 0) {
+        free(jump_map);
+        return NULL;
+    }
+    return jump_map;
+}
+
+// Metadata for `$` optimizations (pointer-only scan loops)
+typedef struct {
+    size_t position;  // Position of '$' in the Brainfuck code
+    int shift_value;  // Net shift value (e.g., -4 for [<<<<], +4 for [>>>>])
+} LoopInfo;
+
+// An offset and its corresponding net value change
+typedef struct {
+    int offset;      // Relative position from the starting pointer position
+    int net_change;  // Net change in value at this offset
+} OffsetChange;
+
+// Metadata for `#` optimizations (simple multiply/clear loops)
+typedef struct {
+    size_t position;        // Starting position of the loop in the code
+    int totalOffsets;       // Number of unique offsets in the loop
+    size_t capacity;        // Allocated entries in `changes`
+    OffsetChange *changes;  // Changes at different offsets, in first-touch order
+} SimpleLoopInfo;
+
+// Scratch index from loop-relative offset to its slot in SimpleLoopInfo.changes.
+// Offsets inside a body of length n lie in [-n, n], so lookups are O(1); only
+// the slots a loop touched are reset afterwards, keeping analysis linear.
+typedef struct {
+    int *slots;       // slots[offset + span] -> index in changes, -1 if unused
+    size_t span;
+    size_t capacity;
+} OffsetIndex;
+
+static inline void offset_index_reserve(OffsetIndex *index, size_t span) {
+    size_t needed = 2 * span + 1;
+    if (needed > index->capacity) {
+        index->slots = (int *)realloc(index->slots, needed * sizeof(int));
+        if (!index->slots) {
+            perror("Failed to allocate offset index");
+            exit(1);
+        }
+        memset(index->slots, -1, needed * sizeof(int));
+        index->capacity = needed;
+    }
+    index->span = (index->capacity - 1) / 2;
+}
+
+// Function to find or create an entry for a given offset, returning its slot
+static inline OffsetChange *add_or_update_offset(SimpleLoopInfo *loop_info, OffsetIndex *index, int offset) {
+    int *slot = &index->slots[offset + (long)index->span];
+    if (*slot == -1) {
+        loop_info->changes = (OffsetChange *)grow_array(loop_info->changes, &loop_info->capacity,
+                                                        loop_info->totalOffsets + 1, sizeof(OffsetChange));
+        loop_info->changes[loop_info->totalOffsets].offset = offset;
+        loop_info->changes[loop_info->totalOffsets].net_change = 0;  // Default value
+        *slot = loop_info->totalOffsets++;
+    }
+    return &loop_info->changes[*slot];
+}
+
+// Forget the offsets recorded for one loop so the index can be reused
+static inline void offset_index_reset(OffsetIndex *index, const SimpleLoopInfo *loop_info) {
+    for (int k = 0; k < loop_info->totalOffsets; ++k) {
+        index->slots[loop_info->changes[k].offset + (long)index->span] = -1;
+    }
+}
+
+// Turn a simple loop's net changes into factors of the counter's starting
+// value, for a counter that changes by `counter_delta` (+1 or -1) per
+// iteration: counting up from c takes 256 - c iterations, so the factors are
+// negated then, as in bf_bytecode.h. Returns -1, leaving the loop as is, when
+// a factor doesn't fit the byte-sized multiply count the backends emit.
+static inline int simple_loop_factors(SimpleLoopInfo *loop_info, int counter_delta) {
+    for (int k = 0; k < loop_info->totalOffsets; ++k) {
+        int net_change = loop_info->changes[k].net_change;
+        if (loop_info->changes[k].offset != 0 && (net_change > 255 || net_change < -255)) {
+            return -1;
+        }
+    }
+    if (counter_delta == 1) {
+        for (int k = 0; k < loop_info->totalOffsets; ++k) {
+            loop_info->changes[k].net_change = -loop_info->changes[k].net_change;
+        }
+    }
+    return 0;
+}
+
+static inline void offset_index_free(OffsetIndex *index) {
+    free(index->slots);
+    index->slots = NULL;
+    index->span = index->capacity = 0;
+}
+
+// Optimized loop metadata, indexed by source position for O(1) lookup
+typedef struct {
+    int *slot_at;              // slot_at[pos] -> index into simple/scan arrays, -1 if none
+    size_t size;
+    SimpleLoopInfo *simple;    // Detected simple loops ('#')
+    size_t simple_count;
+    size_t simple_capacity;
+    LoopInfo *scan;            // Detected scan loops ('$')
+    size_t scan_count;
+    size_t scan_capacity;
+} LoopTable;
+
+static inline void loop_table_init(LoopTable *table, size_t bf_size) {
+    memset(table, 0, sizeof(*table));
+    table->size = bf_size;
+    table->slot_at = (int *)malloc((bf_size ? bf_size : 1) * sizeof(int));
+    if (!table->slot_at) {
+        perror("Failed to allocate loop table");
+        exit(1);
+    }
+    memset(table->slot_at, -1, bf_size * sizeof(int));
+}
+
+// Takes ownership of loop_info->changes
+static inline void loop_table_add_simple(LoopTable *table, const SimpleLoopInfo *loop_info) {
+    table->simple = (SimpleLoopInfo *)grow_array(table->simple, &table->simple_capacity,
+                                                 table->simple_count + 1, sizeof(SimpleLoopInfo));
+    table->slot_at[loop_info->position] = (int)table->simple_count;
+    table->simple[table->simple_count++] = *loop_info;
+}
+
+static inline void loop_table_add_scan(LoopTable *table, size_t position, int shift_value) {
+    table->scan = (LoopInfo *)grow_array(table->scan, &table->scan_capacity,
+                                         table->scan_count + 1, sizeof(LoopInfo));
+    table->slot_at[position] = (int)table->scan_count;
+    table->scan[table->scan_count].position = position;
+    table->scan[table->scan_count].shift_value = shift_value;
+    table->scan_count++;
+}
+
+// Lookups are only meaningful at positions holding '#' or '$' respectively
+static inline const SimpleLoopInfo *loop_table_simple_at(const LoopTable *table, size_t position) {
+    int slot = position < table->size ? table->slot_at[position] : -1;
+    return slot == -1 ? NULL : &table->simple[slot];
+}
+
+static inline const LoopInfo *loop_table_scan_at(const LoopTable *table, size_t position) {
+    int slot = position < table->size ? table->slot_at[position] : -1;
+    return slot == -1 ? NULL : &table->scan[slot];
+}
+
+static inline void loop_table_free(LoopTable *table) {
+    for (size_t k = 0; k < table->simple_count; ++k) {
+        free(table->simple[k].changes);
+    }
+    free(table->simple);
+    free(table->scan);
+    free(table->slot_at);
+    memset(table, 0, sizeof(*table));
+}
+
+#endif // BF_COMMON_H
@@ -0,0 +1,239 @@
+#ifndef BF_DATAFLOW_H
+#define BF_DATAFLOW_H
+
+#include "bf_bytecode.h"
+
+// Known-cell dataflow over the op stream (bf_bytecode.h), shared by every
+// engine: bf_interp runs the optimized ops, the compilers blank the loops it
+// proves dead out of their source (bf_remove_dead_loops).
+//
+// Walking the ops in order, the pass tracks cell values relative to the
+// pointer: all zero at program start, zero under the pointer after a loop,
+// clear or scan, and exact through ADD/SET/MUL on known cells. Loop bodies
+// start from nothing known, since they may run any number of times. Then:
+//
+//   - loops, multiply loops and scans entered on a known zero are removed
+//   - clears of a known zero are removed
+//   - ADD on a known cell becomes SET; a SET/CLEAR overwriting the previous
+//     store to the same cell replaces it
+//   - ADD/MOVE runs that meet once a loop is gone are merged
+
+#define BF_DATAFLOW_CELLS 64  // Tracked cells; beyond this everything becomes unknown
+#define BF_DATAFLOW_UNKNOWN (-1)
+
+typedef struct {
+    int64_t offset[BF_DATAFLOW_CELLS];  // Relative to `base`
+    int value[BF_DATAFLOW_CELLS];       // 0-255 or BF_DATAFLOW_UNKNOWN
+    size_t count;
+    int others;    // Value of every cell not listed
+    int64_t base;  // Pointer position relative to where tracking (re)started
+} BfCellState;
+
+typedef struct {
+    BfSpan *items;  // Source spans of removed loops, in program order
+    size_t count;
+    size_t capacity;
+} BfDeadLoops;
+
+static inline void bf_cells_reset(BfCellState *cells, int others) {
+    cells->count = 0;
+    cells->others = others;
+    cells->base = 0;
+}
+
+static inline int bf_cells_get(const BfCellState *cells, int64_t offset) {
+    for (size_t k = 0; k < cells->count; ++k) {
+        if (cells->offset[k] == cells->base + offset) {
+            return cells->value[k];
+        }
+    }
+    return cells->others;
+}
+
+static inline void bf_cells_set(BfCellState *cells, int64_t offset, int value) {
+    for (size_t k = 0; k < cells->count; ++k) {
+        if (cells->offset[k] == cells->base + offset) {
+            cells->value[k] = value;
+            return;
+        }
+    }
+    if (cells->count == BF_DATAFLOW_CELLS) {
+        bf_cells_reset(cells, BF_DATAFLOW_UNKNOWN);  // Forgetting is always safe
+        if (value == BF_DATAFLOW_UNKNOWN) {
+            return;
+        }
+    }
+    cells->offset[cells->count] = cells->base + offset;
+    cells->value[cells->count++] = value;
+}
+
+// Pointer moved by an unknown amount onto a zero cell (after a loop or scan)
+static inline void bf_cells_at_unknown_zero(BfCellState *cells) {
+    bf_cells_reset(cells, BF_DATAFLOW_UNKNOWN);
+    bf_cells_set(cells, 0, 0);
+}
+
+static inline void bf_dead_loops_add(BfDeadLoops *dead, const BfSpan *span) {
+    if (dead->count == dead->capacity) {
+        dead->capacity = dead->capacity ? dead->capacity * 2 : 16;
+        dead->items = (BfSpan *)realloc(dead->items, dead->capacity * sizeof(BfSpan));
+        if (!dead->items) {
+            perror("Failed to grow dead loop list");
+            exit(1);
+        }
+    }
+    dead->items[dead->count++] = *span;
+}
+
+// Append an op to the rewritten stream, merging it into the previous op where
+// that is exact. Ops after JZ/JNZ are never merged backwards, so jump targets
+// survive; brackets are re-linked at the end.
+static inline void bf_dataflow_append(BfInsn *out, BfSpan *out_spans, size_t *count, const BfInsn *insn,
+                                      const BfSpan *span) {
+    if (*count > 0) {
+        BfInsn *last = &out[*count - 1];
+        int same_cell_store = (insn->op == BF_OP_SET || insn->op == BF_OP_CLEAR) &&
+                              (last->op == BF_OP_ADD || last->op == BF_OP_SET || last->op == BF_OP_CLEAR);
+        if (insn->op == last->op && (insn->op == BF_OP_ADD || insn->op == BF_OP_MOVE)) {
+            last->arg = insn->op == BF_OP_ADD ? (int8_t)(last->arg + insn->arg) : last->arg + insn->arg;
+            if (out_spans) {
+                out_spans[*count - 1].end = span->end;
+            }
+            if (last->arg == 0) {
+                (*count)--;
+            }
+            return;
+        }
+        if (same_cell_store) {
+            (*count)--;  // The earlier store to this cell is overwritten
+        }
+    }
+    out[*count] = *insn;
+    if (out_spans) {
+        out_spans[*count] = *span;
+    }
+    (*count)++;
+}
+
+// Optimize a compiled program in place; spans of removed loops go to `dead`
+// (may be NULL). Returns the number of loops removed.
+static inline size_t bf_dataflow_optimize(BfProgram *program, BfDeadLoops *dead) {
+    BfInsn *insns = program->owned_insns;
+    BfSpan *spans = program->spans;
+    size_t count = program->insn_count;
+    size_t out_count = 0, removed = 0;
+    BfCellState cells;
+    bf_cells_reset(&cells, 0);  // The tape starts out all zero
+
+    // Rewrites never grow the stream, so the output overwrites the input behind the cursor
+    for (size_t pc = 0; pc < count; ++pc) {
+        BfInsn insn = insns[pc];
+        BfSpan span = {0, 0};
+        if (spans) {
+            span = spans[pc];
+        }
+        int cell = bf_cells_get(&cells, 0);
+
+        switch (insn.op) {
+        case BF_OP_ADD:
+            if (cell != BF_DATAFLOW_UNKNOWN) {
+                insn.op = BF_OP_SET;
+                insn.arg = (uint8_t)(cell + insn.arg);
+                bf_cells_set(&cells, 0, insn.arg);
+            }
+            break;
+        case BF_OP_SET:
+            bf_cells_set(&cells, 0, (uint8_t)insn.arg);
+            break;
+        case BF_OP_MOVE:
+            cells.base += insn.arg;
+            break;
+        case BF_OP_IN:
+            bf_cells_set(&cells, 0, BF_DATAFLOW_UNKNOWN);
+            break;
+        case BF_OP_JZ:
+            if (cell == 0) {
+                size_t close = (size_t)insn.arg - 1;  // Its BF_OP_JNZ
+                if (dead && spans) {
+                    BfSpan loop = {span.begin, spans[close].end};
+                    bf_dead_loops_add(dead, &loop);
+                }
+                removed++;
+                pc = close;
+                continue;
+            }
+            bf_cells_reset(&cells, BF_DATAFLOW_UNKNOWN);  // The body may run any number of times
+            break;
+        case BF_OP_JNZ:
+            bf_cells_at_unknown_zero(&cells);
+            break;
+        case BF_OP_CLEAR:
+        case BF_OP_MUL:
+        case BF_OP_SCAN:
+            if (cell == 0) {
+                if (dead && spans) {
+                    bf_dead_loops_add(dead, &span);
+                }
+                removed++;
+                continue;
+            }
+            if (insn.op == BF_OP_SCAN) {
+                bf_cells_at_unknown_zero(&cells);
+            } else if (insn.op == BF_OP_MUL) {
+                for (uint16_t k = 0; k < insn.count; ++k) {
+                    const BfMulTerm *term = &program->terms[insn.arg + k];
+                    int target = bf_cells_get(&cells, term->offset);
+                    int known = cell != BF_DATAFLOW_UNKNOWN && target != BF_DATAFLOW_UNKNOWN;
+                    bf_cells_set(&cells, term->offset, known ? (uint8_t)(target + cell * term->factor) : BF_DATAFLOW_UNKNOWN);
+                }
+                bf_cells_set(&cells, 0, 0);
+            } else {
+                bf_cells_set(&cells, 0, 0);
+            }
+            break;
+        default:  // BF_OP_OUT, BF_OP_END
+            break;
+        }
+        bf_dataflow_append(insns, spans, &out_count, &insn, &span);
+    }
+
+    // Re-link brackets over the compacted stream
+    size_t *open_stack = (size_t *)malloc((out_count ? out_count : 1) * sizeof(size_t));
+    size_t open_count = 0;
+    if (!open_stack) {
+        perror("Failed to allocate bracket stack");
+        exit(1);
+    }
+    for (size_t pc = 0; pc < out_count; ++pc) {
+        if (insns[pc].op == BF_OP_JZ) {
+            open_stack[open_count++] = pc;
+        } else if (insns[pc].op == BF_OP_JNZ) {
+            size_t open = open_stack[--open_count];
+            insns[open].arg = (int32_t)(pc + 1);
+            insns[pc].arg = (int32_t)(open + 1);
+        }
+    }
+    free(open_stack);
+    program->insn_count = out_count;
+    return removed;
+}
+
+// For front ends that compile from the filtered source text: blank (with ' ',
+// like the '#'/'$' rewrites) every loop the dataflow pass proves dead, keeping
+// all other positions, and so profile offsets, unchanged. Returns loops removed.
+static inline size_t bf_remove_dead_loops(char *bf_source, size_t bf_size) {
+    BfProgram program;
+    if (bf_bytecode_compile(bf_source, bf_size, &program) != 0) {
+        return 0;  // Unbalanced: left for the front end to report
+    }
+    BfDeadLoops dead = {0};
+    size_t removed = bf_dataflow_optimize(&program, &dead);
+    for (size_t k = 0; k < dead.count; ++k) {
+        memset(bf_source + dead.items[k].begin, ' ', dead.items[k].end - dead.items[k].begin + 1);
+    }
+    free(dead.items);
+    bf_bytecode_free(&program);
+    return removed;
+}
+
+#endif // BF_DATAFLOW_H
@@ -0,0 +1,242 @@
+#ifndef BF_LIMITS_H
+#define BF_LIMITS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+// Step budgets and timeouts (--max-steps <n>, --timeout <seconds>) for
+// running untrusted programs. Straight-line code always finishes, so only
+// loop back edges are charged: each loop's cost per iteration (the ops, or
+// for the native back ends the commands, directly in its body) is known
+// before the program runs, and a taken back edge subtracts it from a fuel
+// counter. Loops that end on their own (scans; for bf_llvm also bounded
+// counting loops) are not charged. When the fuel runs out, the slow path adds the slice to the step
+// total, checks the limits and the clock, and refills up to BF_LIMITS_SLICE;
+// the hot path is one subtract and a never-taken branch.
+//
+// Steps executed are reported on stderr when the program ends cleanly. Over
+// the budget the program stops with exit status 125, over time with 124
+// (like timeout(1)).
+
+#define BF_LIMITS_SLICE (1L << 22)  // Steps between clock checks
+#define BF_LIMITS_EXIT_STEPS 125
+#define BF_LIMITS_EXIT_TIME 124
+
+typedef struct {
+    uint64_t max_steps;  // 0: unlimited
+    double timeout;      // Seconds of wall time, 0: unlimited
+} BfLimits;
+
+static inline int bf_limits_enabled(const BfLimits *limits) {
+    return limits->max_steps > 0 || limits->timeout > 0;
+}
+
+static inline int64_t bf_limits_now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// Run-time accounting for the interpreter
+typedef struct {
+    BfLimits limits;
+    uint64_t steps;    // Charged before the current slice
+    int64_t slice;     // Fuel the current slice started with
+    int64_t deadline;  // CLOCK_MONOTONIC ns, when limits.timeout is set
+} BfFuel;
+
+// Size of the next slice, 0 when the step budget is spent
+static inline int64_t bf_fuel_next_slice(const BfFuel *fuel) {
+    if (fuel->limits.max_steps == 0) {
+        return BF_LIMITS_SLICE;
+    }
+    if (fuel->steps >= fuel->limits.max_steps) {
+        return 0;
+    }
+    uint64_t left = fuel->limits.max_steps - fuel->steps;
+    return left < (uint64_t)BF_LIMITS_SLICE ? (int64_t)left : BF_LIMITS_SLICE;
+}
+
+// Returns the initial fuel
+static inline int64_t bf_fuel_start(BfFuel *fuel, const BfLimits *limits) {
+    fuel->limits = *limits;
+    fuel->steps = 0;
+    fuel->deadline = limits->timeout > 0 ? bf_limits_now_ns() + (int64_t)(limits->timeout * 1e9) : 0;
+    fuel->slice = bf_fuel_next_slice(fuel);
+    return fuel->slice;
+}
+
+static inline uint64_t bf_fuel_steps(const BfFuel *fuel, int64_t left) {
+    return fuel->steps + (uint64_t)(fuel->slice - left);
+}
+
+// Slow path once `left` went negative: returns the new fuel, or -1 with the
+// exit status in *status when a limit was hit (the message is already printed)
+static inline int64_t bf_fuel_refill(BfFuel *fuel, int64_t left, int *status) {
+    fuel->steps = bf_fuel_steps(fuel, left);
+    fuel->slice = bf_fuel_next_slice(fuel);
+    if (fuel->slice == 0) {
+        fprintf(stderr, "Error: Step limit of %llu exceeded\n", (unsigned long long)fuel->limits.max_steps);
+        *status = BF_LIMITS_EXIT_STEPS;
+        return -1;
+    }
+    if (fuel->limits.timeout > 0 && bf_limits_now_ns() >= fuel->deadline) {
+        fprintf(stderr, "Error: Time limit of %g seconds exceeded after %llu steps\n", fuel->limits.timeout,
+                (unsigned long long)fuel->steps);
+        *status = BF_LIMITS_EXIT_TIME;
+        return -1;
+    }
+    return fuel->slice;
+}
+
+static inline void bf_fuel_report(const BfFuel *fuel, int64_t left) {
+    fprintf(stderr, "Steps executed: %llu\n", (unsigned long long)bf_fuel_steps(fuel, left));
+}
+
+// GAS for the assembly back ends (bf_compiler, bf_JIT). The fuel lives in
+// %r15, which the generated code uses for nothing else; bf_fuel_refill is the
+// slow path, called from back edges with nothing but %rsi live.
+
+static inline void bf_limits_emit_data(FILE *out, const BfLimits *limits) {
+    if (!bf_limits_enabled(limits)) {
+        return;
+    }
+    fprintf(out, ".pushsection .data\n");
+    fprintf(out, "bf_fuel_steps: .quad 0\n");
+    fprintf(out, "bf_fuel_slice: .quad 0\n");
+    fprintf(out, "bf_fuel_deadline: .quad 0\n");
+    fprintf(out, "bf_fuel_now: .quad 0, 0\n");
+    fprintf(out, "bf_fuel_digits: .space 20\n");
+    fprintf(out, "bf_fuel_digits_end: .byte 10\n");
+    fprintf(out, "bf_fuel_report_text: .ascii \"Steps executed: \"\n");
+    fprintf(out, "bf_fuel_steps_text: .ascii \"Error: Step limit of %llu exceeded\\n\"\n",
+            (unsigned long long)limits->max_steps);
+    fprintf(out, "bf_fuel_steps_end:\n");
+    fprintf(out, "bf_fuel_time_text: .ascii \"Error: Time limit of %g seconds exceeded\\n\"\n", limits->timeout);
+    fprintf(out, "bf_fuel_time_end:\n");
+    fprintf(out, ".popsection\n");
+}
+
+// CLOCK_MONOTONIC in ns to %rax; clobbers %rcx, %rdx, %rdi, %r11, keeps %rsi
+static inline void bf_limits_emit_clock(FILE *out) {
+    fprintf(out, "push %%rsi\n");
+    fprintf(out, "mov $228, %%rax\n");  // syscall: clock_gettime
+    fprintf(out, "mov $1, %%rdi\n");    // CLOCK_MONOTONIC
+    fprintf(out, "lea bf_fuel_now(%%rip), %%rsi\n");
+    fprintf(out, "syscall\n");
+    fprintf(out, "pop %%rsi\n");
+    fprintf(out, "imul $1000000000, bf_fuel_now(%%rip), %%rax\n");
+    fprintf(out, "add bf_fuel_now+8(%%rip), %%rax\n");
+}
+
+// Program start: set the deadline and the first slice
+static inline void bf_limits_emit_start(FILE *out, const BfLimits *limits) {
+    if (!bf_limits_enabled(limits)) {
+        return;
+    }
+    if (limits->timeout > 0) {
+        bf_limits_emit_clock(out);
+        fprintf(out, "mov $%lld, %%rdx\n", (long long)(limits->timeout * 1e9));
+        fprintf(out, "add %%rdx, %%rax\n");
+        fprintf(out, "mov %%rax, bf_fuel_deadline(%%rip)\n");
+    }
+    fprintf(out, "xor %%r15, %%r15\n");
+    fprintf(out, "call bf_fuel_refill\n");  // Nothing charged yet: sets up the first slice
+}
+
+// Charge one iteration of a loop at its back edge; the caller has just tested
+// the cell and continues with `jnz <loop_label>`'s fall-through when it is zero
+static inline void bf_limits_emit_back_edge(FILE *out, const BfLimits *limits, long cost, const char *loop_label) {
+    if (!bf_limits_enabled(limits)) {
+        fprintf(out, "jnz %s\n", loop_label);
+        return;
+    }
+    static unsigned long edge = 0;
+    fprintf(out, "jz fuel_edge_%lu\n", edge);
+    fprintf(out, "sub $%ld, %%r15\n", cost);
+    fprintf(out, "jns %s\n", loop_label);
+    fprintf(out, "call bf_fuel_refill\n");
+    fprintf(out, "jmp %s\n", loop_label);
+    fprintf(out, "fuel_edge_%lu:\n", edge++);
+}
+
+// Before the exit syscall: report the steps on stderr
+static inline void bf_limits_emit_exit(FILE *out, const BfLimits *limits) {
+    if (!bf_limits_enabled(limits)) {
+        return;
+    }
+    fprintf(out, "mov bf_fuel_slice(%%rip), %%rax\n");
+    fprintf(out, "sub %%r15, %%rax\n");
+    fprintf(out, "add bf_fuel_steps(%%rip), %%rax\n");
+    fprintf(out, "lea bf_fuel_digits_end(%%rip), %%rsi\n");
+    fprintf(out, "mov $10, %%rcx\n");
+    fprintf(out, "fuel_digit:\n");
+    fprintf(out, "xor %%edx, %%edx\n");
+    fprintf(out, "div %%rcx\n");
+    fprintf(out, "add $48, %%dl\n");  // '0'
+    fprintf(out, "dec %%rsi\n");
+    fprintf(out, "mov %%dl, (%%rsi)\n");
+    fprintf(out, "test %%rax, %%rax\n");
+    fprintf(out, "jnz fuel_digit\n");
+    fprintf(out, "push %%rsi\n");
+    fprintf(out, "mov $1, %%rax\n");  // syscall: write
+    fprintf(out, "mov $2, %%rdi\n");  // stderr
+    fprintf(out, "lea bf_fuel_report_text(%%rip), %%rsi\n");
+    fprintf(out, "mov $16, %%rdx\n");
+    fprintf(out, "syscall\n");
+    fprintf(out, "pop %%rsi\n");
+    fprintf(out, "lea bf_fuel_digits_end+1(%%rip), %%rdx\n");
+    fprintf(out, "sub %%rsi, %%rdx\n");
+    fprintf(out, "mov $1, %%rax\n");
+    fprintf(out, "mov $2, %%rdi\n");
+    fprintf(out, "syscall\n");
+}
+
+// The slow path, emitted once after the program
+static inline void bf_limits_emit_refill(FILE *out, const BfLimits *limits) {
+    if (!bf_limits_enabled(limits)) {
+        return;
+    }
+    fprintf(out, "bf_fuel_refill:\n");
+    fprintf(out, "mov bf_fuel_slice(%%rip), %%rax\n");
+    fprintf(out, "sub %%r15, %%rax\n");
+    fprintf(out, "add %%rax, bf_fuel_steps(%%rip)\n");
+    fprintf(out, "mov $%ld, %%rax\n", BF_LIMITS_SLICE);
+    if (limits->max_steps > 0) {
+        fprintf(out, "mov $%llu, %%rdx\n", (unsigned long long)limits->max_steps);
+        fprintf(out, "sub bf_fuel_steps(%%rip), %%rdx\n");
+        fprintf(out, "jbe fuel_steps_out\n");  // Spent (or overshot by the last iteration)
+        fprintf(out, "cmp %%rax, %%rdx\n");
+        fprintf(out, "cmovb %%rdx, %%rax\n");
+    }
+    fprintf(out, "mov %%rax, bf_fuel_slice(%%rip)\n");
+    fprintf(out, "mov %%rax, %%r15\n");
+    if (limits->timeout > 0) {
+        bf_limits_emit_clock(out);
+        fprintf(out, "cmp bf_fuel_deadline(%%rip), %%rax\n");
+        fprintf(out, "jge fuel_time_out\n");
+    }
+    fprintf(out, "ret\n");
+
+    // Over a limit: say which and exit; stdout is written unbuffered, nothing to flush
+    fprintf(out, "fuel_steps_out:\n");
+    fprintf(out, "lea bf_fuel_steps_text(%%rip), %%rsi\n");
+    fprintf(out, "mov $bf_fuel_steps_end - bf_fuel_steps_text, %%rdx\n");
+    fprintf(out, "mov $%d, %%r15\n", BF_LIMITS_EXIT_STEPS);
+    fprintf(out, "jmp fuel_out\n");
+    fprintf(out, "fuel_time_out:\n");
+    fprintf(out, "lea bf_fuel_time_text(%%rip), %%rsi\n");
+    fprintf(out, "mov $bf_fuel_time_end - bf_fuel_time_text, %%rdx\n");
+    fprintf(out, "mov $%d, %%r15\n", BF_LIMITS_EXIT_TIME);
+    fprintf(out, "fuel_out:\n");
+    fprintf(out, "mov $1, %%rax\n");  // syscall: write
+    fprintf(out, "mov $2, %%rdi\n");  // stderr
+    fprintf(out, "syscall\n");
+    fprintf(out, "mov $60, %%rax\n");  // syscall: exit
+    fprintf(out, "mov %%r15, %%rdi\n");
+    fprintf(out, "syscall\n");
+}
+
+#endif // BF_LIMITS_H
@@ -0,0 +1,190 @@
+#ifndef BF_PERF_H
+#define BF_PERF_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+// Hardware performance counters around the execution phase (--perf-counters),
+// to tell whether a program is bound by branch mispredicts, cache misses or
+// the front end. Counters are opened with perf_event_open(2) for this process
+// in three groups, each scheduled on the PMU as a unit so ratios within a
+// group are exact: {cycles, instructions, branch misses}, {L1D and iTLB read
+// misses} and the software clock and page faults.
+//
+// Without the privileges to count kernel code (perf_event_paranoid >= 2) the
+// counters fall back to user space only; events the CPU or a VM doesn't
+// provide are left out, so at worst only the software group is reported.
+
+#define BF_PERF_MAX_EVENTS 7
+
+typedef struct {
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+    int group;
+} BfPerfEvent;
+
+#define BF_PERF_CACHE(cache, op, result) \
+    ((uint64_t)(cache) | ((uint64_t)(op) << 8) | ((uint64_t)(result) << 16))
+
+static const BfPerfEvent bf_perf_events[BF_PERF_MAX_EVENTS] = {
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, 0},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, 0},
+    {"branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, 0},
+    {"L1D-misses", PERF_TYPE_HW_CACHE,
+     BF_PERF_CACHE(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS), 1},
+    {"iTLB-misses", PERF_TYPE_HW_CACHE,
+     BF_PERF_CACHE(PERF_COUNT_HW_CACHE_ITLB, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS), 1},
+    {"task-clock-ns", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, 2},
+    {"page-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS, 2},
+};
+
+enum { BF_PERF_CYCLES, BF_PERF_INSTRUCTIONS, BF_PERF_BRANCH_MISSES, BF_PERF_L1D_MISSES, BF_PERF_ITLB_MISSES };
+
+typedef struct {
+    int fds[BF_PERF_MAX_EVENTS];  // -1: not available
+    uint64_t ids[BF_PERF_MAX_EVENTS];
+    int leaders[3];               // First event opened in each group, -1: none
+    int user_only;                // Kernel code is not counted
+    int hardware_error;           // errno from opening the cycles counter
+    double values[BF_PERF_MAX_EVENTS];
+    int counted[BF_PERF_MAX_EVENTS];
+    int scaled[BF_PERF_MAX_EVENTS];  // Multiplexed with other users of the PMU, extrapolated
+} BfPerf;
+
+static inline int bf_perf_open_event(BfPerf *perf, int k, int exclude_kernel) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = bf_perf_events[k].type;
+    attr.config = bf_perf_events[k].config;
+    attr.exclude_kernel = exclude_kernel;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_ID | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                       PERF_FORMAT_TOTAL_TIME_RUNNING;
+    int group = bf_perf_events[k].group;
+    int leader = perf->leaders[group];
+    attr.disabled = leader == -1;  // Members follow their leader
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, leader == -1 ? -1 : perf->fds[leader], 0);
+}
+
+// Open what is available; returns the number of events opened
+static inline int bf_perf_open(BfPerf *perf) {
+    memset(perf, 0, sizeof(*perf));
+    for (int g = 0; g < 3; ++g) {
+        perf->leaders[g] = -1;
+    }
+    int opened = 0;
+    for (int k = 0; k < BF_PERF_MAX_EVENTS; ++k) {
+        int fd = bf_perf_open_event(perf, k, perf->user_only);
+        if (fd == -1 && (errno == EACCES || errno == EPERM) && !perf->user_only) {
+            perf->user_only = 1;  // Not allowed to count the kernel: user space only from here on
+            fd = bf_perf_open_event(perf, k, 1);
+        }
+        perf->fds[k] = fd;
+        if (fd == -1 && k == BF_PERF_CYCLES) {
+            perf->hardware_error = errno;
+        }
+        if (fd == -1) {
+            continue;
+        }
+        if (ioctl(fd, PERF_EVENT_IOC_ID, &perf->ids[k]) != 0) {
+            close(fd);
+            perf->fds[k] = -1;
+            continue;
+        }
+        if (perf->leaders[bf_perf_events[k].group] == -1) {
+            perf->leaders[bf_perf_events[k].group] = k;
+        }
+        opened++;
+    }
+    if (perf->fds[BF_PERF_CYCLES] == -1) {
+        int unsupported = perf->hardware_error == ENOENT || perf->hardware_error == EOPNOTSUPP;
+        fprintf(stderr, "Note: Hardware counters unavailable (%s), reporting software counters only\n",
+                unsupported ? "not provided by this CPU or VM" : strerror(perf->hardware_error));
+    }
+    return opened;
+}
+
+static inline void bf_perf_start(BfPerf *perf) {
+    for (int g = 0; g < 3; ++g) {
+        if (perf->leaders[g] != -1) {
+            ioctl(perf->fds[perf->leaders[g]], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+            ioctl(perf->fds[perf->leaders[g]], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        }
+    }
+}
+
+// Stop counting and read every group
+static inline void bf_perf_stop(BfPerf *perf) {
+    for (int g = 0; g < 3; ++g) {
+        if (perf->leaders[g] != -1) {
+            ioctl(perf->fds[perf->leaders[g]], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+        }
+    }
+    for (int g = 0; g < 3; ++g) {
+        if (perf->leaders[g] == -1) {
+            continue;
+        }
+        // nr, time_enabled, time_running, then {value, id} per member
+        uint64_t data[3 + 2 * BF_PERF_MAX_EVENTS];
+        if (read(perf->fds[perf->leaders[g]], data, sizeof(data)) < (ssize_t)(3 * sizeof(uint64_t)) ||
+            data[2] == 0) {
+            continue;  // Never got on the PMU
+        }
+        for (uint64_t m = 0; m < data[0] && m < BF_PERF_MAX_EVENTS; ++m) {
+            for (int k = 0; k < BF_PERF_MAX_EVENTS; ++k) {
+                if (perf->fds[k] != -1 && perf->ids[k] == data[4 + 2 * m]) {
+                    perf->values[k] = (double)data[3 + 2 * m] * data[1] / data[2];
+                    perf->counted[k] = 1;
+                    perf->scaled[k] = data[2] < data[1];
+                }
+            }
+        }
+    }
+}
+
+static inline void bf_perf_close(BfPerf *perf) {
+    for (int k = 0; k < BF_PERF_MAX_EVENTS; ++k) {
+        if (perf->fds[k] != -1) {
+            close(perf->fds[k]);
+        }
+    }
+}
+
+// Counts, IPC and misses per 1000 instructions on stderr; with `ops` (the
+// steps the program executed, 0: unknown) also every count per op
+static inline void bf_perf_report(const BfPerf *perf, uint64_t ops) {
+    fprintf(stderr, "Performance counters (execution only%s):\n", perf->user_only ? ", user space" : "");
+    for (int k = 0; k < BF_PERF_MAX_EVENTS; ++k) {
+        if (!perf->counted[k]) {
+            if (bf_perf_events[k].group < 2) {
+                fprintf(stderr, "  %-15s %18s\n", bf_perf_events[k].name, "not counted");
+            }
+            continue;
+        }
+        fprintf(stderr, "  %-15s %18.0f", bf_perf_events[k].name, perf->values[k]);
+        if (ops) {
+            fprintf(stderr, "  %10.3f/op", perf->values[k] / ops);
+        }
+        if (k == BF_PERF_INSTRUCTIONS && perf->counted[BF_PERF_CYCLES] && perf->values[BF_PERF_CYCLES] > 0) {
+            fprintf(stderr, "  IPC %.2f", perf->values[k] / perf->values[BF_PERF_CYCLES]);
+        } else if ((k == BF_PERF_BRANCH_MISSES || k == BF_PERF_L1D_MISSES || k == BF_PERF_ITLB_MISSES) &&
+                   perf->counted[BF_PERF_INSTRUCTIONS] && perf->values[BF_PERF_INSTRUCTIONS] > 0) {
+            fprintf(stderr, "  %.3f per 1k instructions", perf->values[k] * 1000 / perf->values[BF_PERF_INSTRUCTIONS]);
+        }
+        fprintf(stderr, "%s\n", perf->scaled[k] ? "  (scaled)" : "");
+    }
+    if (ops) {
+        fprintf(stderr, "  %-15s %18llu\n", "ops", (unsigned long long)ops);
+    }
+}
+
+#endif // BF_PERF_H
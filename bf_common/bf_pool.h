@@ -0,0 +1,156 @@
+#ifndef BF_POOL_H
+#define BF_POOL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+// Work-stealing thread pool for independent tasks (bf_interp --batch).
+//
+// Tasks are the indices [0, count). Each worker starts with a contiguous
+// share in its own deque and takes from the back of it; a worker whose deque
+// is empty steals half of another's from the front, trying the others in
+// turn from its right-hand neighbour. Tasks don't create tasks, so a worker
+// that finds every deque empty is done. Deques are mutex protected: a task
+// runs a whole program, so the locks are never what limits throughput.
+
+#define BF_POOL_MAX_WORKERS 256
+
+typedef void (*BfPoolTask)(void *context, size_t task, int worker);
+
+typedef struct {
+    pthread_mutex_t lock;
+    size_t *tasks;
+    size_t head, tail;  // Pending tasks are tasks[head, tail)
+} BfPoolDeque;
+
+typedef struct {
+    BfPoolDeque deques[BF_POOL_MAX_WORKERS];
+    int workers;
+    BfPoolTask run;
+    void *context;
+} BfPool;
+
+typedef struct {
+    BfPool *pool;
+    int worker;
+} BfPoolWorker;
+
+// Workers for `jobs` (0: one per online CPU)
+static inline int bf_pool_workers(long jobs) {
+    if (jobs <= 0) {
+        jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (jobs > BF_POOL_MAX_WORKERS) {
+        jobs = BF_POOL_MAX_WORKERS;
+    }
+    return jobs > 0 ? (int)jobs : 1;
+}
+
+static inline int bf_pool_pop(BfPoolDeque *deque, size_t *task) {
+    pthread_mutex_lock(&deque->lock);
+    int found = deque->head < deque->tail;
+    if (found) {
+        *task = deque->tasks[--deque->tail];
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+// Move the front half of `victim` (at least one task) into `own`, which is
+// empty and only ever filled by its owner: one lock at a time is enough
+static inline int bf_pool_steal(BfPoolDeque *own, BfPoolDeque *victim) {
+    pthread_mutex_lock(&victim->lock);
+    size_t taken = (victim->tail - victim->head + 1) / 2;
+    size_t *tasks = taken ? (size_t *)malloc(taken * sizeof(size_t)) : NULL;
+    if (tasks) {
+        memcpy(tasks, victim->tasks + victim->head, taken * sizeof(size_t));
+        victim->head += taken;
+    }
+    pthread_mutex_unlock(&victim->lock);
+    if (!tasks) {
+        return 0;
+    }
+    pthread_mutex_lock(&own->lock);
+    free(own->tasks);
+    own->tasks = tasks;
+    own->head = 0;
+    own->tail = taken;
+    pthread_mutex_unlock(&own->lock);
+    return 1;
+}
+
+static inline void *bf_pool_worker(void *arg) {
+    BfPoolWorker *self = (BfPoolWorker *)arg;
+    BfPool *pool = self->pool;
+    BfPoolDeque *own = &pool->deques[self->worker];
+    for (;;) {
+        size_t task;
+        if (bf_pool_pop(own, &task)) {
+            pool->run(pool->context, task, self->worker);
+            continue;
+        }
+        int stolen = 0;
+        for (int k = 1; k < pool->workers && !stolen; ++k) {
+            stolen = bf_pool_steal(own, &pool->deques[(self->worker + k) % pool->workers]);
+        }
+        if (!stolen) {
+            return NULL;
+        }
+    }
+}
+
+// Run run(context, task, worker) for every task in [0, count) on `workers`
+// threads (the caller is worker 0); returns when all are done
+static inline void bf_pool_run(size_t count, int workers, BfPoolTask run, void *context) {
+    BfPool *pool = (BfPool *)calloc(1, sizeof(BfPool));
+    if (!pool) {
+        perror("Failed to allocate thread pool");
+        exit(1);
+    }
+    if ((size_t)workers > count) {
+        workers = count > 0 ? (int)count : 1;
+    }
+    pool->workers = workers;
+    pool->run = run;
+    pool->context = context;
+    for (int w = 0; w < workers; ++w) {
+        BfPoolDeque *deque = &pool->deques[w];
+        size_t begin = count * w / workers, end = count * (w + 1) / workers;
+        pthread_mutex_init(&deque->lock, NULL);
+        deque->tasks = (size_t *)malloc((end - begin + 1) * sizeof(size_t));
+        if (!deque->tasks) {
+            perror("Failed to allocate thread pool");
+            exit(1);
+        }
+        for (size_t t = begin; t < end; ++t) {
+            deque->tasks[deque->tail++] = end - 1 - (t - begin);  // Popped from the back, so run in order
+        }
+    }
+
+    BfPoolWorker selves[BF_POOL_MAX_WORKERS];
+    pthread_t threads[BF_POOL_MAX_WORKERS];
+    int started[BF_POOL_MAX_WORKERS] = {0};
+    for (int w = 0; w < workers; ++w) {
+        selves[w].pool = pool;
+        selves[w].worker = w;
+        if (w > 0) {
+            started[w] = pthread_create(&threads[w], NULL, bf_pool_worker, &selves[w]) == 0;
+        }
+    }
+    bf_pool_worker(&selves[0]);  // Workers that didn't start leave their tasks to be stolen
+    for (int w = 1; w < workers; ++w) {
+        if (started[w]) {
+            pthread_join(threads[w], NULL);
+        }
+    }
+    for (int w = 0; w < workers; ++w) {
+        pthread_mutex_destroy(&pool->deques[w].lock);
+        free(pool->deques[w].tasks);
+    }
+    free(pool);
+}
+
+#endif // BF_POOL_H
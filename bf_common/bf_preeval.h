@@ -0,0 +1,301 @@
+#ifndef BF_PREEVAL_H
+#define BF_PREEVAL_H
+
+#include "bf_bytecode.h"
+
+// Compile-time partial evaluation. A program's run up to its first `,` does
+// not depend on the input, so it can happen once at compile time: the engines
+// then start with that output written in one go and the tape preloaded, and
+// continue from where evaluation stopped. Programs that never read input
+// (hello.b, bottles.b) become a single write.
+//
+// Evaluation stops at the first BF_OP_IN, at BF_OP_END, after a step budget,
+// or before an op that would leave the tape. The snapshot is always taken
+// at a top-level op (outside every loop), which any engine can jump to; when
+// evaluation stops inside a loop, the program is re-run to the last top-level
+// op it passed.
+
+#define BF_PREEVAL_DEFAULT_STEPS 10000000UL  // Ops evaluated at most, --preeval-steps
+#define BF_PREEVAL_MAX_OUTPUT (64UL << 20)   // Larger output is left to run time
+
+typedef struct {
+    const BfProgram *program;
+    unsigned char *tape;
+    size_t tape_size;
+    size_t pointer;
+    size_t pc;
+    char *output;
+    size_t output_size;
+    size_t output_capacity;
+} BfPreevalState;
+
+static inline void bf_preeval_reset(BfPreevalState *state) {
+    memset(state->tape, 0, state->tape_size);
+    state->pointer = 0;
+    state->pc = 0;
+    state->output_size = 0;
+}
+
+// Run the op at state->pc; returns 0, without any effect, if evaluation must stop there
+static inline int bf_preeval_step(BfPreevalState *state) {
+    const BfInsn *insn = &state->program->insns[state->pc];
+    unsigned char *cell = &state->tape[state->pointer];
+
+    switch (insn->op) {
+    case BF_OP_ADD:
+    case BF_OP_SET:
+        *cell = (unsigned char)(insn->op == BF_OP_ADD ? *cell + insn->arg : insn->arg);
+        break;
+    case BF_OP_MOVE:
+        if ((int64_t)state->pointer + insn->arg < 0 || state->pointer + insn->arg >= state->tape_size) {
+            return 0;
+        }
+        state->pointer += insn->arg;
+        break;
+    case BF_OP_OUT:
+        if (state->output_size + (size_t)insn->arg > BF_PREEVAL_MAX_OUTPUT) {
+            return 0;
+        }
+        if (state->output_size + (size_t)insn->arg > state->output_capacity) {
+            while (state->output_size + (size_t)insn->arg > state->output_capacity) {
+                state->output_capacity = state->output_capacity ? state->output_capacity * 2 : 4096;
+            }
+            state->output = (char *)realloc(state->output, state->output_capacity);
+            if (!state->output) {
+                perror("Failed to grow evaluated output");
+                exit(1);
+            }
+        }
+        memset(state->output + state->output_size, *cell, insn->arg);
+        state->output_size += insn->arg;
+        break;
+    case BF_OP_JZ:
+        if (!*cell) {
+            state->pc = insn->arg;
+            return 1;
+        }
+        break;
+    case BF_OP_JNZ:
+        if (*cell) {
+            state->pc = insn->arg;
+            return 1;
+        }
+        break;
+    case BF_OP_CLEAR:
+        *cell = 0;
+        break;
+    case BF_OP_MUL:
+        if (*cell) {
+            const BfMulTerm *terms = state->program->terms + insn->arg;
+            for (uint16_t k = 0; k < insn->count; ++k) {
+                int64_t target = (int64_t)state->pointer + terms[k].offset;
+                if (target < 0 || (size_t)target >= state->tape_size) {
+                    return 0;
+                }
+            }
+            for (uint16_t k = 0; k < insn->count; ++k) {
+                state->tape[state->pointer + terms[k].offset] += (unsigned char)(*cell * terms[k].factor);
+            }
+            *cell = 0;
+        }
+        break;
+    case BF_OP_SCAN: {
+        int64_t target = (int64_t)state->pointer;
+        while (state->tape[target]) {
+            target += insn->arg;
+            if (target < 0 || (size_t)target >= state->tape_size) {
+                return 0;
+            }
+        }
+        state->pointer = (size_t)target;
+        break;
+    }
+    default:  // BF_OP_IN, BF_OP_END
+        return 0;
+    }
+    state->pc++;
+    return 1;
+}
+
+// What an evaluation ran into, for front ends that use it as a probe (bf run)
+typedef struct {
+    size_t steps;                      // Ops evaluated, including any past the snapshot
+    size_t op_counts[BF_OP_SET + 1];   // ...per BF_OP_*
+    size_t folded_iterations;          // Loop iterations the clear, multiply and scan ops stood for
+    int stop_op;                       // Op it stopped at (BF_OP_IN, BF_OP_END, ...), -1: out of steps
+    size_t stop_pc;
+} BfPreevalStats;
+
+// Evaluate `program` on a zeroed tape of `tape_size` cells for at most
+// `max_steps` ops and record where it stopped in program->snapshot, and in
+// `stats` unless it is NULL. Returns the number of ops evaluated up to the
+// snapshot (0: nothing to skip).
+static inline size_t bf_preeval_run(BfProgram *program, size_t tape_size, size_t max_steps, BfPreevalStats *stats) {
+    BfPreevalState state;
+    memset(&state, 0, sizeof(state));
+    state.program = program;
+    state.tape_size = tape_size;
+    state.tape = (unsigned char *)calloc(tape_size, 1);
+    unsigned char *top_level = (unsigned char *)malloc(program->insn_count);
+    if (!state.tape || !top_level) {
+        perror("Failed to allocate evaluation tape");
+        exit(1);
+    }
+    size_t depth = 0;
+    for (size_t pc = 0; pc < program->insn_count; ++pc) {
+        if (program->insns[pc].op == BF_OP_JNZ) {
+            top_level[pc] = 0;  // Still inside the loop it closes
+            depth--;
+        } else {
+            top_level[pc] = depth == 0;
+            depth += program->insns[pc].op == BF_OP_JZ;
+        }
+    }
+
+    size_t steps = 0, boundary_steps = 0;
+    if (stats) {
+        memset(stats, 0, sizeof(*stats));
+    }
+    for (;;) {
+        if (top_level[state.pc]) {
+            boundary_steps = steps;
+        }
+        uint16_t op = program->insns[state.pc].op;
+        size_t pointer = state.pointer;
+        unsigned char cell = state.tape[pointer];
+        if (steps == max_steps || !bf_preeval_step(&state)) {
+            if (stats) {
+                stats->steps = steps;
+                stats->stop_op = steps == max_steps ? -1 : op;
+                stats->stop_pc = state.pc;
+            }
+            break;
+        }
+        if (stats) {
+            stats->op_counts[op]++;
+            if (op == BF_OP_CLEAR || op == BF_OP_MUL) {
+                stats->folded_iterations += cell;  // As many as the counter's value, for a -1 step
+            } else if (op == BF_OP_SCAN) {
+                int32_t stride = program->insns[state.pc - 1].arg;
+                stats->folded_iterations += (state.pointer > pointer ? state.pointer - pointer : pointer - state.pointer) /
+                                            (size_t)(stride < 0 ? -stride : stride);
+            }
+        }
+        steps++;
+    }
+    if (!top_level[state.pc]) {
+        // Stopped inside a loop: replay up to the last top-level op, ops are deterministic
+        bf_preeval_reset(&state);
+        for (steps = 0; steps < boundary_steps; ++steps) {
+            bf_preeval_step(&state);
+        }
+    }
+    free(top_level);
+
+    size_t used = tape_size;
+    while (used > 0 && state.tape[used - 1] == 0) {
+        used--;
+    }
+    BfSnapshot *snapshot = &program->snapshot;
+    free(snapshot->owned);
+    memset(snapshot, 0, sizeof(*snapshot));
+    if (boundary_steps > 0) {
+        unsigned char *block = (unsigned char *)malloc(used + state.output_size + 1);
+        if (!block) {
+            perror("Failed to allocate evaluation snapshot");
+            exit(1);
+        }
+        memcpy(block, state.tape, used);
+        if (state.output_size) {
+            memcpy(block + used, state.output, state.output_size);
+        }
+        snapshot->resume_pc = state.pc;
+        snapshot->pointer = state.pointer;
+        snapshot->tape = block;
+        snapshot->tape_size = used;
+        snapshot->output = (const char *)block + used;
+        snapshot->output_size = state.output_size;
+        snapshot->owned = block;
+    }
+    free(state.tape);
+    free(state.output);
+    return boundary_steps;
+}
+
+static inline size_t bf_preeval(BfProgram *program, size_t tape_size, size_t max_steps) {
+    return bf_preeval_run(program, tape_size, max_steps, NULL);
+}
+
+// For front ends that compile from the filtered source text: evaluate the
+// program and blank (with ' ') the source of every op the snapshot covers, so
+// code is generated only from the resume point on. The snapshot goes to
+// `snapshot` (owned by the caller, free its `owned`); returns ops evaluated.
+static inline size_t bf_preeval_source(char *bf_source, size_t bf_size, size_t tape_size, size_t max_steps,
+                                       BfSnapshot *snapshot) {
+    memset(snapshot, 0, sizeof(*snapshot));
+    BfProgram program;
+    if (max_steps == 0 || bf_bytecode_compile(bf_source, bf_size, &program) != 0) {
+        return 0;  // Unbalanced: left for the front end to report
+    }
+    size_t steps = bf_preeval(&program, tape_size, max_steps);
+    if (steps > 0) {
+        memset(bf_source, ' ', program.spans[program.snapshot.resume_pc].begin);
+        *snapshot = program.snapshot;
+        memset(&program.snapshot, 0, sizeof(program.snapshot));  // Handed over
+    }
+    bf_bytecode_free(&program);
+    return steps;
+}
+
+static inline void bf_preeval_emit_bytes(FILE *out, const unsigned char *bytes, size_t size) {
+    for (size_t i = 0; i < size; i += 16) {
+        fprintf(out, ".byte %u", bytes[i]);
+        for (size_t k = i + 1; k < size && k < i + 16; ++k) {
+            fprintf(out, ",%u", bytes[k]);
+        }
+        fprintf(out, "\n");
+    }
+}
+
+// GAS for the assembly back ends (bf_compiler, bf_JIT): the `tape` symbol,
+// preloaded with the snapshot when there is one
+static inline void bf_preeval_emit_tape(FILE *out, const BfSnapshot *snapshot, size_t tape_size) {
+    if (!snapshot || snapshot->tape_size == 0) {
+        fprintf(out, ".section .bss\n");
+        fprintf(out, "tape: .space %zu\n", tape_size);
+        return;
+    }
+    fprintf(out, ".section .data\n");
+    fprintf(out, "tape:\n");
+    bf_preeval_emit_bytes(out, snapshot->tape, snapshot->tape_size);
+    fprintf(out, ".space %zu\n", tape_size - snapshot->tape_size);
+}
+
+// Start of the program code: write the evaluated output (one write(2) unless
+// it comes back short) and point %rsi at the snapshot's cell
+static inline void bf_preeval_emit_start(FILE *out, const BfSnapshot *snapshot) {
+    if (snapshot && snapshot->output_size) {
+        fprintf(out, ".pushsection .rodata\n");
+        fprintf(out, "preeval_output:\n");
+        bf_preeval_emit_bytes(out, (const unsigned char *)snapshot->output, snapshot->output_size);
+        fprintf(out, ".popsection\n");
+        fprintf(out, "lea preeval_output(%%rip), %%rsi\n");
+        fprintf(out, "mov $%zu, %%rdx\n", snapshot->output_size);
+        fprintf(out, "preeval_write:\n");
+        fprintf(out, "mov $1, %%rax\n");  // syscall: write
+        fprintf(out, "mov $1, %%rdi\n");  // stdout
+        fprintf(out, "syscall\n");
+        fprintf(out, "test %%rax, %%rax\n");
+        fprintf(out, "jle preeval_done\n");
+        fprintf(out, "add %%rax, %%rsi\n");
+        fprintf(out, "sub %%rax, %%rdx\n");
+        fprintf(out, "jnz preeval_write\n");
+        fprintf(out, "preeval_done:\n");
+    }
+    fprintf(out, "lea tape(%%rip), %%rsi\n");
+    if (snapshot && snapshot->pointer) {
+        fprintf(out, "add $%zu, %%rsi\n", snapshot->pointer);
+    }
+}
+
+#endif // BF_PREEVAL_H
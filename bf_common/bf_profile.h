@@ -0,0 +1,109 @@
+#ifndef BF_PROFILE_H
+#define BF_PROFILE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Machine-readable loop profile written by `bf_interp -p --profile-out <file>`
+// and consumed by bf_compiler, bf_JIT and bf_llvm through `--profile <file>`.
+//
+// Offsets count Brainfuck commands only (comments and whitespace are skipped),
+// so they match the filtered source every backend works on:
+//
+//   # brainfog profile v1
+//   loop <offset of '['> <entries> <iterations>
+//
+// `entries` is how often the '[' was reached, `iterations` how often its body
+// ran through to the closing ']'.
+
+#define BF_PROFILE_MAGIC "# brainfog profile v1"
+#define BF_PROFILE_HOT_RATIO 100  // Hot: at least 1/100th of the hottest loop's iterations
+
+typedef struct {
+    long *entries;     // entries[pos] for the '[' at command offset pos
+    long *iterations;  // iterations[pos] for the same loop
+    size_t size;
+    long hottest;      // Largest iteration count of any loop
+} BfProfile;
+
+static inline int bf_is_command(char c) {
+    return c == '>' || c == '<' || c == '+' || c == '-' || c == '.' || c == ',' || c == '[' || c == ']';
+}
+
+static inline void bf_profile_write_header(FILE *out) {
+    fprintf(out, "%s\n", BF_PROFILE_MAGIC);
+}
+
+static inline void bf_profile_write_loop(FILE *out, size_t offset, long entries, long iterations) {
+    fprintf(out, "loop %zu %ld %ld\n", offset, entries, iterations);
+}
+
+// Load a profile for a program of bf_size commands; returns 0 on success
+static inline int bf_profile_load(const char *path, size_t bf_size, BfProfile *profile) {
+    memset(profile, 0, sizeof(*profile));
+
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        perror("Failed to open profile");
+        return -1;
+    }
+
+    char line[256];
+    if (!fgets(line, sizeof(line), file) || strncmp(line, BF_PROFILE_MAGIC, strlen(BF_PROFILE_MAGIC)) != 0) {
+        fprintf(stderr, "Error: %s is not a brainfog profile\n", path);
+        fclose(file);
+        return -1;
+    }
+
+    profile->size = bf_size;
+    profile->entries = (long *)calloc(bf_size ? bf_size : 1, sizeof(long));
+    profile->iterations = (long *)calloc(bf_size ? bf_size : 1, sizeof(long));
+    if (!profile->entries || !profile->iterations) {
+        perror("Failed to allocate profile");
+        fclose(file);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), file)) {
+        size_t offset;
+        long entries, iterations;
+        if (sscanf(line, "loop %zu %ld %ld", &offset, &entries, &iterations) != 3) {
+            continue;  // Comments and unknown records are skipped
+        }
+        if (offset >= bf_size) {
+            fprintf(stderr, "Warning: profile offset %zu is outside the program, ignoring\n", offset);
+            continue;
+        }
+        profile->entries[offset] = entries;
+        profile->iterations[offset] = iterations;
+        if (iterations > profile->hottest) {
+            profile->hottest = iterations;
+        }
+    }
+
+    fclose(file);
+    return 0;
+}
+
+static inline void bf_profile_free(BfProfile *profile) {
+    free(profile->entries);
+    free(profile->iterations);
+    memset(profile, 0, sizeof(*profile));
+}
+
+// Without a profile every loop counts as hot, so transforms keep their default behaviour
+static inline int bf_profile_is_hot(const BfProfile *profile, size_t position) {
+    if (!profile || !profile->size) {
+        return 1;
+    }
+    long iterations = profile->iterations[position];
+    return iterations > 0 && iterations * BF_PROFILE_HOT_RATIO >= profile->hottest;
+}
+
+// A loop the profiling run never reached
+static inline int bf_profile_is_cold(const BfProfile *profile, size_t position) {
+    return profile && profile->size && profile->entries[position] == 0;
+}
+
+#endif // BF_PROFILE_H
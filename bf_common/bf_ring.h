@@ -0,0 +1,222 @@
+#ifndef BF_RING_H
+#define BF_RING_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+// Output and input on their own thread (bf_interp --io-thread).
+//
+// The program's thread and the I/O thread share two single-producer,
+// single-consumer byte rings: the program fills `output` and the I/O thread
+// writes it to stdout, the I/O thread reads stdin ahead into `input` and the
+// program takes bytes from it. Each side only stores its own index and loads
+// the other's, so while neither ring is full or empty the program does no
+// system calls at all. A side that has to wait says so in
+// its `sleeping` flag and blocks on an eventfd, which the other side writes
+// only when it sees the flag set after moving its index.
+//
+// Output is handed out as spans: the program writes straight into the ring
+// and publishes a span when it is full, so a `.` costs the same store and
+// compare as with the plain output buffer.
+
+#define BF_RING_OUTPUT_SIZE (1 << 20)
+#define BF_RING_INPUT_SIZE (1 << 16)
+#define BF_RING_SPAN 8192  // Largest output span, so the I/O thread can start on a long run early
+
+typedef struct {
+    char *data;
+    size_t mask;                                  // Capacity - 1, a power of two
+    uint64_t head __attribute__((aligned(64)));   // Consumer's index
+    uint64_t tail __attribute__((aligned(64)));   // Producer's index
+} BfRing;
+
+typedef struct {
+    BfRing output;
+    BfRing input;
+    int input_eof;         // Set by the I/O thread, after the last input is published
+    int finished;          // Set by the program's thread: drain the output and stop
+    int program_sleeping;  // Waiting for output space or input
+    int io_sleeping;       // Waiting in poll
+    int program_wake;      // eventfds
+    int io_wake;
+    int in_fd, out_fd;
+    pthread_t thread;
+} BfIoThread;
+
+static inline int bf_ring_init(BfRing *ring, size_t capacity) {
+    ring->data = (char *)malloc(capacity);
+    ring->mask = capacity - 1;
+    ring->head = ring->tail = 0;
+    return ring->data ? 0 : -1;
+}
+
+static inline uint64_t bf_ring_load(const uint64_t *index) {
+    return __atomic_load_n(index, __ATOMIC_ACQUIRE);
+}
+
+static inline void bf_ring_store(uint64_t *index, uint64_t value) {
+    __atomic_store_n(index, value, __ATOMIC_SEQ_CST);  // Ordered before the sleeping flag is read
+}
+
+static inline void bf_io_signal(int fd, int *sleeping) {
+    if (__atomic_load_n(sleeping, __ATOMIC_SEQ_CST)) {
+        uint64_t one = 1;
+        ssize_t written = write(fd, &one, sizeof(one));
+        (void)written;
+    }
+}
+
+// Block on `fd` until signalled; the caller rechecks its condition after
+// setting the flag, so a signal between the check and the wait isn't lost
+static inline void bf_io_wait(int fd, int *sleeping, int (*ready)(BfIoThread *), BfIoThread *io) {
+    __atomic_store_n(sleeping, 1, __ATOMIC_SEQ_CST);
+    if (!ready(io)) {
+        uint64_t count;
+        ssize_t got = read(fd, &count, sizeof(count));
+        (void)got;
+    }
+    __atomic_store_n(sleeping, 0, __ATOMIC_SEQ_CST);
+}
+
+static inline int bf_io_output_has_space(BfIoThread *io) {
+    return io->output.tail - bf_ring_load(&io->output.head) <= io->output.mask;
+}
+
+static inline int bf_io_input_available(BfIoThread *io) {
+    return bf_ring_load(&io->input.tail) != io->input.head || __atomic_load_n(&io->input_eof, __ATOMIC_ACQUIRE);
+}
+
+// Next span of the output ring to write into, waiting for the I/O thread if
+// the ring is full; returns its size
+static inline int bf_io_output_span(BfIoThread *io, char **span) {
+    BfRing *ring = &io->output;
+    while (!bf_io_output_has_space(io)) {
+        bf_io_wait(io->program_wake, &io->program_sleeping, bf_io_output_has_space, io);
+    }
+    uint64_t free_bytes = ring->mask + 1 - (ring->tail - bf_ring_load(&ring->head));
+    uint64_t to_end = ring->mask + 1 - (ring->tail & ring->mask);
+    uint64_t size = free_bytes < to_end ? free_bytes : to_end;
+    *span = ring->data + (ring->tail & ring->mask);
+    return (int)(size < BF_RING_SPAN ? size : BF_RING_SPAN);
+}
+
+// Hand the first `size` bytes of the current span to the I/O thread
+static inline void bf_io_output_publish(BfIoThread *io, int size) {
+    if (size > 0) {
+        bf_ring_store(&io->output.tail, io->output.tail + size);
+        bf_io_signal(io->io_wake, &io->io_sleeping);
+    }
+}
+
+static inline int bf_io_getc(BfIoThread *io) {
+    BfRing *ring = &io->input;
+    while (bf_ring_load(&ring->tail) == ring->head) {
+        if (__atomic_load_n(&io->input_eof, __ATOMIC_ACQUIRE) && bf_ring_load(&ring->tail) == ring->head) {
+            return EOF;
+        }
+        bf_io_wait(io->program_wake, &io->program_sleeping, bf_io_input_available, io);
+    }
+    int c = (unsigned char)ring->data[ring->head & ring->mask];
+    int was_full = bf_ring_load(&ring->tail) - ring->head > ring->mask;
+    bf_ring_store(&ring->head, ring->head + 1);
+    if (was_full) {
+        bf_io_signal(io->io_wake, &io->io_sleeping);  // The I/O thread only waits for input space when it's full
+    }
+    return c;
+}
+
+static inline void *bf_io_thread_main(void *arg) {
+    BfIoThread *io = (BfIoThread *)arg;
+    BfRing *output = &io->output, *input = &io->input;
+    int output_failed = 0;
+    for (;;) {
+        int progress = 0;
+        uint64_t tail = bf_ring_load(&output->tail);
+        if (tail != output->head) {
+            uint64_t to_end = output->mask + 1 - (output->head & output->mask);
+            size_t size = tail - output->head < to_end ? tail - output->head : to_end;
+            ssize_t written = output_failed ? (ssize_t)size : write(io->out_fd, output->data + (output->head & output->mask), size);
+            if (written < 0 && errno != EINTR) {
+                perror("Failed to write output");
+                output_failed = 1;  // Keep draining, so the program can finish
+                written = size;
+            }
+            if (written > 0) {
+                bf_ring_store(&output->head, output->head + written);
+                bf_io_signal(io->program_wake, &io->program_sleeping);
+                progress = 1;
+            }
+        } else if (__atomic_load_n(&io->finished, __ATOMIC_ACQUIRE)) {
+            return NULL;
+        }
+
+        // Read ahead only what stdin has ready, so a quiet terminal never blocks the output
+        uint64_t used = input->tail - bf_ring_load(&input->head);
+        struct pollfd fds[2] = {{io->io_wake, POLLIN, 0}, {io->in_fd, POLLIN, 0}};
+        int want_input = !io->input_eof && used <= input->mask;
+        if (want_input && poll(&fds[1], 1, 0) > 0) {
+            uint64_t to_end = input->mask + 1 - (input->tail & input->mask);
+            size_t room = input->mask + 1 - used;
+            ssize_t got = read(io->in_fd, input->data + (input->tail & input->mask), room < to_end ? room : to_end);
+            if (got > 0) {
+                bf_ring_store(&input->tail, input->tail + got);
+            } else if (got == 0 || errno != EINTR) {
+                __atomic_store_n(&io->input_eof, 1, __ATOMIC_SEQ_CST);
+            }
+            bf_io_signal(io->program_wake, &io->program_sleeping);
+            progress = 1;
+        }
+
+        if (!progress) {
+            __atomic_store_n(&io->io_sleeping, 1, __ATOMIC_SEQ_CST);
+            int input_space = !io->input_eof && input->tail - bf_ring_load(&input->head) <= input->mask;
+            if (bf_ring_load(&output->tail) == output->head && !__atomic_load_n(&io->finished, __ATOMIC_SEQ_CST) &&
+                input_space == want_input) {
+                poll(fds, want_input ? 2 : 1, -1);
+            }
+            __atomic_store_n(&io->io_sleeping, 0, __ATOMIC_SEQ_CST);
+            uint64_t count;
+            if (poll(fds, 1, 0) > 0 && read(io->io_wake, &count, sizeof(count)) < 0) {
+                perror("Failed to read wakeup");
+            }
+        }
+    }
+}
+
+// Start the I/O thread on in_fd and out_fd; returns 0 on success
+static inline int bf_io_thread_start(BfIoThread *io, int in_fd, int out_fd) {
+    memset(io, 0, sizeof(*io));
+    io->in_fd = in_fd;
+    io->out_fd = out_fd;
+    io->program_wake = eventfd(0, EFD_CLOEXEC);
+    io->io_wake = eventfd(0, EFD_CLOEXEC);
+    if (io->program_wake == -1 || io->io_wake == -1 || bf_ring_init(&io->output, BF_RING_OUTPUT_SIZE) != 0 ||
+        bf_ring_init(&io->input, BF_RING_INPUT_SIZE) != 0 ||
+        pthread_create(&io->thread, NULL, bf_io_thread_main, io) != 0) {
+        perror("Failed to start the I/O thread");
+        return -1;
+    }
+    return 0;
+}
+
+// Wait until all published output is written, then stop the thread
+static inline void bf_io_thread_finish(BfIoThread *io) {
+    __atomic_store_n(&io->finished, 1, __ATOMIC_SEQ_CST);
+    uint64_t one = 1;
+    ssize_t written = write(io->io_wake, &one, sizeof(one));
+    (void)written;
+    pthread_join(io->thread, NULL);
+    close(io->program_wake);
+    close(io->io_wake);
+    free(io->output.data);
+    free(io->input.data);
+}
+
+#endif // BF_RING_H
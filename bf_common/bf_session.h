@@ -0,0 +1,184 @@
+#ifndef BF_SESSION_H
+#define BF_SESSION_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "bf_bytecode.h"
+
+// A run of a compiled program as a stackless coroutine (bf_interp --sessions).
+// All of its state is in BfSession, so bf_session_resume can return whenever
+// the program can't go on — `,` with no input buffered, `.` with the output
+// buffer full, or the end of its time slice — and pick up at the same op on
+// the next call. The caller owns the buffers and does all of the I/O.
+//
+// Sessions run untrusted programs next to each other, so unlike run_program
+// the pointer is checked: a program that leaves the tape stops with
+// BF_SESSION_FAULT instead of touching another session's cells.
+
+#define BF_SESSION_INPUT_SIZE 256
+#define BF_SESSION_OUTPUT_SIZE 2048
+
+enum {
+    BF_SESSION_END,     // The program finished
+    BF_SESSION_INPUT,   // `,` with nothing buffered: refill `input` or set input_eof
+    BF_SESSION_OUTPUT,  // `.` with the output buffer full: drain it
+    BF_SESSION_YIELD,   // Its slice is used up
+    BF_SESSION_FAULT,   // The pointer left the tape
+};
+
+typedef struct {
+    size_t pc;
+    size_t pointer;
+    uint64_t steps;               // Charged like run_program: per taken back edge, the loop's cost
+    uint32_t pending_output;      // Copies of the current BF_OP_OUT still to write, 0 when not started
+    unsigned char *tape;          // Zeroed by the owner
+    size_t tape_size;
+    uint16_t input_head, input_tail;  // Unread input is input[input_head, input_tail)
+    uint16_t output_sent, output_length;  // Unsent output is output[output_sent, output_length)
+    int input_eof;
+    unsigned char input[BF_SESSION_INPUT_SIZE];
+    unsigned char output[BF_SESSION_OUTPUT_SIZE];
+} BfSession;
+
+// Start a session at the program's snapshot; the snapshot's output is left to
+// the caller, who sends it before anything in `output`. Returns -1 when the
+// snapshot doesn't fit the tape.
+static inline int bf_session_start(BfSession *session, const BfProgram *program, unsigned char *tape,
+                                   size_t tape_size) {
+    const BfSnapshot *snapshot = &program->snapshot;
+    if (snapshot->tape_size > tape_size || snapshot->pointer >= tape_size) {
+        return -1;
+    }
+    session->pc = snapshot->resume_pc;
+    session->pointer = snapshot->pointer;
+    session->steps = 0;
+    session->pending_output = 0;
+    session->tape = tape;
+    session->tape_size = tape_size;
+    session->input_head = session->input_tail = 0;
+    session->output_sent = session->output_length = 0;
+    session->input_eof = 0;
+    if (snapshot->tape_size) {
+        memcpy(tape, snapshot->tape, snapshot->tape_size);
+    }
+    return 0;
+}
+
+// Run until the session has to wait, finishes, or has spent `slice` steps of
+// `costs` (see bf_bytecode_loop_costs); returns BF_SESSION_*
+static inline int bf_session_resume(BfSession *session, const BfProgram *program, const uint32_t *costs,
+                                    int64_t slice) {
+    const BfInsn *insns = program->insns;
+    const BfMulTerm *terms = program->terms;
+    unsigned char *tape = session->tape;
+    size_t size = session->tape_size;
+    size_t p = session->pointer;
+    size_t pc = session->pc;
+    int64_t left = slice;
+    int status;
+
+    for (;;) {
+        const BfInsn *insn = &insns[pc++];
+        switch (insn->op) {
+        case BF_OP_ADD:
+            tape[p] += insn->arg;
+            break;
+        case BF_OP_MOVE:
+            p += (size_t)(intptr_t)insn->arg;  // Leaving on the left wraps to a huge index
+            if (p >= size) {
+                status = BF_SESSION_FAULT;
+                goto suspend;
+            }
+            break;
+        case BF_OP_OUT: {
+            uint32_t wanted = session->pending_output ? session->pending_output : (uint32_t)insn->arg;
+            uint32_t room = BF_SESSION_OUTPUT_SIZE - session->output_length;
+            uint32_t n = wanted < room ? wanted : room;
+            memset(session->output + session->output_length, tape[p], n);
+            session->output_length += n;
+            session->pending_output = wanted - n;
+            if (session->pending_output) {
+                pc--;  // Finish this op once the buffer is drained
+                status = BF_SESSION_OUTPUT;
+                goto suspend;
+            }
+            break;
+        }
+        case BF_OP_IN:
+            if (session->input_head < session->input_tail) {
+                tape[p] = session->input[session->input_head++];
+            } else if (session->input_eof) {
+                tape[p] = (unsigned char)EOF;  // As getc's EOF in run_program
+            } else {
+                pc--;
+                status = BF_SESSION_INPUT;
+                goto suspend;
+            }
+            break;
+        case BF_OP_JZ:
+            if (!tape[p]) {
+                pc = insn->arg;
+            }
+            break;
+        case BF_OP_JNZ:
+            if (tape[p]) {
+                pc = insn->arg;
+                if ((left -= costs[insn - insns]) < 0) {
+                    status = BF_SESSION_YIELD;
+                    goto suspend;
+                }
+            }
+            break;
+        case BF_OP_CLEAR:
+            tape[p] = 0;
+            break;
+        case BF_OP_SET:
+            tape[p] = insn->arg;
+            break;
+        case BF_OP_MUL:
+            if (tape[p]) {
+                for (uint16_t k = 0; k < insn->count; ++k) {
+                    size_t q = p + (size_t)(intptr_t)terms[insn->arg + k].offset;
+                    if (q >= size) {
+                        status = BF_SESSION_FAULT;
+                        goto suspend;
+                    }
+                    tape[q] += tape[p] * terms[insn->arg + k].factor;
+                }
+                tape[p] = 0;
+            }
+            break;
+        case BF_OP_SCAN:
+            if (insn->arg == 1) {
+                unsigned char *zero = (unsigned char *)memchr(tape + p, 0, size - p);
+                if (!zero) {
+                    status = BF_SESSION_FAULT;
+                    goto suspend;
+                }
+                p = zero - tape;
+            } else {
+                while (tape[p]) {
+                    p += (size_t)(intptr_t)insn->arg;
+                    if (p >= size) {
+                        status = BF_SESSION_FAULT;
+                        goto suspend;
+                    }
+                }
+            }
+            break;
+        default:  // BF_OP_END
+            pc--;  // Resuming a finished session finishes it again
+            status = BF_SESSION_END;
+            goto suspend;
+        }
+    }
+
+suspend:
+    session->pointer = p;
+    session->pc = pc;
+    session->steps += slice - left;
+    return status;
+}
+
+#endif // BF_SESSION_H
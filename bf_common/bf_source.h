@@ -0,0 +1,188 @@
+#ifndef BF_SOURCE_H
+#define BF_SOURCE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BF_SOURCE_SIMD 1
+#endif
+
+// Source ingest shared by all the front ends. Regular files are mapped rather
+// than read, and the Brainfuck commands are copied straight out of the mapping
+// into the single output buffer, so a multi-GB source is touched once and
+// never held twice. Pipes fall back to read(2) into that same buffer.
+//
+// Filtering is 16 bytes at a time with SSSE3 when the CPU has it: two pshufb
+// nibble lookups classify every byte, movemask turns the result into a bitmask,
+// and a per-byte shuffle table packs the kept bytes together.
+
+#define BF_SOURCE_SLACK 16  // The SIMD filter stores whole vectors past the last kept byte
+
+static inline size_t bf_filter_commands_scalar(const char *in, size_t size, char *out) {
+    size_t j = 0;
+    for (size_t i = 0; i < size; ++i) {
+        char c = in[i];
+        if (c == '>' || c == '<' || c == '+' || c == '-' || c == '.' || c == ',' || c == '[' || c == ']') {
+            out[j++] = c;
+        }
+    }
+    return j;
+}
+
+#ifdef BF_SOURCE_SIMD
+// pack_shuffle[m] lists the positions of the set bits of m, padded with 0x80 (zero)
+static uint8_t bf_source_pack_shuffle[256][8];
+
+static inline void bf_source_init_shuffle(void) {
+    for (int mask = 0; mask < 256; ++mask) {
+        int n = 0;
+        for (int bit = 0; bit < 8; ++bit) {
+            if (mask & (1 << bit)) {
+                bf_source_pack_shuffle[mask][n++] = (uint8_t)bit;
+            }
+        }
+        while (n < 8) {
+            bf_source_pack_shuffle[mask][n++] = 0x80;
+        }
+    }
+}
+
+// The eight commands sit in three high-nibble rows (0x2_, 0x3_, 0x5_); a byte
+// is a command when its low- and high-nibble lookups share a row bit
+__attribute__((target("ssse3,popcnt")))
+static inline size_t bf_filter_commands_ssse3(const char *in, size_t size, char *out) {
+    const __m128i lo_rows = _mm_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                          1 | 4,   // 0x2B '+', 0x5B '['
+                                          1 | 2,   // 0x2C ',', 0x3C '<'
+                                          1 | 4,   // 0x2D '-', 0x5D ']'
+                                          1 | 2,   // 0x2E '.', 0x3E '>'
+                                          0);
+    const __m128i hi_rows = _mm_setr_epi8(0, 0, 1, 2, 0, 4, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    const __m128i upper_half = _mm_set1_epi8(8);
+    char *start = out;
+
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)(in + i));
+        __m128i lo = _mm_shuffle_epi8(lo_rows, _mm_and_si128(bytes, nibble));
+        __m128i hi = _mm_shuffle_epi8(hi_rows, _mm_and_si128(_mm_srli_epi16(bytes, 4), nibble));
+        __m128i rows = _mm_and_si128(lo, hi);
+        unsigned keep = ~(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(rows, _mm_setzero_si128())) & 0xFFFF;
+
+        if (keep == 0xFFFF) {
+            _mm_storeu_si128((__m128i *)out, bytes);  // Dense code, copy as is
+            out += 16;
+        } else if (keep) {
+            unsigned low = keep & 0xFF, high = keep >> 8;
+            __m128i pick_low = _mm_loadl_epi64((const __m128i *)bf_source_pack_shuffle[low]);
+            __m128i pick_high = _mm_add_epi8(_mm_loadl_epi64((const __m128i *)bf_source_pack_shuffle[high]), upper_half);
+            _mm_storeu_si128((__m128i *)out, _mm_shuffle_epi8(bytes, pick_low));
+            out += _mm_popcnt_u32(low);
+            _mm_storeu_si128((__m128i *)out, _mm_shuffle_epi8(bytes, pick_high));
+            out += _mm_popcnt_u32(high);
+        }
+    }
+    return (out - start) + bf_filter_commands_scalar(in + i, size - i, out);
+}
+#endif
+
+#ifdef BF_SOURCE_SIMD
+static int bf_source_simd;
+static pthread_once_t bf_source_once = PTHREAD_ONCE_INIT;
+
+static inline void bf_source_init(void) {
+    bf_source_init_shuffle();
+    bf_source_simd = __builtin_cpu_supports("ssse3") && __builtin_cpu_supports("popcnt");
+}
+#endif
+
+// Copy the Brainfuck commands of in[0..size) to out, which needs
+// size + BF_SOURCE_SLACK bytes; returns the number of commands. Safe to call
+// from several threads (bf_interp --batch workers read sources at once).
+static inline size_t bf_filter_commands(const char *in, size_t size, char *out) {
+#ifdef BF_SOURCE_SIMD
+    pthread_once(&bf_source_once, bf_source_init);
+    if (bf_source_simd) {
+        return bf_filter_commands_ssse3(in, size, out);
+    }
+#endif
+    return bf_filter_commands_scalar(in, size, out);
+}
+
+// Read the program on `fd` and return its commands, NUL-terminated, in one heap
+// buffer (NULL on error). The fd is left at end of file, as after a full read.
+static inline char *bf_read_source_fd(int fd, size_t *size) {
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && lseek(fd, 0, SEEK_CUR) == 0) {
+        size_t file_size = (size_t)st.st_size;
+        char *source = (char *)malloc(file_size + BF_SOURCE_SLACK + 1);
+        if (!source) {
+            perror("Failed to allocate memory for source");
+            return NULL;
+        }
+        if (file_size == 0) {
+            source[0] = '\0';
+            *size = 0;
+            return source;
+        }
+        void *mapping = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED) {
+            madvise(mapping, file_size, MADV_SEQUENTIAL);
+            size_t count = bf_filter_commands((const char *)mapping, file_size, source);
+            munmap(mapping, file_size);
+            lseek(fd, 0, SEEK_END);
+            source[count] = '\0';
+            *size = count;
+            // Hand back the untouched tail; large buffers shrink in place via mremap
+            char *shrunk = (char *)realloc(source, count + 1);
+            return shrunk ? shrunk : source;
+        }
+        free(source);
+    }
+
+    // Pipe, terminal or unmappable file: filter each chunk as it arrives
+    size_t capacity = 1 << 16, count = 0;
+    char *source = (char *)malloc(capacity);
+    char chunk[1 << 16];
+    if (!source) {
+        perror("Failed to allocate memory for source");
+        return NULL;
+    }
+    for (;;) {
+        ssize_t got = read(fd, chunk, sizeof(chunk));
+        if (got < 0) {
+            perror("Failed to read source");
+            free(source);
+            return NULL;
+        }
+        if (got == 0) {
+            break;
+        }
+        if (count + got + BF_SOURCE_SLACK + 1 > capacity) {
+            while (count + got + BF_SOURCE_SLACK + 1 > capacity) {
+                capacity *= 2;
+            }
+            char *grown = (char *)realloc(source, capacity);
+            if (!grown) {
+                perror("Failed to allocate memory for source");
+                free(source);
+                return NULL;
+            }
+            source = grown;
+        }
+        count += bf_filter_commands(chunk, (size_t)got, source + count);
+    }
+    source[count] = '\0';
+    *size = count;
+    return source;
+}
+
+#endif // BF_SOURCE_H
@@ -0,0 +1,117 @@
+#ifndef BF_SPLICE_H
+#define BF_SPLICE_H
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+// Output into a pipe without copying it (bf_interp --splice; needs
+// _GNU_SOURCE for vmsplice and F_SETPIPE_SZ).
+//
+// When stdout is a pipe, the program's output goes to one of two page-aligned
+// buffers, each as large as the pipe, and a full buffer is handed to the pipe
+// with vmsplice(2): the pipe references the pages instead of copying them.
+// A buffer may only be written again once the reader is done with its pages.
+// That holds once a whole buffer of the other one has been spliced: the pipe
+// can't hold more than one buffer, and it is FIFO. So full buffers alternate,
+// and a partial one (the end of the run, a checkpoint) is copied with write(2)
+// instead, which leaves the buffer free to fill on.
+//
+// The reader sees nothing until a buffer is full (or the run ends), and a
+// reader that splices the pages on instead of reading them (tee(1)-like tools
+// using splice) may see them change, so this is opt-in. The pipe belongs to
+// the reader too: it is only resized when the caller asks.
+
+typedef struct {
+    int fd;
+    char *buffers[2];
+    int current;       // Buffer being filled
+    size_t capacity;   // Of each buffer: the pipe's size
+    int failed;        // vmsplice isn't supported here, write everything
+} BfSplice;
+
+// Set up splicing to `fd` if it is a pipe, first resizing it to `pipe_size`
+// bytes unless that is 0 (the kernel rounds it up, and may refuse); returns 0
+// when it is used
+static inline int bf_splice_open(BfSplice *splice, int fd, long pipe_size) {
+    struct stat st;
+    memset(splice, 0, sizeof(*splice));
+    if (fstat(fd, &st) != 0 || !S_ISFIFO(st.st_mode)) {
+        return -1;
+    }
+    if (pipe_size > 0 && fcntl(fd, F_SETPIPE_SZ, pipe_size < INT_MAX ? (int)pipe_size : INT_MAX) == -1) {
+        perror("Failed to resize the output pipe");
+    }
+    pipe_size = fcntl(fd, F_GETPIPE_SZ);
+    long page = sysconf(_SC_PAGESIZE);
+    if (pipe_size < page) {
+        return -1;
+    }
+    void *memory = mmap(NULL, 2 * (size_t)pipe_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        return -1;
+    }
+    splice->fd = fd;
+    splice->capacity = pipe_size;
+    splice->buffers[0] = (char *)memory;
+    splice->buffers[1] = (char *)memory + pipe_size;
+    return 0;
+}
+
+static inline void bf_splice_close(BfSplice *splice) {
+    munmap(splice->buffers[0], 2 * splice->capacity);
+}
+
+static inline int bf_splice_write_all(int fd, const char *data, size_t size) {
+    while (size > 0) {
+        ssize_t written = write(fd, data, size);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Failed to write output");
+            return -1;
+        }
+        data += written;
+        size -= written;
+    }
+    return 0;
+}
+
+// Hand `size` bytes of the current buffer to the pipe; returns the buffer to
+// fill next (the other one after a full buffer was spliced)
+static inline char *bf_splice_flush(BfSplice *splice, size_t size) {
+    char *data = splice->buffers[splice->current];
+    if (size < splice->capacity || splice->failed) {
+        bf_splice_write_all(splice->fd, data, size);
+        return data;
+    }
+    struct iovec iov = {data, size};
+    while (iov.iov_len > 0) {
+        ssize_t spliced = vmsplice(splice->fd, &iov, 1, 0);
+        if (spliced < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (iov.iov_len == size && (errno == EINVAL || errno == ENOSYS)) {
+                splice->failed = 1;  // Nothing was spliced yet; from now on, copy
+                bf_splice_write_all(splice->fd, data, size);
+                return data;
+            }
+            perror("Failed to splice output");
+            return data;
+        }
+        iov.iov_base = (char *)iov.iov_base + spliced;
+        iov.iov_len -= spliced;
+    }
+    splice->current ^= 1;
+    return splice->buffers[splice->current];
+}
+
+#endif // BF_SPLICE_H
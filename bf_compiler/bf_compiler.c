@@ -1,107 +1,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "../bf_common/bf_common.h"
+#include "../bf_common/bf_profile.h"
+#include "../bf_common/bf_cache.h"
+#include "../bf_common/bf_dataflow.h"
+#include "../bf_common/bf_preeval.h"
+#include "../bf_common/bf_limits.h"
 #define TAPE_SIZE 30000
 
-// Global variables to store metadata for `$` optimizations
-typedef struct {
-    size_t position;  // Position of '$' in the Brainfuck code
-    int shift_value;  // Net shift value (e.g., -4 for [<<<<], +4 for [>>>>])
-} LoopInfo;
-
-// Declare a global array to store loop information and an index to track it
-LoopInfo loop_info_array[256];  // Store metadata for up to 256 loops
-int loop_info_index = 0;        // Index to track the number of loops
-
-#define MAX_OFFSETS 100  // Maximum offsets to track within a loop
-#define MAX_LOOPS 256    // Maximum number of simple loops
-
-typedef struct {
-    size_t position;      // Position of '#' in the Brainfuck code
-    int changes[MAX_OFFSETS];  // Net changes at each offset (index = offset, value = net change)
-    int totalOffsets;     // Total number of unique offsets modified in the loop
-} SimpleLoopInfo;
-
-SimpleLoopInfo simple_loop_info_array[MAX_LOOPS];  // Array to store simple loop information
-int simple_loop_info_index = 0;  // Index to track the number of simple loops
-
-
-// Function to read the Brainfuck source code from file, filtering out invalid characters
-char* read_bf_file(const char *filename, size_t *size) {
-    FILE *file = fopen(filename, "r");
-    if (!file) {
-        perror("Failed to open Brainfuck file");
-        exit(1);
-    }
-
-    fseek(file, 0, SEEK_END);
-    size_t file_size = ftell(file);  // Get the size of the file
-    fseek(file, 0, SEEK_SET);
-
-    char *source = (char *)malloc(file_size + 1);  // Allocate memory for the file contents
-    if (!source) {
-        perror("Failed to allocate memory for source");
-        exit(1);
-    }
-
-    fread(source, 1, file_size, file);  // Read the entire file
-    fclose(file);
-
-    // Filter out any non-Brainfuck characters
-    char *filtered_source = (char *)malloc(file_size + 1);  // Allocate memory for the filtered source
-    size_t j = 0;
-    for (size_t i = 0; i < file_size; ++i) {
-        char c = source[i];
-        if (c == '>' || c == '<' || c == '+' || c == '-' || c == '.' || c == ',' || c == '[' || c == ']') {
-            filtered_source[j++] = c;
-        }
-    }
-    filtered_source[j] = '\0';  // Null terminate the filtered source
-
-    *size = j;  // Update the size to reflect the size of the filtered source
-    free(source);  // Free the original unfiltered source
-    return filtered_source;  // Return the filtered Brainfuck source
-}
-
-// Function to create and populate the jump map for matching '[' and ']' brackets
-int* create_jump_map(const char *bf_source, size_t bf_size) {
-    int *jump_map = malloc(bf_size * sizeof(int));
-    if (!jump_map) {
-        perror("Failed to allocate memory for jump map");
-        return NULL;
-    }
-
-    int stack[256];  // Stack to handle matching brackets
-    int stack_ptr = 0;
-
-    for (size_t i = 0; i < bf_size; ++i) {
-        if (bf_source[i] == '[') {
-            stack[stack_ptr++] = i;  // Push the position of '[' onto the stack
-            if (stack_ptr >= 256) {
-                fprintf(stderr, "Error: Bracket nesting exceeds maximum stack size\n");
-                free(jump_map);
-                return NULL;
-            }
-        } else if (bf_source[i] == ']') {
-            if (stack_ptr == 0) {
-                fprintf(stderr, "Error: Unmatched ']' at position %zu\n", i);
-                free(jump_map);
-                return NULL;
-            }
-            int open = stack[--stack_ptr];  // Pop the position of the matching '[' from the stack
-            jump_map[open] = i;  // Map the opening '[' to the closing ']'
-            jump_map[i] = open;  // Map the closing ']' to the opening '['
-        }
-    }
-
-    if (stack_ptr != 0) {
-        fprintf(stderr, "Error: Unmatched '[' in input\n");
-        free(jump_map);
-        return NULL;
-    }
-
-    return jump_map;
-}
+// Optimized loop metadata ('#' and '$'), indexed by source position
+LoopTable loop_table;
 
 
 void normalize_bf_code(char *buffer, size_t *input_length) {
@@ -123,35 +32,37 @@ void normalize_bf_code(char *buffer, size_t *input_length) {
 
 
 
-void optimize_simple_loops(char *buffer, int *jump_map, size_t *input_length) {
+void optimize_simple_loops(char *buffer, int *jump_map, size_t *input_length, const BfProfile *profile) {
+    OffsetIndex offset_index = {0};  // Shared scratch for offset lookups across loops
+
     for (size_t i = 0; i < *input_length; ++i) {
-        if (buffer[i] == '[') {  // Start of a loop
+        if (buffer[i] == '[' && bf_profile_is_hot(profile, i)) {  // Start of a loop worth transforming
             int loop_end = jump_map[i];
             int pointerPosition = 0;  // Track pointer movements
             int netChangeAtStart = 0;  // Track changes at starting position
             int isSimple = 1;  // Assume loop is simple until proven otherwise
 
-            SimpleLoopInfo newSimpleLoopInfo = { .position = i, .totalOffsets = 1 };  // Start with initial position as one offset
-            memset(newSimpleLoopInfo.changes, 0, sizeof(newSimpleLoopInfo.changes));  // Initialize net changes to zero
+            SimpleLoopInfo newSimpleLoopInfo = { .position = i, .totalOffsets = 0 };
+            offset_index_reserve(&offset_index, loop_end - i);
+            add_or_update_offset(&newSimpleLoopInfo, &offset_index, 0);  // Start with initial position as one offset
 
-            for (int j = i + 1; j < loop_end; ++j) {
+            for (int j = i + 1; j < loop_end && isSimple; ++j) {
                 char c = buffer[j];
                 switch (c) {
                     case '>':  // Increment pointer position and track new offset
                         pointerPosition++;
-                        if (pointerPosition >= newSimpleLoopInfo.totalOffsets) {
-                            newSimpleLoopInfo.totalOffsets++;  // Increment total offsets only when moving right and increasing unique offsets
-                        }
+                        add_or_update_offset(&newSimpleLoopInfo, &offset_index, pointerPosition);
                         break;
-                    case '<':  // Decrement pointer position without changing unique offset count
+                    case '<':  // Decrement pointer position and track new offset
                         pointerPosition--;
+                        add_or_update_offset(&newSimpleLoopInfo, &offset_index, pointerPosition);
                         break;
                     case '+':  // Increment value at current position
-                        newSimpleLoopInfo.changes[pointerPosition]++;
+                        add_or_update_offset(&newSimpleLoopInfo, &offset_index, pointerPosition)->net_change++;
                         if (pointerPosition == 0) netChangeAtStart++;
                         break;
                     case '-':  // Decrement value at current position
-                        newSimpleLoopInfo.changes[pointerPosition]--;
+                        add_or_update_offset(&newSimpleLoopInfo, &offset_index, pointerPosition)->net_change--;
                         if (pointerPosition == 0) netChangeAtStart--;
                         break;
                     case '[':
@@ -162,37 +73,33 @@ void optimize_simple_loops(char *buffer, int *jump_map, size_t *input_length) {
                         break;
                 }
             }
+            offset_index_reset(&offset_index, &newSimpleLoopInfo);
 
             // Check if the loop is simple based on criteria
-            if (isSimple && pointerPosition == 0 && (netChangeAtStart == 1 || netChangeAtStart == -1)) {
-
-                printf("Simple loop detected at position %zu with %d total offsets.\n", i, newSimpleLoopInfo.totalOffsets);
-                for (int offset = 0; offset < newSimpleLoopInfo.totalOffsets; offset++) {
-                    
-                        printf("  Offset %d -> Net Change: %d\n", offset, newSimpleLoopInfo.changes[offset]);
-                    
-                }
+            if (isSimple && pointerPosition == 0 && (netChangeAtStart == 1 || netChangeAtStart == -1) &&
+                simple_loop_factors(&newSimpleLoopInfo, netChangeAtStart) == 0) {
                 // Replace the entire loop with '#'
                 for (int k = i; k <= loop_end; k++) {
                     buffer[k] = ' ';
                 }
                 buffer[i] = '#';  // Mark the start of the optimized loop
-                simple_loop_info_array[simple_loop_info_index++] = newSimpleLoopInfo;
-                printf("Simple loop optimized at position %zu with %d total offsets.\n", i, newSimpleLoopInfo.totalOffsets);
+                loop_table_add_simple(&loop_table, &newSimpleLoopInfo);
+            } else {
+                free(newSimpleLoopInfo.changes);
             }
         }
     }
 
-    printf("Updated BF program: %s\n", buffer);
+    offset_index_free(&offset_index);
 }
 
 
 // Function to optimize non-simple loops that contain only < or > commands
-void optimize_non_simple_loops(char *buffer, int *jump_map, size_t *input_length) {
+void optimize_non_simple_loops(char *buffer, int *jump_map, size_t *input_length, const BfProfile *profile) {
     //int optimized = 0;  // Flag to track if any non-simple loops were optimized
 
     for (size_t i = 0; i < *input_length; ++i) {
-        if (buffer[i] == '[') {
+        if (buffer[i] == '[' && bf_profile_is_hot(profile, i)) {
             int loop_end = jump_map[i];  // Find the matching ']'
             
             // Check if the loop contains only < or > instructions
@@ -222,9 +129,8 @@ void optimize_non_simple_loops(char *buffer, int *jump_map, size_t *input_length
             // Debug: Print the detected pattern and the net shift
             //printf("Detected loop from %zu to %d, net shift: %d\n", i, loop_end, net_shift);
 
-            // If the loop is valid for optimization and net shift is a power of 2
-            // Condition updated to handle both positive and negative shifts
-            if (valid && net_shift != 0 && (net_shift == -1) && ((net_shift & (net_shift - 1)) == 0 || ((-net_shift) & (-net_shift - 1)) == 0)) {
+            // If the loop is valid for optimization: single-cell scans in either direction
+            if (valid && (net_shift == -1 || net_shift == 1)) {
                 //printf("Optimizing loop from %zu to %d with shift value %d\n", i, loop_end, net_shift);
 
                 // Replace the entire loop with '$'
@@ -234,9 +140,7 @@ void optimize_non_simple_loops(char *buffer, int *jump_map, size_t *input_length
                 }
 
                 // Store position and net shift value in the global metadata array
-                loop_info_array[loop_info_index].position = i;
-                loop_info_array[loop_info_index].shift_value = net_shift;
-                loop_info_index++;
+                loop_table_add_scan(&loop_table, i, net_shift);
 
             }
         }
@@ -247,25 +151,31 @@ void optimize_non_simple_loops(char *buffer, int *jump_map, size_t *input_length
 
 
 // Generate assembly for Brainfuck code with vectorized scan support
-void generate_assembly(const char *bf_source, size_t bf_size, FILE *out) {
+void generate_assembly(const char *bf_source, size_t bf_size, FILE *out, const BfProfile *profile,
+                       const BfSnapshot *snapshot, const BfLimits *limits) {
     // Start of assembly code
     fprintf(out, ".global _start\n");
-    fprintf(out, ".section .bss\n");
-    fprintf(out, "tape: .space %d\n", TAPE_SIZE);  // Reserve space for the tape
+    bf_preeval_emit_tape(out, snapshot, TAPE_SIZE);  // Reserve space for the tape
+    bf_limits_emit_data(out, limits);
 
     fprintf(out, ".section .text\n");
     fprintf(out, "_start:\n");
 
-    // Load the tape base address into rsi (pointer to tape)
-    fprintf(out, "lea tape(%%rip), %%rsi\n");
+    // Write the compile-time output, then point rsi at the tape
+    bf_preeval_emit_start(out, snapshot);
+    bf_limits_emit_start(out, limits);
 
     // Brainfuck instruction translation
     int loop_counter = 0;  // Label counter for loops
-    int stack[256];  // Stack to handle nested loops
-    int stack_ptr = 0;
+    IntStack stack = {0};  // Stack to handle nested loops
+    IntStack cost_stack = {0};  // Commands directly in each open loop, charged per iteration with --max-steps/--timeout
+    IntStack cold_stack = {0};  // Whether each open loop was placed in the cold section
 
     for (size_t i = 0; i < bf_size; i++) {
         char c = bf_source[i];
+        if (c != ' ' && cost_stack.count > 0) {
+            cost_stack.items[cost_stack.count - 1]++;
+        }
 
         switch (c) {
             case '>':  // Move pointer right
@@ -299,127 +209,153 @@ void generate_assembly(const char *bf_source, size_t bf_size, FILE *out) {
                 fprintf(out, "syscall\n");
                 break;
             case '[':  // Start of loop
-                stack[stack_ptr++] = loop_counter;
-                fprintf(out, "loop_start_%d:\n", loop_counter);
-                fprintf(out, "movb (%%rsi), %%al\n");
-                fprintf(out, "test %%al, %%al\n");
-                fprintf(out, "jz loop_end_%d\n", loop_counter);
+                int_stack_push(&stack, loop_counter);
+                int_stack_push(&cost_stack, 0);
+                int_stack_push(&cold_stack, bf_profile_is_cold(profile, i));
+                if (cold_stack.items[cold_stack.count - 1]) {
+                    // Never entered while profiling: keep the body out of the hot path
+                    fprintf(out, "movb (%%rsi), %%al\n");
+                    fprintf(out, "test %%al, %%al\n");
+                    fprintf(out, "jnz loop_start_%d\n", loop_counter);
+                    fprintf(out, ".pushsection .text.unlikely\n");
+                    fprintf(out, "loop_start_%d:\n", loop_counter);
+                } else {
+                    if (profile && bf_profile_is_hot(profile, i)) {
+                        fprintf(out, ".p2align 4\n");  // Align hot loop heads for the front end
+                    }
+                    fprintf(out, "loop_start_%d:\n", loop_counter);
+                    fprintf(out, "movb (%%rsi), %%al\n");
+                    fprintf(out, "test %%al, %%al\n");
+                    fprintf(out, "jz loop_end_%d\n", loop_counter);
+                }
                 loop_counter++;
                 break;
             case ']':  // End of loop
-                if (stack_ptr == 0) {
+                if (stack.count == 0) {
                     fprintf(stderr, "Error: unmatched ']' at position %zu\n", i);
                     exit(1);
                 }
-                stack_ptr--;
-                int loop_id = stack[stack_ptr];
+                int loop_id = int_stack_pop(&stack);
+                char loop_label[32];
+                snprintf(loop_label, sizeof(loop_label), "loop_start_%d", loop_id);
                 fprintf(out, "movb (%%rsi), %%al\n");
                 fprintf(out, "test %%al, %%al\n");
-                fprintf(out, "jnz loop_start_%d\n", loop_id);
+                bf_limits_emit_back_edge(out, limits, int_stack_pop(&cost_stack), loop_label);
+                if (int_stack_pop(&cold_stack)) {
+                    fprintf(out, "jmp loop_end_%d\n", loop_id);  // Back to the hot section
+                    fprintf(out, ".popsection\n");
+                }
                 fprintf(out, "loop_end_%d:\n", loop_id);
                 break;
-            case '#':  // Optimized simple loop -> directly set *ptr = 0
-            
-            printf("Got a simple loop at position: %lu\n", i);
-
+            case '#': {  // Optimized simple loop -> directly set *ptr = 0
             // Retrieve the simple loop information corresponding to this position
-            SimpleLoopInfo sli;
-            int found = 0;
-
-            // Find the SimpleLoopInfo corresponding to the current position
-            for (int index = 0; index < simple_loop_info_index; index++) {
-                if (simple_loop_info_array[index].position == i) {  // Match the BF position with stored position
-                    sli = simple_loop_info_array[index];
-                    found = 1;
-                    break;
-                }
-            }
+            const SimpleLoopInfo *found = loop_table_simple_at(&loop_table, i);
 
             if (!found) {
-                printf("Error: Could not find SimpleLoopInfo for this loop position.\n");
+                fprintf(stderr, "Error: Could not find SimpleLoopInfo for this loop position.\n");
                 break;
             }
-
-            // Debug: Print information about the simple loop
-            printf("Processing Simple Loop at position %zu with %d total offsets.\n", sli.position, sli.totalOffsets);
-            for (int k = 0; k < sli.totalOffsets; k++) {
-                printf("  Offset %d -> Net Change: %d\n", k, sli.changes[k]);
-            }
+            const SimpleLoopInfo sli = *found;
 
             // Store the initial value at the current position in %cl
             fprintf(out, "movb (%%rsi), %%cl\n");
+            fprintf(out, "test %%cl, %%cl\n");  // The loop body never runs on a zero cell
+            fprintf(out, "jz simple_done_%zu\n", i);
 
-            // Apply the stored net changes to each unique offset
-            for (int offset = 1; offset < sli.totalOffsets; offset++) {
-                printf("O---L------\n");
-                if (sli.changes[offset] != 0) {  // Only update if there is a net change
+            // Apply the stored net changes to each unique offset, skipping the offset 0
+            for (int k = 0; k < sli.totalOffsets; k++) {
+                int offset = sli.changes[k].offset;
+                int net_change = sli.changes[k].net_change;
+                if (offset != 0 && net_change != 0) {  // Only update if there is a net change
                     fprintf(out, "movq %%rsi, %%rax\n");  // Copy the current pointer position
                     fprintf(out, "addq $%d, %%rax\n", offset);  // Move to the offset position
                     fprintf(out, "movb (%%rax), %%dl\n");  // Load the byte at the target offset into %dl
                     fprintf(out, "movb %%cl, %%al\n");  // Move the original value into %al
 
-                    if (sli.changes[offset] > 0) {  // Positive net changes
-                        fprintf(out, "mov $%d, %%bl\n", sli.changes[offset]);  // Load the multiplier into %bl
-                        fprintf(out, "PositiveMultiplyLoop_%lu_%d:\n", i, offset);  // Start of the multiplication loop
+                    if (net_change > 0) {  // Positive net changes
+                        fprintf(out, "mov $%d, %%bl\n", net_change);  // Load the multiplier into %bl
+                        fprintf(out, "PositiveMultiplyLoop_%lu_%d:\n", i, k);  // Start of the multiplication loop
                         fprintf(out, "addb %%al, %%dl\n");  // Add the original value to %dl
                         fprintf(out, "dec %%bl\n");  // Decrement the multiplier
-                        fprintf(out, "jnz PositiveMultiplyLoop_%lu_%d\n", i, offset);  // Repeat until %bl is zero
-                    } else if (sli.changes[offset] < 0) {  // Negative net changes
-                        int abs_value = -sli.changes[offset];  // Convert to positive value for the loop
+                        fprintf(out, "jnz PositiveMultiplyLoop_%lu_%d\n", i, k);  // Repeat until %bl is zero
+                    } else {  // Negative net changes
+                        int abs_value = -net_change;  // Convert to positive value for the loop
                         fprintf(out, "mov $%d, %%bl\n", abs_value);  // Load the absolute multiplier into %bl
-                        fprintf(out, "NegativeMultiplyLoop_%lu_%d:\n", i, offset);  // Start of the subtraction loop
+                        fprintf(out, "NegativeMultiplyLoop_%lu_%d:\n", i, k);  // Start of the subtraction loop
                         fprintf(out, "subb %%al, %%dl\n");  // Subtract the original value from %dl
                         fprintf(out, "dec %%bl\n");  // Decrement the multiplier
-                        fprintf(out, "jnz NegativeMultiplyLoop_%lu_%d\n", i, offset);  // Repeat until %bl is zero
+                        fprintf(out, "jnz NegativeMultiplyLoop_%lu_%d\n", i, k);  // Repeat until %bl is zero
                     }
 
-                    // Store the updated value back at the offset
+                    // Store the updated value back at the offset (%al clobbered the address)
+                    fprintf(out, "movq %%rsi, %%rax\n");
+                    fprintf(out, "addq $%d, %%rax\n", offset);
                     fprintf(out, "movb %%dl, (%%rax)\n");
                 }
             }
+            fprintf(out, "simple_done_%zu:\n", i);
+
             // After all updates, set the value at the current position to zero as specified
             fprintf(out, "movb $0, (%%rsi)\n");  // Set the byte at the current position to zero
-                
             break;
-            
+            }
+
             case '$': {  // Optimized non-simple loop -> vectorized memory scan
                 //printf("GOT A # at %lu\n",i);
-                int shift_value = 0;
-                for (int j = 0; j < loop_info_index; ++j) {
-                    if (loop_info_array[j].position == i) {
-                        shift_value = loop_info_array[j].shift_value;
-                        //printf("GOT A SHIFT VALUE OF -1\n");
-                        break;
-                    }
-                }
-
-                if(shift_value == -1){
-                    // For [<]-->#
-                    fprintf(out, "loop_start_%zu:\n", i);
-                    fprintf(out, "    mov %%rsi, %%rdi             # Copy current position to %%rdi for checking\n");
-                    fprintf(out, "    sub $16, %%rdi              # Move back 16 bytes to check previous block\n");
-                    fprintf(out, "    lea tape(%%rip), %%rax      # Load address of tape start into %%rax for comparison\n");
-                    fprintf(out, "    cmp %%rdi, %%rax            # Compare if %%rdi is before the start of the tape\n");
-                    fprintf(out, "    jae load_xmm0_%zu          # Jump to load xmm0 if %%rdi is after start of tape\n", i);
-                    fprintf(out, "    lea tape(%%rip), %%rdi     # Adjust %%rdi to the start of tape if %%rdi is before start\n");
-
-                    fprintf(out, "load_xmm0_%zu:\n", i);
+                const LoopInfo *scan = loop_table_scan_at(&loop_table, i);
+                int shift_value = scan ? scan->shift_value : 0;
+
+                if (shift_value == -1) {
+                    // For [<]: check 16 cells ending at the pointer per step, nearest zero wins
+                    fprintf(out, "    cmpb $0, (%%rsi)            # Already on a zero cell?\n");
+                    fprintf(out, "    je scan_done_%zu\n", i);
+                    fprintf(out, "    lea tape(%%rip), %%rdx      # Lowest address a block may start at\n");
+                    fprintf(out, "scan_block_%zu:\n", i);
+                    fprintf(out, "    lea -15(%%rsi), %%rdi       # Block of 16 cells ending at %%rsi\n");
+                    fprintf(out, "    cmp %%rdx, %%rdi\n");
+                    fprintf(out, "    jb scan_bytes_%zu          # Too close to the tape start, finish bytewise\n", i);
                     fprintf(out, "    movdqu (%%rdi), %%xmm0      # Load 16 bytes into %%xmm0 from %%rdi\n");
                     fprintf(out, "    pxor %%xmm1, %%xmm1        # Set %%xmm1 to zeros for comparison\n");
                     fprintf(out, "    pcmpeqb %%xmm1, %%xmm0     # Compare each byte in %%xmm0 to zero\n");
                     fprintf(out, "    pmovmskb %%xmm0, %%eax     # Create a bitmask from comparison results\n");
-                    fprintf(out, "    not %%eax                  # Invert the bitmask so zeros become ones\n");
-                    fprintf(out, "    lzcntl %%eax, %%eax        # Count leading zeros to find the first set bit\n");
                     fprintf(out, "    test %%eax, %%eax          # Check if a zero byte was found\n");
-                    fprintf(out, "    jz found_zero_%zu         # Exit loop if zero was found\n", i);
-                    fprintf(out, "    sub $16, %%rsi             # Move %%rsi 16 bytes back for next loop iteration\n");
-                    fprintf(out, "    jmp loop_start_%zu\n", i);
-
-                    fprintf(out, "found_zero_%zu:\n", i);
-                    fprintf(out, "    mov $31, %%ecx             # Load 31 into %%ecx\n");
-                    fprintf(out, "    sub %%eax, %%ecx           # Calculate the index of the first zero bit\n");
-                    fprintf(out, "    sub %%rax, %%rsi           # Adjust %%rsi to point to the first zero byte found\n");
-                    fprintf(out, "    subq $1, %%rsi\n");
+                    fprintf(out, "    jnz scan_found_%zu\n", i);
+                    fprintf(out, "    sub $16, %%rsi             # Move %%rsi 16 bytes back for next block\n");
+                    fprintf(out, "    jmp scan_block_%zu\n", i);
+                    fprintf(out, "scan_found_%zu:\n", i);
+                    fprintf(out, "    bsr %%eax, %%eax           # Highest set bit is the zero closest to %%rsi\n");
+                    fprintf(out, "    lea (%%rdi,%%rax), %%rsi\n");
+                    fprintf(out, "    jmp scan_done_%zu\n", i);
+                } else if (shift_value == 1) {
+                    // For [>]: check 16 cells starting at the pointer per step, nearest zero wins
+                    fprintf(out, "    cmpb $0, (%%rsi)            # Already on a zero cell?\n");
+                    fprintf(out, "    je scan_done_%zu\n", i);
+                    fprintf(out, "    lea tape+%d(%%rip), %%rdx   # Highest address a block may start at\n", TAPE_SIZE - 16);
+                    fprintf(out, "scan_block_%zu:\n", i);
+                    fprintf(out, "    cmp %%rdx, %%rsi\n");
+                    fprintf(out, "    ja scan_bytes_%zu          # Too close to the tape end, finish bytewise\n", i);
+                    fprintf(out, "    movdqu (%%rsi), %%xmm0      # Load 16 bytes into %%xmm0 from %%rsi\n");
+                    fprintf(out, "    pxor %%xmm1, %%xmm1        # Set %%xmm1 to zeros for comparison\n");
+                    fprintf(out, "    pcmpeqb %%xmm1, %%xmm0     # Compare each byte in %%xmm0 to zero\n");
+                    fprintf(out, "    pmovmskb %%xmm0, %%eax     # Create a bitmask from comparison results\n");
+                    fprintf(out, "    test %%eax, %%eax          # Check if a zero byte was found\n");
+                    fprintf(out, "    jnz scan_found_%zu\n", i);
+                    fprintf(out, "    add $16, %%rsi             # Move %%rsi 16 bytes on for next block\n");
+                    fprintf(out, "    jmp scan_block_%zu\n", i);
+                    fprintf(out, "scan_found_%zu:\n", i);
+                    fprintf(out, "    bsf %%eax, %%eax           # Lowest set bit is the zero closest to %%rsi\n");
+                    fprintf(out, "    add %%rax, %%rsi\n");
+                    fprintf(out, "    jmp scan_done_%zu\n", i);
+                }
+
+                if (shift_value == -1 || shift_value == 1) {
+                    // Byte-at-a-time tail near the tape edges
+                    fprintf(out, "scan_bytes_%zu:\n", i);
+                    fprintf(out, "    cmpb $0, (%%rsi)\n");
+                    fprintf(out, "    je scan_done_%zu\n", i);
+                    fprintf(out, "    %s $1, %%rsi\n", shift_value == 1 ? "add" : "sub");
+                    fprintf(out, "    jmp scan_bytes_%zu\n", i);
+                    fprintf(out, "scan_done_%zu:\n", i);
                 }
                 
                 break;
@@ -433,14 +369,47 @@ void generate_assembly(const char *bf_source, size_t bf_size, FILE *out) {
     }
 
     // Exit system call
+    bf_limits_emit_exit(out, limits);
     fprintf(out, "mov $60, %%rax\n");  // syscall: exit
     fprintf(out, "xor %%rdi, %%rdi\n"); // exit code 0
     fprintf(out, "syscall\n");
+    bf_limits_emit_refill(out, limits);
+
+    int_stack_free(&stack);
+    int_stack_free(&cost_stack);
+    int_stack_free(&cold_stack);
 }
 
 int main(int argc, char *argv[]) {
-    if (argc < 3) {
-        fprintf(stderr, "Usage: %s <input.bf> -o <output.s>\n", argv[0]);
+    const char *output_path = NULL;
+    const char *profile_path = NULL;
+    int use_cache = 0;
+    size_t preeval_steps = BF_PREEVAL_DEFAULT_STEPS;
+    BfLimits limits = {0, 0};
+    for (int j = 1; j < argc; j++) {
+        if (strcmp(argv[j], "-o") == 0 && j + 1 < argc) {
+            output_path = argv[++j];
+        } else if (strcmp(argv[j], "--profile") == 0 && j + 1 < argc) {
+            profile_path = argv[++j];  // Loop profile from `bf_interp --profile-out`
+        } else if (strcmp(argv[j], "--preeval-steps") == 0 && j + 1 < argc) {
+            preeval_steps = strtoul(argv[++j], NULL, 10);  // Compile-time evaluation budget, 0 disables
+        } else if (strcmp(argv[j], "--max-steps") == 0 && j + 1 < argc) {
+            limits.max_steps = strtoull(argv[++j], NULL, 10);  // Stop the program after this many steps
+        } else if (strcmp(argv[j], "--timeout") == 0 && j + 1 < argc) {
+            limits.timeout = strtod(argv[++j], NULL);  // ...or after this many seconds
+        } else if (strcmp(argv[j], "--cache") == 0) {
+            use_cache = 1;  // Reuse output from an identical earlier compile
+        } else if (strcmp(argv[j], "--cache-stats") == 0) {
+            BfCache cache;
+            if (bf_cache_open(&cache) != 0) {
+                return 1;
+            }
+            bf_cache_print_stats(stdout, &cache);
+            return 0;
+        }
+    }
+    if (argc < 2 || !output_path) {
+        fprintf(stderr, "Usage: %s <input.bf> -o <output.s> [--profile <file>] [--preeval-steps <n>] [--max-steps <n>] [--timeout <s>] [--cache] | --cache-stats\n", argv[0]);
         return 1;
     }
 
@@ -448,8 +417,41 @@ int main(int argc, char *argv[]) {
     size_t bf_size;
     char *bf_source = read_bf_file(argv[1], &bf_size);
 
+    // On a cache hit the stored assembly is copied out and nothing is compiled
+    BfCache cache;
+    if (use_cache) {
+        char cached[PATH_MAX];
+        if (bf_cache_open(&cache) != 0) {
+            free(bf_source);
+            return 1;
+        }
+        bf_cache_add_string(&cache, "bf_compiler");
+        char steps[64];
+        snprintf(steps, sizeof(steps), "preeval=%zu", preeval_steps);
+        bf_cache_add_string(&cache, steps);
+        snprintf(steps, sizeof(steps), "limits=%llu/%g", (unsigned long long)limits.max_steps, limits.timeout);
+        bf_cache_add_string(&cache, steps);
+        bf_cache_add_commands(&cache, bf_source, bf_size);
+        if (profile_path && bf_cache_add_file(&cache, profile_path) != 0) {
+            free(bf_source);
+            return 1;
+        }
+        bf_cache_key(&cache);
+        if (bf_cache_lookup(&cache, "s", cached, sizeof(cached))) {
+            free(bf_source);
+            return bf_cache_copy_file(cached, output_path, 0644) == 0 ? 0 : 1;
+        }
+    }
+
+    // Loops that can never run (entered on a known-zero cell) are blanked out
+    bf_remove_dead_loops(bf_source, bf_size);
+
+    // The input-free prefix runs now; code is generated from where it stopped
+    BfSnapshot snapshot;
+    bf_preeval_source(bf_source, bf_size, TAPE_SIZE, preeval_steps, &snapshot);
+
     // Open the output assembly file for writing
-    FILE *out = fopen(argv[3], "w");
+    FILE *out = fopen(output_path, "w");
     if (!out) {
         perror("Failed to open output assembly file");
         free(bf_source);
@@ -463,20 +465,40 @@ int main(int argc, char *argv[]) {
         fclose(out);
         return 1;
     }
+    loop_table_init(&loop_table, bf_size);
+
+    BfProfile profile = {0};
+    if (profile_path) {
+        if (bf_profile_load(profile_path, bf_size, &profile) != 0) {
+            free(bf_source);
+            free(jump_map);
+            fclose(out);
+            return 1;
+        }
+
+        // Profile-guided: spend the loop transforms on the loops that were measured hot
+        optimize_simple_loops(bf_source, jump_map, &bf_size, &profile);
+        optimize_non_simple_loops(bf_source, jump_map, &bf_size, &profile);
+    }
 
-    
-    //optimize_simple_loops(bf_source, jump_map, &bf_size);
+    //optimize_simple_loops(bf_source, jump_map, &bf_size, NULL);
 
     //Optimize non-simple loops using global variables for loop info
-    //optimize_non_simple_loops(bf_source, jump_map, &bf_size);
+    //optimize_non_simple_loops(bf_source, jump_map, &bf_size, NULL);
 
     // Generate assembly code
-    generate_assembly(bf_source, bf_size, out);
+    generate_assembly(bf_source, bf_size, out, profile_path ? &profile : NULL, &snapshot, &limits);
 
     // Clean up
     fclose(out);
     free(bf_source);
     free(jump_map);
+    loop_table_free(&loop_table);
+    bf_profile_free(&profile);
+    free(snapshot.owned);
 
+    if (use_cache) {
+        bf_cache_store(&cache, "s", output_path);
+    }
     return 0;
-}
\ No newline at end of file
+}
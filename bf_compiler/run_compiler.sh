@@ -13,7 +13,7 @@ EXEC_FILE="output_program"
 
 # Compile the bf_compiler if it's not already compiled
 if [ ! -f bf_compiler ]; then
-    gcc bf_compiler.c -o bf_compiler
+    gcc -pthread bf_compiler.c -o bf_compiler
     if [ $? -ne 0 ]; then
         exit 1
     fi
@@ -1,7 +1,27 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "bf_common/bf_common.h"
+#include "bf_common/bf_profile.h"
+#include "bf_common/bf_bytecode.h"
+#include "bf_common/bf_dataflow.h"
+#include "bf_common/bf_preeval.h"
+#include "bf_common/bf_limits.h"
+#include "bf_common/bf_checkpoint.h"
+#include "bf_common/bf_perf.h"
+#include "bf_common/bf_pool.h"
+#include "bf_common/bf_session.h"
+#include "bf_common/bf_ring.h"
+#include "bf_common/bf_splice.h"
+#include "bf_common/bf_source.h"
 
 #define TAPE_SIZE 30000
 #define OUTPUT_BUFFER_SIZE 8192
@@ -12,27 +32,724 @@ typedef struct {
     int executions;
 } loop_info_t;
 
-// Parse command-line arguments for profiling option
-void parse_arguments(int argc, char *argv[], int *profiling_enabled) {
+// Parse command-line arguments for profiling and bytecode options
+void parse_arguments(int argc, char *argv[], int *profiling_enabled, const char **profile_out,
+                     const char **bytecode_out, const char **bytecode_in, size_t *preeval_steps, BfLimits *limits,
+                     BfCheckpointOptions *checkpoint, int *perf_counters, const char **batch_manifest, long *jobs,
+                     const char **sessions_path, size_t *max_sessions, int *io_thread, int *splice_output,
+                     long *pipe_size) {
     for (int j = 1; j < argc; j++) {
         if (strcmp(argv[j], "-p") == 0) {
             *profiling_enabled = 1;
+        } else if (strcmp(argv[j], "--profile-out") == 0 && j + 1 < argc) {
+            *profile_out = argv[++j];  // Machine-readable profile, implies -p
+            *profiling_enabled = 1;
+        } else if (strcmp(argv[j], "--emit-bytecode") == 0 && j + 1 < argc) {
+            *bytecode_out = argv[++j];  // Compile stdin to a .bfc file instead of running it
+        } else if (strcmp(argv[j], "--bytecode") == 0 && j + 1 < argc) {
+            *bytecode_in = argv[++j];  // Run a .bfc file; stdin is left to the program
+        } else if (strcmp(argv[j], "--preeval-steps") == 0 && j + 1 < argc) {
+            *preeval_steps = strtoul(argv[++j], NULL, 10);  // Budget for --emit-bytecode, 0 disables
+        } else if (strcmp(argv[j], "--max-steps") == 0 && j + 1 < argc) {
+            limits->max_steps = strtoull(argv[++j], NULL, 10);  // Stop the program after this many steps
+        } else if (strcmp(argv[j], "--timeout") == 0 && j + 1 < argc) {
+            limits->timeout = strtod(argv[++j], NULL);  // ...or after this many seconds
+        } else if (strcmp(argv[j], "--checkpoint") == 0 && j + 1 < argc) {
+            checkpoint->path = argv[++j];  // Save the run's state there now and then
+        } else if (strcmp(argv[j], "--checkpoint-interval") == 0 && j + 1 < argc) {
+            checkpoint->interval = strtod(argv[++j], NULL);  // Seconds between checkpoints
+        } else if (strcmp(argv[j], "--resume") == 0 && j + 1 < argc) {
+            checkpoint->resume = argv[++j];  // Continue the run a checkpoint saved
+        } else if (strcmp(argv[j], "--perf-counters") == 0) {
+            *perf_counters = 1;  // Hardware counters for the run, on stderr
+        } else if (strcmp(argv[j], "--batch") == 0 && j + 1 < argc) {
+            *batch_manifest = argv[++j];  // Run every program the manifest lists, in parallel
+        } else if (strcmp(argv[j], "-j") == 0 && j + 1 < argc) {
+            *jobs = strtol(argv[++j], NULL, 10);  // Threads for --batch, 0: one per CPU
+        } else if (strcmp(argv[j], "--sessions") == 0 && j + 1 < argc) {
+            *sessions_path = argv[++j];  // Serve the program to every connection on this Unix socket
+        } else if (strcmp(argv[j], "--max-sessions") == 0 && j + 1 < argc) {
+            *max_sessions = strtoull(argv[++j], NULL, 10);  // Concurrent sessions for --sessions
+        } else if (strcmp(argv[j], "--io-thread") == 0) {
+            *io_thread = 1;  // Leave stdin and stdout to a thread of their own
+        } else if (strcmp(argv[j], "--splice") == 0) {
+            *splice_output = 1;  // vmsplice output into a pipe stdout instead of copying it
+        } else if (strcmp(argv[j], "--pipe-size") == 0 && j + 1 < argc) {
+            *pipe_size = strtol(argv[++j], NULL, 10);  // Resize that pipe first (F_SETPIPE_SZ)
         }
     }
 }
 
-// Flush output buffer to stdout
-void flush_output(char *buffer, int *index) {
-    fwrite(buffer, 1, *index, stdout);
-    *index = 0;
+// Where `.` writes: a buffer flushed to `file`, one of the buffers spliced
+// into a pipe stdout, or with --io-thread a span of the I/O thread's output
+// ring, handed over when full (that thread also reads ahead the program's
+// stdin)
+typedef struct {
+    char *buffer;
+    int index;
+    int capacity;
+    FILE *file;
+    BfIoThread *io;
+    BfSplice *splice;
+} Output;
+
+// Flush output buffer to its file or pipe, or publish the span and take the next one
+void flush_output(Output *out) {
+    if (out->io) {
+        bf_io_output_publish(out->io, out->index);
+        out->capacity = bf_io_output_span(out->io, &out->buffer);
+    } else if (out->splice) {
+        out->buffer = bf_splice_flush(out->splice, out->index);
+    } else {
+        fwrite(out->buffer, 1, out->index, out->file);
+    }
+    out->index = 0;
 }
 
 // Add character to output buffer, flush if full
-void buffered_put(char c, char *buffer, int *index) {
-    buffer[(*index)++] = c;
-    if (*index == OUTPUT_BUFFER_SIZE) {
-        flush_output(buffer, index);
+void buffered_put(char c, Output *out) {
+    out->buffer[out->index++] = c;
+    if (out->index == out->capacity) {
+        flush_output(out);
+    }
+}
+
+// Run a compiled program (see bf_common/bf_bytecode.h) on the tape, starting
+// from its snapshot if it has one. With `costs` (see bf_bytecode_loop_costs)
+// every taken back edge is charged to `fuel`, and at the end of each fuel
+// slice a due checkpoint is taken; returns the exit status, non-zero when a
+// limit or a signal stopped the program. `,` reads `input` (or the I/O
+// thread's ring), `.` writes `output`.
+int run_program(const BfProgram *program, unsigned char *tape, Output *output, const uint32_t *costs, BfFuel *fuel,
+                BfCheckpoint *checkpoint, FILE *input) {
+    const BfInsn *insns = program->insns;
+    const BfMulTerm *terms = program->terms;
+    const BfSnapshot *snapshot = &program->snapshot;
+    for (size_t k = 0; k < snapshot->output_size; ++k) {
+        buffered_put(snapshot->output[k], output);
+    }
+    if (snapshot->tape_size) {
+        memcpy(tape, snapshot->tape, snapshot->tape_size);
+    }
+    unsigned char *ptr = tape + snapshot->pointer;
+    int64_t left = costs ? fuel->slice : 0;
+    int status = 0;
+    uint64_t input_offset = checkpoint->state.input_offset;
+    // The snapshot's output was written above. A --resume checkpoint replaces
+    // the snapshot (bf_checkpoint_load), so then there is none to count.
+    uint64_t output_offset = checkpoint->state.output_offset + snapshot->output_size;
+
+    for (size_t pc = snapshot->resume_pc;;) {
+        const BfInsn *insn = &insns[pc++];
+        switch (insn->op) {
+        case BF_OP_ADD:
+            *ptr += insn->arg;
+            break;
+        case BF_OP_MOVE:
+            ptr += insn->arg;
+            break;
+        case BF_OP_OUT:
+            for (int32_t k = 0; k < insn->arg; ++k) {
+                buffered_put(*ptr, output);
+            }
+            output_offset += insn->arg;
+            break;
+        case BF_OP_IN: {
+            int c;
+            if (output->io) {
+                if (output->index && !bf_io_input_available(output->io)) {
+                    flush_output(output);  // Let a prompt out before waiting for the answer
+                }
+                c = bf_io_getc(output->io);
+            } else {
+                c = getc(input);
+            }
+            *ptr = c;
+            input_offset += c != EOF;
+            break;
+        }
+        case BF_OP_JZ:
+            if (!*ptr) {
+                pc = insn->arg;  // Skip past the loop if current cell is zero
+            }
+            break;
+        case BF_OP_JNZ:
+            if (*ptr) {
+                pc = insn->arg;  // Back to the top of the loop body if current cell is non-zero
+                if (costs && (left -= costs[insn - insns]) < 0) {
+                    if ((left = bf_fuel_refill(fuel, left, &status)) < 0) {
+                        return status;
+                    }
+                    if (checkpoint->path && bf_checkpoint_due(checkpoint)) {
+                        flush_output(output);
+                        fflush(output->file);
+                        BfCheckpointState state = {pc, (uint64_t)(ptr - tape), input_offset, output_offset, fuel->steps};
+                        if ((status = bf_checkpoint_take(checkpoint, &state, tape, TAPE_SIZE)) != 0) {
+                            return status;
+                        }
+                    }
+                }
+            }
+            break;
+        case BF_OP_CLEAR:
+            *ptr = 0;
+            break;
+        case BF_OP_SET:
+            *ptr = insn->arg;
+            break;
+        case BF_OP_MUL:
+            if (*ptr) {
+                for (uint16_t k = 0; k < insn->count; ++k) {
+                    ptr[terms[insn->arg + k].offset] += *ptr * terms[insn->arg + k].factor;
+                }
+                *ptr = 0;
+            }
+            break;
+        case BF_OP_SCAN:
+            if (insn->arg == 1) {
+                ptr = memchr(ptr, 0, tape + TAPE_SIZE - ptr);  // Off the tape is undefined anyway
+            } else {
+                while (*ptr) {
+                    ptr += insn->arg;
+                }
+            }
+            break;
+        default:  // BF_OP_END
+            if (costs) {
+                fuel->steps = bf_fuel_steps(fuel, left);
+                fuel->slice = left;
+            }
+            if (costs && bf_limits_enabled(&fuel->limits)) {
+                bf_fuel_report(fuel, left);
+            }
+            return 0;
+        }
+    }
+}
+
+// Run the program, under --max-steps/--timeout and --checkpoint when given,
+// or from where a --resume checkpoint left it, with --perf-counters counting
+// only the run itself and with --io-thread doing stdin and stdout on a thread
+// of their own (bf_common/bf_ring.h), or with --splice output into a pipe
+// spliced (bf_common/bf_splice.h), the pipe resized to `pipe_size` bytes
+// first unless it is 0; returns the exit status
+int execute_program(BfProgram *program, unsigned char *tape, const BfLimits *limits,
+                    const BfCheckpointOptions *options, int perf_counters, int io_thread, int splice_output,
+                    long pipe_size) {
+    BfCheckpoint checkpoint;
+    memset(&checkpoint, 0, sizeof(checkpoint));
+    if (options->resume) {
+        if (bf_checkpoint_load(options->resume, program, TAPE_SIZE, &checkpoint.state) != 0) {
+            return 1;
+        }
+        bf_checkpoint_seek_io(&checkpoint.state);
+    }
+
+    char output_buffer[OUTPUT_BUFFER_SIZE];
+    Output output = {output_buffer, 0, OUTPUT_BUFFER_SIZE, stdout, NULL, NULL};
+    BfIoThread io;
+    BfSplice splice;
+    if (io_thread) {
+        if (bf_io_thread_start(&io, STDIN_FILENO, STDOUT_FILENO) != 0) {
+            return 1;
+        }
+        output.io = &io;
+        output.capacity = bf_io_output_span(&io, &output.buffer);
+    } else if (splice_output && bf_splice_open(&splice, STDOUT_FILENO, pipe_size) == 0) {
+        fflush(stdout);
+        output.splice = &splice;
+        output.buffer = splice.buffers[0];
+        output.capacity = splice.capacity;
+    }
+    uint32_t *costs = NULL;
+    BfFuel fuel;
+    if (bf_limits_enabled(limits) || options->path || perf_counters) {
+        costs = bf_bytecode_loop_costs(program);  // Fuel slices also pace the checkpoints and count the ops
+        bf_fuel_start(&fuel, limits);
+        fuel.steps = checkpoint.state.steps;
+        fuel.slice = bf_fuel_next_slice(&fuel);
+    }
+    if (options->path) {
+        bf_checkpoint_start(&checkpoint, options->path, program, options->interval);
+    }
+    BfPerf perf;
+    if (perf_counters) {
+        bf_perf_open(&perf);
+        bf_perf_start(&perf);
+    }
+    int status = run_program(program, tape, &output, costs, &fuel, &checkpoint, stdin);
+    flush_output(&output);
+    if (output.io) {
+        bf_io_thread_finish(&io);  // Once the output is written
+    }
+    if (output.splice) {
+        bf_splice_close(&splice);  // Every page still in the pipe holds a reference of its own
+    }
+    if (perf_counters) {
+        fflush(stdout);
+        bf_perf_stop(&perf);
+        bf_perf_report(&perf, fuel.steps);
+        bf_perf_close(&perf);
+    }
+    bf_checkpoint_busy(&checkpoint, 1);
+    free(costs);
+    return status;
+}
+
+// --batch: every line of the manifest is `<program.b> <input> <output>`
+// (whitespace separated, `-` for no input, # starts a comment). The programs
+// run on a work-stealing pool (bf_common/bf_pool.h), each with its own tape
+// and output buffer and its files as stdin and stdout, so there is no process
+// per program: decoding, running and the I/O all happen on the pool. The
+// tapes share one allocation, so programs run on the bounds-checked executor
+// of bf_common/bf_session.h: one that leaves its tape fails on its own.
+typedef struct {
+    char *program;
+    char *input;   // NULL: empty input
+    char *output;
+    int status;
+} BatchTask;
+
+typedef struct {
+    BatchTask *tasks;
+    const BfLimits *limits;
+    unsigned char *tapes;  // TAPE_SIZE cells per worker
+} Batch;
+
+// Read the manifest; returns the number of tasks, or -1 after reporting an error
+long read_batch_manifest(const char *path, BatchTask **tasks) {
+    FILE *manifest = fopen(path, "r");
+    if (!manifest) {
+        perror("Failed to open batch manifest");
+        return -1;
+    }
+    size_t count = 0, capacity = 0, line_number = 0;
+    char *line = NULL;
+    size_t line_size = 0;
+    *tasks = NULL;
+    while (getline(&line, &line_size, manifest) != -1) {
+        line_number++;
+        char *comment = strchr(line, '#');
+        if (comment) {
+            *comment = '\0';
+        }
+        char *rest, *fields[4];
+        int n = 0;
+        for (char *field = strtok_r(line, " \t\r\n", &rest); field && n < 4; field = strtok_r(NULL, " \t\r\n", &rest)) {
+            fields[n++] = field;
+        }
+        if (n == 0) {
+            continue;
+        }
+        if (n != 3) {
+            fprintf(stderr, "Error: %s:%zu: expected <program> <input> <output>\n", path, line_number);
+            free(line);
+            fclose(manifest);
+            return -1;
+        }
+        *tasks = grow_array(*tasks, &capacity, count + 1, sizeof(BatchTask));
+        BatchTask *task = &(*tasks)[count++];
+        task->program = strdup(fields[0]);
+        task->input = strcmp(fields[1], "-") == 0 ? NULL : strdup(fields[1]);
+        task->output = strdup(fields[2]);
+        task->status = 0;
+    }
+    free(line);
+    fclose(manifest);
+    return (long)count;
+}
+
+// Decode and run one program of the batch on the worker's tape
+void run_batch_task(void *context, size_t index, int worker) {
+    Batch *batch = (Batch *)context;
+    BatchTask *task = &batch->tasks[index];
+    task->status = 1;
+    int fd = open(task->program, O_RDONLY);
+    if (fd == -1) {
+        fprintf(stderr, "Error: %s: %s\n", task->program, strerror(errno));
+        return;
+    }
+    size_t size;
+    char *source = bf_read_source_fd(fd, &size);
+    close(fd);
+    BfProgram program;
+    if (!source || bf_bytecode_compile(source, size, &program) != 0) {
+        fprintf(stderr, "Error: %s: failed to load\n", task->program);
+        free(source);
+        return;
+    }
+    free(source);
+    bf_dataflow_optimize(&program, NULL);
+
+    FILE *input = fopen(task->input ? task->input : "/dev/null", "rb");
+    FILE *output = input ? fopen(task->output, "wb") : NULL;
+    if (!input || !output) {
+        fprintf(stderr, "Error: %s: %s\n", input ? task->output : task->input, strerror(errno));
+        if (input) {
+            fclose(input);
+        }
+        bf_bytecode_free(&program);
+        return;
+    }
+    unsigned char *tape = batch->tapes + (size_t)worker * TAPE_SIZE;
+    memset(tape, 0, TAPE_SIZE);
+    uint32_t *costs = bf_bytecode_loop_costs(&program);
+    BfFuel fuel;
+    bf_fuel_start(&fuel, batch->limits);  // Without limits, unbounded slices
+    BfSession session;
+    task->status = 0;
+    if (bf_session_start(&session, &program, tape, TAPE_SIZE) != 0) {
+        fprintf(stderr, "Error: %s needs a larger tape than %d cells\n", task->program, TAPE_SIZE);
+        task->status = 1;
+    } else {
+        fwrite(program.snapshot.output, 1, program.snapshot.output_size, output);
+    }
+    while (task->status == 0) {
+        int64_t left = fuel.slice - (int64_t)(session.steps - fuel.steps);
+        int state = bf_session_resume(&session, &program, costs, left);
+        fwrite(session.output, 1, session.output_length, output);
+        session.output_length = 0;
+        left = fuel.slice - (int64_t)(session.steps - fuel.steps);
+        if (state == BF_SESSION_END) {
+            if (bf_limits_enabled(batch->limits)) {
+                bf_fuel_report(&fuel, left);
+            }
+            break;
+        } else if (state == BF_SESSION_FAULT) {
+            fprintf(stderr, "Error: %s: the pointer left the tape\n", task->program);
+            task->status = 1;
+        } else if (state == BF_SESSION_YIELD) {
+            if (bf_fuel_refill(&fuel, left, &task->status) < 0) {
+                break;
+            }
+        } else if (state == BF_SESSION_INPUT) {
+            size_t got = fread(session.input, 1, BF_SESSION_INPUT_SIZE, input);
+            session.input_head = 0;
+            session.input_tail = (uint16_t)got;
+            session.input_eof = got == 0;
+        }
+    }
+    if (fclose(output) != 0) {
+        fprintf(stderr, "Error: %s: %s\n", task->output, strerror(errno));
+        task->status = 1;
+    }
+    fclose(input);
+    free(costs);
+    bf_bytecode_free(&program);
+}
+
+// Run a --batch manifest on `jobs` threads; returns 0 when every program succeeded
+int run_batch(const char *manifest, long jobs, const BfLimits *limits) {
+    BatchTask *tasks;
+    long count = read_batch_manifest(manifest, &tasks);
+    if (count < 0) {
+        return 1;
+    }
+    int workers = bf_pool_workers(jobs);
+    Batch batch = {tasks, limits, calloc((size_t)workers, TAPE_SIZE)};
+    if (!batch.tapes) {
+        perror("Failed to allocate tapes");
+        return 1;
+    }
+    int64_t start = bf_limits_now_ns();
+    bf_pool_run((size_t)count, workers, run_batch_task, &batch);
+    double seconds = (bf_limits_now_ns() - start) / 1e9;
+
+    long failed = 0;
+    for (long k = 0; k < count; ++k) {
+        if (tasks[k].status != 0) {
+            fprintf(stderr, "Error: %s exited with status %d\n", tasks[k].program, tasks[k].status);
+            failed++;
+        }
+        free(tasks[k].program);
+        free(tasks[k].input);
+        free(tasks[k].output);
+    }
+    fprintf(stderr, "Batch: %ld programs, %ld failed, %d threads, %.3f s (%.0f programs/s)\n", count, failed,
+            workers, seconds, seconds > 0 ? count / seconds : 0.0);
+    free(tasks);
+    free(batch.tapes);
+    return failed ? 1 : 0;
+}
+
+// --sessions: serve the program on a Unix socket, every connection running
+// it as a session with the socket as its stdin and stdout. All sessions share
+// this thread as coroutines (bf_common/bf_session.h) driven by one epoll loop:
+// a session blocked on `,` or on a full socket costs nothing until its socket
+// is ready, and a busy one yields after each slice so the rest stay
+// responsive. Tapes are slots of one lazily backed mapping, so a session only
+// pays for the tape pages it touches.
+#define SESSION_SLICE (1 << 20)
+#define SESSION_DEFAULT_MAX 65536
+
+typedef struct Session {
+    BfSession state;
+    int fd;
+    uint64_t id;
+    size_t slot;
+    size_t snapshot_sent;  // Bytes of the program's snapshot output sent so far
+    int queued;
+    struct Session *next;  // Run queue
+} Session;
+
+typedef struct {
+    const BfProgram *program;
+    const uint32_t *costs;
+    uint64_t max_steps;
+    int epoll_fd;
+    int listen_fd;
+    int listening;  // The listener is in the epoll set (not while at max_sessions)
+    unsigned char *tapes;
+    size_t tape_stride;
+    size_t *free_slots;
+    size_t free_count;
+    size_t max_sessions;
+    uint64_t started;
+    Session *queue_head, *queue_tail;
+} SessionServer;
+
+static volatile sig_atomic_t sessions_stop = 0;
+
+static void stop_sessions(int sig) {
+    (void)sig;
+    sessions_stop = 1;
+}
+
+static void queue_session(SessionServer *server, Session *session) {
+    if (session->queued) {
+        return;
+    }
+    session->queued = 1;
+    session->next = NULL;
+    if (server->queue_tail) {
+        server->queue_tail->next = session;
+    } else {
+        server->queue_head = session;
+    }
+    server->queue_tail = session;
+}
+
+// Send what the session has written; returns 0 once it is all sent, 1 when
+// the socket is full, -1 when the peer is gone
+static int send_session_output(SessionServer *server, Session *session) {
+    const BfSnapshot *snapshot = &server->program->snapshot;
+    BfSession *state = &session->state;
+    while (session->snapshot_sent < snapshot->output_size || state->output_sent < state->output_length) {
+        int from_snapshot = session->snapshot_sent < snapshot->output_size;
+        const char *data = from_snapshot ? snapshot->output + session->snapshot_sent
+                                         : (const char *)state->output + state->output_sent;
+        size_t length = from_snapshot ? snapshot->output_size - session->snapshot_sent
+                                      : (size_t)(state->output_length - state->output_sent);
+        ssize_t sent = send(session->fd, data, length, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 1 : -1;
+        }
+        if (from_snapshot) {
+            session->snapshot_sent += sent;
+        } else {
+            state->output_sent += sent;
+        }
+    }
+    state->output_sent = state->output_length = 0;
+    return 0;
+}
+
+static void close_session(SessionServer *server, Session *session) {
+    close(session->fd);
+    unsigned char *tape = server->tapes + session->slot * server->tape_stride;
+    madvise(tape, server->tape_stride, MADV_DONTNEED);  // Hands the pages back; they read as zero again
+    server->free_slots[server->free_count++] = session->slot;
+    free(session);
+    if (!server->listening) {
+        struct epoll_event event = {EPOLLIN, {NULL}};
+        server->listening = epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server->listen_fd, &event) == 0;
+    }
+}
+
+// Resume a session until it has to wait for its socket or uses up its slice
+static void step_session(SessionServer *server, Session *session) {
+    BfSession *state = &session->state;
+    for (;;) {
+        int64_t slice = SESSION_SLICE;
+        if (server->max_steps && (int64_t)(server->max_steps - state->steps) < slice) {
+            slice = (int64_t)(server->max_steps - state->steps);
+        }
+        int status = bf_session_resume(state, server->program, server->costs, slice);
+        int sent = send_session_output(server, session);
+        if (sent < 0) {
+            close_session(server, session);
+            return;
+        }
+        if (status == BF_SESSION_INPUT && sent == 0) {
+            ssize_t received = recv(session->fd, state->input, BF_SESSION_INPUT_SIZE, 0);
+            if (received >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+                state->input_head = 0;
+                state->input_tail = received > 0 ? (uint16_t)received : 0;
+                state->input_eof = received <= 0;  // Shut down for writing, or reset
+                continue;
+            }
+        } else if (status == BF_SESSION_YIELD) {
+            if (server->max_steps && state->steps >= server->max_steps) {
+                fprintf(stderr, "Session %llu: step limit reached\n", (unsigned long long)session->id);
+                close_session(server, session);
+            } else {
+                queue_session(server, session);
+            }
+        } else if (status == BF_SESSION_FAULT) {
+            fprintf(stderr, "Session %llu: pointer left the tape\n", (unsigned long long)session->id);
+            close_session(server, session);
+        } else if (status == BF_SESSION_END && sent == 0) {
+            close_session(server, session);
+        } else if (status == BF_SESSION_OUTPUT && sent == 0) {
+            continue;
+        }
+        return;  // Otherwise wait: edge-triggered epoll queues it when the socket is ready
+    }
+}
+
+static void accept_sessions(SessionServer *server) {
+    while (server->free_count > 0) {
+        int fd = accept4(server->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNABORTED) {
+                perror("Failed to accept session");
+            }
+            return;
+        }
+        Session *session = malloc(sizeof(Session));
+        if (!session) {
+            perror("Failed to allocate session");
+            close(fd);
+            return;
+        }
+        session->fd = fd;
+        session->id = ++server->started;
+        session->slot = server->free_slots[--server->free_count];
+        session->snapshot_sent = 0;
+        session->queued = 0;
+        bf_session_start(&session->state, server->program, server->tapes + session->slot * server->tape_stride,
+                         TAPE_SIZE);
+        struct epoll_event event = {EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, {session}};
+        if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+            perror("Failed to watch session");
+            close_session(server, session);
+            return;
+        }
+        queue_session(server, session);
+    }
+    if (server->listening && epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, server->listen_fd, NULL) == 0) {
+        server->listening = 0;  // Full: connections wait in the backlog until a session ends
+    }
+}
+
+static int listen_unix(const char *path) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Error: Socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(address.sun_path, path);
+    struct stat st;
+    if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(path);  // Left over from an earlier server
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1 || bind(fd, (struct sockaddr *)&address, sizeof(address)) == -1 || listen(fd, SOMAXCONN) == -1) {
+        perror("Failed to listen for sessions");
+        if (fd != -1) {
+            close(fd);
+        }
+        return -1;
+    }
+    return fd;
+}
+
+// Serve `program` on `path` until SIGINT or SIGTERM; returns the exit status
+int run_sessions(const BfProgram *program, const char *path, size_t max_sessions, const BfLimits *limits) {
+    if (program->snapshot.tape_size > TAPE_SIZE || program->snapshot.pointer >= TAPE_SIZE) {
+        fprintf(stderr, "Error: The program needs a larger tape than %d cells\n", TAPE_SIZE);
+        return 1;
+    }
+    struct rlimit files;
+    if (getrlimit(RLIMIT_NOFILE, &files) == 0) {
+        files.rlim_cur = files.rlim_max;  // One descriptor per session
+        setrlimit(RLIMIT_NOFILE, &files);
+        if (files.rlim_cur != RLIM_INFINITY && max_sessions > files.rlim_cur - 16) {
+            max_sessions = files.rlim_cur - 16;
+        }
+    }
+
+    SessionServer server;
+    memset(&server, 0, sizeof(server));
+    server.program = program;
+    server.max_steps = limits->max_steps;
+    server.max_sessions = max_sessions;
+    server.tape_stride = (TAPE_SIZE + 4095) & ~(size_t)4095;
+    uint32_t *costs = bf_bytecode_loop_costs(program);
+    server.costs = costs;
+    server.tapes = mmap(NULL, max_sessions * server.tape_stride, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    server.free_slots = malloc(max_sessions * sizeof(size_t));
+    if (server.tapes == MAP_FAILED || !server.free_slots) {
+        perror("Failed to allocate session tapes");
+        return 1;
+    }
+    for (size_t slot = 0; slot < max_sessions; ++slot) {
+        server.free_slots[server.free_count++] = max_sessions - 1 - slot;
+    }
+    server.listen_fd = listen_unix(path);
+    server.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event listen_event = {EPOLLIN, {NULL}};
+    if (server.listen_fd == -1 || server.epoll_fd == -1 ||
+        epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, server.listen_fd, &listen_event) == -1) {
+        if (server.listen_fd != -1) {
+            perror("Failed to watch the socket");
+        }
+        return 1;
+    }
+    server.listening = 1;
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stop_sessions;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    fprintf(stderr, "Serving on %s, up to %zu sessions\n", path, max_sessions);
+
+    struct epoll_event events[256];
+    while (!sessions_stop) {
+        int count = epoll_wait(server.epoll_fd, events, 256, server.queue_head ? 0 : -1);
+        if (count == -1 && errno != EINTR) {
+            perror("Failed to wait for sessions");
+            break;
+        }
+        for (int k = 0; k < count; ++k) {
+            if (events[k].data.ptr) {
+                queue_session(&server, (Session *)events[k].data.ptr);
+            } else {
+                accept_sessions(&server);
+            }
+        }
+        // One turn for everything ready now; sessions that yield go to the back
+        Session *ready = server.queue_head;
+        server.queue_head = server.queue_tail = NULL;
+        while (ready) {
+            Session *next = ready->next;
+            ready->queued = 0;
+            step_session(&server, ready);
+            ready = next;
+        }
     }
+
+    fprintf(stderr, "Served %llu sessions, %zu still open\n", (unsigned long long)server.started,
+            max_sessions - server.free_count);
+    unlink(path);
+    free(costs);
+    return 0;
 }
 
 // Count instruction executions
@@ -157,6 +874,30 @@ void analyze_loops(char *buffer, int input_length, int *jump_map, int *loop_coun
 }
 
 
+// Write per-loop counts keyed by command offset (see bf_common/bf_profile.h)
+int write_profile(const char *path, char *buffer, int input_length, int *jump_map, int *loop_counts) {
+    FILE *out = fopen(path, "w");
+    if (!out) {
+        perror("Failed to open profile output");
+        return 1;
+    }
+
+    bf_profile_write_header(out);
+    size_t offset = 0;  // Position among Brainfuck commands only
+    for (int i = 0; i < input_length; ++i) {
+        if (!bf_is_command(buffer[i])) {
+            continue;
+        }
+        if (buffer[i] == '[') {
+            bf_profile_write_loop(out, offset, loop_counts[i], loop_counts[jump_map[i]]);
+        }
+        offset++;
+    }
+
+    fclose(out);
+    return 0;
+}
+
 // Print profiling results
 void print_profiling_results(int *instruction_counts, loop_info_t *simple_loops, 
                              int simple_loop_count, loop_info_t *non_simple_loops, 
@@ -195,13 +936,120 @@ void print_profiling_results(int *instruction_counts, loop_info_t *simple_loops,
 }
 int main(int argc, char *argv[]) {
     int profiling_enabled = 0;
-    parse_arguments(argc, argv, &profiling_enabled);
+    const char *profile_out = NULL;
+    const char *bytecode_out = NULL;
+    const char *bytecode_in = NULL;
+    size_t preeval_steps = BF_PREEVAL_DEFAULT_STEPS;
+    BfLimits limits = {0, 0};
+    BfCheckpointOptions checkpoint = {NULL, BF_CHECKPOINT_DEFAULT_INTERVAL, NULL};
+    int perf_counters = 0;
+    const char *batch_manifest = NULL;
+    long jobs = 0;
+    const char *sessions_path = NULL;
+    size_t max_sessions = SESSION_DEFAULT_MAX;
+    int io_thread = 0;
+    int splice_output = 0;
+    long pipe_size = 0;
+    parse_arguments(argc, argv, &profiling_enabled, &profile_out, &bytecode_out, &bytecode_in, &preeval_steps,
+                    &limits, &checkpoint, &perf_counters, &batch_manifest, &jobs, &sessions_path, &max_sessions,
+                    &io_thread, &splice_output, &pipe_size);
 
     static unsigned char tape[TAPE_SIZE] = {0}; 
     unsigned char *ptr = tape;
 
     char output_buffer[OUTPUT_BUFFER_SIZE];
-    int output_index = 0;
+    Output output = {output_buffer, 0, OUTPUT_BUFFER_SIZE, stdout, NULL, NULL};
+
+    // A .bfc file is mapped and run as is: no reading, no bracket matching
+    if (profiling_enabled && bf_limits_enabled(&limits)) {
+        fprintf(stderr, "Error: --max-steps and --timeout don't apply to the profiler\n");
+        return 1;
+    }
+    if (profiling_enabled && perf_counters) {
+        fprintf(stderr, "Error: --perf-counters doesn't apply to the profiler\n");
+        return 1;
+    }
+    if ((profiling_enabled || bytecode_out) && (checkpoint.path || checkpoint.resume)) {
+        fprintf(stderr, "Error: --checkpoint and --resume only apply when running the program\n");
+        return 1;
+    }
+    if (io_thread && (profiling_enabled || bytecode_out || checkpoint.path || checkpoint.resume || batch_manifest ||
+                      sessions_path)) {
+        fprintf(stderr, "Error: --io-thread only applies when running one program, without checkpoints\n");
+        return 1;
+    }
+    if ((splice_output || pipe_size) && (io_thread || profiling_enabled || bytecode_out || batch_manifest ||
+                                         sessions_path || pipe_size < 0 || (pipe_size && !splice_output))) {
+        fprintf(stderr, "Error: --splice only applies when running one program, without --io-thread; --pipe-size "
+                        "needs --splice\n");
+        return 1;
+    }
+    if (checkpoint.interval <= 0) {
+        fprintf(stderr, "Error: --checkpoint-interval must be positive\n");
+        return 1;
+    }
+    if (batch_manifest) {
+        if (profiling_enabled || bytecode_out || bytecode_in || checkpoint.path || checkpoint.resume || perf_counters) {
+            fprintf(stderr, "Error: --batch only combines with -j, --max-steps and --timeout\n");
+            return 1;
+        }
+        return run_batch(batch_manifest, jobs, &limits);
+    }
+    if (sessions_path && (profiling_enabled || bytecode_out || checkpoint.path || checkpoint.resume || perf_counters ||
+                          limits.timeout > 0 || max_sessions == 0)) {
+        fprintf(stderr, "Error: --sessions only combines with --bytecode, --max-sessions (at least 1) and --max-steps\n");
+        return 1;
+    }
+    if (bytecode_in) {
+        if (profiling_enabled) {
+            fprintf(stderr, "Error: Profiling needs the source program, not bytecode\n");
+            return 1;
+        }
+        BfProgram program;
+        if (bf_bytecode_map(bytecode_in, &program) != 0) {
+            return 1;
+        }
+        if (program.snapshot.tape_size > TAPE_SIZE || program.snapshot.pointer >= TAPE_SIZE) {
+            fprintf(stderr, "Error: %s needs a larger tape than %d cells\n", bytecode_in, TAPE_SIZE);
+            bf_bytecode_free(&program);
+            return 1;
+        }
+        int status = sessions_path ? run_sessions(&program, sessions_path, max_sessions, &limits)
+                                   : execute_program(&program, tape, &limits, &checkpoint, perf_counters, io_thread,
+                                                     splice_output, pipe_size);
+        bf_bytecode_free(&program);
+        return status;
+    }
+
+    // Without the profiler only commands matter: stdin is mapped (when it is a
+    // file) and filtered in one pass. The profiler counts raw characters.
+    if (bytecode_out || !profiling_enabled) {
+        size_t input_length;
+        char *buffer = bf_read_source_fd(STDIN_FILENO, &input_length);
+        if (!buffer) {
+            return 1;
+        }
+        BfProgram program;
+        if (bf_bytecode_compile(buffer, input_length, &program) != 0) {
+            free(buffer);
+            return 1;
+        }
+        free(buffer);
+        bf_dataflow_optimize(&program, NULL);  // Drop dead loops, fold known constants
+        int status = 0;
+        if (bytecode_out) {
+            // Run the input-free prefix now, so the .bfc file starts where it ends
+            bf_preeval(&program, TAPE_SIZE, preeval_steps);
+            status = bf_bytecode_write(bytecode_out, &program) == 0 ? 0 : 1;
+        } else if (sessions_path) {
+            status = run_sessions(&program, sessions_path, max_sessions, &limits);
+        } else {
+            status = execute_program(&program, tape, &limits, &checkpoint, perf_counters, io_thread, splice_output,
+                                     pipe_size);
+        }
+        bf_bytecode_free(&program);
+        return status;
+    }
 
     char *buffer = NULL;
     size_t bufsize = 0;
@@ -212,170 +1060,97 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
-    int *jump_map = malloc(input_length * sizeof(int));
+    int *jump_map = create_jump_map(buffer, input_length);
     if (!jump_map) {
-        perror("Failed to allocate memory for jump map");
         free(buffer);
         return 1;
     }
 
-    memset(jump_map, -1, input_length * sizeof(int));
+    // Profiling path: the source is interpreted directly so counts map to characters
+    loop_info_t *simple_loops = calloc(TAPE_SIZE, sizeof(loop_info_t));
+    loop_info_t *non_simple_loops = calloc(TAPE_SIZE, sizeof(loop_info_t));
+    int *loop_counts = calloc(input_length, sizeof(int));
+    int simple_loop_count = 0;
+    int non_simple_loop_count = 0;
+    int total_instructions = 0;
+    int instruction_counts[256] = {0}; // Track instruction occurrences
 
-    int stack[TAPE_SIZE], stack_ptr = 0;
     for (int i = 0; i < input_length; ++i) {
-        if (buffer[i] == '[') {
-            stack[stack_ptr++] = i;
-        } else if (buffer[i] == ']') {
-            int open = stack[--stack_ptr];
-            int close = i;
-            jump_map[open] = close;
-            jump_map[close] = open;
-        }
-    }
-
-    if (!profiling_enabled) {
-        // Fast-path version without profiling
-       for (int i = 0; i < input_length; ++i) {
         char instruction = buffer[i];
-        
-        if (instruction == '>') {
-            int count = 1;
-            while (buffer[i + 1] == '>') { count++; i++; }
-            ptr += count;  // Optimize consecutive '>'
-        } 
-        else if (instruction == '<') {
-            int count = 1;
-            while (buffer[i + 1] == '<') { count++; i++; }
-            ptr -= count;  // Optimize consecutive '<'
-        }
-        else if (instruction == '+') {
-            int count = 1;
-            while (buffer[i + 1] == '+') { count++; i++; }
-            *ptr += count;  // Optimize consecutive '+'
-        } 
-        else if (instruction == '-') {
-            int count = 1;
-            while (buffer[i + 1] == '-') { count++; i++; }
-            *ptr -= count;  // Optimize consecutive '-'
-        }
-        else if (instruction == '.') {
-            int count = 1;
-            buffered_put(*ptr, output_buffer, &output_index);
-            while (buffer[i + 1] == '.') { 
-                i++; 
-                buffered_put(*ptr, output_buffer, &output_index);  // Optimize consecutive '.'
-            }
-        }
-        else if (instruction == ',') {
-            *ptr = getchar();
-        }
-        else if (instruction == '[' && buffer[i+1] == '-' && buffer[i+2] == ']') {
-            // Special case optimization for [-], clear the current cell
-            *ptr = 0;
-            i += 2;  // Skip past '-]'
-        }
-        else if (instruction == '[') {
-            if (!*ptr) {
-                i = jump_map[i];  // Jump to the end of the loop if current cell is zero
-            }
-        } 
-        else if (instruction == ']') {
-            if (*ptr) {
-                i = jump_map[i];  // Jump to the start of the loop if current cell is non-zero
-            }
-        } 
-        else if (instruction == '[' && buffer[i+1] == '>' && buffer[i+2] == '+' && buffer[i+3] == '<' && buffer[i+4] == '-') {
-            // Optimize [->+<] loop which adds current cell to the next cell and sets current cell to zero
-            *(ptr + 1) += *ptr;
-            *ptr = 0;
-            i += 4;  // Skip past ->+<]
-        }
-    }
-        flush_output(output_buffer, &output_index);
-    } else {
-        // Profiling-enabled path
-        loop_info_t *simple_loops = calloc(TAPE_SIZE, sizeof(loop_info_t));
-        loop_info_t *non_simple_loops = calloc(TAPE_SIZE, sizeof(loop_info_t));
-        int *loop_counts = calloc(input_length, sizeof(int));
-        int simple_loop_count = 0;
-        int non_simple_loop_count = 0;
-        int total_instructions = 0;
-        int instruction_counts[256] = {0}; // Track instruction occurrences
-
-        for (int i = 0; i < input_length; ++i) {
-            char instruction = buffer[i];
-            count_instructions(instruction_counts, instruction);
-            total_instructions++;
-
-            if (instruction == '[' || instruction == ']') {
-                loop_counts[i]++;
-            }
+        count_instructions(instruction_counts, instruction);
+        total_instructions++;
 
-           if (instruction == '>') {
-            int count = 1;
-            while (buffer[i + 1] == '>') { count++; i++; }
-            ptr += count;  // Optimize consecutive '>'
-        } 
-        else if (instruction == '<') {
-            int count = 1;
-            while (buffer[i + 1] == '<') { count++; i++; }
-            ptr -= count;  // Optimize consecutive '<'
-        }
-        else if (instruction == '+') {
-            int count = 1;
-            while (buffer[i + 1] == '+') { count++; i++; }
-            *ptr += count;  // Optimize consecutive '+'
-        } 
-        else if (instruction == '-') {
-            int count = 1;
-            while (buffer[i + 1] == '-') { count++; i++; }
-            *ptr -= count;  // Optimize consecutive '-'
-        }
-        else if (instruction == '.') {
-            int count = 1;
-            buffered_put(*ptr, output_buffer, &output_index);
-            while (buffer[i + 1] == '.') { 
-                i++; 
-                buffered_put(*ptr, output_buffer, &output_index);  // Optimize consecutive '.'
-            }
+        if (instruction == '[' || instruction == ']') {
+            loop_counts[i]++;
         }
-        else if (instruction == ',') {
-            *ptr = getchar();
+
+       if (instruction == '>') {
+        int count = 1;
+        while (buffer[i + 1] == '>') { count++; i++; }
+        ptr += count;  // Optimize consecutive '>'
+    } 
+    else if (instruction == '<') {
+        int count = 1;
+        while (buffer[i + 1] == '<') { count++; i++; }
+        ptr -= count;  // Optimize consecutive '<'
+    }
+    else if (instruction == '+') {
+        int count = 1;
+        while (buffer[i + 1] == '+') { count++; i++; }
+        *ptr += count;  // Optimize consecutive '+'
+    } 
+    else if (instruction == '-') {
+        int count = 1;
+        while (buffer[i + 1] == '-') { count++; i++; }
+        *ptr -= count;  // Optimize consecutive '-'
+    }
+    else if (instruction == '.') {
+        int count = 1;
+        buffered_put(*ptr, &output);
+        while (buffer[i + 1] == '.') { 
+            i++; 
+            buffered_put(*ptr, &output);  // Optimize consecutive '.'
         }
-        else if (instruction == '[' && buffer[i+1] == '-' && buffer[i+2] == ']') {
-            // Special case optimization for [-], clear the current cell
-            *ptr = 0;
-            i += 2;  // Skip past '-]'
+    }
+    else if (instruction == ',') {
+        *ptr = getchar();
+    }
+    else if (instruction == '[' && buffer[i+1] == '-' && buffer[i+2] == ']') {
+        // Special case optimization for [-], clear the current cell
+        *ptr = 0;
+        i += 2;  // Skip past '-]'
+    }
+    else if (instruction == '[') {
+        if (!*ptr) {
+            i = jump_map[i];  // Jump to the end of the loop if current cell is zero
         }
-        else if (instruction == '[') {
-            if (!*ptr) {
-                i = jump_map[i];  // Jump to the end of the loop if current cell is zero
-            }
-        } 
-        else if (instruction == ']') {
-            if (*ptr) {
-                i = jump_map[i];  // Jump to the start of the loop if current cell is non-zero
-            }
-        } 
-        else if (instruction == '[' && buffer[i+1] == '>' && buffer[i+2] == '+' && buffer[i+3] == '<' && buffer[i+4] == '-') {
-            // Optimize [->+<] loop which adds current cell to the next cell and sets current cell to zero
-            *(ptr + 1) += *ptr;
-            *ptr = 0;
-            i += 4;  // Skip past ->+<]
+    } 
+    else if (instruction == ']') {
+        if (*ptr) {
+            i = jump_map[i];  // Jump to the start of the loop if current cell is non-zero
         }
+    } 
+    else if (instruction == '[' && buffer[i+1] == '>' && buffer[i+2] == '+' && buffer[i+3] == '<' && buffer[i+4] == '-') {
+        // Optimize [->+<] loop which adds current cell to the next cell and sets current cell to zero
+        *(ptr + 1) += *ptr;
+        *ptr = 0;
+        i += 4;  // Skip past ->+<]
+    }
 
-            
-        }
+        
+    }
 
 
-        flush_output(output_buffer, &output_index);
-        analyze_loops(buffer, input_length, jump_map, loop_counts, &simple_loops, &non_simple_loops, &simple_loop_count, &non_simple_loop_count);
-        print_profiling_results(instruction_counts, simple_loops, simple_loop_count, non_simple_loops, non_simple_loop_count, total_instructions);
-        
-        free(loop_counts);
-        free(simple_loops);
-        free(non_simple_loops);
+    flush_output(&output);
+    if (profile_out) {
+        write_profile(profile_out, buffer, input_length, jump_map, loop_counts);
     }
+    analyze_loops(buffer, input_length, jump_map, loop_counts, &simple_loops, &non_simple_loops, &simple_loop_count, &non_simple_loop_count);
+    print_profiling_results(instruction_counts, simple_loops, simple_loop_count, non_simple_loops, non_simple_loop_count, total_instructions);
+    
+    free(loop_counts);
+    free(simple_loops);
+    free(non_simple_loops);
 
     
     free(buffer);
@@ -2,193 +2,1328 @@
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Verifier.h"
+#include "llvm/IR/MDBuilder.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Support/FileSystem.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/CFG.h"
 #include "llvm/IR/LegacyPassManager.h"
-#include "llvm/Transforms/IPO/PassManagerBuilder.h"
-#include "llvm/Transforms/Scalar.h" // This should include most Scalar passes
-#include "llvm/Transforms/Scalar/GVN.h" // Verify if this is necessary
+#include "llvm/IR/PassManager.h"
+#include "llvm/IR/PatternMatch.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/MC/TargetRegistry.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/Program.h"
+#include "llvm/MC/SubtargetFeature.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Target/TargetOptions.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
+#include "llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Config/llvm-config.h"
+#include <cstdio>
+#include <cstring>
 #include <iostream>
-#include <stack>
+#include <map>
+#include <vector>
 #include <memory>
 #include <string>
 #include <fstream>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <functional>
+#include "../bf_common/bf_profile.h"
+#include "../bf_common/bf_cache.h"
+#include "../bf_common/bf_dataflow.h"
+#include "../bf_common/bf_preeval.h"
+#include "../bf_common/bf_limits.h"
+#include "../bf_common/bf_perf.h"
+#include "../bf_common/bf_source.h"
 
 using namespace llvm;
+using namespace llvm::PatternMatch;
+
+// Static runtime linked into `-o` executables (built next to bf_compiler by CMake)
+#ifndef BF_RUNTIME_PATH
+#define BF_RUNTIME_PATH "libbf_runtime.a"
+#endif
 using namespace std;
 
-LLVMContext Context;
+// Owned through a pointer so --jit can hand the context over to ORC with the module
+unique_ptr<LLVMContext> ContextPtr = make_unique<LLVMContext>();
+LLVMContext &Context = *ContextPtr;
 unique_ptr<Module> ModulePtr;
 IRBuilder<> Builder(Context);
 
-void generateLLVM(const string& code) {
-    ModulePtr = make_unique<Module>("bf_module", Context);
+const uint64_t TapeSize = 30000;  // Cells on the tape
 
-    // Create the main function
-    FunctionType *FuncType = FunctionType::get(Type::getInt32Ty(Context), false);
-    Function *MainFunc = Function::Create(FuncType, Function::ExternalLinkage, "main", ModulePtr.get());
+// Branch weights for a loop test from the profile; the true edge leaves the loop.
+// At '[' the body is entered min(entries, iterations) times, at ']' the rest are back-edges.
+MDNode *loopBranchWeights(const BfProfile *profile, size_t position, bool atLoopEnd) {
+    if (!profile || !profile->size) {
+        return nullptr;
+    }
+    MDBuilder MDB(Context);
+    long entries = profile->entries[position];
+    long iterations = profile->iterations[position];
+    if (entries == 0) {
+        return MDB.createBranchWeights(2000, 1);  // Cold: never reached while profiling
+    }
+    long entered = min(entries, iterations);
+    uint64_t exitWeight = atLoopEnd ? entered : entries - entered;
+    uint64_t bodyWeight = atLoopEnd ? iterations - entered : entered;
+    while (exitWeight > UINT32_MAX || bodyWeight > UINT32_MAX) {
+        exitWeight >>= 1;
+        bodyWeight >>= 1;
+    }
+    return MDB.createBranchWeights(exitWeight, bodyWeight);
+}
 
-    BasicBlock *EntryBB = BasicBlock::Create(Context, "entry", MainFunc);
-    Builder.SetInsertPoint(EntryBB);
+// llvm.loop hints: loops the profile didn't find hot skip unrolling and vectorization,
+// so the optimizer's expensive transforms are spent on the measured hot loops
+MDNode *loopHints(const BfProfile *profile, size_t position) {
+    if (!profile || !profile->size || bf_profile_is_hot(profile, position)) {
+        return nullptr;
+    }
+    Metadata *Unroll = MDNode::get(Context, {MDString::get(Context, "llvm.loop.unroll.disable")});
+    Metadata *Vectorize = MDNode::get(Context, {MDString::get(Context, "llvm.loop.vectorize.enable"),
+                                                ConstantAsMetadata::get(Builder.getFalse())});
+    MDNode *LoopID = MDNode::getDistinct(Context, {nullptr, Unroll, Vectorize});
+    LoopID->replaceOperandWith(0, LoopID);  // Loop IDs refer to themselves
+    return LoopID;
+}
 
-    // Tape memory array (30000 cells of i8)
-    ArrayType *TapeType = ArrayType::get(Type::getInt8Ty(Context), 30000);
-    GlobalVariable *Tape = new GlobalVariable(*ModulePtr, TapeType, false, GlobalValue::PrivateLinkage, Constant::getNullValue(TapeType), "tape");
+// Resolves pointers to a base plus a constant byte offset through GEP chains.
+// Every pointer move adds a GEP to the chain, so straight-line code builds
+// chains as long as the program; results are memoized to keep lookups O(1).
+class PointerOffsets {
+public:
+    explicit PointerOffsets(const DataLayout &DL) : DL(DL) {}
 
-    // Pointer to the start of the tape
-    Value *TapePtr = Builder.CreateGEP(TapeType, Tape, {Builder.getInt32(0), Builder.getInt32(0)}, "tape_ptr");
+    pair<Value *, int64_t> resolve(Value *Ptr) {
+        vector<pair<Value *, int64_t>> chain;  // Unresolved GEPs and their own offset
+        pair<Value *, int64_t> result = {Ptr, 0};
+        for (Value *V = Ptr;;) {
+            auto Known = Cache.find(V);
+            if (Known != Cache.end()) {
+                result = Known->second;
+                break;
+            }
+            auto *GEP = dyn_cast<GEPOperator>(V);
+            APInt Off(DL.getIndexTypeSizeInBits(V->getType()), 0);
+            if (!GEP || !GEP->accumulateConstantOffset(DL, Off)) {
+                result = {V, 0};
+                break;
+            }
+            chain.push_back({V, Off.getSExtValue()});
+            V = GEP->getPointerOperand();
+        }
+        for (auto It = chain.rbegin(); It != chain.rend(); ++It) {
+            result.second += It->second;
+            Cache[It->first] = result;
+        }
+        return result;
+    }
 
-    // Index variable initialized to 0
-    AllocaInst *Index = Builder.CreateAlloca(Type::getInt64Ty(Context), nullptr, "index");
-    Builder.CreateStore(Builder.getInt64(0), Index);
+    // Offset of Ptr from Base, if both are constant offsets from the same root
+    bool offsetFrom(Value *Ptr, Value *Base, int64_t &Offset) {
+        pair<Value *, int64_t> P = resolve(Ptr), B = resolve(Base);
+        Offset = P.second - B.second;
+        return P.first == B.first;
+    }
 
-    // Declare external functions for input and output
-    FunctionCallee PutCharFunc = ModulePtr->getOrInsertFunction("putchar", FunctionType::get(Type::getInt32Ty(Context), {Type::getInt32Ty(Context)}, false));
-    FunctionCallee GetCharFunc = ModulePtr->getOrInsertFunction("getchar", FunctionType::get(Type::getInt32Ty(Context), {}, false));
+    void clear() { Cache.clear(); }
+
+private:
+    const DataLayout &DL;
+    DenseMap<Value *, pair<Value *, int64_t>> Cache;
+};
+
+// A loop in the shape generateLLVM emits for a body without nested loops or I/O:
+//   body: %p = phi [%entry, preheader], [%next, body]
+//         ... loads/adds/stores at constant offsets from %p ...
+//         br (load %next) == 0, exit, body
+struct BFLoop {
+    BasicBlock *Body, *Preheader, *Exit;
+    PHINode *Ptr;
+    Value *EntryPtr;            // Tape pointer when the loop is entered
+    int64_t Shift;              // Net pointer move per iteration
+    map<int64_t, int64_t> Deltas;  // Net change per iteration at each offset
+};
+
+static bool matchBFLoop(BasicBlock &B, PointerOffsets &Offsets, BFLoop &L) {
+    auto *Br = dyn_cast<BranchInst>(B.getTerminator());
+    if (!Br || !Br->isConditional() || Br->getSuccessor(1) != &B || Br->getSuccessor(0) == &B || pred_size(&B) != 2) {
+        return false;
+    }
+    auto *Test = dyn_cast<ICmpInst>(Br->getCondition());
+    if (!Test || Test->getPredicate() != ICmpInst::ICMP_EQ || !match(Test->getOperand(1), m_Zero())) {
+        return false;
+    }
+    auto *TestLoad = dyn_cast<LoadInst>(Test->getOperand(0));
+    auto *Ptr = dyn_cast<PHINode>(&B.front());
+    if (!TestLoad || !Ptr || !Ptr->getType()->isPointerTy() || Ptr->getNextNode() != B.getFirstNonPHI()) {
+        return false;
+    }
+
+    L.Body = &B;
+    L.Exit = Br->getSuccessor(0);
+    L.Ptr = Ptr;
+    for (BasicBlock *Pred : predecessors(&B)) {
+        if (Pred != &B) {
+            L.Preheader = Pred;
+        }
+    }
+    L.EntryPtr = Ptr->getIncomingValueForBlock(L.Preheader);
+    Value *Next = Ptr->getIncomingValueForBlock(&B);
+    if (!Offsets.offsetFrom(Next, Ptr, L.Shift)) {
+        return false;
+    }
+
+    // Track every i8 value as "cell[offset] at iteration start + delta"
+    map<Value *, pair<int64_t, int64_t>> Cells;
+    L.Deltas.clear();
+    for (Instruction &I : B) {
+        if (&I == Ptr || &I == Br || &I == Test) {
+            continue;
+        }
+        int64_t Offset;
+        if (auto *GEP = dyn_cast<GetElementPtrInst>(&I)) {
+            if (!Offsets.offsetFrom(GEP, Ptr, Offset)) {
+                return false;
+            }
+        } else if (auto *Load = dyn_cast<LoadInst>(&I)) {
+            if (!Load->isSimple() || !Load->getType()->isIntegerTy(8) || !Offsets.offsetFrom(Load->getPointerOperand(), Ptr, Offset)) {
+                return false;
+            }
+            Cells[Load] = {Offset, L.Deltas[Offset]};
+        } else if (auto *Add = dyn_cast<BinaryOperator>(&I)) {
+            auto *Step = dyn_cast<ConstantInt>(Add->getOperand(1));
+            auto Cell = Cells.find(Add->getOperand(0));
+            if (Add->getOpcode() != Instruction::Add || !Step || Cell == Cells.end()) {
+                return false;
+            }
+            Cells[Add] = {Cell->second.first, Cell->second.second + Step->getSExtValue()};
+        } else if (auto *Store = dyn_cast<StoreInst>(&I)) {
+            auto Cell = Cells.find(Store->getValueOperand());
+            if (!Store->isSimple() || Cell == Cells.end() || !Offsets.offsetFrom(Store->getPointerOperand(), Ptr, Offset) ||
+                Cell->second.first != Offset) {
+                return false;
+            }
+            L.Deltas[Offset] = Cell->second.second;
+        } else {
+            return false;  // Calls, nested control flow, anything else
+        }
+    }
+
+    // The test must read the final value of the cell the pointer ends on
+    auto Tested = Cells.find(TestLoad);
+    if (Tested == Cells.end() || Tested->second.first != L.Shift || Tested->second.second != L.Deltas[L.Shift]) {
+        return false;
+    }
+
+    // Only the pointer may leave the loop, through the exit block's phis
+    for (Instruction &I : B) {
+        for (User *U : I.users()) {
+            auto *UI = cast<Instruction>(U);
+            if (UI->getParent() == &B) {
+                continue;
+            }
+            auto *ExitPhi = dyn_cast<PHINode>(UI);
+            if (!ExitPhi || ExitPhi->getParent() != L.Exit || &I != Next) {
+                return false;
+            }
+        }
+    }
+    for (PHINode &ExitPhi : L.Exit->phis()) {
+        if (ExitPhi.getIncomingValueForBlock(&B) != Next) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Replace the loop body with straight-line code computing the exit pointer
+static void replaceBFLoop(BFLoop &L, const function<Value *(IRBuilder<> &)> &Emit) {
+    vector<Instruction *> Old;
+    for (Instruction &I : *L.Body) {
+        Old.push_back(&I);
+    }
+
+    IRBuilder<> B(L.Body, L.Body->getFirstInsertionPt());
+    Value *ExitPtr = Emit(B);
+    B.CreateBr(L.Exit);
+    for (PHINode &ExitPhi : L.Exit->phis()) {
+        ExitPhi.setIncomingValueForBlock(L.Body, ExitPtr);
+    }
+
+    L.Ptr->replaceAllUsesWith(L.EntryPtr);
+    for (auto It = Old.rbegin(); It != Old.rend(); ++It) {
+        (*It)->replaceAllUsesWith(PoisonValue::get((*It)->getType()));
+        (*It)->eraseFromParent();
+    }
+}
+
+// Merge runs of `store i8 0` to consecutive cells (`[-]>[-]>[-]...`) into one memset
+static bool mergeZeroStores(BasicBlock &BB, PointerOffsets &Offsets) {
+    const int64_t MinRun = 4;
+    bool Changed = false;
+    Value *RunBase = nullptr;
+    StoreInst *RunLast = nullptr;  // Latest store of the run in program order
+    map<int64_t, StoreInst *> Run;
+
+    auto flush = [&]() {
+        if ((int64_t)Run.size() >= MinRun && Run.rbegin()->first - Run.begin()->first + 1 == (int64_t)Run.size()) {
+            IRBuilder<> B(RunLast);
+            Value *Start = B.CreateGEP(B.getInt8Ty(), RunBase, B.getInt64(Run.begin()->first), "clear_start");
+            B.CreateMemSet(Start, B.getInt8(0), B.getInt64(Run.size()), MaybeAlign(1));
+            for (auto &Entry : Run) {
+                Entry.second->eraseFromParent();
+            }
+            Changed = true;
+        }
+        Run.clear();
+        RunBase = nullptr;
+    };
+
+    for (auto It = BB.begin(); It != BB.end();) {
+        Instruction &I = *It++;
+        if (isa<GetElementPtrInst>(I)) {
+            continue;  // Pointer arithmetic doesn't touch memory
+        }
+        auto *Store = dyn_cast<StoreInst>(&I);
+        if (Store && Store->isSimple() && match(Store->getValueOperand(), m_Zero()) &&
+            Store->getValueOperand()->getType()->isIntegerTy(8)) {
+            auto [Base, Offset] = Offsets.resolve(Store->getPointerOperand());
+            if (RunBase && Base != RunBase) {
+                flush();
+            }
+            RunBase = Base;
+            RunLast = Store;
+            if (!Run.emplace(Offset, Store).second) {
+                Run[Offset]->eraseFromParent();  // Earlier clear of the same cell is dead
+                Run[Offset] = Store;
+            }
+            continue;
+        }
+        flush();
+    }
+    flush();
+    return Changed;
+}
 
-    // Stacks for loop handling
-    stack<BasicBlock*> loopStartStack;
-    stack<BasicBlock*> afterLoopStack;
+// BF loop-idiom pass. Rewrites the loops left after front-end folding:
+//   zeroing/multiply loops  [-], [->+<]  -> straight-line mul/add and a store of 0
+//   scan loops              [>], [<]     -> memchr / memrchr over the tape
+//   runs of cleared cells                -> memset
+// Scans need the tape bounds, so they only fire in functions whose first
+// argument is the dereferenceable tape (bf_program).
+struct BFLoopIdiomPass : PassInfoMixin<BFLoopIdiomPass> {
+    PreservedAnalyses run(Function &F, FunctionAnalysisManager &) {
+        const DataLayout &DL = F.getParent()->getDataLayout();
+        PointerOffsets Offsets(DL);
+        Value *Tape = F.arg_size() ? F.getArg(0) : nullptr;
+        uint64_t TapeBytes = Tape ? F.getParamDereferenceableBytes(0) : 0;
+        bool Changed = false;
+
+        vector<BasicBlock *> Blocks;
+        for (BasicBlock &BB : F) {
+            Blocks.push_back(&BB);
+        }
+        for (BasicBlock *BB : Blocks) {
+            BFLoop L;
+            if (!matchBFLoop(*BB, Offsets, L)) {
+                continue;
+            }
+            int64_t Step = L.Deltas[0] & 0xff;
+            bool OnlyScan = all_of(L.Deltas.begin(), L.Deltas.end(),
+                                   [](const pair<const int64_t, int64_t> &D) { return (D.second & 0xff) == 0; });
+
+            if (L.Shift == 0 && (Step == 1 || Step == 0xff)) {
+                // Runs cell[0] times when counting down, 256 - cell[0] when counting up
+                replaceBFLoop(L, [&](IRBuilder<> &B) -> Value * {
+                    Value *Counter = B.CreateLoad(B.getInt8Ty(), L.EntryPtr, "counter");
+                    Value *Times = Step == 0xff ? Counter : B.CreateNeg(Counter, "times");
+                    for (auto &D : L.Deltas) {
+                        if (D.first == 0 || (D.second & 0xff) == 0) {
+                            continue;
+                        }
+                        Value *Cell = B.CreateGEP(B.getInt8Ty(), L.EntryPtr, B.getInt64(D.first), "cell");
+                        Value *Val = B.CreateLoad(B.getInt8Ty(), Cell, "val");
+                        Value *Product = B.CreateMul(Times, B.getInt8((uint8_t)D.second), "mul");
+                        B.CreateStore(B.CreateAdd(Val, Product, "mul_add"), Cell);
+                    }
+                    B.CreateStore(B.getInt8(0), L.EntryPtr);
+                    return L.EntryPtr;
+                });
+                Changed = true;
+                Offsets.clear();  // The rewrite erased cached pointers
+            } else if ((L.Shift == 1 || L.Shift == -1) && OnlyScan && TapeBytes) {
+                // [>] stops at the first zero after the entry cell, [<] at the last one before it
+                Module &M = *F.getParent();
+                Type *PtrTy = L.EntryPtr->getType();
+                FunctionType *ChrType = FunctionType::get(PtrTy, {PtrTy, Type::getInt32Ty(F.getContext()), DL.getIntPtrType(F.getContext())}, false);
+                FunctionCallee Chr = M.getOrInsertFunction(L.Shift == 1 ? "memchr" : "memrchr", ChrType);
+                replaceBFLoop(L, [&](IRBuilder<> &B) -> Value * {
+                    Type *IntPtrTy = DL.getIntPtrType(F.getContext());
+                    Value *Start = L.Shift == 1 ? B.CreateGEP(B.getInt8Ty(), L.EntryPtr, B.getInt64(1), "scan_start") : Tape;
+                    Value *End = L.Shift == 1 ? B.CreateGEP(B.getInt8Ty(), Tape, B.getInt64(TapeBytes), "tape_end") : L.EntryPtr;
+                    Value *Len = B.CreateSub(B.CreatePtrToInt(End, IntPtrTy), B.CreatePtrToInt(Start, IntPtrTy), "scan_len");
+                    return B.CreateCall(Chr, {Start, B.getInt32(0), Len}, "scan_ptr");
+                });
+                Changed = true;
+                Offsets.clear();  // The rewrite erased cached pointers
+            }
+        }
+
+        for (BasicBlock &BB : F) {
+            Changed |= mergeZeroStores(BB, Offsets);
+        }
+        return Changed ? PreservedAnalyses::none() : PreservedAnalyses::all();
+    }
+};
+
+// Front-end op after run-length and offset folding. Offsets are relative to
+// the tape pointer at the op, so a straight-line run like `>+>++<<` becomes
+// two adds and no pointer movement at all.
+struct BFOp {
+    enum Kind { Add, Move, Output, Input, LoopStart, LoopEnd, MulLoop } kind;
+    int offset;                   // Cell touched (Add/Output/Input/MulLoop counter)
+    int value;                    // Add: delta, Move: shift, MulLoop: counter step (+1/-1)
+    size_t position;              // Loops: command offset of the '[' (profile key)
+    vector<pair<int, int>> terms; // MulLoop: cell[offset] += counter * factor
+};
+
+// Fold the source into BFOp. Adds and moves are buffered until a loop boundary;
+// I/O only flushes the adds, so the pointer is materialized once per block.
+// Loops whose body is a single balanced run that steps cell 0 by +-1 become MulLoop.
+bool foldProgram(const string& code, vector<BFOp>& ops) {
+    map<int, int> pendingAdds;  // offset -> accumulated delta
+    int pendingShift = 0;
+    vector<size_t> openLoops;   // Indices of LoopStart ops
+    size_t position = 0;
+
+    auto flushAdds = [&]() {
+        for (auto &[offset, delta] : pendingAdds) {
+            if (delta & 0xff) {
+                ops.push_back({BFOp::Add, offset, delta, 0, {}});
+            }
+        }
+        pendingAdds.clear();
+    };
+    auto flushAll = [&]() {
+        flushAdds();
+        if (pendingShift != 0) {
+            ops.push_back({BFOp::Move, 0, pendingShift, 0, {}});
+            pendingShift = 0;
+        }
+    };
 
     for (char command : code) {
+        if (command == ' ') {
+            position++;  // A command blanked by bf_remove_dead_loops
+            continue;
+        }
+        if (!bf_is_command(command)) {
+            continue;  // Comments don't advance the command offset
+        }
         switch (command) {
-            case '>':  // Increment index
+            case '>': pendingShift++; break;
+            case '<': pendingShift--; break;
+            case '+': pendingAdds[pendingShift]++; break;
+            case '-': pendingAdds[pendingShift]--; break;
+            case '.':
+                flushAdds();
+                ops.push_back({BFOp::Output, pendingShift, 0, 0, {}});
+                break;
+            case ',':
+                pendingAdds.erase(pendingShift);  // Overwritten by the input anyway
+                flushAdds();
+                ops.push_back({BFOp::Input, pendingShift, 0, 0, {}});
+                break;
+            case '[':
+                flushAll();
+                openLoops.push_back(ops.size());
+                ops.push_back({BFOp::LoopStart, 0, 0, position, {}});
+                break;
+            case ']':
                 {
-                    Value *CurrentIndex = Builder.CreateLoad(Type::getInt64Ty(Context), Index, "load_index");
-                    CurrentIndex = Builder.CreateAdd(CurrentIndex, Builder.getInt64(1), "inc_index");
-                    Builder.CreateStore(CurrentIndex, Index);
+                    if (openLoops.empty()) {
+                        cerr << "Error: unmatched ']' in Brainfuck code" << endl;
+                        return false;
+                    }
+                    size_t start = openLoops.back();
+                    openLoops.pop_back();
+
+                    auto counter = pendingAdds.find(0);
+                    int step = counter == pendingAdds.end() ? 0 : (int8_t)counter->second;
+                    if (ops.size() == start + 1 && pendingShift == 0 && (step == 1 || step == -1)) {
+                        BFOp &loop = ops[start];
+                        loop.kind = BFOp::MulLoop;
+                        loop.value = step;
+                        for (auto &[offset, delta] : pendingAdds) {
+                            if (offset != 0 && (delta & 0xff)) {
+                                loop.terms.push_back({offset, delta});
+                            }
+                        }
+                        pendingAdds.clear();
+                        break;
+                    }
+
+                    flushAll();
+                    ops.push_back({BFOp::LoopEnd, 0, 0, ops[start].position, {}});
                 }
                 break;
-            case '<':  // Decrement index
-                {
-                    Value *CurrentIndex = Builder.CreateLoad(Type::getInt64Ty(Context), Index, "load_index");
-                    CurrentIndex = Builder.CreateSub(CurrentIndex, Builder.getInt64(1), "dec_index");
-                    Builder.CreateStore(CurrentIndex, Index);
+        }
+        position++;
+    }
+    flushAll();
+
+    if (!openLoops.empty()) {
+        cerr << "Error: unmatched '[' in Brainfuck code" << endl;
+        return false;
+    }
+    return true;
+}
+
+// With outlineLoops every top-level loop becomes its own external function
+// `ptr bf_loop_N(ptr tape, ptr p)` returning the moved pointer, so the module
+// can be split into independently compiled parts (see compileParallel).
+// Whether a multiply loop, its pointer `shift` cells along, changes the cell
+// at `target`
+bool mulLoopTouches(const BFOp &op, long shift, long target) {
+    if (shift + op.offset == target) {
+        return true;
+    }
+    for (auto &[offset, factor] : op.terms) {
+        if (shift + offset == target) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Whether the loop opened at ops[start] ends every iteration where it began,
+// so it hands the pointer back unmoved. Sets `touches` if it may change the
+// cell `target` cells from its pointer, and `end` to its LoopEnd.
+bool loopBalanced(const vector<BFOp> &ops, size_t start, long target, bool &touches, size_t &end) {
+    long shift = 0;
+    for (size_t k = start + 1; k < ops.size(); ++k) {
+        const BFOp &op = ops[k];
+        switch (op.kind) {
+            case BFOp::Move:
+                shift += op.value;
+                break;
+            case BFOp::Add:
+            case BFOp::Input:
+                touches |= shift + op.offset == target;
+                break;
+            case BFOp::Output:
+                break;
+            case BFOp::MulLoop:
+                touches |= mulLoopTouches(op, shift, target);
+                break;
+            case BFOp::LoopStart:
+                if (!loopBalanced(ops, k, target - shift, touches, k)) {
+                    return false;
                 }
                 break;
-            case '+':  // Increment byte at pointer
+            case BFOp::LoopEnd:
+                end = k;
+                return shift == 0;
+        }
+    }
+    return false;
+}
+
+// Whether the loop opened at ops[start] ends without outside help. Loops
+// nested in it must hand the pointer back unmoved; they are charged on their
+// own unless they end by themselves too.
+// - A body that moves the pointer runs until it finds a zero cell or leaves
+//   the tape, like a scan: at most the tape's length in iterations.
+// - A body that returns to the counter cell and steps it by an odd amount,
+//   with no nested loop changing it, runs at most 256 times.
+// Under limits such loops are not charged; whatever loop encloses them is.
+bool loopTerminates(const vector<BFOp> &ops, size_t start) {
+    long shift = 0, counterStep = 0;
+    bool counterTouched = false;  // Other than by the body's own adds
+    for (size_t k = start + 1; k < ops.size() && ops[k].kind != BFOp::LoopEnd; ++k) {
+        const BFOp &op = ops[k];
+        if (op.kind == BFOp::Move) {
+            shift += op.value;
+        } else if (op.kind == BFOp::Add && shift + op.offset == 0) {
+            counterStep += op.value;
+        } else if (op.kind == BFOp::Input) {
+            counterTouched |= shift + op.offset == 0;
+        } else if (op.kind == BFOp::MulLoop) {
+            counterTouched |= mulLoopTouches(op, shift, 0);
+        } else if (op.kind == BFOp::LoopStart && !loopBalanced(ops, k, -shift, counterTouched, k)) {
+            return false;
+        }
+    }
+    return shift != 0 || (!counterTouched && (counterStep & 1));
+}
+
+// --max-steps/--timeout (bf_common/bf_limits.h). The fuel counter and its slow
+// path are generated into the module, so output.ll, executables and --jit all
+// enforce the limits alike; only write, exit and clock_gettime come from libc
+// or bf_runtime. Inside a function the fuel is an SSA value threaded through
+// the loops like the tape pointer, so it lives in a register; the global only
+// carries it across calls (main, bf_program, outlined loops).
+struct FuelRuntime {
+    GlobalVariable *Fuel = nullptr;  // Left in the current slice; null without limits
+    Function *Start = nullptr;       // Sets the deadline and the first slice
+    Function *Refill = nullptr;      // Fuel that went negative -> fuel for the next slice
+    Function *Report = nullptr;      // Prints the steps executed
+};
+
+// Constant string (no terminator), as a pointer to its first byte
+Constant *createCString(const string &text, const char *name, GlobalValue::LinkageTypes linkage) {
+    Constant *Text = ConstantDataArray::getString(Context, text, false);
+    GlobalVariable *G = new GlobalVariable(*ModulePtr, Text->getType(), true, linkage, Text, name);
+    return ConstantExpr::getInBoundsGetElementPtr(Text->getType(), G, ArrayRef<Constant *>{Builder.getInt64(0), Builder.getInt64(0)});
+}
+
+// `linkage` is external when the module is split into parts (-j), which all reach the fuel
+FuelRuntime createFuelRuntime(const BfLimits &limits, GlobalValue::LinkageTypes linkage) {
+    FuelRuntime R;
+    if (!bf_limits_enabled(&limits)) {
+        return R;
+    }
+    IRBuilder<> B(Context);
+    Type *I32 = B.getInt32Ty(), *I64 = B.getInt64Ty(), *PtrTy = B.getInt8PtrTy();
+    auto global = [&](const char *name) {
+        return new GlobalVariable(*ModulePtr, I64, false, linkage, B.getInt64(0), name);
+    };
+    R.Fuel = global("bf_fuel");
+    GlobalVariable *Steps = global("bf_fuel_steps");  // Charged before the current slice
+    GlobalVariable *Slice = global("bf_fuel_slice");
+    GlobalVariable *Deadline = global("bf_fuel_deadline");
+    FunctionCallee WriteFunc = ModulePtr->getOrInsertFunction("write", FunctionType::get(I64, {I32, PtrTy, I64}, false));
+    FunctionCallee ExitFunc = ModulePtr->getOrInsertFunction("exit", FunctionType::get(B.getVoidTy(), {I32}, false));
+    FunctionCallee ClockFunc = ModulePtr->getOrInsertFunction("clock_gettime", FunctionType::get(I32, {I32, PtrTy}, false));
+    auto newFunction = [&](const char *name, Type *Result, ArrayRef<Type *> Params = {}) {
+        Function *F = Function::Create(FunctionType::get(Result, Params, false), linkage, name, ModulePtr.get());
+        F->addFnAttr(Attribute::NoInline);
+        F->addFnAttr(Attribute::Cold);
+        B.SetInsertPoint(BasicBlock::Create(Context, "entry", F));
+        return F;
+    };
+    auto stepsSoFar = [&](Value *Left) {
+        return B.CreateAdd(B.CreateLoad(I64, Steps), B.CreateSub(B.CreateLoad(I64, Slice), Left));
+    };
+    auto fail = [&](Function *F, const string &message, int status) {
+        BasicBlock *Block = BasicBlock::Create(Context, "limit_hit", F);
+        IRBuilder<> E(Block);
+        E.CreateCall(WriteFunc, {E.getInt32(2), createCString(message, "bf_fuel_message", linkage), E.getInt64(message.size())});
+        E.CreateCall(ExitFunc, {E.getInt32(status)});
+        E.CreateUnreachable();
+        return Block;
+    };
+
+    // CLOCK_MONOTONIC in ns
+    Function *Clock = newFunction("bf_fuel_clock", I64);
+    Type *TimespecTy = ArrayType::get(I64, 2);
+    Value *Now = B.CreateAlloca(TimespecTy, nullptr, "now");
+    B.CreateCall(ClockFunc, {B.getInt32(1), B.CreatePointerCast(Now, PtrTy)});
+    Value *Seconds = B.CreateLoad(I64, B.CreateConstGEP2_64(TimespecTy, Now, 0, 0));
+    Value *Nanos = B.CreateLoad(I64, B.CreateConstGEP2_64(TimespecTy, Now, 0, 1));
+    B.CreateRet(B.CreateAdd(B.CreateMul(Seconds, B.getInt64(1000000000)), Nanos));
+
+    // Slow path: charge the slice, then check the budget and the clock
+    R.Refill = newFunction("bf_fuel_refill", I64, {I64});
+    Value *Total = stepsSoFar(R.Refill->getArg(0));
+    B.CreateStore(Total, Steps);
+    Value *Next = B.getInt64(BF_LIMITS_SLICE);
+    if (limits.max_steps) {
+        char message[96];
+        snprintf(message, sizeof(message), "Error: Step limit of %llu exceeded\n", (unsigned long long)limits.max_steps);
+        BasicBlock *Within = BasicBlock::Create(Context, "within", R.Refill);
+        B.CreateCondBr(B.CreateICmpUGE(Total, B.getInt64(limits.max_steps)),
+                       fail(R.Refill, message, BF_LIMITS_EXIT_STEPS), Within);
+        B.SetInsertPoint(Within);
+        Value *Left = B.CreateSub(B.getInt64(limits.max_steps), Total);
+        Next = B.CreateSelect(B.CreateICmpULT(Left, Next), Left, Next);
+    }
+    B.CreateStore(Next, Slice);
+    if (limits.timeout > 0) {
+        char message[96];
+        snprintf(message, sizeof(message), "Error: Time limit of %g seconds exceeded\n", limits.timeout);
+        BasicBlock *InTime = BasicBlock::Create(Context, "in_time", R.Refill);
+        B.CreateCondBr(B.CreateICmpSGE(B.CreateCall(Clock), B.CreateLoad(I64, Deadline)),
+                       fail(R.Refill, message, BF_LIMITS_EXIT_TIME), InTime);
+        B.SetInsertPoint(InTime);
+    }
+    B.CreateRet(Next);
+
+    R.Start = newFunction("bf_fuel_start", B.getVoidTy());
+    if (limits.timeout > 0) {
+        B.CreateStore(B.CreateAdd(B.CreateCall(Clock), B.getInt64((int64_t)(limits.timeout * 1e9))), Deadline);
+    }
+    B.CreateStore(B.CreateCall(R.Refill, {B.getInt64(0)}), R.Fuel);  // Nothing charged yet: the first slice
+    B.CreateRetVoid();
+
+    // "Steps executed: N\n" on stderr, the digits built backwards in a buffer
+    R.Report = newFunction("bf_fuel_report", B.getVoidTy());
+    Type *DigitsTy = ArrayType::get(B.getInt8Ty(), 21);
+    Value *Digits = B.CreateAlloca(DigitsTy, nullptr, "digits");
+    B.CreateStore(B.getInt8('\n'), B.CreateConstGEP2_64(DigitsTy, Digits, 0, 20));
+    Value *Count = stepsSoFar(B.CreateLoad(I64, R.Fuel));
+    BasicBlock *Entry = B.GetInsertBlock();
+    BasicBlock *Digit = BasicBlock::Create(Context, "digit", R.Report);
+    BasicBlock *Print = BasicBlock::Create(Context, "print", R.Report);
+    B.CreateBr(Digit);
+    B.SetInsertPoint(Digit);
+    PHINode *Index = B.CreatePHI(I64, 2, "index");
+    PHINode *Rest = B.CreatePHI(I64, 2, "rest");
+    Index->addIncoming(B.getInt64(20), Entry);
+    Rest->addIncoming(Count, Entry);
+    Value *At = B.CreateSub(Index, B.getInt64(1), "at");
+    Value *Char = B.CreateAdd(B.CreateTrunc(B.CreateURem(Rest, B.getInt64(10)), B.getInt8Ty()), B.getInt8('0'));
+    B.CreateStore(Char, B.CreateGEP(DigitsTy, Digits, {B.getInt64(0), At}));
+    Value *Higher = B.CreateUDiv(Rest, B.getInt64(10), "higher");
+    Index->addIncoming(At, Digit);
+    Rest->addIncoming(Higher, Digit);
+    B.CreateCondBr(B.CreateICmpEQ(Higher, B.getInt64(0)), Print, Digit);
+    B.SetInsertPoint(Print);
+    string label = "Steps executed: ";
+    B.CreateCall(WriteFunc, {B.getInt32(2), createCString(label, "bf_fuel_label", linkage), B.getInt64(label.size())});
+    B.CreateCall(WriteFunc, {B.getInt32(2), B.CreateGEP(DigitsTy, Digits, {B.getInt64(0), At}),
+                             B.CreateSub(B.getInt64(21), At)});
+    B.CreateRetVoid();
+    return R;
+}
+
+bool generateLLVM(const string& code, const BfProfile *profile, bool outlineLoops, const BfSnapshot *snapshot,
+                  const BfLimits &limits) {
+    vector<BFOp> ops;
+    if (!foldProgram(code, ops)) {
+        return false;
+    }
+
+    ModulePtr = make_unique<Module>("bf_module", Context);
+
+    // Tape memory array of i8 cells
+    ArrayType *TapeType = ArrayType::get(Type::getInt8Ty(Context), TapeSize);
+    // Preloaded with the cells left by compile-time evaluation, if any
+    Constant *TapeInit = Constant::getNullValue(TapeType);
+    if (snapshot->tape_size) {
+        vector<uint8_t> cells(snapshot->tape, snapshot->tape + snapshot->tape_size);
+        cells.resize(TapeSize, 0);
+        TapeInit = ConstantDataArray::get(Context, cells);
+    }
+    GlobalVariable *Tape = new GlobalVariable(*ModulePtr, TapeType, false, GlobalValue::PrivateLinkage, TapeInit, "tape");
+    Tape->setAlignment(Align(16));
+
+    // The program runs in bf_program, which gets the tape as a noalias,
+    // dereferenceable argument: the optimizer can then vectorize cell updates
+    // without proving that putchar/getchar leave the tape alone.
+    Type *CellTy = Builder.getInt8Ty();
+    Type *PtrTy = Builder.getInt8PtrTy();
+    Function *ProgramFunc = Function::Create(FunctionType::get(Builder.getVoidTy(), {PtrTy}, false),
+                                             outlineLoops ? Function::ExternalLinkage : Function::InternalLinkage,
+                                             "bf_program", ModulePtr.get());
+    ProgramFunc->addParamAttr(0, Attribute::NoAlias);
+    ProgramFunc->addParamAttr(0, Attribute::NoCapture);
+    ProgramFunc->addParamAttr(0, Attribute::getWithDereferenceableBytes(Context, TapeSize));
+    ProgramFunc->addParamAttr(0, Attribute::getWithAlignment(Context, Align(16)));
+
+    // main writes the output evaluated at compile time, then hands the global tape to bf_program
+    Function *MainFunc = Function::Create(FunctionType::get(Type::getInt32Ty(Context), false),
+                                          Function::ExternalLinkage, "main", ModulePtr.get());
+    Builder.SetInsertPoint(BasicBlock::Create(Context, "entry", MainFunc));
+    FuelRuntime Fuel = createFuelRuntime(limits, outlineLoops ? Function::ExternalLinkage : Function::InternalLinkage);
+    if (Fuel.Fuel) {
+        Builder.CreateCall(Fuel.Start);
+    }
+    if (snapshot->output_size) {
+        Type *SizeTy = Builder.getInt64Ty();
+        FunctionCallee WriteFunc = ModulePtr->getOrInsertFunction(
+            "write", FunctionType::get(SizeTy, {Type::getInt32Ty(Context), PtrTy, SizeTy}, false));
+        Constant *Text = ConstantDataArray::get(
+            Context, ArrayRef<uint8_t>((const uint8_t *)snapshot->output, snapshot->output_size));
+        GlobalVariable *Output = new GlobalVariable(*ModulePtr, Text->getType(), true, GlobalValue::PrivateLinkage,
+                                                    Text, "preeval_output");
+
+        // One write, repeated only if it comes back short
+        BasicBlock *entry = Builder.GetInsertBlock();
+        BasicBlock *writeBlock = BasicBlock::Create(Context, "write", MainFunc);
+        BasicBlock *advance = BasicBlock::Create(Context, "write_more", MainFunc);
+        BasicBlock *written = BasicBlock::Create(Context, "written", MainFunc);
+        Builder.CreateBr(writeBlock);
+        Builder.SetInsertPoint(writeBlock);
+        PHINode *Data = Builder.CreatePHI(PtrTy, 2, "data");
+        PHINode *Left = Builder.CreatePHI(SizeTy, 2, "left");
+        Data->addIncoming(Builder.CreateConstGEP2_64(Text->getType(), Output, 0, 0), entry);
+        Left->addIncoming(Builder.getInt64(snapshot->output_size), entry);
+        Value *Done = Builder.CreateCall(WriteFunc, {Builder.getInt32(1), Data, Left}, "done");
+        Builder.CreateCondBr(Builder.CreateICmpSGT(Done, Builder.getInt64(0)), advance, written);
+        Builder.SetInsertPoint(advance);
+        Value *Rest = Builder.CreateSub(Left, Done, "rest");
+        Data->addIncoming(Builder.CreateGEP(CellTy, Data, Done, "next"), advance);
+        Left->addIncoming(Rest, advance);
+        Builder.CreateCondBr(Builder.CreateICmpEQ(Rest, Builder.getInt64(0)), written, writeBlock);
+        Builder.SetInsertPoint(written);
+    }
+    Builder.CreateCall(ProgramFunc, {Builder.CreateConstGEP2_64(TapeType, Tape, 0, 0, "tape_ptr")});
+    if (Fuel.Fuel) {
+        Builder.CreateCall(Fuel.Report);
+    }
+    Builder.CreateRet(ConstantInt::get(Type::getInt32Ty(Context), 0));
+
+    // The tape pointer is an SSA value: moves are GEPs, loops merge it with phis
+    Builder.SetInsertPoint(BasicBlock::Create(Context, "entry", ProgramFunc));
+    Value *Ptr = ProgramFunc->getArg(0);
+    if (snapshot->pointer) {
+        Ptr = Builder.CreateGEP(CellTy, Ptr, Builder.getInt64(snapshot->pointer), "ptr");
+    }
+    Type *I64 = Builder.getInt64Ty();
+    Value *FuelLeft = Fuel.Fuel ? Builder.CreateLoad(I64, Fuel.Fuel, "fuel") : nullptr;  // Threaded like Ptr
+    Function *CurrentFunc = ProgramFunc;
+    CallInst *OutlinedCall = nullptr;  // Call of the outlined loop being emitted
+    unsigned outlinedCount = 0;
+
+    auto cellAt = [&](int offset) -> Value * {
+        return offset == 0 ? Ptr : Builder.CreateGEP(CellTy, Ptr, Builder.getInt64(offset), "cell");
+    };
+
+    // Declare external functions for input and output
+    FunctionCallee PutCharFunc = ModulePtr->getOrInsertFunction("putchar", FunctionType::get(Type::getInt32Ty(Context), {Type::getInt32Ty(Context)}, false));
+    FunctionCallee GetCharFunc = ModulePtr->getOrInsertFunction("getchar", FunctionType::get(Type::getInt32Ty(Context), {}, false));
+
+    // Open loops: body/exit blocks, the body's pointer (and fuel) phi and the preheader edge
+    struct OpenLoop {
+        BasicBlock *body;
+        BasicBlock *exit;
+        PHINode *bodyPtr;
+        BasicBlock *preheader;
+        Value *preheaderPtr;
+        PHINode *bodyFuel;
+        Value *preheaderFuel;
+        bool charged;  // False for loops that end on their own (loopTerminates)
+    };
+    vector<OpenLoop> loopStack;
+    vector<uint64_t> loopCosts;  // Ops directly in each open loop, charged per iteration under limits
+
+    for (const BFOp &op : ops) {
+        if (!loopCosts.empty()) {
+            loopCosts.back()++;
+        }
+        switch (op.kind) {
+            case BFOp::Add:
                 {
-                    Value *CurrentIndex = Builder.CreateLoad(Type::getInt64Ty(Context), Index, "load_index");
-                    Value *Ptr = Builder.CreateGEP(TapeType, TapePtr, {Builder.getInt64(0), CurrentIndex}, "ptr_inc_val");
-                    Value *Val = Builder.CreateLoad(Type::getInt8Ty(Context), Ptr, "load_val");
-                    Val = Builder.CreateAdd(Val, Builder.getInt8(1), "inc_val");
-                    Builder.CreateStore(Val, Ptr);
+                    Value *Cell = cellAt(op.offset);
+                    Value *Val = Builder.CreateLoad(CellTy, Cell, "val");
+                    Builder.CreateStore(Builder.CreateAdd(Val, Builder.getInt8((uint8_t)op.value), "add"), Cell);
                 }
                 break;
-            case '-':  // Decrement byte at pointer
+            case BFOp::Move:
+                Ptr = Builder.CreateGEP(CellTy, Ptr, Builder.getInt64(op.value), "ptr");
+                break;
+            case BFOp::Output:
                 {
-                    Value *CurrentIndex = Builder.CreateLoad(Type::getInt64Ty(Context), Index, "load_index");
-                    Value *Ptr = Builder.CreateGEP(TapeType, TapePtr, {Builder.getInt64(0), CurrentIndex}, "ptr_dec_val");
-                    Value *Val = Builder.CreateLoad(Type::getInt8Ty(Context), Ptr, "load_val");
-                    Val = Builder.CreateSub(Val, Builder.getInt8(1), "dec_val");
-                    Builder.CreateStore(Val, Ptr);
+                    Value *Val = Builder.CreateLoad(CellTy, cellAt(op.offset), "out_val");
+                    Builder.CreateCall(PutCharFunc, Builder.CreateSExt(Val, Type::getInt32Ty(Context), "sext_val"));
                 }
                 break;
-            case '.':  // Output the byte at pointer
+            case BFOp::Input:
                 {
-                    Value *CurrentIndex = Builder.CreateLoad(Type::getInt64Ty(Context), Index, "load_index");
-                    Value *Ptr = Builder.CreateGEP(TapeType, TapePtr, {Builder.getInt64(0), CurrentIndex}, "ptr_out");
-                    Value *Val = Builder.CreateLoad(Type::getInt8Ty(Context), Ptr, "out_val");
-                    Val = Builder.CreateSExt(Val, Type::getInt32Ty(Context), "sext_val");
-                    Builder.CreateCall(PutCharFunc, Val);
+                    Value *Input = Builder.CreateCall(GetCharFunc);
+                    Builder.CreateStore(Builder.CreateTrunc(Input, CellTy, "trunc_val"), cellAt(op.offset));
                 }
                 break;
-            case ',':  // Input a byte
+            case BFOp::MulLoop:
                 {
-                    Value *CurrentIndex = Builder.CreateLoad(Type::getInt64Ty(Context), Index, "load_index");
-                    Value *Ptr = Builder.CreateGEP(TapeType, TapePtr, {Builder.getInt64(0), CurrentIndex}, "ptr_in");
-                    Value *Input = Builder.CreateCall(GetCharFunc);
-                    Input = Builder.CreateTrunc(Input, Type::getInt8Ty(Context), "trunc_val");
-                    Builder.CreateStore(Input, Ptr);
+                    // [->+++<] runs cell[0] times (256 - cell[0] for [+...]): cell[k] += n * factor
+                    if (op.terms.empty()) {
+                        Builder.CreateStore(Builder.getInt8(0), Ptr);  // Plain clear loop
+                        break;
+                    }
+                    // Guarded like the loop it replaces: with a zero counter the target
+                    // cells must not be touched, they may lie outside the tape
+                    Value *Counter = Builder.CreateLoad(CellTy, Ptr, "counter");
+                    BasicBlock *mulBody = BasicBlock::Create(Context, "mul_body", CurrentFunc);
+                    BasicBlock *mulDone = BasicBlock::Create(Context, "mul_done", CurrentFunc);
+                    Builder.CreateCondBr(Builder.CreateICmpEQ(Counter, Builder.getInt8(0), "isZero"), mulDone, mulBody,
+                                         loopBranchWeights(profile, op.position, false));
+                    Builder.SetInsertPoint(mulBody);
+                    Value *Times = op.value == -1 ? Counter : Builder.CreateNeg(Counter, "times");
+                    for (auto &[offset, factor] : op.terms) {
+                        Value *Cell = cellAt(offset);
+                        Value *Val = Builder.CreateLoad(CellTy, Cell, "val");
+                        Value *Product = Builder.CreateMul(Times, Builder.getInt8((uint8_t)factor), "mul");
+                        Builder.CreateStore(Builder.CreateAdd(Val, Product, "mul_add"), Cell);
+                    }
+                    Builder.CreateStore(Builder.getInt8(0), Ptr);
+                    Builder.CreateBr(mulDone);
+                    Builder.SetInsertPoint(mulDone);
                 }
                 break;
-            case '[':  // Start of loop
+            case BFOp::LoopStart:
                 {
-                    BasicBlock *loopStart = BasicBlock::Create(Context, "loop_start", MainFunc);
-                    BasicBlock *afterLoop = BasicBlock::Create(Context, "loop_end", MainFunc);
-
-                    // Push loop start and end blocks onto stacks
-                    loopStartStack.push(loopStart);
-                    afterLoopStack.push(afterLoop);
+                    if (outlineLoops && loopStack.empty()) {
+                        // Enter a fresh function for this top-level loop; the caller gets the moved pointer back
+                        Function *LoopFunc = Function::Create(FunctionType::get(PtrTy, {PtrTy, PtrTy}, false), Function::ExternalLinkage,
+                                                              "bf_loop_" + to_string(outlinedCount++), ModulePtr.get());
+                        LoopFunc->addFnAttr(Attribute::NoInline);  // Keep parts independent; inlining would redo their work
+                        LoopFunc->addParamAttr(0, Attribute::NoCapture);
+                        LoopFunc->addParamAttr(0, Attribute::getWithDereferenceableBytes(Context, TapeSize));
+                        LoopFunc->addParamAttr(0, Attribute::getWithAlignment(Context, Align(16)));
+                        if (FuelLeft) {
+                            Builder.CreateStore(FuelLeft, Fuel.Fuel);
+                        }
+                        OutlinedCall = Builder.CreateCall(LoopFunc, {ProgramFunc->getArg(0), Ptr}, "ptr");
+                        Builder.SetInsertPoint(BasicBlock::Create(Context, "entry", LoopFunc));
+                        CurrentFunc = LoopFunc;
+                        Ptr = LoopFunc->getArg(1);
+                        if (FuelLeft) {
+                            FuelLeft = Builder.CreateLoad(I64, Fuel.Fuel, "fuel");
+                        }
+                    }
+                    BasicBlock *loopStart = BasicBlock::Create(Context, "loop_start", CurrentFunc);
+                    BasicBlock *afterLoop = BasicBlock::Create(Context, "loop_end", CurrentFunc);
 
-                    Value *CurrentIndex = Builder.CreateLoad(Type::getInt64Ty(Context), Index, "load_index");
-                    Value *Ptr = Builder.CreateGEP(TapeType, TapePtr, {Builder.getInt64(0), CurrentIndex}, "ptr_loop_start");
-                    Value *valueAtPointer = Builder.CreateLoad(Type::getInt8Ty(Context), Ptr, "valueAtPointer");
+                    Value *valueAtPointer = Builder.CreateLoad(CellTy, Ptr, "valueAtPointer");
                     Value *isZero = Builder.CreateICmpEQ(valueAtPointer, Builder.getInt8(0), "isZero");
-                    Builder.CreateCondBr(isZero, afterLoop, loopStart);
+                    Builder.CreateCondBr(isZero, afterLoop, loopStart, loopBranchWeights(profile, op.position, false));
+
+                    BasicBlock *preheader = Builder.GetInsertBlock();
                     Builder.SetInsertPoint(loopStart);
+                    PHINode *bodyPtr = Builder.CreatePHI(PtrTy, 2, "loop_ptr");
+                    bodyPtr->addIncoming(Ptr, preheader);
+                    PHINode *bodyFuel = nullptr;
+                    if (FuelLeft) {
+                        bodyFuel = Builder.CreatePHI(I64, 2, "loop_fuel");
+                        bodyFuel->addIncoming(FuelLeft, preheader);
+                    }
+                    bool charged = !loopTerminates(ops, &op - &ops[0]);
+                    loopStack.push_back({loopStart, afterLoop, bodyPtr, preheader, Ptr, bodyFuel, FuelLeft, charged});
+                    loopCosts.push_back(0);
+                    Ptr = bodyPtr;
+                    FuelLeft = bodyFuel;
                 }
                 break;
-            case ']':  // End of loop
+            case BFOp::LoopEnd:
                 {
-                    if (loopStartStack.empty() || afterLoopStack.empty()) {
-                        cerr << "Error: unmatched ']' in Brainfuck code" << endl;
-                        return;
-                    }
+                    OpenLoop loop = loopStack.back();
+                    loopStack.pop_back();
+                    uint64_t cost = loopCosts.back();
+                    loopCosts.pop_back();
 
-                    BasicBlock *loopStart = loopStartStack.top();
-                    BasicBlock *afterLoop = afterLoopStack.top();
-                    loopStartStack.pop();
-                    afterLoopStack.pop();
-
-                    Value *CurrentIndex = Builder.CreateLoad(Type::getInt64Ty(Context), Index, "load_index");
-                    Value *Ptr = Builder.CreateGEP(TapeType, TapePtr, {Builder.getInt64(0), CurrentIndex}, "ptr_loop_end");
-                    Value *valueAtPointer = Builder.CreateLoad(Type::getInt8Ty(Context), Ptr, "valueAtPointer");
+                    Value *valueAtPointer = Builder.CreateLoad(CellTy, Ptr, "valueAtPointer");
                     Value *isZero = Builder.CreateICmpEQ(valueAtPointer, Builder.getInt8(0), "isZero");
-                    Builder.CreateCondBr(isZero, afterLoop, loopStart);
-                    Builder.SetInsertPoint(afterLoop);
+                    BasicBlock *latch = Builder.GetInsertBlock();
+                    Value *latchFuel = FuelLeft;
+                    BranchInst *BackEdge;
+                    if (FuelLeft && loop.charged) {
+                        // Charge the iteration; the refill call joins back so the loop keeps one latch
+                        BasicBlock *charge = BasicBlock::Create(Context, "charge", CurrentFunc);
+                        BasicBlock *refill = BasicBlock::Create(Context, "refill", CurrentFunc);
+                        BasicBlock *next = BasicBlock::Create(Context, "next_iteration", CurrentFunc);
+                        Builder.CreateCondBr(isZero, loop.exit, charge, loopBranchWeights(profile, op.position, true));
+                        Builder.SetInsertPoint(charge);
+                        Value *Left = Builder.CreateSub(FuelLeft, Builder.getInt64(cost), "fuel_left");
+                        Builder.CreateCondBr(Builder.CreateICmpSLT(Left, Builder.getInt64(0)), refill, next,
+                                             MDBuilder(Context).createBranchWeights(1, 1 << 20));
+                        Builder.SetInsertPoint(refill);
+                        Value *Refilled = Builder.CreateCall(Fuel.Refill, {Left}, "refilled");
+                        Builder.CreateBr(next);
+                        Builder.SetInsertPoint(next);
+                        PHINode *nextFuel = Builder.CreatePHI(I64, 2, "next_fuel");
+                        nextFuel->addIncoming(Left, charge);
+                        nextFuel->addIncoming(Refilled, refill);
+                        loop.bodyFuel->addIncoming(nextFuel, next);
+                        BackEdge = Builder.CreateBr(loop.body);
+                    } else {
+                        BackEdge = Builder.CreateCondBr(isZero, loop.exit, loop.body, loopBranchWeights(profile, op.position, true));
+                        if (FuelLeft) {
+                            loop.bodyFuel->addIncoming(FuelLeft, latch);
+                        }
+                    }
+                    if (MDNode *Hints = loopHints(profile, op.position)) {
+                        BackEdge->setMetadata(LLVMContext::MD_loop, Hints);
+                    }
+                    loop.bodyPtr->addIncoming(Ptr, Builder.GetInsertBlock());
+                    Builder.SetInsertPoint(loop.exit);
+                    PHINode *exitPtr = Builder.CreatePHI(PtrTy, 2, "exit_ptr");
+                    exitPtr->addIncoming(loop.preheaderPtr, loop.preheader);
+                    exitPtr->addIncoming(Ptr, latch);
+                    Ptr = exitPtr;
+                    if (FuelLeft) {
+                        PHINode *exitFuel = Builder.CreatePHI(I64, 2, "exit_fuel");
+                        exitFuel->addIncoming(loop.preheaderFuel, loop.preheader);
+                        exitFuel->addIncoming(latchFuel, latch);
+                        FuelLeft = exitFuel;
+                    }
+
+                    if (CurrentFunc != ProgramFunc && loopStack.empty()) {
+                        // Back from an outlined loop: resume after its call in bf_program
+                        if (FuelLeft) {
+                            Builder.CreateStore(FuelLeft, Fuel.Fuel);
+                        }
+                        Builder.CreateRet(Ptr);
+                        Builder.SetInsertPoint(OutlinedCall->getParent());
+                        Ptr = OutlinedCall;
+                        CurrentFunc = ProgramFunc;
+                        if (FuelLeft) {
+                            FuelLeft = Builder.CreateLoad(I64, Fuel.Fuel, "fuel");
+                        }
+                    }
                 }
                 break;
-            default:
-                // Ignore any non-Brainfuck character
-                break;
         }
     }
 
-   
-    Builder.CreateRet(ConstantInt::get(Type::getInt32Ty(Context), 0));
+    if (FuelLeft) {
+        Builder.CreateStore(FuelLeft, Fuel.Fuel);  // For the report in main
+    }
+    Builder.CreateRetVoid();
+
+    // Verify the module
+    if (verifyModule(*ModulePtr, &errs())) {
+        std::cerr << "Error: Module verification failed." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// TargetMachine for the host. With nativeCPU the host CPU name and features
+// (AVX2, BMI, ...) are used instead of baseline x86-64. The native target must
+// already be initialized (main does it once, before any worker threads start).
+// Code generation effort follows the -O level.
+unique_ptr<TargetMachine> createHostTargetMachine(bool nativeCPU, Reloc::Model RelocModel, int optLevel) {
+    string TargetTriple = sys::getDefaultTargetTriple();
+    string Err;
+    const Target *TheTarget = TargetRegistry::lookupTarget(TargetTriple, Err);
+    if (!TheTarget) {
+        cerr << "Error: " << Err << endl;
+        return nullptr;
+    }
+
+    string CPU = "generic";
+    string Features;
+    if (nativeCPU) {
+        CPU = sys::getHostCPUName().str();
+        StringMap<bool> HostFeatures;
+        if (sys::getHostCPUFeatures(HostFeatures)) {
+            SubtargetFeatures SF;
+            for (auto &Feature : HostFeatures) {
+                SF.AddFeature(Feature.first(), Feature.second);
+            }
+            Features = SF.getString();
+        }
+    }
+    const CodeGenOpt::Level CodeGenLevels[] = {CodeGenOpt::None, CodeGenOpt::Less, CodeGenOpt::Default, CodeGenOpt::Aggressive};
+    return unique_ptr<TargetMachine>(TheTarget->createTargetMachine(TargetTriple, CPU, Features, TargetOptions(), RelocModel, {},
+                                                                    CodeGenLevels[optLevel]));
+}
+
+// Run the new pass manager's default pipeline for optLevel (0-3) on the module,
+// with the BF loop-idiom pass at the start so later passes see its rewrites.
+// TM supplies the data layout and vector widths; its CPU is also recorded on
+// each function so output.ll keeps it for llc.
+bool optimizeModule(Module &M, int optLevel, TargetMachine &TM) {
+    M.setTargetTriple(TM.getTargetTriple().str());
+    M.setDataLayout(TM.createDataLayout());
+    for (Function &F : M) {
+        if (!F.isDeclaration()) {
+            F.addFnAttr("target-cpu", TM.getTargetCPU());
+            if (!TM.getTargetFeatureString().empty()) {
+                F.addFnAttr("target-features", TM.getTargetFeatureString());
+            }
+        }
+    }
 
-    // Setup optimization
-    legacy::FunctionPassManager FPM(ModulePtr.get());
-    legacy::PassManager PM;
+    LoopAnalysisManager LAM;
+    FunctionAnalysisManager FAM;
+    CGSCCAnalysisManager CGAM;
+    ModuleAnalysisManager MAM;
 
-    // Populate pass managers
-    PassManagerBuilder PMBuilder;
-    PMBuilder.OptLevel = 2; // Use 3 for -O3 level optimizations
-    PMBuilder.populateFunctionPassManager(FPM);
-    PMBuilder.populateModulePassManager(PM);
+    PassBuilder PB(&TM);
+    PB.registerModuleAnalyses(MAM);
+    PB.registerCGSCCAnalyses(CGAM);
+    PB.registerFunctionAnalyses(FAM);
+    PB.registerLoopAnalyses(LAM);
+    PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+    PB.registerPipelineStartEPCallback([](ModulePassManager &MPM, OptimizationLevel) {
+        MPM.addPass(createModuleToFunctionPassAdaptor(BFLoopIdiomPass()));
+    });
 
-    // Add necessary passes
-    FPM.doInitialization();
-    for (Function &F : *ModulePtr)
-        FPM.run(F);
-    FPM.doFinalization();
+    const OptimizationLevel Levels[] = {OptimizationLevel::O0, OptimizationLevel::O1, OptimizationLevel::O2, OptimizationLevel::O3};
+    ModulePassManager MPM = optLevel == 0 ? PB.buildO0DefaultPipeline(OptimizationLevel::O0)
+                                          : PB.buildPerModuleDefaultPipeline(Levels[optLevel]);
+    MPM.run(M, MAM);
 
-    PM.run(*ModulePtr);
+    if (verifyModule(M, &errs())) {
+        std::cerr << "Error: Module verification failed after optimization." << std::endl;
+        return false;
+    }
+    return true;
+}
 
-    // Verify and output the module
+// Write the optimized module as textual IR for llc/clang (bf_run.sh)
+bool writeIR(const char *path) {
     std::error_code EC;
-    raw_fd_ostream dest("output.ll", EC, sys::fs::OF_None);
+    raw_fd_ostream dest(path, EC, sys::fs::OF_None);
     if (EC) {
         std::cerr << "Could not open file: " << EC.message() << std::endl;
-        return;
+        return false;
     }
 
-    if (verifyModule(*ModulePtr, &errs())) {
-        std::cerr << "Error: Module verification failed." << std::endl;
-        return;
+    ModulePtr->print(dest, nullptr);
+    dest.close();
+    return true;
+}
+
+// Emit the module as a native object file with TM's code generator
+bool emitObject(Module &M, TargetMachine &TM, const string &path) {
+    std::error_code EC;
+    raw_fd_ostream dest(path, EC, sys::fs::OF_None);
+    if (EC) {
+        std::cerr << "Could not open file: " << EC.message() << std::endl;
+        return false;
     }
 
-    ModulePtr->print(dest, nullptr);
+    legacy::PassManager CodeGenPM;
+    if (TM.addPassesToEmitFile(CodeGenPM, dest, nullptr, CGFT_ObjectFile)) {
+        std::cerr << "Error: Target can't emit an object file" << std::endl;
+        return false;
+    }
+    CodeGenPM.run(M);
     dest.close();
+    return true;
+}
+
+// Link the object against the prebuilt bf_runtime into a static executable.
+// The runtime supplies _start and the few libc calls the module makes, so
+// plain `ld` is enough and no compiler driver runs.
+bool linkExecutable(const vector<string> &objects, const char *output) {
+    ErrorOr<string> Linker = sys::findProgramByName("ld");
+    if (!Linker) {
+        std::cerr << "Error: ld not found in PATH" << std::endl;
+        return false;
+    }
+    vector<StringRef> Args = {*Linker, "-static", "-o", output};
+    Args.insert(Args.end(), objects.begin(), objects.end());
+    Args.push_back(BF_RUNTIME_PATH);
+    string ErrMsg;
+    if (sys::ExecuteAndWait(*Linker, Args, {}, {}, 0, 0, &ErrMsg) != 0) {
+        std::cerr << "Error: Linking " << output << " failed " << ErrMsg << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Emit objects for the module and link them. Each function becomes its own
+// unit; units are spread over `jobs` parts of similar instruction count
+// (largest first). Every part is cloned, written out as bitcode and parsed
+// back into a private LLVMContext, so workers can optimize and run codegen
+// for parts in parallel without sharing any LLVM state.
+bool compileParallel(unsigned jobs, int optLevel, bool nativeCPU, const char *exePath) {
+    vector<pair<unsigned, const Function *>> units;
+    for (const Function &F : *ModulePtr) {
+        if (!F.isDeclaration()) {
+            units.push_back({F.getInstructionCount(), &F});
+        }
+    }
+    std::sort(units.begin(), units.end(), [](const auto &a, const auto &b) { return a.first > b.first; });
+
+    size_t partCount = min<size_t>(jobs, units.size());
+    vector<unsigned> partSize(partCount, 0);
+    map<const GlobalValue *, size_t> partOf;
+    for (auto &unit : units) {
+        size_t smallest = min_element(partSize.begin(), partSize.end()) - partSize.begin();
+        partSize[smallest] += unit.first;
+        partOf[unit.second] = smallest;
+    }
+    size_t mainPart = partOf[ModulePtr->getFunction("main")];
+
+    vector<SmallVector<char, 0>> bitcode(partCount);
+    for (size_t part = 0; part < partCount; part++) {
+        ValueToValueMapTy VMap;
+        unique_ptr<Module> Part = CloneModule(*ModulePtr, VMap, [&](const GlobalValue *GV) {
+            auto found = partOf.find(GV);
+            return found != partOf.end() ? found->second == part : part == mainPart;  // The tape lives with main
+        });
+        raw_svector_ostream stream(bitcode[part]);
+        WriteBitcodeToFile(*Part, stream);
+    }
+
+    vector<string> objects(partCount);
+    vector<char> built(partCount, 0);
+    atomic<size_t> nextPart(0);
+    auto worker = [&]() {
+        for (size_t part; (part = nextPart++) < partCount;) {
+            LLVMContext PartContext;
+            Expected<unique_ptr<Module>> M = parseBitcodeFile(
+                MemoryBufferRef(StringRef(bitcode[part].data(), bitcode[part].size()), "bf_part"), PartContext);
+            if (!M) {
+                consumeError(M.takeError());
+                continue;
+            }
+            unique_ptr<TargetMachine> TM = createHostTargetMachine(nativeCPU, Reloc::Static, optLevel);
+            SmallString<128> objectPath;
+            if (!TM || sys::fs::createTemporaryFile("bf_llvm", "o", objectPath)) {
+                continue;
+            }
+            objects[part] = objectPath.str().str();
+            built[part] = optimizeModule(**M, optLevel, *TM) && emitObject(**M, *TM, objects[part]);
+        }
+    };
+
+    vector<std::thread> pool;
+    for (size_t t = 1; t < min<size_t>(jobs, partCount); t++) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (std::thread &t : pool) {
+        t.join();
+    }
+
+    bool ok = std::all_of(built.begin(), built.end(), [](char b) { return b; }) && linkExecutable(objects, exePath);
+    if (!ok) {
+        std::cerr << "Error: Parallel build of " << exePath << " failed" << std::endl;
+    }
+    for (const string &object : objects) {
+        if (!object.empty()) {
+            sys::fs::remove(object);
+        }
+    }
+    return ok;
+}
+
+// Run the optimized module in-process with ORC LLJIT; putchar/getchar resolve
+// against this process, so no llc/clang runs and nothing touches the disk.
+// With `Object` (a cached or just-emitted PIC object) it is linked instead.
+int runJIT(unique_ptr<MemoryBuffer> Object, bool perfCounters) {
+    InitializeNativeTarget();
+    InitializeNativeTargetAsmPrinter();
+
+    auto JIT = orc::LLJITBuilder().create();
+    if (!JIT) {
+        errs() << "Error: Failed to create LLJIT: " << toString(JIT.takeError()) << "\n";
+        return 1;
+    }
+
+    auto HostSymbols = orc::DynamicLibrarySearchGenerator::GetForCurrentProcess((*JIT)->getDataLayout().getGlobalPrefix());
+    if (!HostSymbols) {
+        errs() << "Error: Failed to expose host symbols: " << toString(HostSymbols.takeError()) << "\n";
+        return 1;
+    }
+    (*JIT)->getMainJITDylib().addGenerator(std::move(*HostSymbols));
+
+    if (Object) {
+        if (Error Err = (*JIT)->addObjectFile(std::move(Object))) {
+            errs() << "Error: Failed to add object: " << toString(std::move(Err)) << "\n";
+            return 1;
+        }
+    } else {
+        ModulePtr->setDataLayout((*JIT)->getDataLayout());
+        orc::ThreadSafeModule TSM(std::move(ModulePtr), orc::ThreadSafeContext(std::move(ContextPtr)));
+        if (Error Err = (*JIT)->addIRModule(std::move(TSM))) {
+            errs() << "Error: Failed to add module: " << toString(std::move(Err)) << "\n";
+            return 1;
+        }
+    }
+
+    auto MainSymbol = (*JIT)->lookup("main");
+    if (!MainSymbol) {
+        errs() << "Error: Failed to find main: " << toString(MainSymbol.takeError()) << "\n";
+        return 1;
+    }
+
+    // The lookup compiled everything, so --perf-counters sees only the run
+    auto *MainFn = MainSymbol->toPtr<int()>();
+    BfPerf Perf;
+    if (perfCounters) {
+        bf_perf_open(&Perf);
+        bf_perf_start(&Perf);
+    }
+    int Result = MainFn();
+    fflush(stdout);  // putchar shares our stdio buffer
+    if (perfCounters) {
+        bf_perf_stop(&Perf);
+        bf_perf_report(&Perf, 0);
+        bf_perf_close(&Perf);
+    }
+    return Result;
+}
+
+// Load a cached object for --jit, or copy a cached output.ll / executable out
+int useCachedOutput(const char *cachedPath, bool jitMode, const char *exePath, bool perfCounters) {
+    if (jitMode) {
+        ErrorOr<unique_ptr<MemoryBuffer>> Object = MemoryBuffer::getFile(cachedPath);
+        if (!Object) {
+            std::cerr << "Error: Unable to read cached object " << cachedPath << std::endl;
+            return 1;
+        }
+        InitializeNativeTarget();
+        InitializeNativeTargetAsmPrinter();
+        return runJIT(std::move(*Object), perfCounters);
+    }
+    return bf_cache_copy_file(cachedPath, exePath ? exePath : "output.ll", exePath ? 0755 : 0644) == 0 ? 0 : 1;
 }
 
 int main(int argc, char** argv) {
+    for (int j = 1; j < argc; j++) {
+        if (string(argv[j]) == "--cache-stats") {
+            BfCache cache;
+            if (bf_cache_open(&cache) != 0) {
+                return 1;
+            }
+            bf_cache_print_stats(stdout, &cache);
+            return 0;
+        }
+    }
     if (argc < 2) {
-        std::cerr << "Usage: " << argv[0] << " <brainfuck_code_file>" << std::endl;
+        std::cerr << "Usage: " << argv[0] << " <brainfuck_code_file> [-O0|-O1|-O2|-O3] [--march=native] [-o <exe> [-j <jobs>]] [--profile <file>] [--preeval-steps <n>] [--max-steps <n>] [--timeout <s>] [--jit [--perf-counters]] [--cache | --cache-check] | --cache-stats" << std::endl;
         return 1;
     }
 
+    const char *profilePath = nullptr;
+    bool jitMode = false;
+    bool perfCounters = false;
+    int optLevel = 2;
+    bool nativeCPU = false;
+    const char *exePath = nullptr;
+    unsigned jobs = 0;
+    bool useCache = false;
+    bool cacheCheck = false;
+    size_t preevalSteps = BF_PREEVAL_DEFAULT_STEPS;
+    BfLimits limits = {0, 0};
+    for (int j = 2; j < argc; j++) {
+        if (string(argv[j]) == "--profile" && j + 1 < argc) {
+            profilePath = argv[++j];  // Loop profile from `bf_interp --profile-out`
+        } else if (strlen(argv[j]) == 3 && strncmp(argv[j], "-O", 2) == 0 && argv[j][2] >= '0' && argv[j][2] <= '3') {
+            optLevel = argv[j][2] - '0';
+        } else if (string(argv[j]) == "--march=native") {
+            nativeCPU = true;  // Tune and select instructions for this machine
+        } else if (string(argv[j]) == "-o" && j + 1 < argc) {
+            exePath = argv[++j];  // Emit an executable instead of output.ll
+        } else if (string(argv[j]) == "-j" && j + 1 < argc) {
+            jobs = max(1, atoi(argv[++j]));  // Outline top-level loops and build parts in parallel
+        } else if (string(argv[j]) == "--preeval-steps" && j + 1 < argc) {
+            preevalSteps = strtoul(argv[++j], nullptr, 10);  // Compile-time evaluation budget, 0 disables
+        } else if (string(argv[j]) == "--max-steps" && j + 1 < argc) {
+            limits.max_steps = strtoull(argv[++j], nullptr, 10);  // Stop the program after this many steps
+        } else if (string(argv[j]) == "--timeout" && j + 1 < argc) {
+            limits.timeout = strtod(argv[++j], nullptr);  // ...or after this many seconds
+        } else if (string(argv[j]) == "--jit") {
+            jitMode = true;  // Execute in-process instead of writing output.ll
+        } else if (string(argv[j]) == "--perf-counters") {
+            perfCounters = true;  // Hardware counters for the --jit run, on stderr
+        } else if (string(argv[j]) == "--cache") {
+            useCache = true;  // Reuse output from an identical earlier build
+        } else if (string(argv[j]) == "--cache-check") {
+            useCache = cacheCheck = true;  // Only tell whether --cache would hit: exit status 0 if so
+        }
+    }
+
     std::ifstream bf_file(argv[1]);
     if (!bf_file.is_open()) {
         std::cerr << "Error: Unable to open file " << argv[1] << std::endl;
@@ -198,7 +1333,139 @@ int main(int argc, char** argv) {
     std::string code((std::istreambuf_iterator<char>(bf_file)), std::istreambuf_iterator<char>());
     bf_file.close();
 
-    generateLLVM(code);
+    BfProfile profile = {};
+    if (profilePath) {
+        size_t commandCount = count_if(code.begin(), code.end(), bf_is_command);
+        if (bf_profile_load(profilePath, commandCount, &profile) != 0) {
+            return 1;
+        }
+    }
+
+    if (jobs && (!exePath || jitMode)) {
+        std::cerr << "Error: -j only applies when building an executable with -o" << std::endl;
+        return 1;
+    }
+    if (perfCounters && !jitMode) {
+        std::cerr << "Error: --perf-counters only applies to --jit runs" << std::endl;
+        return 1;
+    }
 
+    // The key covers everything that shapes the output: mode, -O, -j, the
+    // target CPU and features, the LLVM version and the profile. On a hit no
+    // IR is generated at all.
+    BfCache cache;
+    const char *cacheExt = jitMode ? "o" : exePath ? "exe" : "ll";
+    if (useCache) {
+        if (bf_cache_open(&cache) != 0) {
+            return 1;
+        }
+        string flags = string("bf_llvm ") + LLVM_VERSION_STRING + " " + cacheExt + " -O" + to_string(optLevel) + " -j" +
+                       to_string(jobs) + " preeval=" + to_string(preevalSteps) +
+                       " limits=" + to_string(limits.max_steps) + "/" + to_string(limits.timeout) + " " + sys::getDefaultTargetTriple();
+        if (nativeCPU) {
+            flags += " " + sys::getHostCPUName().str();
+            StringMap<bool> HostFeatures;
+            if (sys::getHostCPUFeatures(HostFeatures)) {
+                vector<string> enabled;
+                for (auto &Feature : HostFeatures) {
+                    if (Feature.second) {
+                        enabled.push_back(Feature.first().str());
+                    }
+                }
+                std::sort(enabled.begin(), enabled.end());  // StringMap order is unspecified
+                for (const string &feature : enabled) {
+                    flags += " +" + feature;
+                }
+            }
+        }
+        bf_cache_add_string(&cache, flags.c_str());
+        bf_cache_add_commands(&cache, code.data(), code.size());
+        if (profilePath && bf_cache_add_file(&cache, profilePath) != 0) {
+            return 1;
+        }
+        bf_cache_key(&cache);
+        if (cacheCheck) {
+            return bf_cache_contains(&cache, cacheExt) ? 0 : 1;
+        }
+        char cachedPath[PATH_MAX];
+        if (bf_cache_lookup(&cache, cacheExt, cachedPath, sizeof(cachedPath))) {
+            return useCachedOutput(cachedPath, jitMode, exePath, perfCounters);
+        }
+    }
+
+    // Keep only the commands (offsets are unchanged) and blank out loops that can never run
+    string commands(code.size() + BF_SOURCE_SLACK, '\0');
+    commands.resize(bf_filter_commands(code.data(), code.size(), &commands[0]));
+    bf_remove_dead_loops(&commands[0], commands.size());
+
+    // Run the input-free prefix now; IR is generated from where it stopped
+    BfSnapshot snapshot;
+    bf_preeval_source(&commands[0], commands.size(), TapeSize, preevalSteps, &snapshot);
+
+    bool generated = generateLLVM(commands, profilePath ? &profile : nullptr, jobs > 0, &snapshot, limits);
+    bf_profile_free(&profile);
+    free(snapshot.owned);
+    if (!generated) {
+        return 1;
+    }
+
+    InitializeNativeTarget();
+    InitializeNativeTargetAsmPrinter();
+    if (jobs) {
+        if (!compileParallel(jobs, optLevel, nativeCPU, exePath)) {
+            return 1;
+        }
+        if (useCache) {
+            bf_cache_store(&cache, cacheExt, exePath);
+        }
+        return 0;
+    }
+
+    // Static executables are linked without PIE; everything else stays PIC
+    unique_ptr<TargetMachine> TM = createHostTargetMachine(nativeCPU, exePath && !jitMode ? Reloc::Static : Reloc::PIC_, optLevel);
+    if (!TM || !optimizeModule(*ModulePtr, optLevel, *TM)) {
+        return 1;
+    }
+
+    if (jitMode && !useCache) {
+        return runJIT(nullptr, perfCounters);
+    }
+    if (jitMode) {
+        // Cached JIT runs go through an object file so the next run can skip codegen
+        SmallString<128> objectPath;
+        if (sys::fs::createTemporaryFile("bf_llvm", "o", objectPath)) {
+            std::cerr << "Error: Unable to create a temporary object file" << std::endl;
+            return 1;
+        }
+        bool emitted = emitObject(*ModulePtr, *TM, objectPath.str().str());
+        if (emitted) {
+            bf_cache_store(&cache, cacheExt, objectPath.c_str());
+        }
+        ErrorOr<unique_ptr<MemoryBuffer>> Object = MemoryBuffer::getFile(objectPath);
+        sys::fs::remove(objectPath);
+        if (!emitted || !Object) {
+            return 1;
+        }
+        return runJIT(std::move(*Object), perfCounters);
+    }
+    if (exePath) {
+        SmallString<128> objectPath;
+        if (sys::fs::createTemporaryFile("bf_llvm", "o", objectPath)) {
+            std::cerr << "Error: Unable to create a temporary object file" << std::endl;
+            return 1;
+        }
+        bool linked = emitObject(*ModulePtr, *TM, objectPath.str().str()) && linkExecutable({objectPath.str().str()}, exePath);
+        sys::fs::remove(objectPath);
+        if (linked && useCache) {
+            bf_cache_store(&cache, cacheExt, exePath);
+        }
+        return linked ? 0 : 1;
+    }
+    if (!writeIR("output.ll")) {
+        return 1;
+    }
+    if (useCache) {
+        bf_cache_store(&cache, cacheExt, "output.ll");
+    }
     return 0;
 }
\ No newline at end of file
@@ -1,8 +1,8 @@
 #!/bin/bash
 
 # Check if the path to the Brainfuck file is provided
-if [ "$#" -ne 1 ]; then
-    echo "Usage: $0 path/to/bf_file"
+if [ "$#" -lt 1 ]; then
+    echo "Usage: $0 path/to/bf_file [--profile path/to/profile] [--march=native] [-O0..-O3]"
     exit 1
 fi
 
@@ -17,30 +17,14 @@ fi
 # Path to the bf_compiler (assuming it's in the 'build' directory)
 BF_COMPILER="./build/bf_compiler"
 
-# Compile the Brainfuck file with your custom bf_compiler
-$BF_COMPILER "$BF_FILE"
-
-# Check if the LLVM IR was successfully generated
-if [ ! -f output.ll ]; then
-    echo "Error: Failed to generate LLVM IR (output.ll missing)."
-    exit 1
-fi
-
-# Generate the object file using llc with PIC enabled
-llc -filetype=obj -relocation-model=pic output.ll -o output.o
-
-# Check if the object file was successfully generated
-if [ ! -f output.o ]; then
-    echo "Error: Failed to generate object file (output.o missing)."
-    exit 1
-fi
-
-# Link the object file to create the executable
-clang -o bf_output output.o
+# Compile the Brainfuck file straight to an executable; bf_compiler emits
+# the object itself and links it against the prebuilt bf_runtime
+rm -f bf_output
+$BF_COMPILER "$BF_FILE" -o bf_output "${@:2}"
 
 # Check if the executable was successfully created
 if [ ! -f bf_output ]; then
-    echo "Error: Failed to link executable (bf_output missing)."
+    echo "Error: Failed to build executable (bf_output missing)."
     exit 1
 fi
 
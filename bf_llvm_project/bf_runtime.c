@@ -0,0 +1,129 @@
+// Minimal runtime for executables written by `bf_compiler -o <exe>`.
+// The emitted object only needs putchar/getchar/write, exit/clock_gettime
+// under --max-steps/--timeout, and the memset/memchr/memrchr calls the
+// loop-idiom pass produces, so instead of pulling in libc this
+// provides those, a buffered stdout and `_start`, using raw x86-64 Linux
+// syscalls. Executables link statically with `ld` and start instantly.
+
+#include <stddef.h>
+
+#define SYS_READ 0
+#define SYS_WRITE 1
+#define SYS_EXIT 60
+#define SYS_CLOCK_GETTIME 228
+#define BF_RUNTIME_BUFFER 4096
+
+int main(void);
+
+static unsigned char out_buf[BF_RUNTIME_BUFFER];
+static size_t out_len;
+static unsigned char in_buf[BF_RUNTIME_BUFFER];
+static size_t in_pos, in_len;
+
+static long bf_syscall3(long number, long a, long b, long c) {
+    long result;
+    __asm__ volatile("syscall"
+                     : "=a"(result)
+                     : "a"(number), "D"(a), "S"(b), "d"(c)
+                     : "rcx", "r11", "memory");
+    return result;
+}
+
+static void flush_output(void) {
+    size_t done = 0;
+    while (done < out_len) {
+        long written = bf_syscall3(SYS_WRITE, 1, (long)(out_buf + done), (long)(out_len - done));
+        if (written <= 0) {
+            break;  // Nothing sensible to do if stdout is gone
+        }
+        done += (size_t)written;
+    }
+    out_len = 0;
+}
+
+int putchar(int c) {
+    if (out_len == BF_RUNTIME_BUFFER) {
+        flush_output();
+    }
+    out_buf[out_len++] = (unsigned char)c;
+    return (unsigned char)c;
+}
+
+// Returns -1 on EOF like libc, so ',' stores 255
+int getchar(void) {
+    if (in_pos == in_len) {
+        flush_output();  // Show any prompt before blocking on input
+        long got = bf_syscall3(SYS_READ, 0, (long)in_buf, BF_RUNTIME_BUFFER);
+        if (got <= 0) {
+            return -1;
+        }
+        in_pos = 0;
+        in_len = (size_t)got;
+    }
+    return in_buf[in_pos++];
+}
+
+// main writes the output evaluated at compile time with this, before any putchar
+long write(int fd, const void *buf, size_t count) {
+    flush_output();
+    return bf_syscall3(SYS_WRITE, fd, (long)buf, (long)count);
+}
+
+// Used by programs built with --max-steps/--timeout
+void exit(int status) {
+    flush_output();
+    bf_syscall3(SYS_EXIT, status, 0, 0);
+    __builtin_unreachable();
+}
+
+int clock_gettime(int clock, void *now) {
+    return (int)bf_syscall3(SYS_CLOCK_GETTIME, clock, (long)now, 0);
+}
+
+void *memset(void *dest, int c, size_t n) {
+    unsigned char *d = dest;
+    while (n--) {
+        *d++ = (unsigned char)c;
+    }
+    return dest;
+}
+
+void *memcpy(void *dest, const void *src, size_t n) {
+    unsigned char *d = dest;
+    const unsigned char *s = src;
+    while (n--) {
+        *d++ = *s++;
+    }
+    return dest;
+}
+
+void *memchr(const void *s, int c, size_t n) {
+    const unsigned char *p = s;
+    for (; n; n--, p++) {
+        if (*p == (unsigned char)c) {
+            return (void *)p;
+        }
+    }
+    return NULL;
+}
+
+void *memrchr(const void *s, int c, size_t n) {
+    const unsigned char *p = (const unsigned char *)s + n;
+    while (n--) {
+        if (*--p == (unsigned char)c) {
+            return (void *)p;
+        }
+    }
+    return NULL;
+}
+
+void bf_runtime_start(void) {
+    exit(main());
+}
+
+// The kernel enters with the stack 16-byte aligned and no return address
+__asm__(".globl _start\n"
+        "_start:\n"
+        "    xor %ebp, %ebp\n"
+        "    and $-16, %rsp\n"
+        "    call bf_runtime_start\n");
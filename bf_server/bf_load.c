@@ -0,0 +1,309 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "../bf_common/bf_common.h"  // grow_array
+#include "../bf_common/bf_limits.h"  // bf_limits_now_ns
+
+// Load generator for bf_server: `bf_load -s /tmp/bf.sock -c 8 -n 10000 prog.b`.
+//
+// Each of -c threads opens one connection and sends requests back to back,
+// -n in total (or for -d seconds). The first request of every connection
+// sends the source; with --by-key the rest name the program by the key the
+// server returned, otherwise they resend the source (which the server still
+// finds in its cache). Every response is checked against --expect when
+// given. The report gives the throughput and the latency percentiles, from
+// sending a request to reading its END line.
+
+typedef struct {
+    const char *socket_path;
+    const char *source;
+    size_t source_size;
+    const char *input;
+    size_t input_size;
+    const char *expected;  // NULL: don't check
+    size_t expected_size;
+    int by_key;
+    unsigned long long max_steps;
+    long requests;  // Per thread
+    int64_t deadline_ns;  // 0: run `requests`
+} LoadOptions;
+
+typedef struct {
+    const LoadOptions *options;
+    int64_t *latencies;
+    size_t count, capacity;
+    long errors, mismatches;
+    pthread_t thread;
+} LoadThread;
+
+typedef struct {
+    int fd;
+    char buffer[65536];
+    size_t start, end;
+} Reader;
+
+static int reader_fill(Reader *reader) {
+    if (reader->start == reader->end) {
+        reader->start = reader->end = 0;
+    } else if (reader->end == sizeof(reader->buffer)) {
+        memmove(reader->buffer, reader->buffer + reader->start, reader->end - reader->start);
+        reader->end -= reader->start;
+        reader->start = 0;
+    }
+    ssize_t got;
+    do {
+        got = recv(reader->fd, reader->buffer + reader->end, sizeof(reader->buffer) - reader->end, 0);
+    } while (got < 0 && errno == EINTR);
+    if (got <= 0) {
+        return 0;
+    }
+    reader->end += got;
+    return 1;
+}
+
+static int read_line(Reader *reader, char *line, size_t size) {
+    char *newline;
+    while (!(newline = (char *)memchr(reader->buffer + reader->start, '\n', reader->end - reader->start))) {
+        if (!reader_fill(reader)) {
+            return 0;
+        }
+    }
+    size_t length = newline - (reader->buffer + reader->start);
+    if (length >= size) {
+        return 0;
+    }
+    memcpy(line, reader->buffer + reader->start, length);
+    line[length] = '\0';
+    reader->start += length + 1;
+    return 1;
+}
+
+// Consume `size` bytes of output, comparing them with expected[*offset...]
+static int read_output(Reader *reader, size_t size, const LoadOptions *options, size_t *offset, int *matches) {
+    while (size > 0) {
+        if (reader->start == reader->end && !reader_fill(reader)) {
+            return 0;
+        }
+        size_t n = reader->end - reader->start < size ? reader->end - reader->start : size;
+        if (options->expected && *matches) {
+            *matches = *offset + n <= options->expected_size &&
+                       memcmp(reader->buffer + reader->start, options->expected + *offset, n) == 0;
+        }
+        *offset += n;
+        reader->start += n;
+        size -= n;
+    }
+    return 1;
+}
+
+static int send_all(int fd, const void *data, size_t size) {
+    const char *bytes = (const char *)data;
+    while (size > 0) {
+        ssize_t sent = send(fd, bytes, size, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        bytes += sent;
+        size -= sent;
+    }
+    return 0;
+}
+
+static int connect_unix(const char *path) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    snprintf(address.sun_path, sizeof(address.sun_path), "%s", path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1 || connect(fd, (struct sockaddr *)&address, sizeof(address)) == -1) {
+        perror("Failed to connect");
+        if (fd != -1) {
+            close(fd);
+        }
+        return -1;
+    }
+    return fd;
+}
+
+static void *load_thread(void *arg) {
+    LoadThread *self = (LoadThread *)arg;
+    const LoadOptions *options = self->options;
+    Reader *reader = (Reader *)malloc(sizeof(Reader));
+    if (!reader || (reader->fd = connect_unix(options->socket_path)) == -1) {
+        free(reader);
+        self->errors++;
+        return NULL;
+    }
+    reader->start = reader->end = 0;
+    char key[64] = "";
+    for (long done = 0; options->deadline_ns ? bf_limits_now_ns() < options->deadline_ns : done < options->requests;
+         ++done) {
+        char header[256];
+        int length = options->by_key && key[0]
+                         ? snprintf(header, sizeof(header), "HASH %s %zu %llu\n", key, options->input_size,
+                                    options->max_steps)
+                         : snprintf(header, sizeof(header), "RUN %zu %zu %llu\n", options->source_size,
+                                    options->input_size, options->max_steps);
+        int64_t start = bf_limits_now_ns();
+        if (send_all(reader->fd, header, length) != 0 ||
+            (header[0] == 'R' && send_all(reader->fd, options->source, options->source_size) != 0) ||
+            send_all(reader->fd, options->input, options->input_size) != 0) {
+            self->errors++;
+            break;
+        }
+        size_t offset = 0;
+        int matches = 1, ended = 0;
+        char line[256];
+        while (!ended && read_line(reader, line, sizeof(line))) {
+            size_t size;
+            char status[32];
+            if (sscanf(line, "OUT %zu", &size) == 1) {
+                if (!read_output(reader, size, options, &offset, &matches)) {
+                    break;
+                }
+            } else if (sscanf(line, "END %31s %*u %63s", status, key) == 2) {
+                ended = 1;
+                self->errors += strcmp(status, "ok") != 0;
+            } else {
+                fprintf(stderr, "Error: Server replied: %s\n", line);
+                ended = -1;
+            }
+        }
+        if (ended != 1) {
+            self->errors++;
+            break;
+        }
+        self->mismatches += options->expected && (!matches || offset != options->expected_size);
+        self->latencies = (int64_t *)grow_array(self->latencies, &self->capacity, self->count + 1, sizeof(int64_t));
+        self->latencies[self->count++] = bf_limits_now_ns() - start;
+    }
+    close(reader->fd);
+    free(reader);
+    return NULL;
+}
+
+static char *read_file(const char *path, size_t *size) {
+    FILE *file = fopen(path, "rb");
+    char *data = NULL;
+    size_t capacity = 0;
+    *size = 0;
+    if (!file) {
+        perror(path);
+        return NULL;
+    }
+    char chunk[65536];
+    size_t got;
+    while ((got = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        data = (char *)grow_array(data, &capacity, *size + got + 1, 1);
+        memcpy(data + *size, chunk, got);
+        *size += got;
+    }
+    fclose(file);
+    return data ? data : (char *)calloc(1, 1);
+}
+
+static int compare_latencies(const void *a, const void *b) {
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void usage(const char *program) {
+    fprintf(stderr,
+            "Usage: %s -s <socket> [-c <connections>] [-n <requests> | -d <seconds>] [--by-key]\n"
+            "          [--input <file>] [--expect <file>] [--max-steps <n>] <program.b>\n",
+            program);
+}
+
+int main(int argc, char *argv[]) {
+    LoadOptions options;
+    memset(&options, 0, sizeof(options));
+    const char *program_path = NULL, *input_path = NULL, *expect_path = NULL;
+    int connections = 4;
+    long requests = 1000;
+    double duration = 0;
+    for (int j = 1; j < argc; j++) {
+        if (strcmp(argv[j], "-s") == 0 && j + 1 < argc) {
+            options.socket_path = argv[++j];
+        } else if (strcmp(argv[j], "-c") == 0 && j + 1 < argc) {
+            connections = atoi(argv[++j]);  // Concurrent connections, one thread each
+        } else if (strcmp(argv[j], "-n") == 0 && j + 1 < argc) {
+            requests = strtol(argv[++j], NULL, 10);  // Requests in total
+        } else if (strcmp(argv[j], "-d") == 0 && j + 1 < argc) {
+            duration = strtod(argv[++j], NULL);  // ...or send for this many seconds
+        } else if (strcmp(argv[j], "--by-key") == 0) {
+            options.by_key = 1;  // After the first request, name the program by its key
+        } else if (strcmp(argv[j], "--input") == 0 && j + 1 < argc) {
+            input_path = argv[++j];
+        } else if (strcmp(argv[j], "--expect") == 0 && j + 1 < argc) {
+            expect_path = argv[++j];  // Output every response must match
+        } else if (strcmp(argv[j], "--max-steps") == 0 && j + 1 < argc) {
+            options.max_steps = strtoull(argv[++j], NULL, 10);
+        } else if (argv[j][0] != '-' && !program_path) {
+            program_path = argv[j];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (!options.socket_path || !program_path || connections < 1 || requests < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+    options.source = read_file(program_path, &options.source_size);
+    options.input = input_path ? read_file(input_path, &options.input_size) : "";
+    options.expected = expect_path ? read_file(expect_path, &options.expected_size) : NULL;
+    if (!options.source || !options.input || (expect_path && !options.expected)) {
+        return 1;
+    }
+    options.requests = (requests + connections - 1) / connections;
+
+    LoadThread *threads = (LoadThread *)calloc(connections, sizeof(LoadThread));
+    if (!threads) {
+        perror("Failed to allocate threads");
+        return 1;
+    }
+    int64_t start = bf_limits_now_ns();
+    options.deadline_ns = duration > 0 ? start + (int64_t)(duration * 1e9) : 0;
+    for (int t = 0; t < connections; ++t) {
+        threads[t].options = &options;
+        if (pthread_create(&threads[t].thread, NULL, load_thread, &threads[t]) != 0) {
+            perror("Failed to start thread");
+            return 1;
+        }
+    }
+    size_t total = 0, capacity = 0;
+    long errors = 0, mismatches = 0;
+    int64_t *latencies = NULL;
+    for (int t = 0; t < connections; ++t) {
+        pthread_join(threads[t].thread, NULL);
+        latencies = (int64_t *)grow_array(latencies, &capacity, total + threads[t].count + 1, sizeof(int64_t));
+        memcpy(latencies + total, threads[t].latencies, threads[t].count * sizeof(int64_t));
+        total += threads[t].count;
+        errors += threads[t].errors;
+        mismatches += threads[t].mismatches;
+        free(threads[t].latencies);
+    }
+    double seconds = (bf_limits_now_ns() - start) / 1e9;
+    if (total == 0) {
+        fprintf(stderr, "Error: No request completed\n");
+        return 1;
+    }
+    qsort(latencies, total, sizeof(int64_t), compare_latencies);
+    printf("%zu requests over %d connections in %.3f s: %.0f requests/s, %ld errors, %ld mismatches\n", total,
+           connections, seconds, total / seconds, errors, mismatches);
+    printf("latency ms: p50 %.3f  p90 %.3f  p99 %.3f  p99.9 %.3f  max %.3f\n", latencies[total / 2] / 1e6,
+           latencies[total * 9 / 10] / 1e6, latencies[total * 99 / 100] / 1e6, latencies[total * 999 / 1000] / 1e6,
+           latencies[total - 1] / 1e6);
+    free(latencies);
+    free(threads);
+    return errors || mismatches ? 1 : 0;
+}
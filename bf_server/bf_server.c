@@ -0,0 +1,589 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "../libbrainfog/brainfog.h"
+#include "../bf_common/bf_cache.h"  // Program keys
+#include "../bf_common/bf_pool.h"   // bf_pool_workers
+
+// Resident compile-and-run server: `bf_server -s /tmp/bf.sock`.
+//
+// Clients connect to a Unix socket and send requests, any number per
+// connection. Each request names a program by its source or by the key a
+// previous response returned:
+//
+//   RUN <source bytes> <input bytes> [max steps]\n<source><input>
+//   HASH <key> <input bytes> [max steps]\n<input>
+//
+// The output is streamed back as it is produced, then the request ends:
+//
+//   OUT <n>\n<n bytes>            (any number of these)
+//   END <status> <steps> <key>\n  (status: ok, step-limit, tape-fault, ...)
+//   ERR <message>\n               (bad request, unknown key, compile error, over a limit)
+//
+// Programs are compiled with libbrainfog and kept in an in-memory LRU keyed
+// like the compile cache (bf_cache.h: the commands only), so a repeated
+// program costs neither a process nor a compile. The main thread waits for
+// requests with epoll; a request is read and run on a worker thread, and the
+// connection is watched again once it is done. Each request is capped in
+// steps (--max-steps, 10^9 by default, or less if it asks) and in memory
+// (--max-memory: its source, input and compiled program).
+
+#define SERVER_DEFAULT_CACHE_MB 256
+#define SERVER_DEFAULT_MAX_MEMORY_MB 64
+#define SERVER_DEFAULT_MAX_STEPS 1000000000ULL  // A few seconds of the tightest loop
+#define SERVER_BUCKETS 4096
+#define SERVER_LINE_MAX 256
+#define SERVER_IO_TIMEOUT 30  // Seconds a worker waits on a stalled client
+
+typedef struct CacheEntry {
+    char key[33];
+    uint64_t hash;  // First half of the key, for the buckets
+    BrainfogProgram *program;
+    size_t memory;
+    int users;    // Requests running it
+    int evicted;  // Out of the cache, freed by its last user
+    struct CacheEntry *newer, *older;  // LRU list
+    struct CacheEntry *chain;          // Bucket
+} CacheEntry;
+
+typedef struct {
+    pthread_mutex_t lock;
+    CacheEntry *buckets[SERVER_BUCKETS];
+    CacheEntry *newest, *oldest;
+    size_t memory, max_memory;
+    unsigned long hits, misses, evictions;
+} ProgramCache;
+
+typedef struct Connection {
+    int fd;
+    char buffer[4096];  // Received but not yet consumed: buffer[start, end)
+    size_t start, end;
+    struct Connection *next;  // Work queue
+} Connection;
+
+typedef struct {
+    ProgramCache cache;
+    BrainfogContextPool *contexts;
+    uint64_t max_steps;
+    size_t max_memory;
+    int epoll_fd;
+
+    pthread_mutex_t queue_lock;
+    pthread_cond_t queue_ready;
+    Connection *queue_head, *queue_tail;
+    int stopping;
+
+    pthread_mutex_t stats_lock;
+    unsigned long requests, failed;
+} Server;
+
+static volatile sig_atomic_t server_stop = 0;
+
+static void stop_server(int sig) {
+    (void)sig;
+    server_stop = 1;
+}
+
+static void cache_unlink(ProgramCache *cache, CacheEntry *entry) {
+    if (entry->newer) {
+        entry->newer->older = entry->older;
+    } else {
+        cache->newest = entry->older;
+    }
+    if (entry->older) {
+        entry->older->newer = entry->newer;
+    } else {
+        cache->oldest = entry->newer;
+    }
+    entry->newer = entry->older = NULL;
+}
+
+static void cache_push_newest(ProgramCache *cache, CacheEntry *entry) {
+    entry->older = cache->newest;
+    entry->newer = NULL;
+    if (cache->newest) {
+        cache->newest->newer = entry;
+    } else {
+        cache->oldest = entry;
+    }
+    cache->newest = entry;
+}
+
+static uint64_t key_hash(const char *key) {
+    char half[17];
+    memcpy(half, key, 16);  // Keys are 32 hex digits
+    half[16] = '\0';
+    return strtoull(half, NULL, 16);
+}
+
+static CacheEntry **cache_slot(ProgramCache *cache, const char *key, uint64_t hash) {
+    CacheEntry **slot = &cache->buckets[hash % SERVER_BUCKETS];
+    while (*slot && strcmp((*slot)->key, key) != 0) {
+        slot = &(*slot)->chain;
+    }
+    return slot;
+}
+
+static void cache_free_entry(CacheEntry *entry) {
+    bf_program_free(entry->program);
+    free(entry);
+}
+
+// Find a program and hold it for a request (cache_release gives it back)
+static CacheEntry *cache_acquire(ProgramCache *cache, const char *key) {
+    uint64_t hash = key_hash(key);
+    pthread_mutex_lock(&cache->lock);
+    CacheEntry *entry = *cache_slot(cache, key, hash);
+    if (entry) {
+        entry->users++;
+        cache_unlink(cache, entry);
+        cache_push_newest(cache, entry);
+        cache->hits++;
+    } else {
+        cache->misses++;
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return entry;
+}
+
+// Add a freshly compiled program, held for the request, and evict the least
+// recently used ones over the budget; if another worker added the same
+// program meanwhile, that one is used instead
+static CacheEntry *cache_insert(ProgramCache *cache, const char *key, BrainfogProgram *program) {
+    CacheEntry *entry = (CacheEntry *)calloc(1, sizeof(CacheEntry));
+    if (!entry) {
+        perror("Failed to allocate cache entry");
+        exit(1);
+    }
+    snprintf(entry->key, sizeof(entry->key), "%s", key);
+    entry->hash = key_hash(key);
+    entry->program = program;
+    entry->memory = bf_program_memory(program) + sizeof(CacheEntry);
+    entry->users = 1;
+
+    pthread_mutex_lock(&cache->lock);
+    CacheEntry **slot = cache_slot(cache, key, entry->hash);
+    if (*slot) {
+        CacheEntry *existing = *slot;
+        existing->users++;
+        pthread_mutex_unlock(&cache->lock);
+        cache_free_entry(entry);
+        return existing;
+    }
+    *slot = entry;
+    cache_push_newest(cache, entry);
+    cache->memory += entry->memory;
+    while (cache->memory > cache->max_memory && cache->oldest != entry) {
+        CacheEntry *victim = cache->oldest;
+        cache_unlink(cache, victim);
+        *cache_slot(cache, victim->key, victim->hash) = victim->chain;
+        cache->memory -= victim->memory;
+        cache->evictions++;
+        victim->evicted = 1;
+        if (victim->users == 0) {
+            cache_free_entry(victim);
+        }
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return entry;
+}
+
+static void cache_release(ProgramCache *cache, CacheEntry *entry) {
+    pthread_mutex_lock(&cache->lock);
+    int unused = --entry->users == 0 && entry->evicted;
+    pthread_mutex_unlock(&cache->lock);
+    if (unused) {
+        cache_free_entry(entry);
+    }
+}
+
+static int send_all(int fd, const void *data, size_t size) {
+    const char *bytes = (const char *)data;
+    while (size > 0) {
+        ssize_t sent = send(fd, bytes, size, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        bytes += sent;
+        size -= sent;
+    }
+    return 0;
+}
+
+static int send_line(int fd, const char *format, ...) __attribute__((format(printf, 2, 3)));
+static int send_line(int fd, const char *format, ...) {
+    char line[SERVER_LINE_MAX];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    return send_all(fd, line, length < (int)sizeof(line) ? (size_t)length : sizeof(line) - 1);
+}
+
+// Fill the connection's buffer; returns 0 at end of stream or on an error
+static int connection_fill(Connection *connection) {
+    if (connection->start == connection->end) {
+        connection->start = connection->end = 0;
+    }
+    ssize_t got;
+    do {
+        got = recv(connection->fd, connection->buffer + connection->end,
+                   sizeof(connection->buffer) - connection->end, 0);
+    } while (got < 0 && errno == EINTR);
+    if (got <= 0) {
+        return 0;
+    }
+    connection->end += got;
+    return 1;
+}
+
+// Read one request line without its newline; returns 0 if the client left
+static int connection_read_line(Connection *connection, char *line, size_t size) {
+    for (;;) {
+        char *newline = (char *)memchr(connection->buffer + connection->start, '\n',
+                                       connection->end - connection->start);
+        if (newline) {
+            size_t length = newline - (connection->buffer + connection->start);
+            if (length >= size) {
+                return 0;
+            }
+            memcpy(line, connection->buffer + connection->start, length);
+            line[length] = '\0';
+            connection->start += length + 1;
+            return 1;
+        }
+        if (connection->end - connection->start >= SERVER_LINE_MAX) {
+            return 0;  // No request line is this long
+        }
+        if (connection->start > 0) {
+            memmove(connection->buffer, connection->buffer + connection->start, connection->end - connection->start);
+            connection->end -= connection->start;
+            connection->start = 0;
+        }
+        if (!connection_fill(connection)) {
+            return 0;
+        }
+    }
+}
+
+// Read exactly `size` payload bytes; returns 0 if the client left
+static int connection_read(Connection *connection, char *data, size_t size) {
+    size_t buffered = connection->end - connection->start;
+    size_t n = buffered < size ? buffered : size;
+    memcpy(data, connection->buffer + connection->start, n);
+    connection->start += n;
+    while (n < size) {
+        ssize_t got = recv(connection->fd, data + n, size - n, MSG_WAITALL);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            return 0;
+        }
+        n += got;
+    }
+    return 1;
+}
+
+static int stream_output(void *user, const unsigned char *data, size_t size) {
+    int fd = *(int *)user;
+    return send_line(fd, "OUT %zu\n", size) != 0 || send_all(fd, data, size) != 0;
+}
+
+static const char *status_name(int status) {
+    switch (status) {
+    case BRAINFOG_OK:
+        return "ok";
+    case BRAINFOG_STEP_LIMIT:
+        return "step-limit";
+    case BRAINFOG_TAPE_FAULT:
+        return "tape-fault";
+    case BRAINFOG_OUTPUT_FULL:
+        return "output-full";
+    default:
+        return "write-failed";
+    }
+}
+
+// Serve one request; returns 0 when the connection should be closed
+static int serve_request(Server *server, Connection *connection, BrainfogContext *context) {
+    char line[SERVER_LINE_MAX], verb[8], name[64];
+    unsigned long long first = 0, input_size = 0, max_steps = 0;
+    if (!connection_read_line(connection, line, sizeof(line))) {
+        return 0;
+    }
+    int fields = sscanf(line, "%7s %63s %llu %llu", verb, name, &input_size, &max_steps);
+    int run = strcmp(verb, "RUN") == 0, by_key = strcmp(verb, "HASH") == 0;
+    // %llu takes "-1" as its two's complement, so sizes and limits are refused with any '-' in them
+    if (fields < 3 || (!run && !by_key) || (run && sscanf(name, "%llu", &first) != 1) ||
+        (by_key && strlen(name) != 32) || strchr(line, '-')) {
+        send_line(connection->fd, "ERR bad request\n");
+        return 0;  // Can't tell where the next request starts
+    }
+    size_t source_size = run ? first : 0;
+    // Each size on its own first, so their sum can't wrap
+    if (source_size > server->max_memory || input_size > server->max_memory - source_size) {
+        send_line(connection->fd, "ERR request over the memory limit\n");
+        return 0;
+    }
+    char *payload = (char *)malloc(source_size + input_size + 1);
+    if (!payload || !connection_read(connection, payload, source_size + input_size)) {
+        free(payload);
+        return 0;
+    }
+
+    CacheEntry *entry;
+    if (run) {
+        BfCache key;
+        bf_cache_key_start(&key);
+        bf_cache_add_commands(&key, payload, source_size);
+        entry = cache_acquire(&server->cache, bf_cache_key(&key));
+        if (!entry) {
+            BrainfogProgram *program = bf_program_compile(payload, source_size, BRAINFOG_DEFAULT_PREEVAL_STEPS);
+            if (!program) {
+                send_line(connection->fd, "ERR unbalanced brackets\n");
+                free(payload);
+                return 1;
+            }
+            if (bf_program_memory(program) > server->max_memory - source_size - input_size) {
+                bf_program_free(program);
+                send_line(connection->fd, "ERR request over the memory limit\n");
+                free(payload);
+                return 1;
+            }
+            entry = cache_insert(&server->cache, key.key, program);
+        }
+    } else {
+        entry = cache_acquire(&server->cache, name);
+        if (!entry) {
+            send_line(connection->fd, "ERR unknown program\n");
+            free(payload);
+            return 1;
+        }
+    }
+
+    BrainfogIo io;
+    memset(&io, 0, sizeof(io));
+    io.input = (const unsigned char *)payload + source_size;
+    io.input_size = input_size;
+    io.write = stream_output;
+    io.user = &connection->fd;
+    io.max_steps = server->max_steps;
+    if (max_steps && (!io.max_steps || max_steps < io.max_steps)) {
+        io.max_steps = max_steps;
+    }
+    BrainfogResult result;
+    int status = bf_run(entry->program, context, &io, &result);
+    int ok = status != BRAINFOG_WRITE_FAILED &&
+             send_line(connection->fd, "END %s %llu %s\n", status_name(status),
+                       (unsigned long long)result.steps, entry->key) == 0;
+    cache_release(&server->cache, entry);
+    free(payload);
+
+    pthread_mutex_lock(&server->stats_lock);
+    server->requests++;
+    server->failed += status != BRAINFOG_OK;
+    pthread_mutex_unlock(&server->stats_lock);
+    return ok;
+}
+
+static void *server_worker(void *arg) {
+    Server *server = (Server *)arg;
+    BrainfogContext *context = bf_context_create(server->contexts);
+    for (;;) {
+        pthread_mutex_lock(&server->queue_lock);
+        while (!server->queue_head && !server->stopping) {
+            pthread_cond_wait(&server->queue_ready, &server->queue_lock);
+        }
+        Connection *connection = server->queue_head;
+        if (connection) {
+            server->queue_head = connection->next;
+            if (!server->queue_head) {
+                server->queue_tail = NULL;
+            }
+        }
+        pthread_mutex_unlock(&server->queue_lock);
+        if (!connection) {
+            break;
+        }
+
+        // Requests the client already sent are served now; otherwise the
+        // connection goes back to epoll until the next one arrives
+        int open;
+        do {
+            open = serve_request(server, connection, context);
+        } while (open && connection->start < connection->end);
+        struct epoll_event event = {EPOLLIN | EPOLLRDHUP | EPOLLONESHOT, {connection}};
+        if (!open || epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, connection->fd, &event) != 0) {
+            close(connection->fd);
+            free(connection);
+        }
+    }
+    bf_context_release(context);
+    return NULL;
+}
+
+static void queue_connection(Server *server, Connection *connection) {
+    connection->next = NULL;
+    pthread_mutex_lock(&server->queue_lock);
+    if (server->queue_tail) {
+        server->queue_tail->next = connection;
+    } else {
+        server->queue_head = connection;
+    }
+    server->queue_tail = connection;
+    pthread_cond_signal(&server->queue_ready);
+    pthread_mutex_unlock(&server->queue_lock);
+}
+
+static int listen_unix(const char *path) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Error: Socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(address.sun_path, path);
+    struct stat st;
+    if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(path);  // Left over from an earlier server
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1 || bind(fd, (struct sockaddr *)&address, sizeof(address)) == -1 || listen(fd, SOMAXCONN) == -1) {
+        perror("Failed to listen");
+        if (fd != -1) {
+            close(fd);
+        }
+        return -1;
+    }
+    return fd;
+}
+
+static void usage(const char *program) {
+    fprintf(stderr,
+            "Usage: %s -s <socket> [-j <workers>] [--cache-mb <n>] [--max-steps <n>] [--max-memory <MB>]\n",
+            program);
+}
+
+int main(int argc, char *argv[]) {
+    const char *socket_path = NULL;
+    long jobs = 0;
+    size_t cache_mb = SERVER_DEFAULT_CACHE_MB, max_memory_mb = SERVER_DEFAULT_MAX_MEMORY_MB;
+    uint64_t max_steps = SERVER_DEFAULT_MAX_STEPS;
+    for (int j = 1; j < argc; j++) {
+        if (strcmp(argv[j], "-s") == 0 && j + 1 < argc) {
+            socket_path = argv[++j];  // Unix socket to listen on
+        } else if (strcmp(argv[j], "-j") == 0 && j + 1 < argc) {
+            jobs = strtol(argv[++j], NULL, 10);  // Worker threads, 0: one per CPU
+        } else if (strcmp(argv[j], "--cache-mb") == 0 && j + 1 < argc) {
+            cache_mb = strtoull(argv[++j], NULL, 10);  // Compiled programs kept in memory
+        } else if (strcmp(argv[j], "--max-steps") == 0 && j + 1 < argc) {
+            max_steps = strtoull(argv[++j], NULL, 10);  // Per request, 0: none (trusted clients only)
+        } else if (strcmp(argv[j], "--max-memory") == 0 && j + 1 < argc) {
+            max_memory_mb = strtoull(argv[++j], NULL, 10);  // Per request: source, input and program
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (!socket_path) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    static Server server;
+    pthread_mutex_init(&server.cache.lock, NULL);
+    server.cache.max_memory = cache_mb << 20;
+    server.max_steps = max_steps;
+    server.max_memory = max_memory_mb << 20;
+    pthread_mutex_init(&server.queue_lock, NULL);
+    pthread_cond_init(&server.queue_ready, NULL);
+    pthread_mutex_init(&server.stats_lock, NULL);
+    int workers = bf_pool_workers(jobs);
+    server.contexts = bf_context_pool_create(workers);
+
+    int listen_fd = listen_unix(socket_path);
+    server.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event listen_event = {EPOLLIN, {NULL}};
+    if (listen_fd == -1 || server.epoll_fd == -1 ||
+        epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, listen_fd, &listen_event) == -1) {
+        if (listen_fd != -1) {
+            perror("Failed to watch the socket");
+        }
+        return 1;
+    }
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stop_server;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    pthread_t threads[BF_POOL_MAX_WORKERS];
+    for (int w = 0; w < workers; ++w) {
+        if (pthread_create(&threads[w], NULL, server_worker, &server) != 0) {
+            perror("Failed to start worker");
+            return 1;
+        }
+    }
+    fprintf(stderr, "Serving on %s with %d workers\n", socket_path, workers);
+
+    struct epoll_event events[64];
+    while (!server_stop) {
+        int count = epoll_wait(server.epoll_fd, events, 64, -1);
+        if (count == -1 && errno != EINTR) {
+            perror("Failed to wait for requests");
+            break;
+        }
+        for (int k = 0; k < count; ++k) {
+            if (events[k].data.ptr) {
+                queue_connection(&server, (Connection *)events[k].data.ptr);
+                continue;
+            }
+            int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+            if (fd == -1) {
+                continue;
+            }
+            struct timeval timeout = {SERVER_IO_TIMEOUT, 0};
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+            Connection *connection = (Connection *)calloc(1, sizeof(Connection));
+            struct epoll_event event = {EPOLLIN | EPOLLRDHUP | EPOLLONESHOT, {connection}};
+            if (!connection) {
+                close(fd);
+                continue;
+            }
+            connection->fd = fd;
+            if (epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+                close(fd);
+                free(connection);
+            }
+        }
+    }
+
+    pthread_mutex_lock(&server.queue_lock);
+    server.stopping = 1;
+    pthread_cond_broadcast(&server.queue_ready);
+    pthread_mutex_unlock(&server.queue_lock);
+    for (int w = 0; w < workers; ++w) {
+        pthread_join(threads[w], NULL);
+    }
+    fprintf(stderr, "Served %lu requests (%lu not ok); cache: %lu hits, %lu misses, %lu evictions, %zu KB\n",
+            server.requests, server.failed, server.cache.hits, server.cache.misses, server.cache.evictions,
+            server.cache.memory >> 10);
+    unlink(socket_path);
+    return 0;
+}
@@ -0,0 +1,192 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "brainfog.h"
+#include "../bf_common/bf_bytecode.h"
+#include "../bf_common/bf_dataflow.h"
+#include "../bf_common/bf_preeval.h"
+#include "../bf_common/bf_session.h"
+
+// The library runs programs with the sessions' resumable interpreter
+// (bf_common/bf_session.h): bf_run resumes it and moves bytes between the
+// session's small buffers and the caller's I/O whenever it stops.
+
+#define BRAINFOG_SLICE (1 << 30)  // Steps between limit checks when there is no max_steps
+
+struct BrainfogProgram {
+    BfProgram program;
+    uint32_t *costs;  // Per back edge, see bf_bytecode_loop_costs
+};
+
+struct BrainfogContext {
+    BfSession session;
+    BrainfogContextPool *pool;
+    BrainfogContext *next;  // Free list
+    unsigned char tape[BRAINFOG_TAPE_SIZE];
+};
+
+struct BrainfogContextPool {
+    pthread_mutex_t lock;
+    BrainfogContext *free;
+};
+
+BrainfogProgram *bf_program_compile(const char *source, size_t size, size_t preeval_steps) {
+    BrainfogProgram *compiled = (BrainfogProgram *)calloc(1, sizeof(BrainfogProgram));
+    if (!compiled) {
+        perror("Failed to allocate program");
+        exit(1);
+    }
+    if (bf_bytecode_compile(source, size, &compiled->program) != 0) {
+        bf_bytecode_free(&compiled->program);
+        free(compiled);
+        return NULL;
+    }
+    bf_dataflow_optimize(&compiled->program, NULL);
+    bf_preeval(&compiled->program, BRAINFOG_TAPE_SIZE, preeval_steps);
+    compiled->costs = bf_bytecode_loop_costs(&compiled->program);
+    free(compiled->program.spans);  // Only the passes above map ops back to the source
+    compiled->program.spans = NULL;
+    return compiled;
+}
+
+void bf_program_free(BrainfogProgram *program) {
+    if (program) {
+        bf_bytecode_free(&program->program);
+        free(program->costs);
+        free(program);
+    }
+}
+
+size_t bf_program_memory(const BrainfogProgram *program) {
+    const BfProgram *compiled = &program->program;
+    return sizeof(BrainfogProgram) + compiled->insn_capacity * sizeof(BfInsn) +
+           compiled->term_capacity * sizeof(BfMulTerm) + compiled->snapshot.tape_size +
+           compiled->snapshot.output_size + compiled->insn_count * sizeof(uint32_t);
+}
+
+static BrainfogContext *brainfog_context_new(BrainfogContextPool *pool) {
+    BrainfogContext *context = (BrainfogContext *)malloc(sizeof(BrainfogContext));
+    if (!context) {
+        perror("Failed to allocate context");
+        exit(1);
+    }
+    context->pool = pool;
+    context->next = NULL;
+    return context;
+}
+
+BrainfogContextPool *bf_context_pool_create(size_t preallocate) {
+    BrainfogContextPool *pool = (BrainfogContextPool *)calloc(1, sizeof(BrainfogContextPool));
+    if (!pool) {
+        perror("Failed to allocate context pool");
+        exit(1);
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    for (size_t k = 0; k < preallocate; ++k) {
+        BrainfogContext *context = brainfog_context_new(pool);
+        context->next = pool->free;
+        pool->free = context;
+    }
+    return pool;
+}
+
+void bf_context_pool_free(BrainfogContextPool *pool) {
+    if (!pool) {
+        return;
+    }
+    while (pool->free) {
+        BrainfogContext *next = pool->free->next;
+        free(pool->free);
+        pool->free = next;
+    }
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
+
+BrainfogContext *bf_context_create(BrainfogContextPool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    BrainfogContext *context = pool->free;
+    if (context) {
+        pool->free = context->next;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return context ? context : brainfog_context_new(pool);
+}
+
+void bf_context_release(BrainfogContext *context) {
+    BrainfogContextPool *pool = context->pool;
+    pthread_mutex_lock(&pool->lock);
+    context->next = pool->free;
+    pool->free = context;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// Hand output to the callback or copy what fits into the buffer
+static int brainfog_write(const BrainfogIo *io, const unsigned char *data, size_t size, size_t *output_size) {
+    if (size == 0) {
+        return BRAINFOG_OK;
+    }
+    if (io->write) {
+        *output_size += size;
+        return io->write(io->user, data, size) == 0 ? BRAINFOG_OK : BRAINFOG_WRITE_FAILED;
+    }
+    size_t room = io->output_capacity - *output_size;
+    size_t n = size < room ? size : room;
+    if (n) {
+        memcpy(io->output + *output_size, data, n);
+    }
+    *output_size += n;
+    return n == size ? BRAINFOG_OK : BRAINFOG_OUTPUT_FULL;
+}
+
+int bf_run(const BrainfogProgram *compiled, BrainfogContext *context, const BrainfogIo *io, BrainfogResult *result) {
+    const BfProgram *program = &compiled->program;
+    BfSession *session = &context->session;
+    size_t input_read = 0, output_size = 0;
+
+    memset(context->tape, 0, BRAINFOG_TAPE_SIZE);
+    bf_session_start(session, program, context->tape, BRAINFOG_TAPE_SIZE);  // Preevaluated for this tape size
+    int status = brainfog_write(io, (const unsigned char *)program->snapshot.output, program->snapshot.output_size,
+                                &output_size);
+    while (status == BRAINFOG_OK) {
+        int64_t slice = BRAINFOG_SLICE;
+        if (io->max_steps && (int64_t)(io->max_steps - session->steps) < slice) {
+            slice = (int64_t)(io->max_steps - session->steps);
+        }
+        int state = bf_session_resume(session, program, compiled->costs, slice);
+        status = brainfog_write(io, session->output, session->output_length, &output_size);
+        session->output_length = 0;
+        if (status != BRAINFOG_OK || state == BF_SESSION_END) {
+            break;
+        }
+        if (state == BF_SESSION_FAULT) {
+            status = BRAINFOG_TAPE_FAULT;
+        } else if (state == BF_SESSION_YIELD && io->max_steps && session->steps >= io->max_steps) {
+            status = BRAINFOG_STEP_LIMIT;
+        } else if (state == BF_SESSION_INPUT) {
+            size_t n;
+            if (io->read) {
+                n = io->read(io->user, session->input, BF_SESSION_INPUT_SIZE);
+                n = n < BF_SESSION_INPUT_SIZE ? n : BF_SESSION_INPUT_SIZE;
+            } else {
+                n = io->input_size - input_read < BF_SESSION_INPUT_SIZE ? io->input_size - input_read
+                                                                        : BF_SESSION_INPUT_SIZE;
+                if (n) {
+                    memcpy(session->input, io->input + input_read, n);
+                }
+            }
+            input_read += n;
+            session->input_head = 0;
+            session->input_tail = (uint16_t)n;
+            session->input_eof = n == 0;
+        }
+    }
+
+    if (result) {
+        result->steps = session->steps;
+        result->output_size = output_size;
+        result->input_used = input_read - (session->input_tail - session->input_head);
+    }
+    return status;
+}
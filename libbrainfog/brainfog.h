@@ -0,0 +1,96 @@
+#ifndef BRAINFOG_H
+#define BRAINFOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// libbrainfog: the interpreter engine as a library, for services that run
+// Brainfuck programs without starting a process per run.
+//
+//   BrainfogProgram *program = bf_program_compile(source, size, BRAINFOG_DEFAULT_PREEVAL_STEPS);
+//   BrainfogContextPool *pool = bf_context_pool_create(threads);
+//   ...on any thread:
+//   BrainfogContext *context = bf_context_create(pool);
+//   BrainfogIo io = {input, input_size, NULL, output, output_capacity, NULL, NULL, max_steps};
+//   BrainfogResult result;
+//   int status = bf_run(program, context, &io, &result);
+//   bf_context_release(context);
+//
+// A compiled program is immutable and can be run by any number of threads at
+// once. A context (tape plus input and output buffers) serves one run at a
+// time; contexts come from a pool so they are allocated once and reused.
+// There is no global state, and bf_run allocates nothing: it only touches the
+// program, the context and the caller's buffers. Unlike bf_interp, the
+// pointer is checked against the tape.
+//
+// Compile errors are reported on stderr, like the tools do; running out of
+// memory while compiling or creating a context aborts the process.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BRAINFOG_TAPE_SIZE 30000
+#define BRAINFOG_DEFAULT_PREEVAL_STEPS 10000000
+
+enum {
+    BRAINFOG_OK,            // The program finished
+    BRAINFOG_STEP_LIMIT,    // It went over max_steps
+    BRAINFOG_TAPE_FAULT,    // The pointer left the tape
+    BRAINFOG_OUTPUT_FULL,   // Buffer output: more output than output_capacity
+    BRAINFOG_WRITE_FAILED,  // The write callback asked to stop
+};
+
+typedef struct BrainfogProgram BrainfogProgram;
+typedef struct BrainfogContext BrainfogContext;
+typedef struct BrainfogContextPool BrainfogContextPool;
+
+// Input and output of one run. Each side is either a buffer or a callback:
+// the callback is used when set.
+typedef struct {
+    const unsigned char *input;  // `,` reads input[0, input_size), then EOF (255)
+    size_t input_size;
+    size_t (*read)(void *user, unsigned char *buffer, size_t size);  // Bytes read into buffer, 0 at EOF
+
+    unsigned char *output;  // `.` writes to output[0, output_capacity)
+    size_t output_capacity;
+    int (*write)(void *user, const unsigned char *data, size_t size);  // Non-zero stops the run
+
+    void *user;          // Passed to read and write
+    uint64_t max_steps;  // Stop the program after this many steps, 0 for no limit
+} BrainfogIo;
+
+typedef struct {
+    uint64_t steps;       // As bf_interp --max-steps counts them
+    size_t output_size;   // Bytes written to the output buffer or callback
+    size_t input_used;    // Bytes of input the program read
+} BrainfogResult;
+
+// Compile `source` (any text; only the eight commands count). Up to
+// `preeval_steps` ops of its input-free prefix run now, once, instead of in
+// every run (0 turns that off). Returns NULL for an unbalanced program.
+BrainfogProgram *bf_program_compile(const char *source, size_t size, size_t preeval_steps);
+void bf_program_free(BrainfogProgram *program);
+
+// Bytes the compiled program holds, for callers that budget memory
+size_t bf_program_memory(const BrainfogProgram *program);
+
+// A pool of contexts, `preallocate` of them made up front; more are made
+// when a bf_context_create finds none free. Freeing the pool frees the
+// contexts released to it; release every context first.
+BrainfogContextPool *bf_context_pool_create(size_t preallocate);
+void bf_context_pool_free(BrainfogContextPool *pool);
+
+// Take a context from the pool, and give it back; both are thread-safe
+BrainfogContext *bf_context_create(BrainfogContextPool *pool);
+void bf_context_release(BrainfogContext *context);
+
+// Run `program` from the start on `context`; returns BRAINFOG_*, and fills
+// `result` when it isn't NULL
+int bf_run(const BrainfogProgram *program, BrainfogContext *context, const BrainfogIo *io, BrainfogResult *result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BRAINFOG_H
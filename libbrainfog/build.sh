@@ -0,0 +1,18 @@
+#!/bin/bash
+
+# Build libbrainfog.a (and its header next to it) for linking into a service.
+#
+#   ./libbrainfog/build.sh [build dir]
+#
+# The build dir defaults to libbrainfog/build. CFLAGS is passed to the
+# compiler, e.g. CFLAGS="-O1 -g -fsanitize=thread" for a ThreadSanitizer build
+# (link the program with the same flag).
+
+LIB=$(cd "$(dirname "$0")" && pwd)
+BUILD=${1:-$LIB/build}
+mkdir -p "$BUILD" || exit 1
+
+gcc ${CFLAGS:--O2} -Wall -pthread -c "$LIB/brainfog.c" -o "$BUILD/brainfog.o" || exit 1
+rm -f "$BUILD/libbrainfog.a"
+ar rcs "$BUILD/libbrainfog.a" "$BUILD/brainfog.o" || exit 1
+cp "$LIB/brainfog.h" "$BUILD/" || exit 1
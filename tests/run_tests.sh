@@ -0,0 +1,33 @@
+#!/bin/bash
+
+# Build what the tests need and run every test in tests/.
+#
+#   ./tests/run_tests.sh
+#
+# Each test prints one `name: ok` line, or what went wrong on stderr; the exit
+# status is the number of tests that failed.
+
+REPO=$(cd "$(dirname "$0")/.." && pwd)
+BUILD=${BUILD_DIR:-$REPO/tests/build}
+mkdir -p "$BUILD" || exit 1
+
+gcc -O2 -pthread "$REPO/bf_interp.c" -o "$BUILD/bf_interp" || exit 1
+gcc -O2 -pthread "$REPO/bf_compiler/bf_compiler.c" -o "$BUILD/bf_compiler" || exit 1
+gcc -O2 -pthread "$REPO/bf_JIT/bf_JIT.c" -o "$BUILD/bf_JIT" || exit 1
+gcc -O2 -Wall "$REPO/tests/test_source.c" -o "$BUILD/test_source" || exit 1
+gcc -O2 -Wall -pthread "$REPO/tests/test_brackets.c" -o "$BUILD/test_brackets" || exit 1
+"$REPO/libbrainfog/build.sh" "$BUILD/libbrainfog" || exit 1
+gcc -O2 -Wall -pthread "$REPO/tests/test_brainfog.c" "$BUILD/libbrainfog/libbrainfog.a" -o "$BUILD/test_brainfog" || exit 1
+
+# The benches that run in well under a second, for the tests that run them many times
+QUICK_BENCHES=$(ls "$REPO"/benches/*.b | grep -v -e /long.b -e /mandel.b)
+
+failed=0
+BF_INTERP=$BUILD/bf_interp "$REPO/tests/test_checkpoint.sh" || failed=$((failed + 1))
+BF_INTERP=$BUILD/bf_interp "$REPO/tests/test_batch.sh" || failed=$((failed + 1))
+BF_INTERP=$BUILD/bf_interp "$REPO/tests/test_splice.sh" || failed=$((failed + 1))
+BF_COMPILER=$BUILD/bf_compiler BF_JIT=$BUILD/bf_JIT "$REPO/tests/test_simple_loops.sh" || failed=$((failed + 1))
+"$BUILD/test_source" || failed=$((failed + 1))
+"$BUILD/test_brackets" || failed=$((failed + 1))
+"$BUILD/test_brainfog" "$REPO/benches/golden" 4 2 $QUICK_BENCHES || failed=$((failed + 1))
+exit $failed
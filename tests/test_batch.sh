@@ -0,0 +1,39 @@
+#!/bin/bash
+
+# Run the benches in one --batch next to programs that leave the tape (on
+# either side, by moves and by a scan) and check that only those fail: the
+# benches' outputs still match benches/golden/.
+#
+#   BF_INTERP=path/to/bf_interp ./tests/test_batch.sh
+
+BF_INTERP=${BF_INTERP:?set BF_INTERP to a built bf_interp}
+REPO=$(cd "$(dirname "$0")/.." && pwd)
+WORK=$(mktemp -d) || exit 1
+trap 'rm -rf "$WORK"' EXIT
+
+printf '<<<<+' > "$WORK/left.b"
+printf -- '-[>-]' > "$WORK/right.b"
+printf '+[<]' > "$WORK/scan.b"
+for bench in "$REPO"/benches/*.b; do
+    echo "$bench - $WORK/$(basename "$bench" .b).out"
+    for bad in left right scan; do
+        echo "$WORK/$bad.b - $WORK/$bad.out"
+    done
+done > "$WORK/jobs.txt"
+
+"$BF_INTERP" --batch "$WORK/jobs.txt" -j 4 2> "$WORK/stderr"
+failed=$(grep -c "the pointer left the tape" "$WORK/stderr")
+expected=$((3 * $(ls "$REPO"/benches/*.b | wc -l)))
+if [ "$failed" -ne "$expected" ]; then
+    echo "FAIL: $failed programs left the tape, expected $expected" >&2
+    cat "$WORK/stderr" >&2
+    exit 1
+fi
+for bench in "$REPO"/benches/*.b; do
+    name=$(basename "$bench" .b)
+    if ! cmp -s "$WORK/$name.out" "$REPO/benches/golden/$name.out"; then
+        echo "FAIL: $name's output differs from benches/golden/$name.out" >&2
+        exit 1
+    fi
+done
+echo "batch: ok"
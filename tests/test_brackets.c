@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../bf_common/bf_common.h"
+
+// Check the chunked bracket matcher against a plain serial walk:
+//
+//   test_brackets [iterations]
+//
+// Random programs, balanced or not, are matched with match_brackets in 1 to
+// BF_BRACKETS_MAX_THREADS chunks (more chunks than brackets too). A balanced
+// program must give the serial jump map; an unbalanced one must fail with the
+// error the serial walk reports: the first unmatched ']', or else the
+// innermost unmatched '['.
+
+#define MAX_PROGRAM 4096
+
+static const size_t chunk_counts[] = {1, 2, 3, 4, 7, 16, BF_BRACKETS_MAX_THREADS};
+
+// The serial walk: fills jump_map and returns 0, or writes the error to
+// `error` and returns -1
+static int match_serial(const char *source, size_t size, int *jump_map, char *error, size_t error_size) {
+    int *stack = (int *)malloc((size ? size : 1) * sizeof(int));
+    size_t depth = 0;
+    for (size_t i = 0; i < size; ++i) {
+        jump_map[i] = -1;
+        if (source[i] == '[') {
+            stack[depth++] = (int)i;
+        } else if (source[i] == ']') {
+            if (depth == 0) {
+                snprintf(error, error_size, "Error: Unmatched ']' at position %zu\n", i);
+                free(stack);
+                return -1;
+            }
+            int open = stack[--depth];
+            jump_map[open] = (int)i;
+            jump_map[i] = open;
+        }
+    }
+    if (depth > 0) {
+        snprintf(error, error_size, "Error: Unmatched '[' at position %d\n", stack[depth - 1]);
+    }
+    free(stack);
+    return depth > 0 ? -1 : 0;
+}
+
+// Run match_brackets with its stderr captured into `error`, through `capture`
+static int match_captured(const char *source, size_t size, int *jump_map, size_t chunks, FILE *capture, char *error,
+                          size_t error_size) {
+    int saved = dup(fileno(stderr));
+    if (saved == -1 || ftruncate(fileno(capture), 0) != 0) {
+        perror("Failed to capture stderr");
+        exit(1);
+    }
+    rewind(capture);
+    fflush(stderr);
+    dup2(fileno(capture), fileno(stderr));
+    int status = match_brackets(source, size, jump_map, chunks);
+    fflush(stderr);
+    dup2(saved, fileno(stderr));
+    close(saved);
+    rewind(capture);
+    size_t got = fread(error, 1, error_size - 1, capture);
+    error[got] = '\0';
+    return status;
+}
+
+// A random program: mostly balanced with deep or shallow nesting, sometimes
+// with a bracket dropped, added or swapped, sometimes brackets at random
+static size_t random_program(char *source) {
+    size_t size = rand() % 4 ? rand() % 200 : rand() % (MAX_PROGRAM / 2);
+    int kind = rand() % 4, nest_percent = rand() % 2 ? 50 : 95;
+    size_t depth = 0;
+    for (size_t i = 0; i < size; ++i) {
+        int r = rand() % 100;
+        if (kind == 3) {
+            source[i] = r < 40 ? '[' : r < 80 ? ']' : "+-<>.,"[r % 6];
+        } else if (r < 30 && (depth == 0 || rand() % 100 < nest_percent)) {
+            source[i] = '[';
+            depth++;
+        } else if (r < 30) {
+            source[i] = ']';
+            depth--;
+        } else {
+            source[i] = "+-<>.,"[r % 6];
+        }
+    }
+    while (depth > 0) {  // Close what is open, at most doubling the size
+        source[size++] = ']';
+        depth--;
+    }
+    if (size > 0 && kind == 1) {
+        source[rand() % size] = "[]"[rand() % 2];  // Usually unbalanced now
+    } else if (size > 1 && kind == 2) {
+        size_t a = rand() % size, b = rand() % size;
+        char c = source[a];
+        source[a] = source[b];
+        source[b] = c;
+    }
+    return size;
+}
+
+int main(int argc, char *argv[]) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 500;
+    char *source = (char *)malloc(MAX_PROGRAM);
+    int *expected = (int *)malloc(MAX_PROGRAM * sizeof(int)), *jump_map = (int *)malloc(MAX_PROGRAM * sizeof(int));
+    char expected_error[128], error[4096];
+    int failures = 0, unbalanced = 0;
+    FILE *capture = tmpfile();
+    if (!capture) {
+        perror("Failed to capture stderr");
+        return 1;
+    }
+    srand(1);
+
+    for (int n = 0; n < iterations; ++n) {
+        size_t size = random_program(source);
+        expected_error[0] = '\0';
+        int expected_status = match_serial(source, size, expected, expected_error, sizeof(expected_error));
+        unbalanced += expected_status != 0;
+        for (size_t c = 0; c < sizeof(chunk_counts) / sizeof(chunk_counts[0]); ++c) {
+            int status = match_captured(source, size, jump_map, chunk_counts[c], capture, error, sizeof(error));
+            if (status != expected_status || strcmp(error, expected_error) != 0 ||
+                (status == 0 && size > 0 && memcmp(jump_map, expected, size * sizeof(int)) != 0)) {
+                fprintf(stderr, "FAIL: %zu chars in %zu chunks: status %d, expected %d; said \"%s\", expected \"%s\"\n",
+                        size, chunk_counts[c], status, expected_status, error, expected_error);
+                failures++;
+            }
+        }
+    }
+    fclose(capture);
+    free(source);
+    free(expected);
+    free(jump_map);
+    if (failures) {
+        fprintf(stderr, "FAIL: %d matches\n", failures);
+        return 1;
+    }
+    if (unbalanced == 0 || unbalanced == iterations) {
+        fprintf(stderr, "FAIL: %d of %d programs unbalanced, expected a mix\n", unbalanced, iterations);
+        return 1;
+    }
+    printf("brackets: ok\n");
+    return 0;
+}
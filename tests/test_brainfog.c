@@ -0,0 +1,193 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "../libbrainfog/brainfog.h"
+
+// Run libbrainfog programs from several threads at once and check every
+// output against the golden files:
+//
+//   test_brainfog <golden dir> <threads> <rounds> bench.b...
+//
+// The programs are compiled once and the contexts come from one pool made
+// smaller than the thread count, so threads share programs and reuse each
+// other's contexts. Each thread runs every program `rounds` times, starting
+// at a different one, alternately into a buffer and through a write
+// callback. A few single-threaded runs check the other statuses.
+
+typedef struct {
+    const char *name;
+    BrainfogProgram *program;
+    char *expected;
+    size_t expected_size;
+} TestProgram;
+
+typedef struct {
+    const TestProgram *programs;
+    int count;
+    int rounds;
+    int index;
+    BrainfogContextPool *pool;
+    long runs, failures;
+    pthread_t thread;
+} TestThread;
+
+typedef struct {
+    unsigned char *data;
+    size_t size, capacity;
+} Collected;
+
+static char *read_file(const char *path, size_t *size) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        perror(path);
+        return NULL;
+    }
+    char *data = NULL;
+    size_t capacity = 0, got;
+    *size = 0;
+    do {
+        if (*size + 65536 > capacity) {
+            capacity = capacity ? capacity * 2 : 65536;
+            data = (char *)realloc(data, capacity);
+            if (!data) {
+                perror("Failed to read file");
+                exit(1);
+            }
+        }
+        got = fread(data + *size, 1, capacity - *size, file);
+        *size += got;
+    } while (got > 0);
+    fclose(file);
+    return data;
+}
+
+static int collect(void *user, const unsigned char *data, size_t size) {
+    Collected *collected = (Collected *)user;
+    if (collected->size + size > collected->capacity) {
+        collected->capacity = (collected->size + size) * 2;
+        collected->data = (unsigned char *)realloc(collected->data, collected->capacity);
+        if (!collected->data) {
+            return 1;
+        }
+    }
+    memcpy(collected->data + collected->size, data, size);
+    collected->size += size;
+    return 0;
+}
+
+// Run one program once, into a buffer or through the callback; returns 0 when
+// the output matches
+static int run_once(const TestProgram *test, BrainfogContextPool *pool, int use_callback) {
+    Collected collected = {NULL, 0, 0};
+    unsigned char *buffer = (unsigned char *)malloc(test->expected_size + 1);  // Room to notice extra output
+    BrainfogIo io = {NULL, 0, NULL, buffer, test->expected_size + 1, NULL, NULL, 0};
+    if (use_callback) {
+        io.write = collect;
+        io.user = &collected;
+    }
+    BrainfogResult result;
+    BrainfogContext *context = bf_context_create(pool);
+    int status = bf_run(test->program, context, &io, &result);
+    bf_context_release(context);
+
+    const unsigned char *output = use_callback ? collected.data : buffer;
+    int ok = status == BRAINFOG_OK && result.output_size == test->expected_size &&
+             (test->expected_size == 0 || memcmp(output, test->expected, test->expected_size) == 0);
+    if (!ok) {
+        fprintf(stderr, "FAIL: %s (%s): status %d, %zu bytes of output, expected %zu\n", test->name,
+                use_callback ? "callback" : "buffer", status, result.output_size, test->expected_size);
+    }
+    free(collected.data);
+    free(buffer);
+    return ok ? 0 : 1;
+}
+
+static void *test_thread(void *arg) {
+    TestThread *self = (TestThread *)arg;
+    for (int round = 0; round < self->rounds; ++round) {
+        for (int k = 0; k < self->count; ++k) {
+            const TestProgram *test = &self->programs[(self->index + round + k) % self->count];
+            self->failures += run_once(test, self->pool, (self->index + round + k) % 2);
+            self->runs++;
+        }
+    }
+    return NULL;
+}
+
+// Check one run of `source` ends with `expected`
+static int check_status(BrainfogContextPool *pool, const char *source, uint64_t max_steps, size_t capacity,
+                        int expected, const char *what) {
+    BrainfogProgram *program = bf_program_compile(source, strlen(source), 0);
+    unsigned char output[16];
+    BrainfogIo io = {NULL, 0, NULL, output, capacity, NULL, NULL, max_steps};
+    BrainfogContext *context = bf_context_create(pool);
+    int status = program ? bf_run(program, context, &io, NULL) : -1;
+    bf_context_release(context);
+    bf_program_free(program);
+    if (status != expected) {
+        fprintf(stderr, "FAIL: %s: status %d, expected %d\n", what, status, expected);
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 5) {
+        fprintf(stderr, "Usage: %s <golden dir> <threads> <rounds> <bench.b>...\n", argv[0]);
+        return 1;
+    }
+    const char *golden = argv[1];
+    int threads = atoi(argv[2]), rounds = atoi(argv[3]), count = argc - 4;
+    TestProgram *programs = (TestProgram *)calloc(count, sizeof(TestProgram));
+    for (int k = 0; k < count; ++k) {
+        const char *path = argv[k + 4];
+        const char *base = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+        char expected_path[4096];
+        snprintf(expected_path, sizeof(expected_path), "%s/%.*s.out", golden, (int)strcspn(base, "."), base);
+        size_t size;
+        char *source = read_file(path, &size);
+        programs[k].name = base;
+        programs[k].expected = read_file(expected_path, &programs[k].expected_size);
+        programs[k].program = source ? bf_program_compile(source, size, BRAINFOG_DEFAULT_PREEVAL_STEPS) : NULL;
+        free(source);
+        if (!programs[k].program || !programs[k].expected) {
+            fprintf(stderr, "FAIL: %s: couldn't load it or its golden output\n", path);
+            return 1;
+        }
+    }
+
+    BrainfogContextPool *pool = bf_context_pool_create(threads > 1 ? threads / 2 : 1);
+    long failures = 0, runs = 0;
+    failures += check_status(pool, "+[]", 1000, 16, BRAINFOG_STEP_LIMIT, "step limit");
+    failures += check_status(pool, "<+", 0, 16, BRAINFOG_TAPE_FAULT, "tape fault");
+    failures += check_status(pool, "+[>+]", 0, 16, BRAINFOG_TAPE_FAULT, "tape fault on the right");
+    failures += check_status(pool, "+[.]", 0, 16, BRAINFOG_OUTPUT_FULL, "output full");
+
+    TestThread *workers = (TestThread *)calloc(threads, sizeof(TestThread));
+    for (int t = 0; t < threads; ++t) {
+        workers[t] = (TestThread){programs, count, rounds, t, pool, 0, 0, 0};
+        if (pthread_create(&workers[t].thread, NULL, test_thread, &workers[t]) != 0) {
+            perror("Failed to start thread");
+            return 1;
+        }
+    }
+    for (int t = 0; t < threads; ++t) {
+        pthread_join(workers[t].thread, NULL);
+        failures += workers[t].failures;
+        runs += workers[t].runs;
+    }
+    bf_context_pool_free(pool);
+    for (int k = 0; k < count; ++k) {
+        bf_program_free(programs[k].program);
+        free(programs[k].expected);
+    }
+    free(programs);
+    free(workers);
+    if (failures) {
+        fprintf(stderr, "FAIL: %ld of %ld checks\n", failures, runs + 4);
+        return 1;
+    }
+    printf("brainfog: ok\n");
+    return 0;
+}
@@ -0,0 +1,45 @@
+#!/bin/bash
+
+# Checkpoint, kill and resume a run of a .bfc program whose compile-time
+# evaluated prefix printed output, and compare what stdout ends up with
+# against an uninterrupted run.
+#
+#   BF_INTERP=path/to/bf_interp ./tests/test_checkpoint.sh
+
+BF_INTERP=${BF_INTERP:?set BF_INTERP to a built bf_interp}
+WORK=$(mktemp -d) || exit 1
+trap 'rm -rf "$WORK"' EXIT
+
+# `H` is printed before the first `,`, so it ends up in the snapshot; then
+# 100 * 255 * 255 `x`s, each after a short busy loop so the run takes a while
+plus() { printf '+%.0s' $(seq "$1"); }
+echo "++++++++[>+++++++++<-]>.[-]<,[-]>>>>$(plus 120)<<<$(plus 100)[>-[>-[>.>+++[>+++[-]<-]<<-]<-]<-]" \
+    > "$WORK/prog.b"
+"$BF_INTERP" --emit-bytecode "$WORK/prog.bfc" < "$WORK/prog.b" || exit 1
+echo a > "$WORK/input"
+"$BF_INTERP" --bytecode "$WORK/prog.bfc" < "$WORK/input" > "$WORK/expected" || exit 1
+
+"$BF_INTERP" --bytecode "$WORK/prog.bfc" --checkpoint "$WORK/run.ckpt" --checkpoint-interval 0.05 \
+    < "$WORK/input" > "$WORK/actual" &
+pid=$!
+for _ in $(seq 200); do
+    [ -s "$WORK/run.ckpt" ] && break
+    sleep 0.01
+done
+sleep 0.02
+kill -KILL $pid 2> /dev/null
+wait $pid 2> /dev/null
+if [ ! -s "$WORK/run.ckpt" ]; then
+    echo "FAIL: no checkpoint was written" >&2
+    exit 1
+fi
+if cmp -s "$WORK/actual" "$WORK/expected"; then
+    echo "FAIL: the run finished before it was killed; make the program longer" >&2
+    exit 1
+fi
+"$BF_INTERP" --bytecode "$WORK/prog.bfc" --resume "$WORK/run.ckpt" < "$WORK/input" >> "$WORK/actual" || exit 1
+if ! cmp "$WORK/actual" "$WORK/expected"; then
+    echo "FAIL: resumed output differs from an uninterrupted run" >&2
+    exit 1
+fi
+echo "checkpoint: ok"
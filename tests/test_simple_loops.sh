@@ -0,0 +1,50 @@
+#!/bin/bash
+
+# Compile multiply loops with a profile that marks them hot, so the simple-loop
+# pass of bf_compiler and bf_JIT rewrites them, and check the bytes they print:
+# counters going down and up, and a factor too big for the byte-sized multiply
+# (left as a loop). bf_compiler must keep its stdout clean.
+#
+#   BF_COMPILER=path/to/bf_compiler BF_JIT=path/to/bf_JIT ./tests/test_simple_loops.sh
+
+BF_COMPILER=${BF_COMPILER:?set BF_COMPILER to a built bf_compiler}
+BF_JIT=${BF_JIT:?set BF_JIT to a built bf_JIT}
+WORK=$(mktemp -d) || exit 1
+trap 'rm -rf "$WORK"' EXIT
+
+failed=0
+check() {  # name, program, input (printf format), expected bytes (hex)
+    local name=$1
+    printf '%s' "$2" > "$WORK/$name.b"
+    printf "$3" > "$WORK/$name.in"
+    echo '# brainfog profile v1' > "$WORK/$name.prof"
+    # Every '[' hot, at its offset among the commands
+    tr -cd '][><+.,-' < "$WORK/$name.b" | grep -o . | grep -n '\[' |
+        while IFS=: read -r line _; do echo "loop $((line - 1)) 1 1"; done >> "$WORK/$name.prof"
+
+    "$BF_COMPILER" "$WORK/$name.b" -o "$WORK/$name.s" --profile "$WORK/$name.prof" --preeval-steps 0 \
+        > "$WORK/$name.stdout" || { echo "FAIL: $name: bf_compiler failed" >&2; failed=1; return; }
+    if [ -s "$WORK/$name.stdout" ]; then
+        echo "FAIL: $name: bf_compiler wrote to stdout" >&2
+        failed=1
+    fi
+    as -o "$WORK/$name.o" "$WORK/$name.s" &&
+        ld -o "$WORK/$name" "$WORK/$name.o" -lc --dynamic-linker /lib64/ld-linux-x86-64.so.2 ||
+        { echo "FAIL: $name: the assembly doesn't build" >&2; failed=1; return; }
+    local compiled jitted
+    compiled=$("$WORK/$name" < "$WORK/$name.in" | od -An -tx1 | tr -d ' \n')
+    jitted=$("$BF_JIT" "$WORK/$name.b" --profile "$WORK/$name.prof" --preeval-steps 0 < "$WORK/$name.in" 2> /dev/null |
+             od -An -tx1 | tr -d ' \n')
+    if [ "$compiled" != "$4" ] || [ "$jitted" != "$4" ]; then
+        echo "FAIL: $name: bf_compiler printed $compiled, bf_JIT $jitted, expected $4" >&2
+        failed=1
+    fi
+}
+
+check down '+++[>--<-]>.' '' fa                                          # 3 * -2
+check up ',+++++[>+++++++++++++<-]>[<+>+]<.>.' '\0' bf00                  # Counting 65 up to 256
+check up_once '-[>+<+]>.' '' 01                                          # 255 needs one step up
+check big "++[>$(printf '+%.0s' {1..300})<-]>." '' 58                    # 2 * 300 mod 256
+
+[ $failed = 0 ] || exit 1
+echo "simple_loops: ok"
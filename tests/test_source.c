@@ -0,0 +1,94 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../bf_common/bf_source.h"
+
+// Check the SSSE3 command filter against the scalar one:
+//
+//   test_source [iterations]
+//
+// Every byte value at every position of a vector, then random inputs of
+// every length up to a few vectors: arbitrary bytes, commands only (the
+// dense copy), sparse commands among text, bytes that share a nibble with a
+// command, and unbalanced brackets. Inputs start at every offset within a
+// vector, and the output may use BF_SOURCE_SLACK bytes past the commands but
+// no more.
+
+#define MAX_INPUT 200
+
+static const char commands[] = "><+-.,[]";
+
+static char random_byte(int kind) {
+    switch (kind) {
+    case 0:
+        return (char)(rand() & 0xFF);
+    case 1:
+        return commands[rand() % 8];
+    case 2:
+        return rand() % 8 ? "abc \n\t#;"[rand() % 8] : commands[rand() % 8];
+    case 3:  // Same low nibble as a command, or the same high nibble with the high bit flipped
+        return (char)((commands[rand() % 8] ^ (rand() % 2 ? 0x80 : (rand() % 16) << 4)) & 0xFF);
+    default:
+        return rand() % 4 ? "[]"[rand() % 2] : commands[rand() % 8];
+    }
+}
+
+// Filter in[0, size) both ways; returns 0 when they agree
+static int check(const char *in, size_t size, const char *what) {
+    static char simd_out[MAX_INPUT + BF_SOURCE_SLACK + 64], scalar_out[MAX_INPUT + BF_SOURCE_SLACK];
+    memset(simd_out, 0x7F, sizeof(simd_out));
+    size_t simd_count = bf_filter_commands_ssse3(in, size, simd_out);
+    size_t scalar_count = bf_filter_commands_scalar(in, size, scalar_out);
+    if (simd_count != scalar_count || memcmp(simd_out, scalar_out, scalar_count) != 0) {
+        fprintf(stderr, "FAIL: %s, %zu bytes: %zu commands from SSSE3, %zu from scalar\n", what, size, simd_count,
+                scalar_count);
+        return 1;
+    }
+    for (size_t k = size + BF_SOURCE_SLACK; k < sizeof(simd_out); ++k) {
+        if (simd_out[k] != 0x7F) {
+            fprintf(stderr, "FAIL: %s, %zu bytes: written past the slack\n", what, size);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 20000;
+#ifdef BF_SOURCE_SIMD
+    if (!__builtin_cpu_supports("ssse3") || !__builtin_cpu_supports("popcnt")) {
+        printf("source: ok (no SSSE3 here, nothing to compare)\n");
+        return 0;
+    }
+    bf_source_init_shuffle();
+    static const char *kinds[] = {"random bytes", "commands", "sparse commands", "near commands", "brackets"};
+    char buffer[MAX_INPUT + 16];
+    int failures = 0;
+    srand(1);
+
+    for (int byte = 0; byte < 256; ++byte) {
+        for (int position = 0; position < 16; ++position) {
+            memset(buffer, ' ', 16);
+            buffer[position] = (char)byte;
+            failures += check(buffer, 16, "one byte");
+        }
+    }
+    for (int n = 0; n < iterations; ++n) {
+        int kind = n % 5, offset = rand() % 16;
+        size_t size = rand() % (MAX_INPUT - 15);
+        for (size_t k = 0; k < size; ++k) {
+            buffer[offset + k] = random_byte(kind);
+        }
+        failures += check(buffer + offset, size, kinds[kind]);
+    }
+    if (failures) {
+        fprintf(stderr, "FAIL: %d inputs\n", failures);
+        return 1;
+    }
+    printf("source: ok\n");
+#else
+    (void)iterations;
+    printf("source: ok (no SIMD filter on this architecture)\n");
+#endif
+    return 0;
+}
@@ -0,0 +1,24 @@
+#!/bin/bash
+
+# Print a few MB of changing bytes with --splice into a slow reader, with the
+# default pipe and a resized one, and compare with the output written to a
+# file: a buffer overwritten while the pipe still held its pages would show.
+#
+#   BF_INTERP=path/to/bf_interp ./tests/test_splice.sh
+
+BF_INTERP=${BF_INTERP:?set BF_INTERP to a built bf_interp}
+WORK=$(mktemp -d) || exit 1
+trap 'rm -rf "$WORK"' EXIT
+
+# 64 * 255 * 255 bytes counting up in runs of 255, so a buffer written over
+# with the next one differs from it
+echo '++++++++[>++++++++<-]>[>-[>-[>>.+<<-]>>+<<<-]<-]' > "$WORK/prog.b"
+"$BF_INTERP" < "$WORK/prog.b" > "$WORK/expected" || exit 1
+for pipe_size in 0 1048576; do
+    "$BF_INTERP" --splice --pipe-size $pipe_size < "$WORK/prog.b" | (sleep 0.2; cat) > "$WORK/actual"
+    if ! cmp "$WORK/actual" "$WORK/expected"; then
+        echo "FAIL: spliced output differs (--pipe-size $pipe_size)" >&2
+        exit 1
+    fi
+done
+echo "splice: ok"